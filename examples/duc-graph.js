@@ -0,0 +1,338 @@
+/*
+ * Client side renderer for the graph layout exported by 'duc graph
+ * --format=json' or the 'cmd=json' request of 'duc cgi' and 'duc serve'.
+ *
+ * Hover, zoom and pan are handled in the browser, the server is only asked
+ * for a new layout when navigating to another directory.
+ *
+ * Usage:
+ *
+ *   var g = new DucGraph(canvas, tooltip_element, 'duc.cgi');
+ *   g.load('/home');
+ */
+
+function DucGraph(canvas, tooltip, url)
+{
+	this.canvas = canvas;
+	this.ctx = canvas.getContext('2d');
+	this.tooltip = tooltip;
+	this.url = url;
+	this.layout = null;
+	this.rings = [];
+	this.hover = -1;
+	this.reset_view();
+
+	var self = this;
+	var drag = null;
+
+	canvas.addEventListener('mousemove', function(ev) {
+		var p = self.event_pos(ev);
+		if(drag) {
+			self.ox += p.x - drag.x;
+			self.oy += p.y - drag.y;
+			drag = p;
+			drag.moved = true;
+			self.draw();
+			return;
+		}
+		self.set_hover(self.find(p.x, p.y), ev);
+	});
+
+	canvas.addEventListener('mousedown', function(ev) {
+		drag = self.event_pos(ev);
+	});
+
+	canvas.addEventListener('mouseup', function(ev) {
+		var moved = drag && drag.moved;
+		drag = null;
+		if(!moved) self.click(self.event_pos(ev));
+	});
+
+	canvas.addEventListener('mouseleave', function(ev) {
+		drag = null;
+		self.set_hover(-1, ev);
+	});
+
+	canvas.addEventListener('wheel', function(ev) {
+		ev.preventDefault();
+		var p = self.event_pos(ev);
+		var f = ev.deltaY < 0 ? 1.25 : 1 / 1.25;
+		self.ox = p.x - (p.x - self.ox) * f;
+		self.oy = p.y - (p.y - self.oy) * f;
+		self.scale *= f;
+		self.draw();
+	});
+
+	canvas.addEventListener('dblclick', function(ev) {
+		self.reset_view();
+		self.draw();
+	});
+}
+
+
+DucGraph.prototype.reset_view = function()
+{
+	this.scale = 1;
+	this.ox = 0;
+	this.oy = 0;
+};
+
+
+DucGraph.prototype.load = function(path)
+{
+	var self = this;
+	var req = new XMLHttpRequest();
+	req.open('GET', this.url + '?cmd=json&path=' + encodeURIComponent(path), true);
+	req.onload = function() {
+		if(req.status != 200) return;
+		self.set_layout(JSON.parse(req.responseText));
+	};
+	req.send();
+};
+
+
+/*
+ * Index the sections per ring for hit testing. Sections are listed depth
+ * first, so every ring is already sorted by angle
+ */
+
+DucGraph.prototype.set_layout = function(layout)
+{
+	this.layout = layout;
+	this.rings = [];
+	for(var i=0; i<layout.max_level; i++) this.rings.push([]);
+	for(var i=0; i<layout.sections.length; i++) {
+		this.rings[layout.sections[i][1]].push(i);
+	}
+	this.canvas.width = layout.width;
+	this.canvas.height = layout.height;
+	this.hover = -1;
+	this.reset_view();
+	this.draw();
+};
+
+
+DucGraph.prototype.event_pos = function(ev)
+{
+	var r = this.canvas.getBoundingClientRect();
+	return { x: ev.clientX - r.left, y: ev.clientY - r.top };
+};
+
+
+/*
+ * Return the index of the section at canvas position x,y, -1 for none or -2
+ * for the center of the graph
+ */
+
+DucGraph.prototype.find = function(x, y)
+{
+	var l = this.layout;
+	if(!l) return -1;
+
+	x = (x - this.ox) / this.scale - l.cx;
+	y = (y - this.oy) / this.scale - l.cy;
+	var r = Math.sqrt(x*x + y*y);
+	var a = Math.atan2(x, -y) / (Math.PI * 2);
+	if(a < 0) a += 1;
+
+	if(r < l.r_start) return -2;
+
+	for(var level=0; level<this.rings.length; level++) {
+		var ring = this.rings[level];
+		var lo = 0, hi = ring.length, s = -1;
+		while(lo < hi) {
+			var mid = (lo + hi) >> 1;
+			var m = l.sections[ring[mid]];
+			if(a < m[2]) {
+				hi = mid;
+			} else if(a >= m[3]) {
+				lo = mid + 1;
+			} else {
+				s = ring[mid];
+				break;
+			}
+		}
+		if(s == -1) return -1;
+		var sec = l.sections[s];
+		if(r >= sec[4] && r < sec[5]) return s;
+	}
+
+	return -1;
+};
+
+
+DucGraph.prototype.path_of = function(idx)
+{
+	var names = [];
+	for(; idx != -1; idx = this.layout.sections[idx][0]) {
+		names.unshift(this.layout.sections[idx][9]);
+	}
+	var path = this.layout.path;
+	for(var i=0; i<names.length; i++) {
+		path = (path == '/' ? '' : path) + '/' + names[i];
+	}
+	return path;
+};
+
+
+DucGraph.prototype.click = function(p)
+{
+	var l = this.layout;
+	var idx = this.find(p.x, p.y);
+
+	if(idx == -2) {
+		var up = l.path.replace(/\/[^\/]*$/, '');
+		this.load(up == '' ? '/' : up);
+	} else if(idx >= 0 && l.sections[idx][8] == 'directory') {
+		this.load(this.path_of(idx));
+	}
+};
+
+
+function duc_human_size(v, count)
+{
+	var units = 'KMGTPE';
+	var base = count ? 1000 : 1024;
+	if(v < base) return String(v);
+	var i = -1;
+	while(v >= base && i < units.length - 1) {
+		v /= base;
+		i++;
+	}
+	return v.toFixed(1) + units[i];
+}
+
+
+DucGraph.prototype.set_hover = function(idx, ev)
+{
+	if(idx == this.hover) return;
+	this.hover = idx;
+	this.draw();
+
+	var t = this.tooltip;
+	if(!t) return;
+
+	var l = this.layout;
+	var name, type, size;
+
+	if(idx >= 0) {
+		var s = l.sections[idx];
+		name = s[9];
+		type = s[8];
+		size = { actual: s[10], apparent: s[11], count: s[12] };
+	} else if(idx == -2) {
+		name = l.path;
+		type = 'directory';
+		size = l.size;
+	} else {
+		t.style.visibility = 'hidden';
+		return;
+	}
+
+	t.textContent =
+		'name: ' + name + '\n' +
+		'type: ' + type + '\n' +
+		'actual size: ' + duc_human_size(size.actual) + '\n' +
+		'apparent size: ' + duc_human_size(size.apparent) + '\n' +
+		'file count: ' + duc_human_size(size.count, true);
+	t.style.left = (ev.pageX + 10) + 'px';
+	t.style.top = (ev.pageY + 10) + 'px';
+	t.style.visibility = 'visible';
+};
+
+
+function duc_shade(color, f)
+{
+	var v = parseInt(color.substr(1), 16);
+	var r = Math.floor(((v >> 16) & 255) * f);
+	var g = Math.floor(((v >> 8) & 255) * f);
+	var b = Math.floor((v & 255) * f);
+	return 'rgb(' + r + ',' + g + ',' + b + ')';
+}
+
+
+DucGraph.prototype.draw_section = function(a1, a2, r1, r2, color, line, f)
+{
+	var c = this.ctx;
+	var l = this.layout;
+
+	a1 = a1 * Math.PI * 2 - Math.PI / 2;
+	a2 = a2 * Math.PI * 2 - Math.PI / 2;
+
+	if(l.gradient) {
+		var g = c.createRadialGradient(l.cx, l.cy, r1, l.cx, l.cy, r2);
+		g.addColorStop(0, duc_shade(color, 0.6 * f));
+		g.addColorStop(1, duc_shade(color, 1.0 * f));
+		c.fillStyle = g;
+	} else {
+		c.fillStyle = duc_shade(color, f);
+	}
+	c.beginPath();
+	c.arc(l.cx, l.cy, r1, a1, a2, false);
+	c.arc(l.cx, l.cy, r2, a2, a1, true);
+	c.closePath();
+	c.fill();
+	if(line) {
+		c.strokeStyle = 'rgb(' + line + ',' + line + ',' + line + ')';
+		c.lineWidth = 1 / this.scale;
+		c.stroke();
+	}
+};
+
+
+DucGraph.prototype.draw = function()
+{
+	var c = this.ctx;
+	var l = this.layout;
+	if(!l) return;
+
+	c.setTransform(1, 0, 0, 1, 0, 0);
+	c.clearRect(0, 0, this.canvas.width, this.canvas.height);
+	c.setTransform(this.scale, 0, 0, this.scale, this.ox, this.oy);
+	c.lineJoin = 'round';
+
+	for(var i=0; i<l.sections.length; i++) {
+		var s = l.sections[i];
+
+		/* Directories on the outer ring get a marker showing there is
+		 * more below */
+
+		if(s[8] == 'directory' && s[1] == l.max_level - 1) {
+			this.draw_section(s[2], s[3], s[5] + 2, s[5] + 8, s[6], s[7], 0.5);
+		}
+		this.draw_section(s[2], s[3], s[4], s[5] - l.ring_gap, s[6], s[7], i == this.hover ? 0.3 : 1.0);
+	}
+
+	/* Labels are drawn in screen coordinates so the text size does not
+	 * change when zooming. The last two labels are the path on top and the
+	 * total size in the center, the path label is not moved */
+
+	c.setTransform(1, 0, 0, 1, 0, 0);
+	c.textAlign = 'center';
+	c.textBaseline = 'middle';
+	c.lineWidth = 2;
+	c.strokeStyle = '#ffffff';
+	c.fillStyle = '#000000';
+
+	for(var i=0; i<l.labels.length; i++) {
+		var t = l.labels[i];
+		var x = t[0];
+		var y = t[1];
+		if(i != l.labels.length - 2) {
+			x = x * this.scale + this.ox;
+			y = y * this.scale + this.oy;
+		}
+		c.font = t[2] + 'pt Arial';
+		var h = Math.floor(c.measureText('M').width * 1.6);
+		var ls = t[3].split('\n');
+		y = Math.floor(y - ((ls.length - 1) * h) / 2);
+		for(var j=0; j<ls.length; j++) {
+			c.strokeText(ls[j], x, y + j * h);
+			c.fillText(ls[j], x, y + j * h);
+		}
+	}
+};
+
+/*
+ * End
+ */
@@ -0,0 +1,33 @@
+#ifndef cgi_h
+#define cgi_h
+
+#include <stdio.h>
+
+#include "duc.h"
+#include "ducrc.h"
+
+struct param {
+	char *key;
+	char *val;
+	struct param *next;
+};
+
+struct cgi {
+	struct param *param_list;
+	const char *script;
+	const char *if_none_match;
+	FILE *out;
+};
+
+int cgi_parse(struct cgi *cgi, const char *qs);
+void cgi_free(struct cgi *cgi);
+int cgi_handle(struct cgi *cgi, duc *duc);
+const char *cgi_database(void);
+int cgi_threads(void);
+size_t cgi_cache_size(void);
+
+int server_run(duc *duc, int fd_listen, int fastcgi);
+
+extern struct ducrc_option cgi_options[];
+
+#endif
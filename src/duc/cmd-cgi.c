@@ -9,17 +9,14 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include "cmd.h"
 #include "duc.h"
 #include "duc-graph.h"
-
-
-struct param {
-	char *key;
-	char *val;
-	struct param *next;
-};
+#include "cgi.h"
+#include "render-cache.h"
 
 
 static bool opt_apparent = false;
@@ -38,18 +35,20 @@ static char *opt_palette = NULL;
 static bool opt_tooltip = false;
 static int opt_ring_gap = 4;
 static double opt_dpi = 96.0;
+static int opt_threads = 8;
+static int opt_cache_size = 64;
+static char *opt_cache_dir = NULL;
+static int opt_cache_dir_size = 256;
 
-static struct param *param_list = NULL;
-
-static void print_html(const char *s)
+static void print_html(FILE *f, const char *s)
 {
 	while(*s) {
 		switch(*s) {
-			case '<': printf("&lt;"); break;
-			case '>': printf("&gt;"); break;
-			case '&': printf("&amp;"); break;
-			case '"': printf("&quot;"); break;
-			default: putchar(*s); break;
+			case '<': fputs("&lt;", f); break;
+			case '>': fputs("&gt;", f); break;
+			case '&': fputs("&amp;", f); break;
+			case '"': fputs("&quot;", f); break;
+			default: putc(*s, f); break;
 		}
 		s++;
 	}
@@ -74,13 +73,13 @@ static int isrfc1738(const char c)
 	return 0;
 }
 
-static void print_cgi(const char *s)
+static void print_cgi(FILE *f, const char *s)
 {
 	while(*s) {
 		if(*s == '/' || isrfc1738(*s) || isalnum(*s)) {
-			putchar(*s);
+			putc(*s, f);
 		} else {
-			printf("%%%02x", *(uint8_t *)s);
+			fprintf(f, "%%%02x", *(uint8_t *)s);
 		}
 		s++;
 	}
@@ -119,23 +118,26 @@ void decode_uri(char *src, char *dst)
 }
 
 
-static int cgi_parse(void)
+/*
+ * Parse the given query string into the parameter list of the request
+ */
+
+int cgi_parse(struct cgi *cgi, const char *qs)
 {
-	char *qs = getenv("QUERY_STRING");
 	if(qs == NULL) qs = "";
 
-	char *p = qs;
+	const char *p = qs;
 
 	for(;;) {
 
-		char *pe = strchr(p, '=');
+		const char *pe = strchr(p, '=');
 		if(!pe) break;
-		char *pn = strchr(pe, '&');
+		const char *pn = strchr(pe, '&');
 		if(!pn) pn = pe + strlen(pe);
 
-		char *key = p;
+		const char *key = p;
 		int keylen = pe-p;
-		char *val = pe+1;
+		const char *val = pe+1;
 		int vallen = pn-pe-1;
 
 		struct param *param = malloc(sizeof(struct param));
@@ -153,8 +155,8 @@ static int cgi_parse(void)
 		param->val[vallen] = '\0';
 		decode_uri(param->val, param->val);
 		
-		param->next = param_list;
-		param_list = param;
+		param->next = cgi->param_list;
+		cgi->param_list = param;
 
 		if(*pn == 0) break;
 		p = pn+1;
@@ -164,9 +166,25 @@ static int cgi_parse(void)
 }
 
 
-static char *cgi_get(const char *key)
+void cgi_free(struct cgi *cgi)
+{
+	struct param *param = cgi->param_list;
+
+	while(param) {
+		struct param *next = param->next;
+		free(param->key);
+		free(param->val);
+		free(param);
+		param = next;
+	}
+
+	cgi->param_list = NULL;
+}
+
+
+static char *cgi_get(struct cgi *cgi, const char *key)
 {
-	struct param *param = param_list;
+	struct param *param = cgi->param_list;
 
 	while(param) {
 		if(strcmp(param->key, key) == 0) {
@@ -179,9 +197,9 @@ static char *cgi_get(const char *key)
 }
 
 
-static void print_css(void)
+static void print_css(FILE *f)
 {
-	printf(
+	fprintf(f,
 		"<style>\n"
 		"body { font-family: \"arial\", \"sans-serif\"; font-size: 11px; }\n"
 		"table, thead, tbody, tr, td, th { font-size: inherit; font-family: inherit; }\n"
@@ -201,9 +219,9 @@ static void print_css(void)
 }
 
 
-static void print_script(const char *path)
+static void print_script(FILE *f, const char *path)
 {
-	printf(
+	fprintf(f,
 		"<script>\n"
 		"  window.onload = function() {\n"
 		"    var img = document.getElementById('duc_canvas');\n"
@@ -215,13 +233,13 @@ static void print_script(const char *path)
 		"        var x = e.clientX - rect.left;\n"
 		"        var y = e.clientY - rect.top;\n"
 		"        window.location = '?x=' + x + '&y=' + y + '&path=");
-	print_html(path);
-	printf( "';\n"
+	print_html(f, path);
+	fprintf(f, "';\n"
 		"      }\n"
 		"    }\n");
 
 	if(opt_tooltip) {
-		printf(
+		fprintf(f,
 		"    img.onmouseout = function() { tt.style.display = \"none\"; };\n"
 		"    img.onmousemove = function(e) {\n"
 		"      if(timer) clearTimeout(timer);\n"
@@ -244,32 +262,34 @@ static void print_script(const char *path)
 		"    };\n", path);
 	}
 
-	printf(
+	fprintf(f,
 		"  };\n"
 		"</script>\n"
 	      );
 }
 
-static void include_file(const char *fname)
+static void include_file(FILE *out, const char *fname)
 {
+	if(fname == NULL) return;
+
 	FILE *f = fopen(fname, "rb");
 	if(f) {
-		printf("<!-- start include -->\n");
+		fprintf(out, "<!-- start include -->\n");
 		for(;;) {
 			char buf[4096];
 			size_t n = fread(buf, 1, sizeof(buf), f);
 			if(n == 0) break;
-			fwrite(buf, 1, n, stdout);
+			fwrite(buf, 1, n, out);
 		}
-		printf("<!-- end include -->\n");
+		fprintf(out, "<!-- end include -->\n");
 		fclose(f);
 	}
 }
 
 
-static void print_html_header(const char *path)
+static void print_html_header(FILE *f, const char *path)
 {
-  printf(
+  fprintf(f,
 		 "Content-Type: text/html\n"
 		 "\n"
 		 "<!DOCTYPE html>\n"
@@ -278,25 +298,26 @@ static void print_html_header(const char *path)
 		 );
   
   if(opt_css_url) {
-	printf("<link rel=\"stylesheet\" type=\"text/css\" href=\"%s\">\n", opt_css_url);
+	fprintf(f, "<link rel=\"stylesheet\" type=\"text/css\" href=\"%s\">\n", opt_css_url);
   } else {
-	print_css();
+	print_css(f);
   }
   
   if(path) {
-	print_script(path);
+	print_script(f, path);
   }
   
-  printf("</head>\n");
-  printf("<body>\n");
+  fprintf(f, "</head>\n");
+  fprintf(f, "<body>\n");
   
-  include_file(opt_header);
+  include_file(f, opt_header);
 }
 
-static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
+static void do_index(struct cgi *cgi, duc *duc, duc_graph *graph, duc_dir *dir)
 {
-	char *path = cgi_get("path");
-	char *script = getenv("SCRIPT_NAME");
+	FILE *f = cgi->out;
+	char *path = cgi_get(cgi, "path");
+	const char *script = cgi->script;
 	if(!script) return;
 		
 	char url[DUC_PATH_MAX];
@@ -305,8 +326,8 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 	/* If 'x' and 'y' CGI parameters are given, lookup the new path in the
 	 * database. If found, generate a HTTP redirect to the new path. */
 
-	char *xs = cgi_get("x");
-	char *ys = cgi_get("y");
+	char *xs = cgi_get(cgi, "x");
+	char *ys = cgi_get(cgi, "y");
 
 	if(dir && xs && ys) {
 
@@ -315,14 +336,15 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 
 		duc_dir *dir2 = duc_graph_find_spot(graph, dir, x, y, NULL);
 		if(dir2) {
-			dir = dir2;
-			path = duc_dir_get_path(dir);
-			printf("Status: 302 Found\n");
-			printf("Location: ?path=%s\n", path);
-			printf("URI: ?path=%s\n", path);
-			printf("Connection: close\n");
-			printf("Content-type: text/html\n\n");
-			printf("\n");
+			path = duc_dir_get_path(dir2);
+			fprintf(f, "Status: 302 Found\n");
+			fprintf(f, "Location: ?path=%s\n", path);
+			fprintf(f, "URI: ?path=%s\n", path);
+			fprintf(f, "Connection: close\n");
+			fprintf(f, "Content-type: text/html\n\n");
+			fprintf(f, "\n");
+			free(path);
+			duc_dir_close(dir2);
 			return;
 		}
 	}
@@ -330,56 +352,59 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 	struct duc_index_report *report;
 	int i = 0;
 
-	print_html_header(path);
+	print_html_header(f, path);
 
-	printf("<div id=main>\n");
-	printf("<div id=index>");
-	printf(" <table>\n");
-	printf("  <tr>\n");
-	printf("   <th>Path</th>\n");
-	printf("   <th>Size</th>\n");
-	printf("   <th>Files</th>\n");
-	printf("   <th>Directories</th>\n");
-	printf("   <th>Date</th>\n");
-	printf("   <th>Time</th>\n");
-	printf("  </tr>\n");
+	fprintf(f, "<div id=main>\n");
+	fprintf(f, "<div id=index>");
+	fprintf(f, " <table>\n");
+	fprintf(f, "  <tr>\n");
+	fprintf(f, "   <th>Path</th>\n");
+	fprintf(f, "   <th>Size</th>\n");
+	fprintf(f, "   <th>Files</th>\n");
+	fprintf(f, "   <th>Directories</th>\n");
+	fprintf(f, "   <th>Date</th>\n");
+	fprintf(f, "   <th>Time</th>\n");
+	fprintf(f, "  </tr>\n");
 
 	while( (report = duc_get_report(duc, i)) != NULL) {
 
 		char ts_date[32];
 		char ts_time[32];
 		time_t t = report->time_start.tv_sec;
-		struct tm *tm = localtime(&t);
-		strftime(ts_date, sizeof ts_date, "%Y-%m-%d",tm);
-		strftime(ts_time, sizeof ts_time, "%H:%M:%S",tm);
+		struct tm tm;
+		localtime_r(&t, &tm);
+		strftime(ts_date, sizeof ts_date, "%Y-%m-%d",&tm);
+		strftime(ts_time, sizeof ts_time, "%H:%M:%S",&tm);
 	
 		duc_size_type st = opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
 
 		char siz[32];
 		duc_human_size(&report->size, st, 0, siz, sizeof siz);
 
-		printf("  <tr>\n");
-		printf("   <td><a href=\"%s&path=", url);
-		print_cgi(report->path);
-		printf("\">");
-		print_html(report->path);
-		printf("</a></td>\n");
-		printf("   <td>%s</td>\n", siz);
-		printf("   <td>%zu</td>\n", report->file_count);
-		printf("   <td>%zu</td>\n", report->dir_count);
-		printf("   <td>%s</td>\n", ts_date);
-		printf("   <td>%s</td>\n", ts_time);
-		printf("  </tr>\n");
+		fprintf(f, "  <tr>\n");
+		fprintf(f, "   <td><a href=\"");
+		print_html(f, url);
+		fprintf(f, "&path=");
+		print_cgi(f, report->path);
+		fprintf(f, "\">");
+		print_html(f, report->path);
+		fprintf(f, "</a></td>\n");
+		fprintf(f, "   <td>%s</td>\n", siz);
+		fprintf(f, "   <td>%zu</td>\n", report->file_count);
+		fprintf(f, "   <td>%zu</td>\n", report->dir_count);
+		fprintf(f, "   <td>%s</td>\n", ts_date);
+		fprintf(f, "   <td>%s</td>\n", ts_time);
+		fprintf(f, "  </tr>\n");
 
 		duc_index_report_free(report);
 		i++;
 	}
-	printf(" </table>\n");
+	fprintf(f, " </table>\n");
 
 	if(path) {
-		printf("<div id=graph>\n");
+		fprintf(f, "<div id=graph>\n");
 		duc_graph_draw(graph, dir);
-		printf("</div>\n");
+		fprintf(f, "</div>\n");
 	}
 
 	if(path && dir && opt_list) {
@@ -387,12 +412,12 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 		duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT : 
 	                           opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
 
-		printf("<div id=list>\n");
-		printf(" <table>\n");
-		printf("  <tr>\n");
-		printf("   <th class=name>Filename</th>\n");
-		printf("   <th class=size>Size</th>\n");
-		printf("  </tr>\n");
+		fprintf(f, "<div id=list>\n");
+		fprintf(f, " <table>\n");
+		fprintf(f, "  <tr>\n");
+		fprintf(f, "   <th class=name>Filename</th>\n");
+		fprintf(f, "   <th class=size>Size</th>\n");
+		fprintf(f, "  </tr>\n");
 
 		duc_dir_rewind(dir);
 
@@ -401,53 +426,57 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 		while((n++ < 40) && (e = duc_dir_read(dir, st, DUC_SORT_SIZE)) != NULL) {
 			char siz[32];
 			duc_human_size(&e->size, st, opt_bytes, siz, sizeof siz);
-			printf("  <tr><td class=name>");
+			fprintf(f, "  <tr><td class=name>");
 
 			if(e->type == DUC_FILE_TYPE_DIR) {
-				printf("<a href=\"%s&path=", url);
-				print_cgi(path);
-				printf("/");
-				print_cgi(e->name);
-				printf("\">");
+				fprintf(f, "<a href=\"");
+				print_html(f, url);
+				fprintf(f, "&path=");
+				print_cgi(f, path);
+				fprintf(f, "/");
+				print_cgi(f, e->name);
+				fprintf(f, "\">");
 			}
 
-			print_html(e->name);
+			print_html(f, e->name);
 
 			if(e->type == DUC_FILE_TYPE_DIR) 
-				printf("</a>\n");
+				fprintf(f, "</a>\n");
 
-			printf("   <td class=size>%s</td>\n", siz);
-			printf("  </tr>\n");
+			fprintf(f, "   <td class=size>%s</td>\n", siz);
+			fprintf(f, "  </tr>\n");
 		}
 
-		printf(" </table>\n");
-		printf("</div>\n");
+		fprintf(f, " </table>\n");
+		fprintf(f, "</div>\n");
 	}
 
-	printf("</div>\n");
+	fprintf(f, "</div>\n");
 
 	if(opt_tooltip) {
-		printf("<div id=\"tooltip\"></div>\n");
+		fprintf(f, "<div id=\"tooltip\"></div>\n");
 	}
 
-	printf("</div>\n");
+	fprintf(f, "</div>\n");
 
-	include_file(opt_footer);
+	include_file(f, opt_footer);
 
-	printf("</body>\n");
-	printf("</html>\n");
+	fprintf(f, "</body>\n");
+	fprintf(f, "</html>\n");
 
-	fflush(stdout);
+	fflush(f);
 }
 
 
-void do_tooltip(duc *duc, duc_graph *graph, duc_dir *dir)
+static void do_tooltip(struct cgi *cgi, duc *duc, duc_graph *graph, duc_dir *dir)
 {
-	printf("Content-Type: text/html\n");
-	printf("\n");
+	FILE *f = cgi->out;
+
+	fprintf(f, "Content-Type: text/html\n");
+	fprintf(f, "\n");
 
-	char *xs = cgi_get("x");
-	char *ys = cgi_get("y");
+	char *xs = cgi_get(cgi, "x");
+	char *ys = cgi_get(cgi, "y");
 
 	if(dir && xs && ys) {
 
@@ -464,7 +493,7 @@ void do_tooltip(duc *duc, duc_graph *graph, duc_dir *dir)
 			duc_human_size(&ent->size, DUC_SIZE_TYPE_ACTUAL, opt_bytes, siz_act, sizeof siz_act);
 			duc_human_size(&ent->size, DUC_SIZE_TYPE_COUNT, opt_bytes, siz_cnt, sizeof siz_cnt);
 			char *typ = duc_file_type_name(ent->type);
-			printf("name: %s<br>\n"
+			fprintf(f, "name: %s<br>\n"
 			       "type: %s<br>\n"
 			       "actual size: %s<br>\n"
 			       "apparent size: %s<br>\n"
@@ -478,43 +507,41 @@ void do_tooltip(duc *duc, duc_graph *graph, duc_dir *dir)
 }
 
 
-static int cgi_main(duc *duc, int argc, char **argv)
+static void do_json(struct cgi *cgi, duc *duc, duc_graph *graph, duc_dir *dir)
 {
-	int r;
+	FILE *f = cgi->out;
 
-	if(getenv("GATEWAY_INTERFACE") == NULL) {
-		fprintf(stderr, 
-			"The 'cgi' subcommand is used for integrating Duc into a web server.\n"
-			"Please refer to the documentation for instructions how to install and configure.\n"
-		);
-		return(-1);
+	if(dir == NULL) {
+		fprintf(f, "Status: 400 Bad Request\n");
+		fprintf(f, "Content-Type: text/plain\n\n");
+		fprintf(f, "No path given\n");
+		return;
 	}
-	
-	cgi_parse();
 
-	char *cmd = cgi_get("cmd");
-	if(cmd == NULL) cmd = "index";
+	fprintf(f, "Content-Type: application/json\n");
+	fprintf(f, "\n");
 
-        r = duc_open(duc, opt_database, DUC_OPEN_RO);
-        if(r != DUC_OK) {
-		printf("Content-Type: text/plain\n\n");
-                printf("%s\n", duc_strerror(duc));
-		return -1;
-        }
+	duc_graph_draw(graph, dir);
+}
+
+
+static int cgi_render(struct cgi *cgi, duc *duc, const char *cmd)
+{
+	FILE *f = cgi->out;
 
 	duc_dir *dir = NULL;
-	char *path = cgi_get("path");
+	char *path = cgi_get(cgi, "path");
 	if(path) {
 		dir = duc_dir_open(duc, path);
 		if(dir == NULL) {
-			printf("Content-Type: text/plain\n\n");
-			printf("%s\n", duc_strerror(duc));
-			print_html(path);
+			fprintf(f, "Content-Type: text/plain\n\n");
+			fprintf(f, "%s\n", duc_strerror(duc));
+			print_html(f, path);
 			return -1;
 		}
 	}
 
-	static enum duc_graph_palette palette = 0;
+	enum duc_graph_palette palette = 0;
 	
 	if(opt_palette) {
 		char c = tolower(opt_palette[0]);
@@ -528,7 +555,12 @@ static int cgi_main(duc *duc, int argc, char **argv)
 	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT : 
 			   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
 
-	duc_graph *graph = duc_graph_new_html(duc, stdout, 0);
+	duc_graph *graph;
+	if(strcmp(cmd, "json") == 0) {
+		graph = duc_graph_new_json(duc, f);
+	} else {
+		graph = duc_graph_new_html(duc, f, 0);
+	}
 	duc_graph_set_size(graph, opt_size, opt_size);
 	duc_graph_set_dpi(graph, opt_dpi);
 	duc_graph_set_max_level(graph, opt_levels);
@@ -539,18 +571,185 @@ static int cgi_main(duc *duc, int argc, char **argv)
 	duc_graph_set_ring_gap(graph, opt_ring_gap);
 	duc_graph_set_gradient(graph, opt_gradient);
 
-	if(strcmp(cmd, "index") == 0) do_index(duc, graph, dir);
-	if(strcmp(cmd, "tooltip") == 0) do_tooltip(duc, graph, dir);
+	if(strcmp(cmd, "index") == 0) do_index(cgi, duc, graph, dir);
+	if(strcmp(cmd, "tooltip") == 0) do_tooltip(cgi, duc, graph, dir);
+	if(strcmp(cmd, "json") == 0) do_json(cgi, duc, graph, dir);
 
-	duc_close(duc);
+	duc_graph_free(graph);
+	if(dir) duc_dir_close(dir);
 
 	return 0;
 }
 
 
-static struct ducrc_option options[] = {
+/*
+ * Handle a single request on an opened database, writing CGI style headers
+ * and the page to cgi->out. Used by both 'duc cgi' and 'duc serve'.
+ *
+ * With --cache-dir, graph pages are looked up in the render cache first, and
+ * requests from clients already holding the current version are answered
+ * with '304 Not Modified'. The key is made of the parameters the pages use
+ * only, in a fixed order, so unknown parameters can not create new entries.
+ * Clicks on the graph are not cached, these redirect to another page
+ */
+
+int cgi_handle(struct cgi *cgi, duc *duc)
+{
+	FILE *f = cgi->out;
+
+	char *cmd = cgi_get(cgi, "cmd");
+	if(cmd == NULL) cmd = "index";
+
+	if(opt_cache_dir == NULL || (strcmp(cmd, "index") != 0 && strcmp(cmd, "json") != 0)) {
+		return cgi_render(cgi, duc, cmd);
+	}
+
+	if(strcmp(cmd, "index") == 0 && cgi_get(cgi, "x") && cgi_get(cgi, "y")) {
+		return cgi_render(cgi, duc, cmd);
+	}
+
+	struct render_key key;
+	render_key_init(&key, duc);
+	render_key_add_str(&key, cgi->script);
+	render_key_add_options(&key, cgi_options);
+	render_key_add_str(&key, cmd);
+	render_key_add_str(&key, cgi_get(cgi, "path"));
+
+	char etag[64];
+	char last_modified[64];
+	render_key_etag(&key, etag, sizeof(etag));
+	render_key_last_modified(&key, last_modified, sizeof(last_modified));
+
+	if(cgi->if_none_match && strstr(cgi->if_none_match, etag)) {
+		fprintf(f, "Status: 304 Not Modified\n");
+		fprintf(f, "ETag: %s\n", etag);
+		fprintf(f, "\n");
+		return 0;
+	}
+
+	char *data = NULL;
+	size_t len = 0;
+
+	if(render_cache_get(opt_cache_dir, &key, &data, &len) != 0) {
+
+		FILE *m = open_memstream(&data, &len);
+		if(m == NULL) return cgi_render(cgi, duc, cmd);
+
+		cgi->out = m;
+		int r = cgi_render(cgi, duc, cmd);
+		cgi->out = f;
+		fclose(m);
+
+		/* Errors are passed on as they are and not cached */
+
+		if(r != 0 || strncmp(data, "Status:", 7) == 0) {
+			fwrite(data, 1, len, f);
+			free(data);
+			return r;
+		}
+
+		render_cache_put(opt_cache_dir, &key, data, len, (size_t)opt_cache_dir_size * 1024 * 1024);
+	}
+
+	fprintf(f, "ETag: %s\n", etag);
+	fprintf(f, "Last-Modified: %s\n", last_modified);
+	fwrite(data, 1, len, f);
+	free(data);
+
+	return 0;
+}
+
+
+const char *cgi_database(void)
+{
+	return opt_database;
+}
+
+
+int cgi_threads(void)
+{
+	return opt_threads;
+}
+
+
+size_t cgi_cache_size(void)
+{
+	return (size_t)opt_cache_size * 1024 * 1024;
+}
+
+
+#ifdef ENABLE_SERVE
+
+/*
+ * Web servers like apache mod_fcgid or spawn-fcgi start FastCGI applications
+ * with a listening socket on stdin instead of a CGI environment
+ */
+
+static int is_fastcgi(void)
+{
+	int listening = 0;
+	socklen_t len = sizeof(listening);
+	if(getsockopt(STDIN_FILENO, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == -1) return 0;
+	return listening;
+}
+
+#endif
+
+
+static int cgi_main(duc *duc, int argc, char **argv)
+{
+	int r;
+
+#ifdef ENABLE_SERVE
+	if(getenv("GATEWAY_INTERFACE") == NULL && is_fastcgi()) {
+		return server_run(duc, STDIN_FILENO, 1);
+	}
+#endif
+
+	if(getenv("GATEWAY_INTERFACE") == NULL) {
+		fprintf(stderr, 
+			"The 'cgi' subcommand is used for integrating Duc into a web server.\n"
+			"Please refer to the documentation for instructions how to install and configure.\n"
+		);
+		return(-1);
+	}
+
+	struct cgi cgi = {
+		.param_list = NULL,
+		.script = getenv("SCRIPT_NAME"),
+		.if_none_match = getenv("HTTP_IF_NONE_MATCH"),
+		.out = stdout,
+	};
+	
+	cgi_parse(&cgi, getenv("QUERY_STRING"));
+
+        r = duc_open(duc, opt_database, DUC_OPEN_RO);
+        if(r != DUC_OK) {
+		printf("Content-Type: text/plain\n\n");
+                printf("%s\n", duc_strerror(duc));
+		cgi_free(&cgi);
+		return -1;
+        }
+
+	r = cgi_handle(&cgi, duc);
+
+	duc_close(duc);
+	cgi_free(&cgi);
+
+	return r;
+}
+
+
+struct ducrc_option cgi_options[] = {
 	{ &opt_apparent,  "apparent",  'a', DUCRC_TYPE_BOOL,   "Show apparent instead of actual file size" },
 	{ &opt_bytes,     "bytes",     'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_cache_dir, "cache-dir",  0,  DUCRC_TYPE_STRING, "keep rendered pages in the given directory and reuse them until the database changes",
+		"pages are keyed by the command and path requested, the options and the time of the index runs in the database; "
+		"responses carry an ETag header so browsers can revalidate them without transferring the page again" },
+	{ &opt_cache_dir_size, "cache-dir-size", 0, DUCRC_TYPE_INT, "limit the size of the --cache-dir directory in MB, 0 for no limit [256]",
+		"when the limit is exceeded the least recently used pages are removed" },
+	{ &opt_cache_size, "cache-size", 0, DUCRC_TYPE_INT,    "size of the directory cache in MB when running as FastCGI or HTTP server [64]",
+		"the cache is shared by all worker threads and holds decoded directories from the database" },
 	{ &opt_count,     "count",      0,  DUCRC_TYPE_BOOL,   "show number of files instead of file size" },
 	{ &opt_css_url,   "css-url",    0,  DUCRC_TYPE_STRING, "url of CSS style sheet to use instead of default CSS" },
 	{ &opt_database,  "database",  'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
@@ -565,6 +764,8 @@ static struct ducrc_option options[] = {
 		"available palettes are: size, rainbow, greyscale, monochrome, classic" },
 	{ &opt_ring_gap,  "ring-gap",   0,  DUCRC_TYPE_INT,    "leave a gap of VAL pixels between rings" },
 	{ &opt_size,      "size",      's', DUCRC_TYPE_INT,    "image size [800]" },
+	{ &opt_threads,   "threads",    0,  DUCRC_TYPE_INT,    "number of worker threads when running as FastCGI or HTTP server [8]",
+		"each worker thread keeps its own read-only handle to the database open" },
 	{ &opt_tooltip,   "tooltip",    0,  DUCRC_TYPE_BOOL,   "enable tooltip when hovering over the graph",
 		"enabling the tooltip will cause an asynchronous HTTP request every time the mouse is moved and "
 		"can greatly increase the HTTP traffic to the web server" },
@@ -576,7 +777,7 @@ struct cmd cmd_cgi = {
 	.descr_short = "CGI interface wrapper",
 	.usage = "[options] [PATH]",
 	.main = cgi_main,
-	.options = options,
+	.options = cgi_options,
 		
 };
 
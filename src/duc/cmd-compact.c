@@ -0,0 +1,156 @@
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "duc.h"
+#include "private.h"
+
+
+static bool opt_bytes = false;
+static char *opt_database = NULL;
+static bool opt_uncompressed = false;
+
+
+/*
+ * Size of a database on disk, some backends store a directory of files
+ */
+
+static off_t db_size(const char *path)
+{
+	struct stat st;
+	if(stat(path, &st) != 0) return 0;
+	if(!S_ISDIR(st.st_mode)) return st.st_size;
+
+	off_t size = 0;
+	DIR *d = opendir(path);
+	if(d == NULL) return 0;
+
+	struct dirent *e;
+	while((e = readdir(d)) != NULL) {
+		char tmp[PATH_MAX];
+		snprintf(tmp, sizeof tmp, "%s/%s", path, e->d_name);
+		if(stat(tmp, &st) == 0 && S_ISREG(st.st_mode)) size += st.st_size;
+	}
+	closedir(d);
+
+	return size;
+}
+
+
+static void format_size(off_t v, char *buf, size_t len)
+{
+	struct duc_size size = { v, v, v };
+	duc_human_size(&size, DUC_SIZE_TYPE_ACTUAL, opt_bytes, buf, len);
+}
+
+
+static int compact_main(duc *duc, int argc, char **argv)
+{
+	if(argc < 1) {
+		duc_log(duc, DUC_LOG_FTL, "Required OUTPUT database missing.");
+		return -2;
+	}
+
+	char *path_out = argv[0];
+	argc--; argv++;
+
+	if(access(path_out, F_OK) == 0) {
+		duc_log(duc, DUC_LOG_FTL, "Output database '%s' already exists", path_out);
+		return -1;
+	}
+
+	/* Without databases on the command line the one given with --database,
+	 * or the default one, is compacted */
+
+	size_t count = argc > 0 ? argc : 1;
+	struct duc **src = calloc(count, sizeof(*src));
+	off_t size_in = 0;
+	size_t i;
+	int r = 0;
+
+	for(i=0; i<count; i++) {
+		src[i] = duc_new();
+		duc_set_log_level(src[i], duc->log_level);
+		if(duc_open(src[i], argc > 0 ? argv[i] : opt_database, DUC_OPEN_RO) != DUC_OK) {
+			r = -1;
+			goto out;
+		}
+	}
+
+	int open_flags = DUC_OPEN_RW | DUC_OPEN_COMPRESS;
+	if(opt_uncompressed) open_flags &= ~DUC_OPEN_COMPRESS;
+
+	if(duc_open(duc, path_out, open_flags) != DUC_OK) {
+		r = -1;
+		goto out;
+	}
+
+	r = duc_compact(duc, src, count);
+	duc_close(duc);
+
+	if(r != 0) {
+		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		goto out;
+	}
+
+	for(i=0; i<count; i++) {
+		size_in += db_size(src[i]->path_db);
+	}
+	off_t size_out = db_size(path_out);
+
+	char s_in[32], s_out[32], s_rec[32];
+	format_size(size_in, s_in, sizeof s_in);
+	format_size(size_out, s_out, sizeof s_out);
+	format_size(size_in > size_out ? size_in - size_out : 0, s_rec, sizeof s_rec);
+	printf("Compacted %zu database%s of %s into %s of %s, reclaimed %s\n",
+			count, count == 1 ? "" : "s", s_in, path_out, s_out, s_rec);
+
+out:
+	for(i=0; i<count; i++) {
+		if(src[i]) {
+			duc_close(src[i]);
+			duc_del(src[i]);
+		}
+	}
+	free(src);
+
+	return r;
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_bytes,        "bytes",        'b', DUCRC_TYPE_BOOL,   "show sizes in exact number of bytes" },
+	{ &opt_database,     "database",     'd', DUCRC_TYPE_STRING, "select database file to compact when none are given [~/.duc.db]" },
+	{ &opt_uncompressed, "uncompressed",  0,  DUCRC_TYPE_BOOL,   "do not use compression for the output database" },
+	{ NULL }
+};
+
+
+struct cmd cmd_compact = {
+	.name = "compact",
+	.descr_short = "Copy the live contents of databases into a new one",
+	.usage = "[options] OUTPUT [DATABASE]...",
+	.main = compact_main,
+	.options = options,
+	.descr_long =
+		"The 'compact' subcommand writes a new database OUTPUT holding only the records\n"
+		"reachable from the indexed paths of the given databases. Directories removed\n"
+		"since an earlier index run leave their records behind in a database, which\n"
+		"grows with every run. When more than one database is given they are merged,\n"
+		"keeping the most recent run of every indexed path. The original databases are\n"
+		"not changed.\n"
+};
+
+
+/*
+ * End
+ */
+
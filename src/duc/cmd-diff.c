@@ -0,0 +1,277 @@
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmd.h"
+#include "duc.h"
+#include "private.h"
+
+
+static bool opt_apparent = false;
+static bool opt_bytes = false;
+static bool opt_count = false;
+static char *opt_database = NULL;
+static int opt_levels = 1;
+static bool opt_list = false;
+static char *opt_since = NULL;
+
+
+struct change {
+	char *path;
+	int depth;
+	duc_file_type type;
+	off_t size_old;
+	off_t size_new;
+	int added;
+	int removed;
+};
+
+struct change_list {
+	struct change *list;
+	size_t count;
+	size_t max;
+	duc_size_type st;
+};
+
+
+static int add_change(const char *path, int depth,
+		const struct duc_dirent *e_old, const struct duc_dirent *e_new, void *ptr)
+{
+	struct change_list *cl = ptr;
+
+	if(cl->count == cl->max) {
+		cl->max = cl->max ? cl->max * 2 : 256;
+		cl->list = duc_realloc(cl->list, cl->max * sizeof(*cl->list));
+	}
+
+	struct change *c = &cl->list[cl->count++];
+	c->path = duc_strdup(path);
+	c->depth = depth;
+	c->type = e_new ? e_new->type : e_old->type;
+	c->size_old = e_old ? duc_get_size((struct duc_size *)&e_old->size, cl->st) : 0;
+	c->size_new = e_new ? duc_get_size((struct duc_size *)&e_new->size, cl->st) : 0;
+	c->added = e_old == NULL;
+	c->removed = e_new == NULL;
+	return 0;
+}
+
+
+static int cmp_change(const void *a, const void *b)
+{
+	const struct change *c1 = a;
+	const struct change *c2 = b;
+	off_t d1 = c1->size_new - c1->size_old;
+	off_t d2 = c2->size_new - c2->size_old;
+	if(d1 != d2) return d1 > d2 ? -1 : 1;
+	return strcmp(c1->path, c2->path);
+}
+
+
+/*
+ * Parse the --since argument, either an absolute date 'YYYY-MM-DD [HH:MM[:SS]]'
+ * or a relative age like '3d', with unit h, d or w
+ */
+
+static int parse_since(const char *s, time_t *t)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	if(end != s && end[0] && end[1] == '\0') {
+		long unit = 0;
+		if(end[0] == 'h') unit = 3600;
+		if(end[0] == 'd') unit = 24 * 3600;
+		if(end[0] == 'w') unit = 7 * 24 * 3600;
+		if(unit) {
+			*t = time(NULL) - n * unit;
+			return 0;
+		}
+	}
+
+	static const char *formats[] = {
+		"%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%d %H:%M",
+		"%Y-%m-%d",
+		NULL
+	};
+
+	const char **f;
+	for(f=formats; *f; f++) {
+		struct tm tm;
+		memset(&tm, 0, sizeof tm);
+		end = strptime(s, *f, &tm);
+		if(end && *end == '\0') {
+			tm.tm_isdst = -1;
+			*t = mktime(&tm);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+static void format_time(const struct timeval *tv, char *buf, size_t len)
+{
+	time_t t = tv->tv_sec;
+	struct tm *tm = localtime(&t);
+	strftime(buf, len, "%Y-%m-%d %H:%M:%S", tm);
+}
+
+
+static void format_delta(off_t delta, duc_size_type st, char *buf, size_t len)
+{
+	off_t v = delta < 0 ? -delta : delta;
+	struct duc_size size = { v, v, v };
+	buf[0] = delta < 0 ? '-' : '+';
+	duc_human_size(&size, st, opt_bytes, buf + 1, len - 1);
+}
+
+
+static int diff_main(duc *duc, int argc, char **argv)
+{
+	char *path = ".";
+	if(argc > 0) path = argv[0];
+
+	time_t since = 0;
+	if(opt_since && parse_since(opt_since, &since) != 0) {
+		duc_log(duc, DUC_LOG_FTL, "Invalid date '%s' for --since, use YYYY-MM-DD [HH:MM[:SS]] or a number of hours, days or weeks like '3d'", opt_since);
+		return -2;
+	}
+
+	int r = duc_open(duc, opt_database, DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		return -1;
+	}
+
+	size_t count;
+	struct duc_generation *gens = duc_get_generations(duc, path, &count);
+	if(gens == NULL) {
+		duc_log(duc, DUC_LOG_FTL, "No history found for '%s',", path);
+		duc_log(duc, DUC_LOG_FTL, "Please index with 'duc index --history' to keep previous index runs.");
+		duc_close(duc);
+		return -1;
+	}
+
+	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT :
+	                   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
+	size_t i;
+
+	if(opt_list) {
+		printf("Date       Time        Size\n");
+		for(i=0; i<count; i++) {
+			char ts[32], siz[32];
+			format_time(&gens[i].time, ts, sizeof ts);
+			duc_human_size(&gens[i].size, st, opt_bytes, siz, sizeof siz);
+			printf("%s %7s\n", ts, siz);
+		}
+		duc_generations_free(gens);
+		duc_close(duc);
+		return 0;
+	}
+
+	if(count < 2) {
+		duc_log(duc, DUC_LOG_FTL, "Only one index run found for '%s', nothing to compare", path);
+		duc_generations_free(gens);
+		duc_close(duc);
+		return -1;
+	}
+
+	/* Compare the latest generation with the last one from before the
+	 * given date, or with the oldest one */
+
+	size_t gen_new = count - 1;
+	size_t gen_old = 0;
+	if(opt_since) {
+		for(i=0; i<gen_new; i++) {
+			if(gens[i].time.tv_sec <= since) gen_old = i;
+		}
+	}
+
+	struct change_list cl = { NULL, 0, 0, st };
+	r = duc_diff(duc, path, gen_old, gen_new, opt_levels, add_change, &cl);
+	if(r < 0) {
+		duc_log(duc, DUC_LOG_FTL, "The requested path '%s' was not found in the history", path);
+		duc_generations_free(gens);
+		duc_close(duc);
+		return -1;
+	}
+
+	qsort(cl.list, cl.count, sizeof(*cl.list), cmp_change);
+
+	/* The change of PATH itself is the sum of the changes of its entries */
+
+	off_t total = 0;
+	for(i=0; i<cl.count; i++) {
+		if(cl.list[i].depth == 0) total += cl.list[i].size_new - cl.list[i].size_old;
+	}
+
+	char ts_old[32], ts_new[32], delta[32];
+	format_time(&gens[gen_old].time, ts_old, sizeof ts_old);
+	format_time(&gens[gen_new].time, ts_new, sizeof ts_new);
+	format_delta(total, st, delta, sizeof delta);
+	printf("Changes from %s to %s: %s\n", ts_old, ts_new, delta);
+
+	/* Find the widest size for aligning the output */
+
+	int max_size_len = 0;
+	for(i=0; i<cl.count; i++) {
+		struct change *c = &cl.list[i];
+		format_delta(c->size_new - c->size_old, st, delta, sizeof delta);
+		int l = strlen(delta);
+		if(l > max_size_len) max_size_len = l;
+	}
+
+	for(i=0; i<cl.count; i++) {
+		struct change *c = &cl.list[i];
+		format_delta(c->size_new - c->size_old, st, delta, sizeof delta);
+		printf("%*s %s%s%s\n", max_size_len, delta, c->path,
+				c->type == DUC_FILE_TYPE_DIR ? "/" : "",
+				c->added ? " (new)" : c->removed ? " (removed)" : "");
+		duc_free(c->path);
+	}
+
+	duc_free(cl.list);
+	duc_generations_free(gens);
+	duc_close(duc);
+
+	return 0;
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_apparent,    "apparent",    'a', DUCRC_TYPE_BOOL,   "show apparent instead of actual file size" },
+	{ &opt_bytes,       "bytes",       'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_count,       "count",        0,  DUCRC_TYPE_BOOL,   "show number of files instead of file size" },
+	{ &opt_database,    "database",    'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
+	{ &opt_levels,      "levels",      'l', DUCRC_TYPE_INT,    "show changes up to VAL levels deep, 0 for no limit [1]" },
+	{ &opt_list,        "list",         0,  DUCRC_TYPE_BOOL,   "list the index runs kept in the history" },
+	{ &opt_since,       "since",        0,  DUCRC_TYPE_STRING, "compare with the last index run before date VAL",
+	  "VAL is a date as YYYY-MM-DD, optionally followed by HH:MM or HH:MM:SS, or an age like '12h', '3d' or '2w'. "
+	  "Without this option the oldest index run in the history is used" },
+	{ NULL }
+};
+
+
+struct cmd cmd_diff = {
+	.name = "diff",
+	.descr_short = "Show size changes between index runs",
+	.usage = "[options] [PATH]",
+	.main = diff_main,
+	.options = options,
+	.descr_long =
+		"The 'diff' subcommand compares the latest index run of PATH with an earlier\n"
+		"one and lists the files and directories which grew, shrunk, appeared or\n"
+		"disappeared, largest change first. This requires the database to be created\n"
+		"with 'duc index --history'.\n"
+};
+
+
+/*
+ * End
+ */
+
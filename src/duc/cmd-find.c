@@ -0,0 +1,157 @@
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "duc.h"
+#include "private.h"
+
+
+static bool opt_apparent = false;
+static bool opt_bytes = false;
+static bool opt_classify = false;
+static bool opt_count = false;
+static char *opt_database = NULL;
+static bool opt_dirs_only = false;
+static bool opt_ignore_case = false;
+
+
+struct result {
+	char *path;
+	duc_file_type type;
+	struct duc_size size;
+};
+
+struct result_list {
+	struct result *list;
+	size_t count;
+	size_t max;
+};
+
+
+static int add_result(const char *path, const struct duc_dirent *e, void *ptr)
+{
+	struct result_list *rl = ptr;
+
+	if(opt_dirs_only && e->type != DUC_FILE_TYPE_DIR) return 0;
+
+	if(rl->count == rl->max) {
+		rl->max = rl->max ? rl->max * 2 : 256;
+		rl->list = duc_realloc(rl->list, rl->max * sizeof(*rl->list));
+	}
+
+	struct result *r = &rl->list[rl->count++];
+	r->path = duc_strdup(path);
+	r->type = e->type;
+	r->size = e->size;
+	return 0;
+}
+
+
+static int cmp_result(const void *a, const void *b)
+{
+	const struct result *r1 = a;
+	const struct result *r2 = b;
+	return strcmp(r1->path, r2->path);
+}
+
+
+static int find_main(duc *duc, int argc, char **argv)
+{
+	if(argc < 1) {
+		duc_log(duc, DUC_LOG_FTL, "Required search PATTERN missing.");
+		return -2;
+	}
+
+	char *pattern = argv[0];
+	char *path = ".";
+	if(argc > 1) path = argv[1];
+
+	int r = duc_open(duc, opt_database, DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		return -1;
+	}
+
+	duc_dir *dir = duc_dir_open(duc, path);
+	if(dir == NULL) {
+		if(duc_error(duc) == DUC_E_PATH_NOT_FOUND) {
+			duc_log(duc, DUC_LOG_FTL, "The requested path '%s' was not found in the database,", path);
+			duc_log(duc, DUC_LOG_FTL, "Please run 'duc info' for a list of available directories.");
+		} else {
+			duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		}
+		return -1;
+	}
+
+	struct result_list rl = { NULL, 0, 0 };
+	duc_find(dir, pattern, opt_ignore_case ? DUC_FIND_ICASE : 0, add_result, &rl);
+
+	qsort(rl.list, rl.count, sizeof(*rl.list), cmp_result);
+
+	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT :
+	                   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
+
+	/* Find the widest size for aligning the output */
+
+	size_t i;
+	int max_size_len = 0;
+	for(i=0; i<rl.count; i++) {
+		char siz[32];
+		int l = duc_human_size(&rl.list[i].size, st, opt_bytes, siz, sizeof siz);
+		if(l > max_size_len) max_size_len = l;
+	}
+
+	for(i=0; i<rl.count; i++) {
+		struct result *res = &rl.list[i];
+		char siz[32];
+		duc_human_size(&res->size, st, opt_bytes, siz, sizeof siz);
+		printf("%*s %s", max_size_len, siz, res->path);
+		if(opt_classify) {
+			putchar(duc_file_type_char(res->type));
+		}
+		putchar('\n');
+		duc_free(res->path);
+	}
+
+	duc_free(rl.list);
+	duc_dir_close(dir);
+	duc_close(duc);
+
+	return 0;
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_apparent,    "apparent",    'a', DUCRC_TYPE_BOOL,   "show apparent instead of actual file size" },
+	{ &opt_bytes,       "bytes",       'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_classify,    "classify",    'F', DUCRC_TYPE_BOOL,   "append file type indicator (one of */) to entries" },
+	{ &opt_count,       "count",        0,  DUCRC_TYPE_BOOL,   "show number of files instead of file size" },
+	{ &opt_database,    "database",    'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
+	{ &opt_dirs_only,   "dirs-only",    0,  DUCRC_TYPE_BOOL,   "list only directories, skip individual files" },
+	{ &opt_ignore_case, "ignore-case", 'i', DUCRC_TYPE_BOOL,   "ignore case when matching names" },
+	{ NULL }
+};
+
+
+struct cmd cmd_find = {
+	.name = "find",
+	.descr_short = "Find files and directories by name",
+	.usage = "[options] PATTERN [PATH]",
+	.main = find_main,
+	.options = options,
+	.descr_long =
+		"The 'find' subcommand lists all files and directories below PATH with a name\n"
+		"matching PATTERN, together with their size. PATTERN is a shell wildcard pattern,\n"
+		"a pattern without wildcards matches all names containing it. Searches are fast\n"
+		"when the database was created with 'duc index --name-index', otherwise the\n"
+		"whole tree below PATH is read.\n"
+};
+
+
+/*
+ * End
+ */
+
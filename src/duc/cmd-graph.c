@@ -15,6 +15,7 @@
 #include "duc.h"
 #include "duc-graph.h"
 #include "cmd.h"
+#include "render-cache.h"
 
 static char *opt_database = NULL;
 static bool opt_apparent = false;
@@ -28,6 +29,8 @@ static enum duc_graph_palette palette = 0;
 static int opt_ring_gap = 4;
 static bool opt_gradient = false;
 static double opt_dpi = 96.0;
+static char *opt_cache_dir = NULL;
+static int opt_cache_dir_size = 256;
 
 #ifdef ENABLE_CAIRO
 static char *opt_format = "png";
@@ -35,6 +38,53 @@ static char *opt_format = "png";
 static char *opt_format = "svg";
 #endif
 
+extern struct cmd cmd_graph;
+
+
+static void draw(duc *duc, duc_dir *dir, duc_graph_file_format format, FILE *f)
+{
+	duc_graph *graph;
+
+	switch(format) {
+		case DUC_GRAPH_FORMAT_SVG:
+			graph = duc_graph_new_svg(duc, f);
+			break;
+		case DUC_GRAPH_FORMAT_HTML:
+			graph = duc_graph_new_html(duc, f, 1);
+			break;
+		case DUC_GRAPH_FORMAT_JSON:
+			graph = duc_graph_new_json(duc, f);
+			break;
+#ifdef ENABLE_CAIRO
+		case DUC_GRAPH_FORMAT_PNG:
+		case DUC_GRAPH_FORMAT_PDF:
+			graph = duc_graph_new_cairo_file(duc, format, f);
+			break;
+#endif
+		default:
+			duc_log(duc, DUC_LOG_FTL, "Requested image format is not supported");
+			exit(1);
+			break;
+	}
+	
+	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT : 
+	                   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
+
+	duc_graph_set_size(graph, opt_size, opt_size);
+	duc_graph_set_dpi(graph, opt_dpi);
+	duc_graph_set_fuzz(graph, opt_fuzz);
+	duc_graph_set_max_level(graph, opt_levels);
+	duc_graph_set_palette(graph, palette);
+	duc_graph_set_size_type(graph, st);
+	duc_graph_set_ring_gap(graph, opt_ring_gap);
+	duc_graph_set_gradient(graph, opt_gradient);
+
+	duc_graph_draw(graph, dir);
+
+	duc_graph_free(graph);
+}
+
+
 static int graph_main(duc *duc, int argc, char **argv)
 {
 	char *path_out = opt_output;
@@ -47,6 +97,11 @@ static int graph_main(duc *duc, int argc, char **argv)
 		path_out_default = "duc.html";
 	}
 
+	if(strcasecmp(opt_format, "json") == 0) {
+		format = DUC_GRAPH_FORMAT_JSON;
+		path_out_default = "duc.json";
+	}
+
 	if(strcasecmp(opt_format, "svg") == 0) {
 		format = DUC_GRAPH_FORMAT_SVG;
 		path_out_default = "duc.svg";
@@ -95,42 +150,41 @@ static int graph_main(duc *duc, int argc, char **argv)
 		return -1;
 	}
 
-	duc_graph *graph;
-
-	switch(format) {
-		case DUC_GRAPH_FORMAT_SVG:
-			graph = duc_graph_new_svg(duc, f);
-			break;
-		case DUC_GRAPH_FORMAT_HTML:
-			graph = duc_graph_new_html(duc, f, 1);
-			break;
-#ifdef ENABLE_CAIRO
-		case DUC_GRAPH_FORMAT_PNG:
-		case DUC_GRAPH_FORMAT_PDF:
-			graph = duc_graph_new_cairo_file(duc, format, f);
-			break;
-#endif
-		default:
-			duc_log(duc, DUC_LOG_FTL, "Requested image format is not supported");
-			exit(1);
-			break;
+	/* With a render cache, the graph is only drawn if the cache does not
+	 * hold it yet for the current database contents and options */
+
+	if(opt_cache_dir) {
+		struct render_key key;
+		char *data = NULL;
+		size_t len = 0;
+
+		render_key_init(&key, duc);
+		char *p = duc_dir_get_path(dir);
+		render_key_add_str(&key, p);
+		free(p);
+
+		struct ducrc_option *o;
+		for(o = cmd_graph.options; o->longopt; o++) {
+			if(o->ptr != &opt_output && o->ptr != &opt_cache_dir_size) render_key_add_option(&key, o);
+		}
+
+		if(render_cache_get(opt_cache_dir, &key, &data, &len) != 0) {
+			FILE *m = open_memstream(&data, &len);
+			if(m == NULL) {
+				duc_log(duc, DUC_LOG_FTL, "Error creating memory stream: %s", strerror(errno));
+				return -1;
+			}
+			draw(duc, dir, format, m);
+			fclose(m);
+			render_cache_put(opt_cache_dir, &key, data, len, (size_t)opt_cache_dir_size * 1024 * 1024);
+		}
+
+		fwrite(data, 1, len, f);
+		free(data);
+	} else {
+		draw(duc, dir, format, f);
 	}
-	
-	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT : 
-	                   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
-
-	duc_graph_set_size(graph, opt_size, opt_size);
-	duc_graph_set_dpi(graph, opt_dpi);
-	duc_graph_set_fuzz(graph, opt_fuzz);
-	duc_graph_set_max_level(graph, opt_levels);
-	duc_graph_set_palette(graph, palette);
-	duc_graph_set_size_type(graph, st);
-	duc_graph_set_ring_gap(graph, opt_ring_gap);
-	duc_graph_set_gradient(graph, opt_gradient);
 
-	duc_graph_draw(graph, dir);
-
-	duc_graph_free(graph);
 	duc_dir_close(dir);
 	duc_close(duc);
 
@@ -141,13 +195,15 @@ static int graph_main(duc *duc, int argc, char **argv)
 static struct ducrc_option options[] = {
 	{ &opt_apparent,  "apparent",  'a', DUCRC_TYPE_BOOL,   "Show apparent instead of actual file size" },
 	{ &opt_database,  "database",  'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
+	{ &opt_cache_dir, "cache-dir",  0,  DUCRC_TYPE_STRING, "keep rendered graphs in the given directory and reuse them until the database changes" },
+	{ &opt_cache_dir_size, "cache-dir-size", 0, DUCRC_TYPE_INT, "limit the size of the --cache-dir directory in MB, 0 for no limit [256]" },
 	{ &opt_count,     "count",      0,  DUCRC_TYPE_BOOL,   "show number of files instead of file size" },
 	{ &opt_dpi,       "dpi",        0 , DUCRC_TYPE_DOUBLE, "set destination resolution in DPI [96.0]" },
 	{ &opt_format,    "format",    'f', DUCRC_TYPE_STRING, 
 #ifdef ENABLE_CAIRO
-	                                                        "select output format <png|svg|pdf|html> [png]" },
+	                                                        "select output format <png|svg|pdf|html|json> [png]" },
 #else
-	                                                        "select output format <svg|html> [svg]" },
+	                                                        "select output format <svg|html|json> [svg]" },
 #endif
 	{ &opt_fuzz,      "fuzz",       0,  DUCRC_TYPE_DOUBLE, "use radius fuzz factor when drawing graph [0.7]" },
 	{ &opt_gradient,  "gradient",   0,  DUCRC_TYPE_BOOL,   "draw graph with color gradient" },
@@ -0,0 +1,131 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "cmd.h"
+#include "duc.h"
+
+
+static bool opt_bytes = false;
+static char *opt_database = NULL;
+static bool opt_force = false;
+static bool opt_hide_file_names = false;
+static bool opt_uncompressed = false;
+static bool opt_dryrun = false;
+static bool opt_name_index = false;
+static bool opt_extensions = false;
+static bool opt_null = false;
+
+
+static int import_main(duc *duc, int argc, char **argv)
+{
+	duc_index_flags index_flags = 0;
+	int open_flags = DUC_OPEN_RW | DUC_OPEN_COMPRESS;
+
+	if(opt_force) open_flags |= DUC_OPEN_FORCE;
+	if(opt_uncompressed) open_flags &= ~DUC_OPEN_COMPRESS;
+	if(opt_hide_file_names) index_flags |= DUC_INDEX_HIDE_FILE_NAMES;
+	if(opt_dryrun) index_flags |= DUC_INDEX_DRY_RUN;
+	if(opt_name_index) index_flags |= DUC_INDEX_NAMES;
+	if(opt_extensions) index_flags |= DUC_INDEX_EXTS;
+
+	/* Read the listing from stdin when no file or '-' is given */
+
+	FILE *f = stdin;
+	const char *path_listing = argc > 0 ? argv[0] : "-";
+
+	if(strcmp(path_listing, "-") != 0) {
+		f = fopen(path_listing, "r");
+		if(f == NULL) {
+			duc_log(duc, DUC_LOG_FTL, "Error opening listing %s: %s", path_listing, strerror(errno));
+			return -1;
+		}
+	}
+
+	int r = duc_open(duc, opt_database, open_flags);
+	if(r != DUC_OK) {
+		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		if(f != stdin) fclose(f);
+		return -1;
+	}
+
+	struct duc_index_report *report = duc_import(duc, f, opt_null ? '\0' : '\n', index_flags);
+
+	duc_close(duc);
+	if(f != stdin) fclose(f);
+
+	if(report == NULL) {
+		duc_log(duc, DUC_LOG_FTL, "Error importing %s: %s", path_listing, duc_strerror(duc));
+		return -1;
+	}
+
+	char siz_apparent[32], siz_actual[32];
+	duc_human_size(&report->size, DUC_SIZE_TYPE_APPARENT, opt_bytes, siz_apparent, sizeof siz_apparent);
+	duc_human_size(&report->size, DUC_SIZE_TYPE_ACTUAL,   opt_bytes, siz_actual,   sizeof siz_actual);
+
+	char dur[64];
+	duc_human_duration(report->time_start, report->time_stop, dur, sizeof dur);
+	duc_log(duc, DUC_LOG_INF,
+			"Imported %s with %zu files and %zu directories, (%sB apparent, %sB actual) in %s",
+			report->path,
+			report->file_count,
+			report->dir_count,
+			siz_apparent,
+			siz_actual,
+			dur);
+	if(report->error_count) {
+		duc_log(duc, DUC_LOG_WRN, "Skipped %zu records of the listing", report->error_count);
+	}
+
+	duc_index_report_free(report);
+
+	return 0;
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_bytes,           "bytes",           'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_database,        "database",        'd', DUCRC_TYPE_STRING, "use database file VAL" },
+	{ &opt_dryrun,          "dry-run",          0,  DUCRC_TYPE_BOOL,   "read the listing without writing to the database" },
+	{ &opt_extensions,      "extensions",       0,  DUCRC_TYPE_BOOL,   "record usage per file name extension for 'duc ls --by-ext'" },
+	{ &opt_force,           "force",           'f', DUCRC_TYPE_BOOL,   "force writing in case of corrupted db" },
+	{ &opt_hide_file_names, "hide-file-names",  0,  DUCRC_TYPE_BOOL,   "hide file names in index (privacy)" },
+	{ &opt_name_index,      "name-index",       0,  DUCRC_TYPE_BOOL,   "build an index of file names for 'duc find'" },
+	{ &opt_null,            "null",            '0', DUCRC_TYPE_BOOL,   "records are terminated by a null character instead of a newline",
+	  "use this for listings written with '\\0' at the end of the find -printf format, which is the only safe "
+	  "choice for file names holding newlines" },
+	{ &opt_uncompressed,    "uncompressed",     0,  DUCRC_TYPE_BOOL,   "do not use compression for database" },
+	{ NULL }
+};
+
+
+struct cmd cmd_import = {
+	.name = "import",
+	.descr_short = "Index a file system from a listing of its entries",
+	.usage = "[options] [LISTING]",
+	.main = import_main,
+	.options = options,
+	.descr_long =
+		"The 'import' subcommand reads a listing of a file system from the file LISTING,\n"
+		"or from stdin, and writes the same index as 'duc index' would. Storage systems\n"
+		"can often list their metadata much faster than a recursive scan. Every record\n"
+		"holds the inode, device number, apparent size, number of 512 byte blocks, type\n"
+		"and path of one entry, as written by\n"
+		"\n"
+		"    find PATH -printf '%i %D %s %b %y %p\\n'\n"
+		"\n"
+		"The listing must be in depth-first order with every directory before its\n"
+		"contents, as written by find without -depth. Only the directories on the path\n"
+		"to the current entry are kept in memory. Owners and times are not part of the\n"
+		"listing, so no history, users or ages are recorded, and hard links are counted\n"
+		"every time.\n"
+};
+
+
+/*
+ * End
+ */
+
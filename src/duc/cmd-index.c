@@ -12,9 +12,15 @@
 #include <errno.h>
 #include <dirent.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #include "cmd.h"
 #include "duc.h"
+#include "private.h"
 #include "ducrc.h"
 
 
@@ -23,6 +29,7 @@ static char *opt_database = NULL;
 static bool opt_force = false;
 static bool opt_check_hard_links = false;
 static bool opt_hide_file_names = false;
+static bool opt_history = false;
 static char *opt_username = NULL;
 static int opt_uid = 0;
 static int opt_max_depth = 0;
@@ -30,9 +37,64 @@ static bool opt_one_file_system = false;
 static bool opt_progress = false;
 static bool opt_uncompressed = false;
 static bool opt_dryrun = false;
+static char *opt_hard_link_spill = NULL;
+static int opt_checkpoint = 0;
+static bool opt_resume = false;
+static bool opt_name_index = false;
+static bool opt_users = false;
+static bool opt_extensions = false;
+static bool opt_ages = false;
+static char *opt_progress_file = NULL;
+static char *opt_progress_format = "json";
+static double opt_progress_interval = 10.0;
+static int opt_threads = 1;
+static char **opt_graft = NULL;
+static size_t opt_graft_count = 0;
 static duc_index_req *req;
 
 
+/*
+ * State for the machine readable progress sink. The library reports progress
+ * as directories are completed, which can stall for a long time on a single
+ * large or slow directory. A thread writes samples at the configured interval
+ * regardless, so a stalled run shows by the time of its last update. Rates are
+ * calculated over the period since the previous sample was written.
+ *
+ * Paths indexed in parallel report in turns, so the state is kept per path.
+ */
+
+struct sink_root {
+	struct duc_index_report rep;        /* Copy of the last report received */
+	char path_current[DUC_PATH_MAX];
+	int done;
+	struct timeval t_update;            /* Time the last report was received */
+	struct timeval t_prev;
+	size_t files_prev;
+	size_t dirs_prev;
+	off_t bytes_prev;
+	double r_entries;                   /* Rates of the last sample */
+	double r_dirs;
+	double r_bytes;
+};
+
+struct progress_sink {
+	duc *duc;
+	FILE *f;
+	int prometheus;
+	struct sink_root *roots;
+	size_t root_count;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	int stop;
+#endif
+};
+
+static struct progress_sink sink;
+
+
 static int index_init(duc *duc, int argc, char **argv)
 {
 	req = duc_index_req_new(duc);
@@ -59,6 +121,318 @@ void progress_cb(struct duc_index_report *rep, void *ptr)
 }
 
 
+static double tv_to_double(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1.0E6;
+}
+
+
+static void sink_write_json(FILE *f, struct sink_root *r, double now)
+{
+	struct duc_index_report *rep = &r->rep;
+
+	fprintf(f, "{\"time\":%.3f,\"updated\":%.3f,\"path\":", now, tv_to_double(r->t_update));
+	duc_fquote(f, rep->path, DUC_QUOTE_JSON);
+	fprintf(f, ",\"current\":");
+	duc_fquote(f, r->path_current, DUC_QUOTE_JSON);
+	fprintf(f, ",\"depth\":%d,\"files\":%zu,\"dirs\":%zu,\"errors\":%zu,"
+	           "\"size_apparent\":%jd,\"size_actual\":%jd,\"queue_depth\":%zu,"
+	           "\"entries_per_sec\":%.1f,\"dirs_per_sec\":%.1f,\"bytes_per_sec\":%.0f,\"done\":%s}\n",
+			rep->depth_current, rep->file_count, rep->dir_count, rep->error_count,
+			(intmax_t)rep->size.apparent, (intmax_t)rep->size.actual, rep->queue_current,
+			r->r_entries, r->r_dirs, r->r_bytes, r->done ? "true" : "false");
+	fflush(f);
+}
+
+
+/*
+ * All paths go into one file, with a sample per path labeled with the path
+ */
+
+static void sink_write_prometheus(FILE *f, double now)
+{
+	static const struct {
+		const char *name;
+		const char *help;
+	} *m, metrics[] = {
+		{ "duc_index_files",                  "Number of files indexed" },
+		{ "duc_index_dirs",                   "Number of directories indexed" },
+		{ "duc_index_errors",                 "Number of entries which could not be read" },
+		{ "duc_index_size_apparent_bytes",    "Apparent size indexed" },
+		{ "duc_index_size_actual_bytes",      "Actual size indexed" },
+		{ "duc_index_entries_per_second",     "Entries indexed per second" },
+		{ "duc_index_dirs_per_second",        "Directories indexed per second" },
+		{ "duc_index_bytes_per_second",       "Bytes indexed per second" },
+		{ "duc_index_queue_depth",            "Records waiting to be written to the database" },
+		{ "duc_index_depth",                  "Depth of the directory being scanned" },
+		{ "duc_index_done",                   "Set to 1 when the index has finished" },
+		{ "duc_index_last_update_seconds",    "Time of the last progress update" },
+		{ "duc_index_sample_seconds",         "Time this sample was written" },
+		{ NULL }
+	};
+
+	size_t n;
+	for(m=metrics, n=0; m->name; m++, n++) {
+		fprintf(f, "# HELP %s %s\n", m->name, m->help);
+		fprintf(f, "# TYPE %s gauge\n", m->name);
+
+		size_t i;
+		for(i=0; i<sink.root_count; i++) {
+			struct sink_root *r = &sink.roots[i];
+			struct duc_index_report *rep = &r->rep;
+			double vals[] = {
+				rep->file_count, rep->dir_count, rep->error_count,
+				rep->size.apparent, rep->size.actual,
+				r->r_entries, r->r_dirs, r->r_bytes,
+				rep->queue_current, rep->depth_current, r->done,
+				tv_to_double(r->t_update), now,
+			};
+			fprintf(f, "%s{path=", m->name);
+			duc_fquote(f, rep->path, DUC_QUOTE_PROMETHEUS);
+			fprintf(f, "} %.17g\n", vals[n]);
+		}
+	}
+}
+
+
+/*
+ * Prometheus textfile collectors read the whole file at random moments, so
+ * the file is written to a temporary file first and renamed into place
+ */
+
+static void sink_write_prometheus_file(double now)
+{
+	char tmp[DUC_PATH_MAX];
+	snprintf(tmp, sizeof tmp, "%s.tmp", opt_progress_file);
+
+	FILE *f = fopen(tmp, "w");
+	if(f == NULL) {
+		duc_log(sink.duc, DUC_LOG_WRN, "Error writing progress file %s: %s", tmp, strerror(errno));
+		return;
+	}
+
+	sink_write_prometheus(f, now);
+	fclose(f);
+
+	if(rename(tmp, opt_progress_file) != 0) {
+		duc_log(sink.duc, DUC_LOG_WRN, "Error writing progress file %s: %s", opt_progress_file, strerror(errno));
+	}
+}
+
+
+/*
+ * Write a sample of the given path, or of all paths still being indexed when
+ * NULL. Called with the sink locked
+ */
+
+static void sink_sample(struct sink_root *root)
+{
+	struct timeval t_now;
+	gettimeofday(&t_now, NULL);
+	double now = tv_to_double(t_now);
+	size_t i, n = 0;
+
+	for(i=0; i<sink.root_count; i++) {
+		struct sink_root *r = &sink.roots[i];
+		struct duc_index_report *rep = &r->rep;
+		if(root ? r != root : r->done) continue;
+
+		double dt = now - tv_to_double(r->t_prev);
+		if(dt <= 0) dt = 1.0E-6;
+
+		r->r_entries = ((double)rep->file_count + rep->dir_count - r->files_prev - r->dirs_prev) / dt;
+		r->r_dirs = ((double)rep->dir_count - r->dirs_prev) / dt;
+		r->r_bytes = ((double)rep->size.actual - r->bytes_prev) / dt;
+
+		r->t_prev = t_now;
+		r->files_prev = rep->file_count;
+		r->dirs_prev = rep->dir_count;
+		r->bytes_prev = rep->size.actual;
+
+		if(!sink.prometheus) sink_write_json(sink.f, r, now);
+		n ++;
+	}
+
+	if(sink.prometheus && n > 0) sink_write_prometheus_file(now);
+}
+
+
+static void sink_lock(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&sink.mutex);
+#endif
+}
+
+
+static void sink_unlock(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&sink.mutex);
+#endif
+}
+
+
+static void progress_sink_cb(struct duc_index_report *rep, void *ptr)
+{
+	struct timeval t_now;
+	gettimeofday(&t_now, NULL);
+
+	sink_lock();
+
+	struct sink_root *r = NULL;
+	size_t i;
+	for(i=0; i<sink.root_count; i++) {
+		if(strcmp(sink.roots[i].rep.path, rep->path) == 0) r = &sink.roots[i];
+	}
+
+	if(r == NULL) {
+		sink.roots = duc_realloc(sink.roots, (sink.root_count + 1) * sizeof(*sink.roots));
+		r = &sink.roots[sink.root_count++];
+		memset(r, 0, sizeof *r);
+	}
+
+	/* Start counting from the start of this index run */
+
+	if(timercmp(&r->rep.time_start, &rep->time_start, !=)) {
+		r->t_prev = rep->time_start;
+		r->files_prev = 0;
+		r->dirs_prev = 0;
+		r->bytes_prev = 0;
+	}
+
+	r->rep = *rep;
+	r->rep.path_current = NULL;
+	snprintf(r->path_current, sizeof r->path_current, "%s", rep->path_current ? rep->path_current : "");
+	r->t_update = t_now;
+	r->done = rep->time_stop.tv_sec != 0;
+
+	/* The top level directory is reported last, after the index is finished.
+	 * Other samples are written by the sink thread, if there is one */
+
+	int running = 0;
+#ifdef HAVE_LIBPTHREAD
+	running = sink.running;
+#endif
+
+	if(r->done) {
+		sink_sample(r);
+	} else if(!running) {
+		double dt = tv_to_double(t_now) - tv_to_double(r->t_prev);
+		if(dt >= opt_progress_interval) sink_sample(NULL);
+	}
+
+	sink_unlock();
+}
+
+
+#ifdef HAVE_LIBPTHREAD
+
+static void *sink_thread(void *ptr)
+{
+	pthread_mutex_lock(&sink.mutex);
+
+	while(!sink.stop) {
+		struct timeval t_now, t_next;
+		struct timeval t_interval = {
+			(time_t)opt_progress_interval,
+			(opt_progress_interval - (time_t)opt_progress_interval) * 1.0E6
+		};
+		gettimeofday(&t_now, NULL);
+		timeradd(&t_now, &t_interval, &t_next);
+		struct timespec ts = { t_next.tv_sec, t_next.tv_usec * 1000 };
+
+		int r = 0;
+		while(!sink.stop && r != ETIMEDOUT) {
+			r = pthread_cond_timedwait(&sink.cond, &sink.mutex, &ts);
+		}
+
+		if(!sink.stop) {
+			sink_sample(NULL);
+		}
+	}
+
+	pthread_mutex_unlock(&sink.mutex);
+	return NULL;
+}
+
+#endif
+
+
+static void progress_all_cb(struct duc_index_report *rep, void *ptr)
+{
+	if(opt_progress) progress_cb(rep, ptr);
+	if(opt_progress_file) progress_sink_cb(rep, ptr);
+}
+
+
+static int progress_sink_open(duc *duc)
+{
+	sink.duc = duc;
+
+	if(opt_progress_interval <= 0) {
+		duc_log(duc, DUC_LOG_FTL, "The progress interval must be larger than zero");
+		return -1;
+	}
+
+	if(strcasecmp(opt_progress_format, "prometheus") == 0) {
+		sink.prometheus = 1;
+		if(strcmp(opt_progress_file, "-") == 0) {
+			duc_log(duc, DUC_LOG_FTL, "The prometheus progress format can not be written to stdout");
+			return -1;
+		}
+	} else if(strcasecmp(opt_progress_format, "json") == 0) {
+		if(strcmp(opt_progress_file, "-") == 0) {
+			sink.f = stdout;
+		} else {
+			sink.f = fopen(opt_progress_file, "a");
+			if(sink.f == NULL) {
+				duc_log(duc, DUC_LOG_FTL, "Error opening progress file %s: %s", opt_progress_file, strerror(errno));
+				return -1;
+			}
+		}
+	} else {
+		duc_log(duc, DUC_LOG_FTL, "Unknown progress format '%s'", opt_progress_format);
+		return -1;
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&sink.mutex, NULL);
+	pthread_cond_init(&sink.cond, NULL);
+	if(pthread_create(&sink.thread, NULL, sink_thread, NULL) == 0) {
+		sink.running = 1;
+	} else {
+		duc_log(duc, DUC_LOG_WRN, "Unable to start progress thread, writing progress only as directories complete");
+	}
+#endif
+
+	return 0;
+}
+
+
+static void progress_sink_close(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	if(sink.running) {
+		pthread_mutex_lock(&sink.mutex);
+		sink.stop = 1;
+		pthread_cond_signal(&sink.cond);
+		pthread_mutex_unlock(&sink.mutex);
+		pthread_join(sink.thread, NULL);
+		sink.running = 0;
+	}
+	pthread_cond_destroy(&sink.cond);
+	pthread_mutex_destroy(&sink.mutex);
+#endif
+
+	if(sink.f && sink.f != stdout) fclose(sink.f);
+	sink.f = NULL;
+	duc_free(sink.roots);
+	sink.roots = NULL;
+	sink.root_count = 0;
+}
+
+
 static void log_callback(duc_log_level level, const char *fmt, va_list va)
 {
 	vfprintf(stderr, fmt, va);
@@ -66,6 +440,43 @@ static void log_callback(duc_log_level level, const char *fmt, va_list va)
 }
 
 
+/*
+ * Called when a path is done, paths indexed in parallel finish in any order
+ */
+
+static void index_done(const char *path, struct duc_index_report *report, void *ptr)
+{
+	duc *duc = ptr;
+
+	if(report == NULL) {
+		duc_log(duc, DUC_LOG_WRN, "%s", duc_strerror(duc));
+		return;
+	}
+
+	char siz_apparent[32], siz_actual[32];
+	duc_human_size(&report->size, DUC_SIZE_TYPE_APPARENT, opt_bytes, siz_apparent, sizeof siz_apparent);
+	duc_human_size(&report->size, DUC_SIZE_TYPE_ACTUAL,   opt_bytes, siz_actual,   sizeof siz_actual);
+
+	char dur[64];
+	duc_human_duration(report->time_start, report->time_stop, dur, sizeof dur);
+	duc_log(duc, DUC_LOG_INF, 
+			"Indexed %zu files and %zu directories, (%sB apparent, %sB actual) in %s", 
+			report->file_count, 
+			report->dir_count,
+			siz_apparent,
+			siz_actual,
+			dur);
+
+	/* Prevent final output of progress_cb() from being overwritten with the shell's prompt */
+	if (opt_progress) {
+		fputc ('\n', stdout);
+		fflush (stdout);
+	}
+
+	duc_index_report_free(report);
+}
+
+
 static int index_main(duc *duc, int argc, char **argv)
 {
 	duc_index_flags index_flags = 0;
@@ -76,69 +487,64 @@ static int index_main(duc *duc, int argc, char **argv)
 	if(opt_one_file_system) index_flags |= DUC_INDEX_XDEV;
 	if(opt_hide_file_names) index_flags |= DUC_INDEX_HIDE_FILE_NAMES;
 	if(opt_check_hard_links) index_flags |= DUC_INDEX_CHECK_HARD_LINKS;
+	if(opt_hard_link_spill) duc_index_req_set_hard_link_spill(req, opt_hard_link_spill);
 	if(opt_uncompressed) open_flags &= ~DUC_OPEN_COMPRESS;
 	if(opt_dryrun) index_flags |= DUC_INDEX_DRY_RUN;
+	if(opt_resume) index_flags |= DUC_INDEX_RESUME;
+	if(opt_name_index) index_flags |= DUC_INDEX_NAMES;
+	if(opt_history) index_flags |= DUC_INDEX_HISTORY;
+	if(opt_users) index_flags |= DUC_INDEX_USERS;
+	if(opt_extensions) index_flags |= DUC_INDEX_EXTS;
+	if(opt_ages) index_flags |= DUC_INDEX_AGES;
+	if(opt_checkpoint) duc_index_req_set_checkpoint(req, opt_checkpoint);
 	if(opt_username) duc_index_req_set_username(req, opt_username);
 	if(opt_uid) duc_index_req_set_uid(req, opt_uid);
+	if(opt_threads > 1) duc_index_req_set_threads(req, opt_threads);
 
 	if(argc < 1) {
 		duc_log(duc, DUC_LOG_FTL, "Required index PATH missing.");
 		return -2;
 	}
 	
+	size_t i;
+	for(i=0; i<opt_graft_count; i++) {
+		if(duc_index_req_add_graft(req, opt_graft[i]) != 0) {
+			duc_log(duc, DUC_LOG_FTL, "Unable to graft %s: %s", opt_graft[i], duc_strerror(duc));
+			return -1;
+		}
+	}
+
+	if(opt_progress_file) {
+		if(progress_sink_open(duc) != 0) return -1;
+	}
+
+	if(opt_progress || opt_progress_file) {
+		duc_index_req_set_progress_cb(req, progress_all_cb, NULL);
+	}
+
 	if(opt_progress) {
-		duc_index_req_set_progress_cb(req, progress_cb, NULL);
 		duc_set_log_callback(duc, log_callback);
 	}
 	
 	int r = duc_open(duc, opt_database, open_flags);
 	if(r != DUC_OK) {
 		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		if(opt_progress_file) progress_sink_close();
 		return -1;
 	}
 
 	/* Index all paths passed on the cmdline */
 
-	int i;
-	for(i=0; i<argc; i++) {
-
-		struct duc_index_report *report;
-		report = duc_index(req, argv[i], index_flags);
-		if(report == NULL) {
-			duc_log(duc, DUC_LOG_WRN, "%s", duc_strerror(duc));
-			continue;
-		}
-
-		char siz_apparent[32], siz_actual[32];
-		duc_human_size(&report->size, DUC_SIZE_TYPE_APPARENT, opt_bytes, siz_apparent, sizeof siz_apparent);
-		duc_human_size(&report->size, DUC_SIZE_TYPE_ACTUAL,   opt_bytes, siz_actual,   sizeof siz_actual);
-
-		if(r == DUC_OK) {
-			char dur[64];
-			duc_human_duration(report->time_start, report->time_stop, dur, sizeof dur);
-			duc_log(duc, DUC_LOG_INF, 
-					"Indexed %zu files and %zu directories, (%sB apparent, %sB actual) in %s", 
-					report->file_count, 
-					report->dir_count,
-					siz_apparent,
-					siz_actual,
-					dur);
-		} else {
-			duc_log(duc, DUC_LOG_WRN, "An error occurred while indexing: %s", duc_strerror(duc));
-		}
-
-		/* Prevent final output of progress_cb() from being overwritten with the shell's prompt */
-		if (opt_progress) {
-			fputc ('\n', stdout);
-			fflush (stdout);
-		}
-
-		duc_index_report_free(report);
-	}
+	duc_index_paths(req, argv, argc, index_flags, index_done, duc);
 
 	duc_close(duc);
 	duc_index_req_free(req);
 
+	for(i=0; i<opt_graft_count; i++) free(opt_graft[i]);
+	free(opt_graft);
+
+	if(opt_progress_file) progress_sink_close();
+
 	return 0;
 }
 
@@ -149,6 +555,13 @@ static void fn_exclude(const char *val)
 }
 
 
+static void fn_graft(const char *val)
+{
+	opt_graft = realloc(opt_graft, (opt_graft_count + 1) * sizeof(*opt_graft));
+	opt_graft[opt_graft_count++] = strdup(val);
+}
+
+
 static void fn_fs_include(const char *val)
 {
 	duc_index_req_add_fstype_include(req, val);
@@ -162,25 +575,65 @@ static void fn_fs_exclude(const char *val)
 
 
 static struct ducrc_option options[] = {
+	{ &opt_ages,            "ages",             0,  DUCRC_TYPE_BOOL,   "record file age histograms for 'duc ls --older-than'",
+	  "for every directory the size of the files below it is stored by the age of their modification "
+	  "and access times, in buckets on a log scale" },
 	{ &opt_bytes,           "bytes",           'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_checkpoint,      "checkpoint",       0,  DUCRC_TYPE_INT,    "write a checkpoint every VAL seconds",
+	  "an interrupted index run can be continued from the last checkpoint with the --resume option, "
+	  "without rescanning the directories which were completed before" },
 	{ &opt_database,        "database",        'd', DUCRC_TYPE_STRING, "use database file VAL" },
-	{ fn_exclude,           "exclude",         'e', DUCRC_TYPE_FUNC,   "exclude files matching VAL"  },
+	{ fn_exclude,           "exclude",         'e', DUCRC_TYPE_FUNC,   "exclude files matching VAL",
+	  "VAL is a shell wildcard pattern which is matched against the file name. Patterns containing a '/' "
+	  "are matched against the full path of the file instead" },
 	{ &opt_check_hard_links,"check-hard-links",'H', DUCRC_TYPE_BOOL,   "count hard links only once",
           "if two or more hard links point to the same file, only one of the hard links is displayed and counted" },
+	{ &opt_hard_link_spill, "hard-link-spill",  0,  DUCRC_TYPE_STRING, "keep hard link table in a temporary file in directory VAL",
+	  "with --check-hard-links every file with more than one link is remembered. On file systems with many "
+	  "millions of hard links this table can be kept in a file so the kernel can page it out" },
+	{ &opt_extensions,      "extensions",       0,  DUCRC_TYPE_BOOL,   "record usage per file name extension for 'duc ls --by-ext'",
+	  "for every directory the size of the regular files below it is stored for the 20 largest extensions, "
+	  "all others are added up" },
 	{ &opt_force,           "force",           'f', DUCRC_TYPE_BOOL,   "force writing in case of corrupted db" },
 	{ fn_fs_exclude,        "fs-exclude",       0,  DUCRC_TYPE_FUNC,   "exclude file system type VAL during indexing",
 	  "VAL is a comma separated list of file system types as found in your systems fstab, for example ext3,ext4,dosfs" },
 	{ fn_fs_include,        "fs-include",       0,  DUCRC_TYPE_FUNC,   "include file system type VAL during indexing",
 	  "VAL is a comma separated list of file system types as found in your systems fstab, for example ext3,ext4,dosfs" },
+	{ fn_graft,             "graft",            0,  DUCRC_TYPE_FUNC,   "graft the index runs of partial database VAL",
+	  "directories which were indexed into partial database VAL, for example by 'duc index' runs on other "
+	  "subtrees at the same time, are copied from there instead of being scanned. The directories above them "
+	  "are scanned as usual, so their totals include the grafted trees. A subtree is only grafted if its "
+	  "partial database recorded all breakdowns and, with --check-hard-links, the hard links this run records" },
 	{ &opt_hide_file_names, "hide-file-names",  0 , DUCRC_TYPE_BOOL,   "hide file names in index (privacy)", 
 	  "the names of directories will be preserved, but the names of the individual files will be hidden" },
+	{ &opt_history,         "history",          0,  DUCRC_TYPE_BOOL,   "keep previous index runs for 'duc diff'",
+	  "every index run is added to the history of the indexed path as a new generation. Directories which "
+	  "did not change between runs are stored only once" },
+	{ &opt_name_index,      "name-index",       0,  DUCRC_TYPE_BOOL,   "build an index of file names for 'duc find'",
+	  "the name index allows 'duc find' to search file names without reading the whole database. "
+	  "It takes some extra time and space during indexing" },
+	{ &opt_resume,          "resume",           0,  DUCRC_TYPE_BOOL,   "resume an interrupted index run from the last checkpoint" },
 	{ &opt_uid,             "uid",              'U', DUCRC_TYPE_INT,    "limit index to only files/dirs owned by uid" },
 	{ &opt_username,        "username",         'u', DUCRC_TYPE_STRING, "limit index to only files/dirs owned by username" },
+	{ &opt_users,           "users",            0,  DUCRC_TYPE_BOOL,   "record usage per user for 'duc ls --by-user'",
+	  "for every directory the size of the files below it is stored for each owner, so the usage of all "
+	  "users is known from a single index run" },
 	{ &opt_max_depth,       "max-depth",       'm', DUCRC_TYPE_INT,    "limit directory names to given depth" ,
 	  "when this option is given duc will traverse the complete file system, but will only the first VAL "
 	  "levels of directories in the database to reduce the size of the index" },
 	{ &opt_one_file_system, "one-file-system", 'x', DUCRC_TYPE_BOOL,   "skip directories on different file systems" },
 	{ &opt_progress,        "progress",        'p', DUCRC_TYPE_BOOL,   "show progress during indexing" },
+	{ &opt_progress_file,   "progress-file",    0,  DUCRC_TYPE_STRING, "write machine readable progress to file VAL",
+	  "progress samples are appended as JSON lines, or the file is rewritten as a Prometheus textfile collector "
+	  "file when --progress-format=prometheus is given. Use '-' to write JSON to stdout. Samples are also "
+	  "written while a single directory takes long, the time of the last progress of the index run tells "
+	  "if it has stalled" },
+	{ &opt_progress_format, "progress-format",  0,  DUCRC_TYPE_STRING, "select progress file format <json|prometheus> [json]" },
+	{ &opt_progress_interval,"progress-interval",0, DUCRC_TYPE_DOUBLE, "write progress file every VAL seconds [10]" },
+	{ &opt_threads,         "threads",          0 , DUCRC_TYPE_INT,    "index up to VAL paths in parallel [1]",
+	  "every PATH is scanned by a thread of its own, while a single thread writes to the database. With "
+	  "--check-hard-links all threads share one table of hard links, a link shared by several paths is "
+	  "counted once, in the path where it was found first" },
 	{ &opt_dryrun,          "dry-run",          0 , DUCRC_TYPE_BOOL,   "do not update database, just crawl" },
 	{ &opt_uncompressed,    "uncompressed",     0 , DUCRC_TYPE_BOOL,   "do not use compression for database",
           "Duc enables compression if the underlying database supports this. This reduces index size at the cost "
@@ -0,0 +1,184 @@
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "duc.h"
+#include "writer.h"
+
+
+static bool opt_apparent = false;
+static bool opt_count = false;
+static char *opt_database = NULL;
+static bool opt_dirs_only = false;
+static int opt_levels = 0;
+static double opt_min_size = 0;
+static char *opt_output = NULL;
+static int opt_threads = 1;
+static int opt_top = 0;
+
+
+struct json_state {
+	struct writer w;
+	int need_comma;
+};
+
+
+static void put_sizes(struct writer *w, const struct duc_size *size, int count)
+{
+	writer_puts(w, "\"size_apparent\":");
+	writer_put_int(w, size->apparent);
+	writer_puts(w, ",\"size_actual\":");
+	writer_put_int(w, size->actual);
+	if(count) {
+		writer_puts(w, ",\"count\":");
+		writer_put_int(w, size->count);
+	}
+}
+
+
+static void put_ent(struct writer *w, const struct duc_dirent *e, int depth)
+{
+	writer_puts(w, depth == 0 ? "{\"path\":" : "{\"name\":");
+	writer_put_json(w, e->name);
+	writer_puts(w, ",\"type\":\"");
+	writer_puts(w, duc_file_type_name(e->type));
+	writer_puts(w, "\",");
+	put_sizes(w, &e->size, e->type == DUC_FILE_TYPE_DIR);
+}
+
+
+static int dump(struct duc_walk_ent *we, void *ptr)
+{
+	struct json_state *s = ptr;
+	struct writer *w = &s->w;
+
+	switch(we->event) {
+
+		case DUC_WALK_DIR_ENTER:
+			if(s->need_comma) writer_put(w, ",\n", 2);
+			put_ent(w, we->ent, we->depth);
+			writer_puts(w, ",\"children\":[\n");
+			s->need_comma = 0;
+			break;
+
+		case DUC_WALK_DIR_LEAVE:
+			writer_puts(w, "\n]");
+			if(we->skipped_count > 0) {
+				writer_puts(w, ",\"skipped\":{\"entries\":");
+				writer_put_int(w, we->skipped_count);
+				writer_put(w, ",", 1);
+				put_sizes(w, &we->skipped_size, 1);
+				writer_put(w, "}", 1);
+			}
+			writer_put(w, "}", 1);
+			s->need_comma = 1;
+			break;
+
+		case DUC_WALK_ENTRY:
+			if(s->need_comma) writer_put(w, ",\n", 2);
+			put_ent(w, we->ent, we->depth);
+			writer_put(w, "}", 1);
+			s->need_comma = 1;
+			break;
+	}
+
+	return 0;
+}
+
+
+static int json_main(duc *duc, int argc, char **argv)
+{
+	char *path = ".";
+	if(argc > 0) path = argv[0];
+
+	int r = duc_open(duc, opt_database, DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		return -1;
+	}
+
+	duc_dir *dir = duc_dir_open(duc, path);
+	if(dir == NULL) {
+		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		return -1;
+	}
+
+	FILE *f = stdout;
+	if(opt_output && strcmp(opt_output, "-") != 0) {
+		f = fopen(opt_output, "w");
+		if(f == NULL) {
+			duc_log(duc, DUC_LOG_FTL, "Error opening output file: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT :
+	                   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
+
+	struct json_state s = { .need_comma = 0 };
+	writer_init(&s.w, f, WRITER_BUF_SIZE);
+
+	duc_walk_req *req = duc_walk_req_new(duc);
+	duc_walk_req_set_size_type(req, st);
+	duc_walk_req_set_maxdepth(req, opt_levels);
+	duc_walk_req_set_min_size(req, (off_t)opt_min_size);
+	duc_walk_req_set_top(req, opt_top > 0 ? opt_top : 0);
+	duc_walk_req_set_exclude_files(req, opt_dirs_only);
+	duc_walk_req_set_threads(req, opt_threads);
+	duc_walk(req, dir, dump, &s);
+	duc_walk_req_free(req);
+
+	writer_put(&s.w, "\n", 1);
+
+	r = writer_done(&s.w);
+	if(r != 0) {
+		duc_log(duc, DUC_LOG_FTL, "Error writing output: %s", strerror(errno));
+	}
+
+	if(f != stdout) fclose(f);
+	duc_dir_close(dir);
+	duc_close(duc);
+
+	return r;
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_apparent,  "apparent",  'a', DUCRC_TYPE_BOOL,   "use apparent instead of actual file size for sorting and pruning" },
+	{ &opt_count,     "count",      0,  DUCRC_TYPE_BOOL,   "use number of files instead of file size for sorting and pruning" },
+	{ &opt_database,  "database",  'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
+	{ &opt_dirs_only, "dirs-only",  0,  DUCRC_TYPE_BOOL,   "only include directories, skip individual files" },
+	{ &opt_levels,    "levels",    'l', DUCRC_TYPE_INT,    "traverse up to ARG levels deep, 0 for no limit [0]" },
+	{ &opt_min_size,  "min-size",  's', DUCRC_TYPE_DOUBLE, "skip files and directories smaller than VAL" },
+	{ &opt_output,    "output",    'o', DUCRC_TYPE_STRING, "output file name, '-' for stdout [-]" },
+	{ &opt_threads,   "threads",    0,  DUCRC_TYPE_INT,    "number of threads reading from the database [1]" },
+	{ &opt_top,       "top",       'n', DUCRC_TYPE_INT,    "only include the VAL largest entries of every directory" },
+	{ NULL }
+};
+
+
+struct cmd cmd_json = {
+	.name = "json",
+	.descr_short = "Dump JSON output",
+	.usage = "[options] [PATH]",
+	.main = json_main,
+	.options = options,
+	.descr_long =
+		"The 'json' subcommand writes the tree below PATH as nested JSON objects. Entries are\n"
+		"sorted by size, largest first. Every directory object holds its entries in the\n"
+		"'children' array, directories at the --levels limit have no 'children'. Entries\n"
+		"left out by the --min-size, --top or --dirs-only options are summed up in the\n"
+		"'skipped' object of their parent directory.\n"
+};
+
+
+/*
+ * End
+ */
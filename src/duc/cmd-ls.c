@@ -12,6 +12,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pwd.h>
+#include <time.h>
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
 #endif
@@ -45,6 +47,9 @@ static char *tree_utf8[] = {
 };
 
 static bool opt_apparent = false;
+static bool opt_atime = false;
+static bool opt_by_ext = false;
+static bool opt_by_user = false;
 static bool opt_count = false;
 static bool opt_ascii = false;
 static bool opt_bytes = false;
@@ -59,6 +64,7 @@ static char *opt_database = NULL;
 static bool opt_dirs_only = false;
 static int opt_levels = 4;
 static bool opt_name_sort = false;
+static char *opt_older_than = NULL;
 
 
 /* 
@@ -240,6 +246,208 @@ static void ls_dir_only(const char *path, duc_dir *dir)
 }
 
 
+/*
+ * Show a breakdown of the usage of this directory, largest first
+ */
+
+struct breakdown {
+	char label[64];
+	struct duc_size size;
+};
+
+static duc_size_type breakdown_size_type;
+
+static int cmp_breakdown(const void *a, const void *b)
+{
+	const struct breakdown *b1 = a;
+	const struct breakdown *b2 = b;
+	off_t s1 = duc_get_size((struct duc_size *)&b1->size, breakdown_size_type);
+	off_t s2 = duc_get_size((struct duc_size *)&b2->size, breakdown_size_type);
+	if(s1 != s2) return s1 > s2 ? -1 : 1;
+	return strcmp(b1->label, b2->label);
+}
+
+
+static void ls_breakdown(struct breakdown *list, size_t count)
+{
+	size_t i;
+
+	breakdown_size_type = opt_count ? DUC_SIZE_TYPE_COUNT : 
+		              opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
+	qsort(list, count, sizeof(*list), cmp_breakdown);
+
+	int max_size_len = opt_bytes ? 12 : 7;
+
+	for(i=0; i<count; i++) {
+		char siz[32];
+		duc_human_size(&list[i].size, breakdown_size_type, opt_bytes, siz, sizeof siz);
+		printf("%*s %s\n", max_size_len, siz, list[i].label);
+	}
+}
+
+
+static void ls_users(struct duc *duc, const char *path, duc_dir *dir)
+{
+	size_t count, i;
+	struct duc_user *users = duc_dir_get_users(dir, &count);
+
+	if(users == NULL) {
+		duc_log(duc, DUC_LOG_FTL, "No usage per user found for '%s',", path);
+		duc_log(duc, DUC_LOG_FTL, "Please index with 'duc index --users' to record it.");
+		exit(1);
+	}
+
+	struct breakdown *list = malloc(count * sizeof(*list) + 1);
+	for(i=0; i<count; i++) {
+		struct passwd *pw = getpwuid(users[i].uid);
+		if(pw) {
+			snprintf(list[i].label, sizeof(list[i].label), "%s", pw->pw_name);
+		} else {
+			snprintf(list[i].label, sizeof(list[i].label), "%ju", (uintmax_t)users[i].uid);
+		}
+		list[i].size = users[i].size;
+	}
+
+	ls_breakdown(list, count);
+
+	free(list);
+	duc_users_free(users);
+}
+
+
+static void ls_exts(struct duc *duc, const char *path, duc_dir *dir)
+{
+	size_t count, i;
+	struct duc_ext *exts = duc_dir_get_exts(dir, &count);
+
+	if(exts == NULL) {
+		duc_log(duc, DUC_LOG_FTL, "No usage per extension found for '%s',", path);
+		duc_log(duc, DUC_LOG_FTL, "Please index with 'duc index --extensions' to record it.");
+		exit(1);
+	}
+
+	struct breakdown *list = malloc(count * sizeof(*list) + 1);
+	for(i=0; i<count; i++) {
+		const char *name = exts[i].name;
+		if(strcmp(name, "") == 0) {
+			snprintf(list[i].label, sizeof(list[i].label), "(none)");
+		} else if(strcmp(name, "*") == 0) {
+			snprintf(list[i].label, sizeof(list[i].label), "(other)");
+		} else {
+			snprintf(list[i].label, sizeof(list[i].label), ".%s", name);
+		}
+		list[i].size = exts[i].size;
+	}
+
+	ls_breakdown(list, count);
+
+	free(list);
+	duc_exts_free(exts);
+}
+
+
+/*
+ * Size of the files below a directory older than the cutoff time, from its
+ * age histogram. Buckets reaching past the cutoff are not counted. Returns -1
+ * if the directory has no age histogram
+ */
+
+static int cold_size(duc_dir *dir, time_t cutoff, struct duc_size *size)
+{
+	size_t count, i;
+	struct duc_age *ages = duc_dir_get_ages(dir, opt_atime ? DUC_AGE_ATIME : DUC_AGE_MTIME, &count);
+
+	if(ages == NULL) return -1;
+
+	memset(size, 0, sizeof *size);
+	for(i=0; i<count; i++) {
+		if(ages[i].time_max <= cutoff) {
+			size->actual += ages[i].size.actual;
+			size->apparent += ages[i].size.apparent;
+			size->count += ages[i].size.count;
+		}
+	}
+
+	duc_ages_free(ages);
+	return 0;
+}
+
+
+/*
+ * Parse the --older-than argument, an age like '180d' with unit h, d, w or y
+ */
+
+static int parse_age(const char *s, time_t *age)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	if(end == s || n < 0 || end[0] == '\0' || end[1] != '\0') return -1;
+
+	long unit = 0;
+	if(end[0] == 'h') unit = 3600;
+	if(end[0] == 'd') unit = 24 * 3600;
+	if(end[0] == 'w') unit = 7 * 24 * 3600;
+	if(end[0] == 'y') unit = 365 * 24 * 3600;
+	if(unit == 0) return -1;
+
+	*age = n * unit;
+	return 0;
+}
+
+
+static void ls_older_than(struct duc *duc, const char *path, duc_dir *dir)
+{
+	time_t age;
+	if(parse_age(opt_older_than, &age) != 0) {
+		duc_log(duc, DUC_LOG_FTL, "Invalid age '%s' for --older-than, use a number of hours, days, weeks or years like '180d'", opt_older_than);
+		exit(1);
+	}
+	time_t cutoff = time(NULL) - age;
+
+	struct duc_size files;
+	if(cold_size(dir, cutoff, &files) != 0) {
+		duc_log(duc, DUC_LOG_FTL, "No file ages found for '%s',", path);
+		duc_log(duc, DUC_LOG_FTL, "Please index with 'duc index --ages' to record them.");
+		exit(1);
+	}
+
+	/* List the subdirectories holding old files, the files in the directory
+	 * itself are what remains after subtracting those */
+
+	size_t max = duc_dir_get_count(dir) + 1;
+	struct breakdown *list = malloc(max * sizeof(*list));
+	size_t count = 0;
+
+	struct duc_dirent *e;
+	while( (e = duc_dir_read(dir, DUC_SIZE_TYPE_ACTUAL, DUC_SORT_NAME)) != NULL) {
+		if(e->type != DUC_FILE_TYPE_DIR) continue;
+		duc_dir *sub = duc_dir_openent(dir, e);
+		if(sub == NULL) continue;
+		struct duc_size size;
+		if(cold_size(sub, cutoff, &size) == 0 && size.count > 0) {
+			snprintf(list[count].label, sizeof(list[count].label), "%s/", e->name);
+			list[count].size = size;
+			files.actual -= size.actual;
+			files.apparent -= size.apparent;
+			files.count -= size.count;
+			count ++;
+		}
+		duc_dir_close(sub);
+	}
+
+	if(files.count > 0) {
+		snprintf(list[count].label, sizeof(list[count].label), "(files)");
+		list[count].size = files;
+		count ++;
+	}
+
+	ls_breakdown(list, count);
+
+	free(list);
+}
+
+
 static void do_one(struct duc *duc, const char *path)
 {
 	duc_dir *dir = duc_dir_open(duc, path);
@@ -253,7 +461,13 @@ static void do_one(struct duc *duc, const char *path)
 		exit(1);
 	}
 
-	if(opt_directory) {
+	if(opt_by_user) {
+		ls_users(duc, path, dir);
+	} else if(opt_by_ext) {
+		ls_exts(duc, path, dir);
+	} else if(opt_older_than) {
+		ls_older_than(duc, path, dir);
+	} else if(opt_directory) {
 		ls_dir_only(path, dir);
 	} else {
 		ls_one(dir, 0, 0);
@@ -317,7 +531,10 @@ static int ls_main(duc *duc, int argc, char **argv)
 static struct ducrc_option options[] = {
 	{ &opt_apparent,  "apparent",  'a', DUCRC_TYPE_BOOL,   "show apparent instead of actual file size" },
 	{ &opt_ascii,     "ascii",      0,  DUCRC_TYPE_BOOL,   "use ASCII characters instead of UTF-8 to draw tree" },
+	{ &opt_atime,     "atime",      0,  DUCRC_TYPE_BOOL,   "use access instead of modification time for --older-than" },
 	{ &opt_bytes,     "bytes",     'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_by_ext,    "by-ext",     0,  DUCRC_TYPE_BOOL,   "show usage per file name extension instead of the directory contents" },
+	{ &opt_by_user,   "by-user",    0,  DUCRC_TYPE_BOOL,   "show usage per user instead of the directory contents" },
 	{ &opt_classify,  "classify",  'F', DUCRC_TYPE_BOOL,   "append file type indicator (one of */) to entries" },
 	{ &opt_color,     "color",     'c', DUCRC_TYPE_BOOL,   "colorize output (only on ttys)" },
 	{ &opt_count,     "count",      0,  DUCRC_TYPE_BOOL,   "show number of files instead of file size" },
@@ -328,6 +545,10 @@ static struct ducrc_option options[] = {
 	{ &opt_graph,     "graph",     'g', DUCRC_TYPE_BOOL,   "draw graph with relative size for each entry" },
 	{ &opt_levels,    "levels",    'l', DUCRC_TYPE_INT,    "traverse up to ARG levels deep [4]" },
 	{ &opt_name_sort, "name-sort", 'n', DUCRC_TYPE_BOOL,   "sort output by name instead of by size" },
+	{ &opt_older_than,"older-than", 0,  DUCRC_TYPE_STRING, "show only files older than VAL, per subdirectory",
+	  "VAL is an age like '12h', '180d', '4w' or '2y'. This requires the database to be created with "
+	  "'duc index --ages'. File ages are recorded in buckets of about 19%, files in the bucket holding "
+	  "the cutoff age are not counted" },
 	{ &opt_recursive, "recursive", 'R', DUCRC_TYPE_BOOL,   "recursively list subdirectories" },
 	{ NULL }
 };
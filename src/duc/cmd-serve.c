@@ -0,0 +1,1109 @@
+#include "config.h"
+
+#ifdef ENABLE_SERVE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "private.h"
+#include "cmd.h"
+#include "duc.h"
+#include "cgi.h"
+#include "render-cache.h"
+
+/*
+ * Built-in HTTP/1.1 and FastCGI server, serving the same pages as 'duc cgi'.
+ * The main thread accepts connections and watches idle keep-alive connections
+ * with poll(). It also reads the requests without blocking, and only hands
+ * connections holding a complete request to a pool of worker threads, so a
+ * slow client never keeps a worker waiting. The database is opened once for
+ * the lifetime of the server, and the workers read through handles sharing
+ * it, see duc_share(). After a request is handled the connection is passed
+ * back to the main thread, so idle clients never occupy a worker.
+ */
+
+#define CONN_BUF_SIZE 8192
+#define CONN_BUF_MAX_FCGI (512 * 1024)
+#define REQUEST_TIMEOUT 10
+#define KEEPALIVE_TIMEOUT 30
+
+struct conn {
+	int fd;
+	char *buf;
+	size_t len;
+	size_t size;
+	time_t t_deadline;        /* Closed when no complete request is read by then */
+	struct conn *next;
+};
+
+struct server {
+	int fd_listen;
+	int fd_wake[2];
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct conn *queue;
+	struct conn *queue_tail;
+	struct conn *returned;
+	duc_dircache *cache;
+	uint64_t db_signature;
+	int fastcgi;
+	int stop;
+};
+
+static char *opt_address = "127.0.0.1";
+static bool opt_fastcgi = false;
+static int opt_port = 8080;
+
+static volatile sig_atomic_t got_signal = 0;
+
+
+static void on_signal(int sig)
+{
+	got_signal = 1;
+}
+
+
+static struct conn *conn_new(int fd)
+{
+	struct conn *c = duc_malloc0(sizeof *c);
+	c->fd = fd;
+	c->size = CONN_BUF_SIZE;
+	c->buf = duc_malloc(c->size);
+	c->t_deadline = time(NULL) + REQUEST_TIMEOUT;
+	return c;
+}
+
+
+static void conn_close(struct conn *c)
+{
+	close(c->fd);
+	duc_free(c->buf);
+	duc_free(c);
+}
+
+
+/*
+ * Remove len bytes from the start of the connection buffer
+ */
+
+static void conn_consume(struct conn *c, size_t len)
+{
+	memmove(c->buf, c->buf + len, c->len - len);
+	c->len -= len;
+	c->buf[c->len] = '\0';
+}
+
+
+/*
+ * Queue of connections with pending data, consumed by the workers
+ */
+
+static void queue_push(struct server *srv, struct conn *c)
+{
+	pthread_mutex_lock(&srv->mutex);
+	c->next = NULL;
+	if(srv->queue_tail) {
+		srv->queue_tail->next = c;
+	} else {
+		srv->queue = c;
+	}
+	srv->queue_tail = c;
+	pthread_cond_signal(&srv->cond);
+	pthread_mutex_unlock(&srv->mutex);
+}
+
+
+static struct conn *queue_pop(struct server *srv)
+{
+	struct conn *c = NULL;
+
+	pthread_mutex_lock(&srv->mutex);
+	while(!srv->stop && srv->queue == NULL) {
+		pthread_cond_wait(&srv->cond, &srv->mutex);
+	}
+	if(srv->queue) {
+		c = srv->queue;
+		srv->queue = c->next;
+		if(srv->queue == NULL) srv->queue_tail = NULL;
+	}
+	pthread_mutex_unlock(&srv->mutex);
+
+	return c;
+}
+
+
+/*
+ * Hand a keep-alive connection back to the main thread
+ */
+
+static void conn_return(struct server *srv, struct conn *c)
+{
+	pthread_mutex_lock(&srv->mutex);
+	c->next = srv->returned;
+	srv->returned = c;
+	pthread_mutex_unlock(&srv->mutex);
+
+	char b = 0;
+	if(write(srv->fd_wake[1], &b, 1) == -1) {
+		/* Pipe full, the main thread will wake up anyway */
+	}
+}
+
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+	while(len > 0) {
+		ssize_t r = send(fd, buf, len, MSG_NOSIGNAL);
+		if(r == -1) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		buf += r;
+		len -= r;
+	}
+	return 0;
+}
+
+
+static void send_error(int fd, const char *status)
+{
+	char buf[256];
+	int l = snprintf(buf, sizeof(buf),
+			"HTTP/1.1 %s\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n"
+			"\r\n"
+			"%s\n", status, strlen(status) + 1, status);
+	send_all(fd, buf, l);
+}
+
+
+/*
+ * Find a complete request header in the connection buffer. Returns the length
+ * of the header, 0 if the header is not complete yet, or -1 if the header
+ * does not fit in the buffer
+ */
+
+static ssize_t http_request_len(struct conn *c)
+{
+	c->buf[c->len] = '\0';
+	char *p = strstr(c->buf, "\r\n\r\n");
+	if(p) return p - c->buf + 4;
+	if(c->len >= c->size - 1) return -1;
+	return 0;
+}
+
+
+/*
+ * Translate the CGI style headers written by cgi_handle() into a HTTP
+ * response and send it. Returns 0 on success
+ */
+
+static int send_response(int fd, char *resp, size_t resp_len, int head_only, int keep_alive)
+{
+	char *body = strstr(resp, "\n\n");
+	char *hdr_end = body;
+	if(body) {
+		body += 2;
+	} else {
+		body = resp + resp_len;
+		hdr_end = body;
+	}
+	size_t body_len = resp + resp_len - body;
+
+	char *hdr = NULL;
+	size_t hdr_len = 0;
+	FILE *f = open_memstream(&hdr, &hdr_len);
+	if(f == NULL) return -1;
+
+	const char *status = "200 OK";
+	char status_buf[64];
+
+	char *p = resp;
+	while(p < hdr_end) {
+		char *e = memchr(p, '\n', hdr_end - p);
+		if(e == NULL) e = hdr_end;
+		int l = e - p;
+		if(l > 7 && strncasecmp(p, "Status:", 7) == 0) {
+			snprintf(status_buf, sizeof(status_buf), "%.*s", l - 8, p + 8);
+			status = status_buf;
+		} else if(l > 0 && strncasecmp(p, "Connection:", 11) != 0) {
+			fprintf(f, "%.*s\r\n", l, p);
+		}
+		p = e + 1;
+	}
+
+	if(strncmp(status, "304", 3) != 0) {
+		fprintf(f, "Content-Length: %zu\r\n", body_len);
+	}
+	fprintf(f, "Connection: %s\r\n", keep_alive ? "keep-alive" : "close");
+	fprintf(f, "\r\n");
+	fclose(f);
+
+	char line[96];
+	int l = snprintf(line, sizeof(line), "HTTP/1.1 %s\r\n", status);
+
+	int r = send_all(fd, line, l);
+	if(r == 0) r = send_all(fd, hdr, hdr_len);
+	if(r == 0 && !head_only) r = send_all(fd, body, body_len);
+
+	free(hdr);
+	return r;
+}
+
+
+/*
+ * Handle one request from the connection buffer. Returns 1 if the connection
+ * can be kept open for the next request
+ */
+
+static int handle_request(duc *duc, struct conn *c, size_t req_len)
+{
+	char *req = c->buf;
+	req[req_len - 2] = '\0';
+
+	/* Request line: method, target and protocol version */
+
+	char *eol = strstr(req, "\r\n");
+	*eol = '\0';
+	char *headers = eol + 2;
+
+	char *method = req;
+	char *target = strchr(method, ' ');
+	if(target == NULL) {
+		send_error(c->fd, "400 Bad Request");
+		return 0;
+	}
+	*target++ = '\0';
+	char *version = strchr(target, ' ');
+	if(version == NULL) {
+		send_error(c->fd, "400 Bad Request");
+		return 0;
+	}
+	*version++ = '\0';
+
+	int keep_alive = strcmp(version, "HTTP/1.1") == 0;
+	int has_body = 0;
+	char *if_none_match = NULL;
+
+	char *h = headers;
+	while(*h) {
+		char *e = strstr(h, "\r\n");
+		if(e) *e = '\0';
+		if(strncasecmp(h, "Connection:", 11) == 0) {
+			char *v = h + 11;
+			while(*v == ' ') v++;
+			if(strcasecmp(v, "close") == 0) keep_alive = 0;
+			if(strcasecmp(v, "keep-alive") == 0) keep_alive = 1;
+		}
+		if(strncasecmp(h, "Content-Length:", 15) == 0 && atoi(h + 15) > 0) has_body = 1;
+		if(strncasecmp(h, "Transfer-Encoding:", 18) == 0) has_body = 1;
+		if(strncasecmp(h, "If-None-Match:", 14) == 0) {
+			if_none_match = h + 14;
+			while(*if_none_match == ' ') if_none_match++;
+		}
+		if(e == NULL) break;
+		h = e + 2;
+	}
+
+	int head_only = strcmp(method, "HEAD") == 0;
+
+	if((strcmp(method, "GET") != 0 && !head_only) || has_body) {
+		send_error(c->fd, "405 Method Not Allowed");
+		return 0;
+	}
+
+	char *query = strchr(target, '?');
+	if(query) *query++ = '\0';
+
+	/* Run the page handler shared with 'duc cgi' into a memory buffer */
+
+	char *resp = NULL;
+	size_t resp_len = 0;
+	FILE *f = open_memstream(&resp, &resp_len);
+	if(f == NULL) {
+		send_error(c->fd, "500 Internal Server Error");
+		return 0;
+	}
+
+	/* Every target is answered with the same pages, the links in them point
+	 * to the root instead of echoing the target back to the client */
+
+	struct cgi cgi = {
+		.param_list = NULL,
+		.script = "/",
+		.if_none_match = if_none_match,
+		.out = f,
+	};
+
+	cgi_parse(&cgi, query);
+	cgi_handle(&cgi, duc);
+	cgi_free(&cgi);
+	fclose(f);
+
+	int r = send_response(c->fd, resp, resp_len, head_only, keep_alive);
+	free(resp);
+
+	return r == 0 && keep_alive;
+}
+
+
+/*
+ * Handle all complete HTTP requests in the connection buffer, a client may
+ * pipeline several requests on one connection. Returns 1 if the connection
+ * should be kept open
+ */
+
+static int http_handle_conn(duc *duc, struct conn *c)
+{
+	int keep = 1;
+
+	while(keep) {
+		ssize_t req_len = http_request_len(c);
+		if(req_len == -1) {
+			send_error(c->fd, "431 Request Header Fields Too Large");
+			return 0;
+		}
+		if(req_len == 0) break;
+
+		keep = handle_request(duc, c, req_len);
+		conn_consume(c, req_len);
+	}
+
+	return keep;
+}
+
+
+/*
+ * FastCGI responder. Requests are not multiplexed: one connection carries
+ * one request at a time, and is kept open for the next request only when
+ * the web server sets FCGI_KEEP_CONN.
+ */
+
+#define FCGI_VERSION_1          1
+
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_GET_VALUES         9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_UNKNOWN_TYPE      11
+
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+
+#define FCGI_REQUEST_COMPLETE   0
+#define FCGI_UNKNOWN_ROLE       3
+
+#define FCGI_MAX_CONTENT    65535
+
+
+/*
+ * Check if the connection buffer holds a complete request, or a management
+ * record, which can be answered without reading from the connection
+ */
+
+static int fcgi_request_complete(struct conn *c)
+{
+	const uint8_t *p = (uint8_t *)c->buf;
+	size_t off = 0;
+
+	while(off + 8 <= c->len) {
+		const uint8_t *hdr = p + off;
+		int type = hdr[1];
+		int rid = (hdr[2] << 8) | hdr[3];
+		size_t len = (hdr[4] << 8) | hdr[5];
+		size_t rec_len = 8 + len + hdr[6];
+
+		if(off + rec_len > c->len) return 0;
+		if(rid == 0 || type == FCGI_ABORT_REQUEST) return 1;
+		if(type == FCGI_STDIN && len == 0) return 1;
+		if(type == FCGI_BEGIN_REQUEST && len >= 8 && ((hdr[8] << 8) | hdr[9]) != FCGI_RESPONDER) return 1;
+		off += rec_len;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Take the next len bytes from the connection buffer, which was checked to
+ * hold a complete request by fcgi_request_complete()
+ */
+
+static int conn_take(struct conn *c, void *buf, size_t len)
+{
+	if(len > c->len) return -1;
+	memcpy(buf, c->buf, len);
+	conn_consume(c, len);
+	return 0;
+}
+
+
+static void fcgi_put_record(FILE *f, int type, int id, const void *data, size_t len)
+{
+	uint8_t hdr[8] = {
+		FCGI_VERSION_1, type, id >> 8, id & 0xff, len >> 8, len & 0xff, 0, 0
+	};
+	fwrite(hdr, 1, sizeof(hdr), f);
+	if(len > 0) fwrite(data, 1, len, f);
+}
+
+
+static void fcgi_put_stream(FILE *f, int type, int id, const char *data, size_t len)
+{
+	while(len > 0) {
+		size_t n = len < FCGI_MAX_CONTENT ? len : FCGI_MAX_CONTENT;
+		fcgi_put_record(f, type, id, data, n);
+		data += n;
+		len -= n;
+	}
+	fcgi_put_record(f, type, id, NULL, 0);
+}
+
+
+static void fcgi_put_end(FILE *f, int id, int status)
+{
+	uint8_t body[8] = { 0, 0, 0, 0, status, 0, 0, 0 };
+	fcgi_put_record(f, FCGI_END_REQUEST, id, body, sizeof(body));
+}
+
+
+static void fcgi_put_pair(FILE *f, const char *name, const char *val)
+{
+	fputc(strlen(name), f);
+	fputc(strlen(val), f);
+	fputs(name, f);
+	fputs(val, f);
+}
+
+
+static size_t fcgi_get_len(const uint8_t **p, const uint8_t *end)
+{
+	if(*p >= end) return 0;
+	if(**p & 0x80) {
+		if(end - *p < 4) {
+			*p = end;
+			return 0;
+		}
+		size_t l = ((size_t)((*p)[0] & 0x7f) << 24) | ((*p)[1] << 16) | ((*p)[2] << 8) | (*p)[3];
+		*p += 4;
+		return l;
+	}
+	return *(*p)++;
+}
+
+
+/*
+ * Find a parameter in the encoded name-value pairs of a request. Returns a
+ * copy of the value, or NULL if not found
+ */
+
+static char *fcgi_get_param(const uint8_t *params, size_t len, const char *name)
+{
+	const uint8_t *p = params;
+	const uint8_t *end = params + len;
+
+	while(p < end) {
+		size_t nl = fcgi_get_len(&p, end);
+		size_t vl = fcgi_get_len(&p, end);
+		if(nl + vl > (size_t)(end - p)) break;
+		if(nl == strlen(name) && memcmp(p, name, nl) == 0) {
+			char *val = duc_malloc(vl + 1);
+			memcpy(val, p + nl, vl);
+			val[vl] = '\0';
+			return val;
+		}
+		p += nl + vl;
+	}
+
+	return NULL;
+}
+
+
+static int fcgi_respond(duc *duc, int fd, int id, const uint8_t *params, size_t params_len)
+{
+	char *query = fcgi_get_param(params, params_len, "QUERY_STRING");
+	char *script = fcgi_get_param(params, params_len, "SCRIPT_NAME");
+	char *if_none_match = fcgi_get_param(params, params_len, "HTTP_IF_NONE_MATCH");
+
+	char *resp = NULL;
+	size_t resp_len = 0;
+	FILE *f = open_memstream(&resp, &resp_len);
+	if(f == NULL) return -1;
+
+	struct cgi cgi = {
+		.param_list = NULL,
+		.script = script ? script : "",
+		.if_none_match = if_none_match,
+		.out = f,
+	};
+
+	cgi_parse(&cgi, query);
+	cgi_handle(&cgi, duc);
+	cgi_free(&cgi);
+	fclose(f);
+
+	/* Wrap the page in FCGI_STDOUT records and send it in one go */
+
+	char *out = NULL;
+	size_t out_len = 0;
+	f = open_memstream(&out, &out_len);
+	if(f == NULL) {
+		free(resp);
+		return -1;
+	}
+	fcgi_put_stream(f, FCGI_STDOUT, id, resp, resp_len);
+	fcgi_put_end(f, id, FCGI_REQUEST_COMPLETE);
+	fclose(f);
+
+	int r = send_all(fd, out, out_len);
+
+	free(out);
+	free(resp);
+	duc_free(query);
+	duc_free(script);
+	duc_free(if_none_match);
+
+	return r;
+}
+
+
+/*
+ * Read records until a complete request is received and answer it. Returns 1
+ * if the connection should be kept open
+ */
+
+static int fcgi_handle_conn(duc *duc, struct conn *c)
+{
+	uint8_t *content = duc_malloc(FCGI_MAX_CONTENT + 256);
+	uint8_t *params = NULL;
+	size_t params_len = 0;
+	int id = -1;
+	int keep_conn = 0;
+	int params_done = 0;
+	int r = 0;
+
+	for(;;) {
+		uint8_t hdr[8];
+
+		/* Wait in the main thread for the rest of the next request */
+
+		if(id == -1 && !fcgi_request_complete(c)) {
+			r = 1;
+			break;
+		}
+		if(conn_take(c, hdr, sizeof(hdr)) == -1) break;
+
+		int type = hdr[1];
+		int rid = (hdr[2] << 8) | hdr[3];
+		size_t len = (hdr[4] << 8) | hdr[5];
+		size_t padding = hdr[6];
+
+		if(hdr[0] != FCGI_VERSION_1) break;
+		if(conn_take(c, content, len + padding) == -1) break;
+
+		/* Management records */
+
+		if(rid == 0) {
+			char *out = NULL;
+			size_t out_len = 0;
+			FILE *f = open_memstream(&out, &out_len);
+			if(f == NULL) break;
+
+			if(type == FCGI_GET_VALUES) {
+				char *body = NULL;
+				size_t body_len = 0;
+				FILE *fb = open_memstream(&body, &body_len);
+				if(fb) {
+					char max[16];
+					snprintf(max, sizeof(max), "%d", cgi_threads());
+					fcgi_put_pair(fb, "FCGI_MAX_CONNS", max);
+					fcgi_put_pair(fb, "FCGI_MAX_REQS", max);
+					fcgi_put_pair(fb, "FCGI_MPXS_CONNS", "0");
+					fclose(fb);
+					fcgi_put_record(f, FCGI_GET_VALUES_RESULT, 0, body, body_len);
+					free(body);
+				}
+			} else {
+				uint8_t body[8] = { type };
+				fcgi_put_record(f, FCGI_UNKNOWN_TYPE, 0, body, sizeof(body));
+			}
+
+			fclose(f);
+			int rs = send_all(c->fd, out, out_len);
+			free(out);
+			if(rs == -1) break;
+			continue;
+		}
+
+		if(type == FCGI_BEGIN_REQUEST && len >= 8) {
+			int role = (content[0] << 8) | content[1];
+			keep_conn = content[2] & FCGI_KEEP_CONN;
+			if(role != FCGI_RESPONDER) {
+				uint8_t body[8] = { 0, 0, 0, 0, FCGI_UNKNOWN_ROLE, 0, 0, 0 };
+				uint8_t rec[16] = { FCGI_VERSION_1, FCGI_END_REQUEST, rid >> 8, rid & 0xff, 0, 8, 0, 0 };
+				memcpy(rec + 8, body, sizeof(body));
+				if(send_all(c->fd, (char *)rec, sizeof(rec)) == -1 || !keep_conn) break;
+				continue;
+			}
+			id = rid;
+			params_len = 0;
+			params_done = 0;
+			continue;
+		}
+
+		if(rid != id) continue;
+
+		if(type == FCGI_ABORT_REQUEST) {
+			char *out = NULL;
+			size_t out_len = 0;
+			FILE *f = open_memstream(&out, &out_len);
+			if(f == NULL) break;
+			fcgi_put_end(f, id, FCGI_REQUEST_COMPLETE);
+			fclose(f);
+			send_all(c->fd, out, out_len);
+			free(out);
+			r = keep_conn;
+			break;
+		}
+
+		if(type == FCGI_PARAMS) {
+			if(len == 0) {
+				params_done = 1;
+			} else {
+				params = duc_realloc(params, params_len + len);
+				memcpy(params + params_len, content, len);
+				params_len += len;
+			}
+			continue;
+		}
+
+		/* The request body is not used, the request is complete at the
+		 * end of the FCGI_STDIN stream */
+
+		if(type == FCGI_STDIN && len == 0 && params_done) {
+			r = fcgi_respond(duc, c->fd, id, params, params_len) == 0 && keep_conn;
+			break;
+		}
+	}
+
+	duc_free(params);
+	duc_free(content);
+	return r;
+}
+
+
+/*
+ * Empty the shared directory cache if the database was changed since the
+ * last request
+ */
+
+static void check_cache(struct server *srv, duc *duc)
+{
+	uint64_t sig = render_db_signature(duc, NULL);
+
+	pthread_mutex_lock(&srv->mutex);
+	int changed = sig != srv->db_signature;
+	srv->db_signature = sig;
+	pthread_mutex_unlock(&srv->mutex);
+
+	if(changed) duc_dircache_purge(srv->cache);
+}
+
+
+static int conn_complete(struct server *srv, struct conn *c)
+{
+	if(srv->fastcgi) return fcgi_request_complete(c);
+	return http_request_len(c) != 0;
+}
+
+
+/*
+ * Read the data the client has sent so far without blocking. Returns 1 when
+ * the buffer holds a complete request, or a HTTP header too large to fit, 0
+ * if more data is needed, and -1 if the connection should be closed
+ */
+
+static int conn_fill(struct server *srv, struct conn *c)
+{
+	for(;;) {
+		if(c->len >= c->size - 1) {
+			if(!srv->fastcgi) return 1;
+			if(c->size >= CONN_BUF_MAX_FCGI) return -1;
+			c->size *= 2;
+			c->buf = duc_realloc(c->buf, c->size);
+		}
+
+		ssize_t r = recv(c->fd, c->buf + c->len, c->size - c->len - 1, MSG_DONTWAIT);
+		if(r == -1 && errno == EINTR) continue;
+		if(r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if(r <= 0) return -1;
+
+		if(c->len == 0) {
+			time_t t = time(NULL) + REQUEST_TIMEOUT;
+			if(t < c->t_deadline) c->t_deadline = t;
+		}
+		c->len += r;
+	}
+
+	return conn_complete(srv, c);
+}
+
+
+struct worker {
+	struct server *srv;
+	duc *duc;
+	pthread_t thread;
+};
+
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	struct server *srv = w->srv;
+	duc *duc = w->duc;
+
+	struct conn *c;
+
+	while((c = queue_pop(srv)) != NULL) {
+
+		int keep;
+
+		check_cache(srv, duc);
+
+		if(srv->fastcgi) {
+			keep = fcgi_handle_conn(duc, c);
+		} else {
+			keep = http_handle_conn(duc, c);
+		}
+
+		if(keep) {
+			conn_return(srv, c);
+		} else {
+			conn_close(c);
+		}
+	}
+
+	duc_close(duc);
+	duc_del(duc);
+
+	return NULL;
+}
+
+
+/*
+ * Open a listening socket on the given TCP address and port, or on a unix
+ * domain socket if the address is an absolute path
+ */
+
+static int open_listen_socket(const char *address, int port)
+{
+	if(address[0] == '/') {
+		struct sockaddr_un sa = { .sun_family = AF_UNIX };
+		if(strlen(address) >= sizeof(sa.sun_path)) {
+			duc_log(NULL, DUC_LOG_FTL, "Socket path %s too long", address);
+			return -1;
+		}
+		strcpy(sa.sun_path, address);
+		unlink(address);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd == -1 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || listen(fd, 128) == -1) {
+			duc_log(NULL, DUC_LOG_FTL, "Error listening on %s: %s", address, strerror(errno));
+			if(fd != -1) close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	struct addrinfo hints = { 0 };
+	struct addrinfo *res, *ai;
+	char service[16];
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	snprintf(service, sizeof(service), "%d", port);
+
+	int r = getaddrinfo(address, service, &hints, &res);
+	if(r != 0) {
+		duc_log(NULL, DUC_LOG_FTL, "Error resolving %s: %s", address, gai_strerror(r));
+		return -1;
+	}
+
+	int fd = -1;
+
+	for(ai=res; ai; ai=ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd == -1) continue;
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 128) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+
+	if(fd == -1) {
+		duc_log(NULL, DUC_LOG_FTL, "Error listening on %s port %d: %s", address, port, strerror(errno));
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+
+/*
+ * Run the server on the given listening socket until SIGINT or SIGTERM
+ */
+
+int server_run(duc *duc, int fd_listen, int fastcgi)
+{
+	struct server srv = { 0 };
+	srv.fd_listen = fd_listen;
+	srv.fastcgi = fastcgi;
+	srv.cache = duc_dircache_new(cgi_cache_size());
+
+	/* Open the database before starting any threads, the workers share this
+	 * handle. Few backends allow the same database to be opened twice */
+
+	duc_set_dircache(duc, srv.cache);
+
+	int r = duc_open(duc, cgi_database(), DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		duc_dircache_free(srv.cache);
+		return -1;
+	}
+
+	int nthreads = cgi_threads();
+	if(nthreads < 1) nthreads = 1;
+
+	if(pipe(srv.fd_wake) == -1) {
+		duc_log(duc, DUC_LOG_FTL, "Error creating pipe: %s", strerror(errno));
+		duc_close(duc);
+		duc_dircache_free(srv.cache);
+		return -1;
+	}
+	fcntl(srv.fd_wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(srv.fd_wake[1], F_SETFL, O_NONBLOCK);
+
+	pthread_mutex_init(&srv.mutex, NULL);
+	pthread_cond_init(&srv.cond, NULL);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	/* Every worker reads through a handle of its own sharing the database,
+	 * these are made here before any of them runs */
+
+	struct worker *workers = duc_malloc(nthreads * sizeof(*workers));
+	int i;
+	for(i=0; i<nthreads; i++) {
+		workers[i].srv = &srv;
+		workers[i].duc = duc_share(duc);
+	}
+	for(i=0; i<nthreads; i++) {
+		pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+	}
+
+	/* Connections waiting for a complete request */
+
+	struct conn *idle = NULL;
+	size_t nidle = 0;
+	struct pollfd *fds = NULL;
+	struct conn **fd_conn = NULL;
+	size_t fds_max = 0;
+
+	while(!got_signal) {
+
+		/* Take back connections returned by the workers */
+
+		pthread_mutex_lock(&srv.mutex);
+		struct conn *c = srv.returned;
+		srv.returned = NULL;
+		pthread_mutex_unlock(&srv.mutex);
+
+		time_t now = time(NULL);
+
+		while(c) {
+			struct conn *next = c->next;
+			if(conn_complete(&srv, c)) {
+				queue_push(&srv, c);
+			} else {
+				c->t_deadline = now + (c->len ? REQUEST_TIMEOUT : KEEPALIVE_TIMEOUT);
+				c->next = idle;
+				idle = c;
+				nidle ++;
+			}
+			c = next;
+		}
+
+		if(nidle + 2 > fds_max) {
+			fds_max = (nidle + 2) * 2;
+			fds = duc_realloc(fds, fds_max * sizeof(*fds));
+			fd_conn = duc_realloc(fd_conn, fds_max * sizeof(*fd_conn));
+		}
+
+		size_t n = 0;
+		fds[n].fd = srv.fd_listen; fds[n].events = POLLIN; fd_conn[n++] = NULL;
+		fds[n].fd = srv.fd_wake[0]; fds[n].events = POLLIN; fd_conn[n++] = NULL;
+		for(c=idle; c; c=c->next) {
+			fds[n].fd = c->fd;
+			fds[n].events = POLLIN;
+			fd_conn[n++] = c;
+		}
+
+		r = poll(fds, n, 1000);
+		if(r == -1) {
+			if(errno == EINTR) continue;
+			duc_log(duc, DUC_LOG_FTL, "poll(): %s", strerror(errno));
+			break;
+		}
+
+		if(fds[1].revents) {
+			char buf[64];
+			while(read(srv.fd_wake[0], buf, sizeof(buf)) > 0);
+		}
+
+		/* Read pending data, hand connections with a complete request to
+		 * the workers, and close connections which took too long */
+
+		now = time(NULL);
+		struct conn **pc = &idle;
+		size_t j = 2;
+		while(*pc) {
+			c = *pc;
+			while(fd_conn[j] != c) j++;
+			int ready = 0;
+			if(fds[j].revents) {
+				ready = conn_fill(&srv, c);
+			} else if(now > c->t_deadline) {
+				ready = -1;
+			}
+			if(ready) {
+				*pc = c->next;
+				nidle --;
+				if(ready == 1) {
+					queue_push(&srv, c);
+				} else {
+					conn_close(c);
+				}
+			} else {
+				pc = &c->next;
+			}
+		}
+
+		if(fds[0].revents & POLLIN) {
+			int fd = accept(srv.fd_listen, NULL, NULL);
+			if(fd != -1) {
+				struct timeval tv = { REQUEST_TIMEOUT, 0 };
+				setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+				int on = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+				c = conn_new(fd);
+				c->next = idle;
+				idle = c;
+				nidle ++;
+			}
+		}
+	}
+
+	/* Shut down workers and close all connections */
+
+	pthread_mutex_lock(&srv.mutex);
+	srv.stop = 1;
+	pthread_cond_broadcast(&srv.cond);
+	pthread_mutex_unlock(&srv.mutex);
+
+	for(i=0; i<nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	duc_close(duc);
+
+	struct conn *c, *cn;
+	for(c=idle; c; c=cn) { cn = c->next; conn_close(c); }
+	for(c=srv.queue; c; c=cn) { cn = c->next; conn_close(c); }
+	for(c=srv.returned; c; c=cn) { cn = c->next; conn_close(c); }
+
+	close(srv.fd_listen);
+	close(srv.fd_wake[0]);
+	close(srv.fd_wake[1]);
+	pthread_mutex_destroy(&srv.mutex);
+	pthread_cond_destroy(&srv.cond);
+	duc_dircache_free(srv.cache);
+	duc_free(workers);
+	duc_free(fds);
+	duc_free(fd_conn);
+
+	return 0;
+}
+
+
+static int serve_main(duc *duc, int argc, char **argv)
+{
+	int fd = open_listen_socket(opt_address, opt_port);
+	if(fd == -1) return -1;
+
+	const char *proto = opt_fastcgi ? "FastCGI" : "HTTP";
+	if(opt_address[0] == '/') {
+		duc_log(duc, DUC_LOG_INF, "Serving %s on %s", proto, opt_address);
+	} else {
+		duc_log(duc, DUC_LOG_INF, "Serving %s on %s port %d", proto, opt_address, opt_port);
+	}
+
+	return server_run(duc, fd, opt_fastcgi);
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_address,   "address",    0,  DUCRC_TYPE_STRING, "listen on address ARG [127.0.0.1]",
+		"if the address is an absolute path, listen on a unix domain socket instead" },
+	{ &opt_fastcgi,   "fastcgi",    0,  DUCRC_TYPE_BOOL,   "speak FastCGI instead of HTTP",
+		"use this to run duc as a FastCGI application behind a web server like nginx or apache" },
+	{ &opt_port,      "port",      'p', DUCRC_TYPE_INT,    "listen on TCP port ARG [8080]" },
+	{ NULL }
+};
+
+struct cmd cmd_serve = {
+	.name = "serve",
+	.descr_short = "Built-in HTTP server",
+	.usage = "[options]",
+	.main = serve_main,
+	.options = options,
+	.options_inherit = cgi_options,
+	.descr_long =
+		"The 'serve' subcommand runs a multi-threaded HTTP/1.1 server which serves the\n"
+		"same pages as the 'cgi' subcommand, without the need for an external web\n"
+		"server. The database is opened once for the lifetime of the server and shared\n"
+		"by all worker threads. With --fastcgi the same server speaks the FastCGI protocol for\n"
+		"running behind a web server. All options of the 'cgi' subcommand can be used\n"
+		"as well.\n"
+};
+
+#endif
+
+/*
+ * End
+ */
@@ -0,0 +1,110 @@
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "duc.h"
+
+
+static bool opt_apparent = false;
+static bool opt_bytes = false;
+static bool opt_classify = false;
+static bool opt_count = false;
+static char *opt_database = NULL;
+static bool opt_dirs = false;
+static int opt_number = 20;
+
+
+static int top_main(duc *duc, int argc, char **argv)
+{
+	char *path = ".";
+	if(argc > 0) path = argv[0];
+
+	if(opt_number < 1) {
+		duc_log(duc, DUC_LOG_FTL, "The number of entries must be at least 1");
+		return -2;
+	}
+
+	int r = duc_open(duc, opt_database, DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		return -1;
+	}
+
+	duc_dir *dir = duc_dir_open(duc, path);
+	if(dir == NULL) {
+		if(duc_error(duc) == DUC_E_PATH_NOT_FOUND) {
+			duc_log(duc, DUC_LOG_FTL, "The requested path '%s' was not found in the database,", path);
+			duc_log(duc, DUC_LOG_FTL, "Please run 'duc info' for a list of available directories.");
+		} else {
+			duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		}
+		return -1;
+	}
+
+	duc_size_type st = opt_count ? DUC_SIZE_TYPE_COUNT :
+	                   opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
+
+	size_t count;
+	struct duc_dirent *list = duc_top(dir, st, opt_number, opt_dirs ? DUC_TOP_DIRS : DUC_TOP_FILES, &count);
+
+	/* Find the widest size for aligning the output */
+
+	size_t i;
+	int max_size_len = 0;
+	for(i=0; i<count; i++) {
+		char siz[32];
+		int l = duc_human_size(&list[i].size, st, opt_bytes, siz, sizeof siz);
+		if(l > max_size_len) max_size_len = l;
+	}
+
+	for(i=0; i<count; i++) {
+		char siz[32];
+		duc_human_size(&list[i].size, st, opt_bytes, siz, sizeof siz);
+		printf("%*s %s", max_size_len, siz, list[i].name);
+		if(opt_classify) {
+			putchar(duc_file_type_char(list[i].type));
+		}
+		putchar('\n');
+	}
+
+	duc_top_free(list, count);
+	duc_dir_close(dir);
+	duc_close(duc);
+
+	return 0;
+}
+
+
+static struct ducrc_option options[] = {
+	{ &opt_apparent,  "apparent",  'a', DUCRC_TYPE_BOOL,   "show apparent instead of actual file size" },
+	{ &opt_bytes,     "bytes",     'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
+	{ &opt_classify,  "classify",  'F', DUCRC_TYPE_BOOL,   "append file type indicator (one of */) to entries" },
+	{ &opt_count,     "count",      0,  DUCRC_TYPE_BOOL,   "show number of files instead of file size" },
+	{ &opt_database,  "database",  'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
+	{ &opt_dirs,      "dirs",       0,  DUCRC_TYPE_BOOL,   "list the largest directories instead of files" },
+	{ &opt_number,    "number",    'n', DUCRC_TYPE_INT,    "number of entries to list [20]" },
+	{ NULL }
+};
+
+
+struct cmd cmd_top = {
+	.name = "top",
+	.descr_short = "List largest files or directories",
+	.usage = "[options] [PATH]",
+	.main = top_main,
+	.options = options,
+	.descr_long =
+		"The 'top' subcommand lists the largest files anywhere below the given path,\n"
+		"largest first, with their full path. With --dirs the largest directories are\n"
+		"listed instead. Directories which are too small to hold any of the entries\n"
+		"found are not read from the database at all.\n"
+};
+
+
+/*
+ * End
+ */
+
@@ -12,77 +12,75 @@
 
 #include "cmd.h"
 #include "duc.h"
+#include "writer.h"
 	
 
 static bool opt_apparent = false;
 static char *opt_database = NULL;
 static double opt_min_size = 0;
 static bool opt_exclude_files = false;
+static int opt_threads = 1;
 
 
-static void indent(int n)
+static void indent(struct writer *w, int n)
 {
-	int i;
-	for(i=0; i<n; i++) {
-		putchar(' ');
+	static const char spaces[64] = "                                                                ";
+	while(n > 0) {
+		int l = n < (int)sizeof(spaces) ? n : (int)sizeof(spaces);
+		writer_put(w, spaces, l);
+		n -= l;
 	}
 }
 
 
-static void print_escaped(const char *s)
+static void put_size(struct writer *w, const char *key, off_t val)
 {
-	while(*s) {
-		switch(*s) {
-			case '<': printf("&lt;"); break;
-			case '>': printf("&gt;"); break;
-			case '&': printf("&amp;"); break;
-			case '"': printf("&quot;"); break;
-			case '\t': putchar('\t'); break;
-			case '\n': putchar('\n'); break;
-			case '\r': putchar('\r'); break;
-			default:
-				if(*s >= 0 && *s < 32) {
-					printf("#x%02x", *(uint8_t *)s);
-				} else {
-					putchar(*s); 
-				}
-				break;
-		}
-		s++;
-	}
+	writer_puts(w, key);
+	writer_put(w, "=\"", 2);
+	writer_put_int(w, val);
+	writer_put(w, "\"", 1);
 }
 
 
-static void dump(duc *duc, duc_dir *dir, int depth, off_t min_size, int ex_files)
+static int dump(struct duc_walk_ent *we, void *ptr)
 {
-	struct duc_dirent *e;
-
-	duc_size_type st = opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
-
-	while( (e = duc_dir_read(dir, DUC_SIZE_TYPE_ACTUAL, DUC_SORT_SIZE)) != NULL) {
-
-		off_t size = duc_get_size(&e->size, st);
-
-		if(e->type == DUC_FILE_TYPE_DIR && size>= min_size) {
-			duc_dir *dir_child = duc_dir_openent(dir, e);
-			if(dir_child) {
-				indent(depth);
-				printf("<ent type=\"dir\" name=\"");
-				print_escaped(e->name);
-				printf("\" size_apparent=\"%jd\" size_actual=\"%jd\" count=\"%jd\">\n", (intmax_t)e->size.apparent, (intmax_t)e->size.actual, (intmax_t)e->size.count);
-				dump(duc, dir_child, depth + 1, min_size, ex_files);
-				indent(depth);
-				printf("</ent>\n");
-			}
-		} else {
-			if(!ex_files && size >= min_size) {
-				indent(depth);
-				printf("<ent name=\"");
-				print_escaped(e->name);
-				printf("\" size_apparent=\"%jd\" size_actual=\"%jd\" />\n", (intmax_t)e->size.apparent, (intmax_t)e->size.actual);
-			}
-		}
+	struct writer *w = ptr;
+	const struct duc_dirent *e = we->ent;
+
+	/* The starting directory is written by xml_main() */
+
+	if(we->depth == 0) return 0;
+
+	switch(we->event) {
+
+		case DUC_WALK_DIR_ENTER:
+			indent(w, we->depth);
+			writer_puts(w, "<ent type=\"dir\" name=\"");
+			writer_put_xml(w, e->name);
+			writer_put(w, "\"", 1);
+			put_size(w, " size_apparent", e->size.apparent);
+			put_size(w, " size_actual", e->size.actual);
+			put_size(w, " count", e->size.count);
+			writer_put(w, ">\n", 2);
+			break;
+
+		case DUC_WALK_DIR_LEAVE:
+			indent(w, we->depth);
+			writer_puts(w, "</ent>\n");
+			break;
+
+		case DUC_WALK_ENTRY:
+			indent(w, we->depth);
+			writer_puts(w, "<ent name=\"");
+			writer_put_xml(w, e->name);
+			writer_put(w, "\"", 1);
+			put_size(w, " size_apparent", e->size.apparent);
+			put_size(w, " size_actual", e->size.actual);
+			writer_puts(w, " />\n");
+			break;
 	}
+
+	return 0;
 }
 
 
@@ -103,20 +101,39 @@ static int xml_main(duc *duc, int argc, char **argv)
 		return -1;
 	}
 
+	struct writer w;
+	writer_init(&w, stdout, WRITER_BUF_SIZE);
+
 	struct duc_size size;
 	duc_dir_get_size(dir, &size);
-	printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-	printf("<duc root=\"%s\" size_apparent=\"%jd\" size_actual=\"%jd\" count=\"%jd\">\n", 
-			path, (intmax_t)size.apparent, (intmax_t)size.actual, (intmax_t)size.count);
-
-	dump(duc, dir, 1, (off_t)opt_min_size, opt_exclude_files);
-
-	printf("</duc>\n");
+	writer_puts(&w, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	writer_puts(&w, "<duc root=\"");
+	writer_put_xml(&w, path);
+	writer_put(&w, "\"", 1);
+	put_size(&w, " size_apparent", size.apparent);
+	put_size(&w, " size_actual", size.actual);
+	put_size(&w, " count", size.count);
+	writer_put(&w, ">\n", 2);
+
+	duc_walk_req *req = duc_walk_req_new(duc);
+	duc_walk_req_set_size_type(req, opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL);
+	duc_walk_req_set_min_size(req, (off_t)opt_min_size);
+	duc_walk_req_set_exclude_files(req, opt_exclude_files);
+	duc_walk_req_set_threads(req, opt_threads);
+	duc_walk(req, dir, dump, &w);
+	duc_walk_req_free(req);
+
+	writer_puts(&w, "</duc>\n");
+
+	r = writer_done(&w);
+	if(r != 0) {
+		duc_log(duc, DUC_LOG_FTL, "Error writing output: %s", strerror(errno));
+	}
 
 	duc_dir_close(dir);
 	duc_close(duc);
 
-	return 0;
+	return r;
 }
 
 
@@ -125,6 +142,7 @@ static struct ducrc_option options[] = {
 	{ &opt_database,      "database",      'd', DUCRC_TYPE_STRING, "select database file to use [~/.duc.db]" },
 	{ &opt_exclude_files, "exclude-files", 'x', DUCRC_TYPE_BOOL,   "exclude file from xml output, only include directories" },
 	{ &opt_min_size,      "min_size",      's', DUCRC_TYPE_DOUBLE, "specify min size for files or directories" },
+	{ &opt_threads,       "threads",        0,  DUCRC_TYPE_INT,    "number of threads reading from the database [1]" },
 	{ NULL }
 };
 
@@ -33,19 +33,35 @@ extern struct cmd cmd_gui;
 extern struct cmd cmd_guigl;
 extern struct cmd cmd_graph;
 extern struct cmd cmd_xml;
+extern struct cmd cmd_json;
+extern struct cmd cmd_top;
+extern struct cmd cmd_find;
+extern struct cmd cmd_diff;
+extern struct cmd cmd_compact;
+extern struct cmd cmd_import;
 extern struct cmd cmd_cgi;
 extern struct cmd cmd_ui;
+extern struct cmd cmd_serve;
 
 
 struct cmd *cmd_list[] = {
 	&cmd_help,
 	&cmd_index,
+	&cmd_import,
 	&cmd_info,
 	&cmd_manual,
 	&cmd_ls,
 	&cmd_xml,
+	&cmd_json,
+	&cmd_top,
+	&cmd_find,
+	&cmd_diff,
+	&cmd_compact,
 	&cmd_graph,
 	&cmd_cgi,
+#ifdef ENABLE_SERVE
+	&cmd_serve,
+#endif
 #ifdef ENABLE_X11
 	&cmd_gui,
 #endif
@@ -117,6 +133,7 @@ int main(int argc, char **argv)
 	struct ducrc *ducrc = ducrc_new(cmd->name);
 	ducrc_add_options(ducrc, global_options);
 	ducrc_add_options(ducrc, cmd->options);
+	ducrc_add_options(ducrc, cmd->options_inherit);
 
 	/* Call init function */
 
@@ -280,6 +297,7 @@ static void help_cmd(struct cmd *cmd)
 	
 	printf("Options for the command '%s':\n", cmd->name);
 	show_options(cmd->options, 1);
+	show_options(cmd->options_inherit, 1);
 
 	printf("\n");
 	printf("Global options:\n");
@@ -318,6 +336,7 @@ static int help_main(duc *duc, int argc, char **argv)
 				printf("duc %s %s: %s\n", c->name, c->usage, c->descr_short);
 				printf("\n");
 				show_options(c->options, 0);
+				show_options(c->options_inherit, 0);
 				printf("\n");
 			} else {
 				printf("  %-10.10s: %s\n", c->name, c->descr_short);
@@ -391,6 +410,7 @@ static int manual_main(duc *duc, int argc, char **argv)
 		printf("Options for command `duc %s %s`:\n", c->name, c->usage);
 		printf("\n");
 		show_options_manual(c->options);
+		show_options_manual(c->options_inherit);
 	}
 
 
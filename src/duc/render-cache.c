@@ -0,0 +1,383 @@
+
+/*
+ * On-disk cache of rendered graphs and pages. Entries are addressed by a hash
+ * of everything the output depends on: the database, the index reports in it,
+ * the request and the options. Entries are stored as files named
+ *
+ *   duc-<database hash>-<reports signature>-<key hash>
+ *
+ * Re-indexing the database changes the signature, so stale entries are never
+ * served again; they are removed when the first new entry for the same
+ * database is written. A marker file named
+ *
+ *   duc-<database hash>-<reports signature>-pruned
+ *
+ * makes sure only one writer does so for every signature.
+ *
+ * The total size of the entries in the directory can be limited, when an
+ * entry is written that pushes it over the limit the least recently used
+ * entries are removed until it is back at three quarters of the limit.
+ * Reading an entry updates its modification time to keep track of its use.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "private.h"
+#include "duc.h"
+#include "render-cache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* Temporary files older than this were left behind by a writer which died */
+#define TMP_MAX_AGE 3600
+
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	while(len--) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+
+/*
+ * Cheap fingerprint of the index reports in the database, which changes when
+ * the database is updated by a new index run. Optionally returns the time of
+ * the most recent index run
+ */
+
+uint64_t render_db_signature(duc *duc, time_t *mtime)
+{
+	uint64_t sig = 0;
+	struct duc_index_report *report;
+	size_t i = 0;
+
+	if(mtime) *mtime = 0;
+
+	while((report = duc_get_report(duc, i)) != NULL) {
+		sig = sig * 31 + report->time_stop.tv_sec * 1000000 + report->time_stop.tv_usec;
+		if(mtime && report->time_stop.tv_sec > *mtime) *mtime = report->time_stop.tv_sec;
+		duc_index_report_free(report);
+		i++;
+	}
+
+	return sig;
+}
+
+
+/*
+ * The database is identified by the resolved path it was opened with, so all
+ * spellings of the same path share their entries
+ */
+
+void render_key_init(struct render_key *k, duc *duc)
+{
+	const char *path = duc->path_db ? duc->path_db : "";
+	char *real = realpath(path, NULL);
+	if(real) path = real;
+	k->db = fnv(FNV_OFFSET, path, strlen(path));
+	free(real);
+	k->sig = render_db_signature(duc, &k->mtime);
+	k->hash = FNV_OFFSET;
+}
+
+
+void render_key_add(struct render_key *k, const void *data, size_t len)
+{
+	k->hash = fnv(k->hash, data, len);
+}
+
+
+/*
+ * Add a string including its terminating zero, so consecutive strings can
+ * not run into each other
+ */
+
+void render_key_add_str(struct render_key *k, const char *s)
+{
+	if(s) {
+		render_key_add(k, s, strlen(s) + 1);
+	} else {
+		render_key_add(k, "\xff", 1);
+	}
+}
+
+
+/*
+ * Add the current value of an option. The database option is left out, the
+ * database is part of the key by its resolved path
+ */
+
+void render_key_add_option(struct render_key *k, struct ducrc_option *o)
+{
+	if(strcmp(o->longopt, "database") == 0) return;
+
+	render_key_add_str(k, o->longopt);
+	switch(o->type) {
+		case DUCRC_TYPE_BOOL:
+			render_key_add(k, o->ptr, sizeof(bool));
+			break;
+		case DUCRC_TYPE_INT:
+			render_key_add(k, o->ptr, sizeof(int));
+			break;
+		case DUCRC_TYPE_DOUBLE:
+			render_key_add(k, o->ptr, sizeof(double));
+			break;
+		case DUCRC_TYPE_STRING:
+			render_key_add_str(k, *(char **)o->ptr);
+			break;
+		case DUCRC_TYPE_FUNC:
+			break;
+	}
+}
+
+
+void render_key_add_options(struct render_key *k, struct ducrc_option *o)
+{
+	for(; o && o->longopt; o++) {
+		render_key_add_option(k, o);
+	}
+}
+
+
+void render_key_etag(struct render_key *k, char *buf, size_t len)
+{
+	snprintf(buf, len, "\"%016" PRIx64 "%016" PRIx64 "\"", k->sig, k->hash);
+}
+
+
+/*
+ * Format the time of the last index run as HTTP date, independent of the
+ * locale
+ */
+
+void render_key_last_modified(struct render_key *k, char *buf, size_t len)
+{
+	static const char *day[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char *mon[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	                             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	struct tm tm;
+	gmtime_r(&k->mtime, &tm);
+	snprintf(buf, len, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+			day[tm.tm_wday], tm.tm_mday, mon[tm.tm_mon], tm.tm_year + 1900,
+			tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+
+static void entry_path(const char *dir, struct render_key *k, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/duc-%016" PRIx64 "-%016" PRIx64 "-%016" PRIx64,
+			dir, k->db, k->sig, k->hash);
+}
+
+
+/*
+ * Read the entry for the given key. Returns 0 and a malloced buffer on a hit,
+ * -1 on a miss
+ */
+
+int render_cache_get(const char *dir, struct render_key *k, char **data, size_t *len)
+{
+	char path[DUC_PATH_MAX];
+	entry_path(dir, k, path, sizeof(path));
+
+	int fd = open(path, O_RDONLY);
+	if(fd == -1) return -1;
+
+	struct stat st;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	char *buf = duc_malloc(st.st_size + 1);
+	size_t n = 0;
+	while(n < (size_t)st.st_size) {
+		ssize_t r = read(fd, buf + n, st.st_size - n);
+		if(r == -1 && errno == EINTR) continue;
+		if(r <= 0) break;
+		n += r;
+	}
+	futimens(fd, NULL);
+	close(fd);
+
+	if(n != (size_t)st.st_size) {
+		duc_free(buf);
+		return -1;
+	}
+
+	*data = buf;
+	*len = n;
+	return 0;
+}
+
+
+/*
+ * Remove entries of the same database made from older index runs, once for
+ * every signature. Temporary files of other writers are left alone unless
+ * they are old enough to be left over
+ */
+
+static void prune(const char *dir, struct render_key *k)
+{
+	char prefix[64], current[64];
+	char path[DUC_PATH_MAX];
+	snprintf(prefix, sizeof(prefix), "duc-%016" PRIx64 "-", k->db);
+	snprintf(current, sizeof(current), "duc-%016" PRIx64 "-%016" PRIx64 "-", k->db, k->sig);
+	size_t l = strlen(prefix);
+
+	snprintf(path, sizeof(path), "%s/%spruned", dir, current);
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if(fd == -1) return;
+	close(fd);
+
+	DIR *d = opendir(dir);
+	if(d == NULL) return;
+
+	time_t now = time(NULL);
+	struct dirent *e;
+	while((e = readdir(d)) != NULL) {
+		if(strncmp(e->d_name, prefix, l) != 0) continue;
+		if(strncmp(e->d_name, current, strlen(current)) == 0) continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if(strchr(e->d_name, '.')) {
+			struct stat st;
+			if(stat(path, &st) == -1 || now - st.st_mtime < TMP_MAX_AGE) continue;
+		}
+		unlink(path);
+	}
+
+	closedir(d);
+}
+
+
+struct entry {
+	char name[64];
+	time_t mtime;
+	off_t size;
+};
+
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct entry *ea = a;
+	const struct entry *eb = b;
+	if(ea->mtime < eb->mtime) return -1;
+	if(ea->mtime > eb->mtime) return 1;
+	return 0;
+}
+
+
+/*
+ * Keep the total size of all entries in the directory below 'max' bytes by
+ * removing the least recently used ones. Temporary files are counted but
+ * never removed here, markers are neither
+ */
+
+static void trim(const char *dir, size_t max)
+{
+	char path[DUC_PATH_MAX];
+	struct entry *list = NULL;
+	size_t count = 0, alloc = 0;
+	size_t total = 0;
+
+	DIR *d = opendir(dir);
+	if(d == NULL) return;
+
+	struct dirent *e;
+	while((e = readdir(d)) != NULL) {
+		if(strncmp(e->d_name, "duc-", 4) != 0) continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		struct stat st;
+		if(stat(path, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+		total += st.st_size;
+		if(strchr(e->d_name, '.') || strlen(e->d_name) >= sizeof(list->name)) continue;
+		if(strstr(e->d_name, "-pruned")) continue;
+		if(count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			list = duc_realloc(list, alloc * sizeof(*list));
+		}
+		strcpy(list[count].name, e->d_name);
+		list[count].mtime = st.st_mtime;
+		list[count].size = st.st_size;
+		count++;
+	}
+
+	closedir(d);
+
+	if(total > max) {
+		qsort(list, count, sizeof(*list), entry_cmp);
+		size_t i;
+		for(i = 0; i < count && total > max / 4 * 3; i++) {
+			snprintf(path, sizeof(path), "%s/%s", dir, list[i].name);
+			if(unlink(path) == 0) total -= list[i].size;
+		}
+	}
+
+	duc_free(list);
+}
+
+
+/*
+ * Store an entry. The data is written to a temporary file which is renamed
+ * into place, so concurrent readers never see partial entries. With a non
+ * zero 'max' the directory is trimmed to that many bytes afterwards
+ */
+
+int render_cache_put(const char *dir, struct render_key *k, const char *data, size_t len, size_t max)
+{
+	char path[DUC_PATH_MAX];
+	char path_tmp[DUC_PATH_MAX + 8];
+	entry_path(dir, k, path, sizeof(path));
+	snprintf(path_tmp, sizeof(path_tmp), "%s.XXXXXX", path);
+
+	int fd = mkstemp(path_tmp);
+	if(fd == -1) {
+		duc_log(NULL, DUC_LOG_WRN, "Unable to write render cache entry in %s: %s", dir, strerror(errno));
+		return -1;
+	}
+
+	size_t n = 0;
+	while(n < len) {
+		ssize_t r = write(fd, data + n, len - n);
+		if(r == -1 && errno == EINTR) continue;
+		if(r <= 0) break;
+		n += r;
+	}
+
+	fchmod(fd, 0644);
+	int r = close(fd);
+
+	if(n != len || r != 0 || rename(path_tmp, path) != 0) {
+		duc_log(NULL, DUC_LOG_WRN, "Unable to write render cache entry %s: %s", path, strerror(errno));
+		unlink(path_tmp);
+		return -1;
+	}
+
+	prune(dir, k);
+	if(max > 0) trim(dir, max);
+	return 0;
+}
+
+
+/*
+ * End
+ */
@@ -0,0 +1,30 @@
+#ifndef render_cache_h
+#define render_cache_h
+
+#include <stdint.h>
+#include <time.h>
+
+#include "duc.h"
+#include "ducrc.h"
+
+struct render_key {
+	uint64_t db;
+	uint64_t sig;
+	uint64_t hash;
+	time_t mtime;
+};
+
+uint64_t render_db_signature(duc *duc, time_t *mtime);
+
+void render_key_init(struct render_key *k, duc *duc);
+void render_key_add(struct render_key *k, const void *data, size_t len);
+void render_key_add_str(struct render_key *k, const char *s);
+void render_key_add_option(struct render_key *k, struct ducrc_option *o);
+void render_key_add_options(struct render_key *k, struct ducrc_option *o);
+void render_key_etag(struct render_key *k, char *buf, size_t len);
+void render_key_last_modified(struct render_key *k, char *buf, size_t len);
+
+int render_cache_get(const char *dir, struct render_key *k, char **data, size_t *len);
+int render_cache_put(const char *dir, struct render_key *k, const char *data, size_t len, size_t max);
+
+#endif
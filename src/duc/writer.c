@@ -0,0 +1,136 @@
+
+/*
+ * Buffered writer used by the export commands. Output is collected in a large
+ * buffer, and strings are escaped by copying runs of characters which need no
+ * escaping in one go instead of writing character by character.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "writer.h"
+
+
+void writer_init(struct writer *w, FILE *f, size_t size)
+{
+	w->f = f;
+	w->size = size;
+	w->buf = duc_malloc(size);
+	w->len = 0;
+	w->error = 0;
+}
+
+
+void writer_flush(struct writer *w)
+{
+	if(w->len > 0) {
+		if(fwrite(w->buf, 1, w->len, w->f) != w->len) w->error = 1;
+		w->len = 0;
+	}
+}
+
+
+/*
+ * Flush and release the buffer. Returns -1 if writing failed
+ */
+
+int writer_done(struct writer *w)
+{
+	writer_flush(w);
+	if(fflush(w->f) != 0) w->error = 1;
+	duc_free(w->buf);
+	w->buf = NULL;
+	return w->error ? -1 : 0;
+}
+
+
+void writer_put(struct writer *w, const char *s, size_t len)
+{
+	if(w->len + len > w->size) {
+		writer_flush(w);
+		if(len > w->size) {
+			if(fwrite(s, 1, len, w->f) != len) w->error = 1;
+			return;
+		}
+	}
+	memcpy(w->buf + w->len, s, len);
+	w->len += len;
+}
+
+
+void writer_puts(struct writer *w, const char *s)
+{
+	writer_put(w, s, strlen(s));
+}
+
+
+void writer_put_int(struct writer *w, intmax_t v)
+{
+	char tmp[24];
+	char *p = tmp + sizeof(tmp);
+	uintmax_t u = v < 0 ? -(uintmax_t)v : (uintmax_t)v;
+
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while(u);
+
+	if(v < 0) *--p = '-';
+
+	writer_put(w, p, tmp + sizeof(tmp) - p);
+}
+
+
+/*
+ * Write a quoted JSON string
+ */
+
+static void put_writer(const char *s, size_t len, void *ptr)
+{
+	writer_put(ptr, s, len);
+}
+
+
+void writer_put_json(struct writer *w, const char *s)
+{
+	duc_quote(s, DUC_QUOTE_JSON, put_writer, w);
+}
+
+
+/*
+ * Write a string for use in a XML attribute value
+ */
+
+void writer_put_xml(struct writer *w, const char *s)
+{
+	for(;;) {
+		const char *run = s;
+		while(((uint8_t)*s >= 0x20 || *s == '\t' || *s == '\n' || *s == '\r') &&
+		      *s != '<' && *s != '>' && *s != '&' && *s != '"') s++;
+		if(s > run) writer_put(w, run, s - run);
+		if(*s == '\0') break;
+
+		char esc[8];
+		switch(*s) {
+			case '<': writer_put(w, "&lt;", 4); break;
+			case '>': writer_put(w, "&gt;", 4); break;
+			case '&': writer_put(w, "&amp;", 5); break;
+			case '"': writer_put(w, "&quot;", 6); break;
+			default:
+				snprintf(esc, sizeof(esc), "#x%02x", *(uint8_t *)s);
+				writer_put(w, esc, 4);
+				break;
+		}
+		s++;
+	}
+}
+
+
+/*
+ * End
+ */
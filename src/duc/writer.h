@@ -0,0 +1,31 @@
+#ifndef writer_h
+#define writer_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Buffered output for large exports, flushed to the file in big chunks
+ */
+
+#define WRITER_BUF_SIZE (1024 * 1024)
+
+struct writer {
+	FILE *f;
+	char *buf;
+	size_t len;
+	size_t size;
+	int error;
+};
+
+void writer_init(struct writer *w, FILE *f, size_t size);
+int writer_done(struct writer *w);
+
+void writer_flush(struct writer *w);
+void writer_put(struct writer *w, const char *s, size_t len);
+void writer_puts(struct writer *w, const char *s);
+void writer_put_int(struct writer *w, intmax_t v);
+void writer_put_json(struct writer *w, const char *s);
+void writer_put_xml(struct writer *w, const char *s);
+
+#endif
@@ -24,6 +24,7 @@ typedef enum {
 	DUC_GRAPH_FORMAT_SVG,
 	DUC_GRAPH_FORMAT_PDF,
 	DUC_GRAPH_FORMAT_HTML,
+	DUC_GRAPH_FORMAT_JSON,
 } duc_graph_file_format;
 
 #ifdef ENABLE_CAIRO
@@ -36,6 +37,7 @@ duc_graph *duc_graph_new_opengl(duc *duc, double font_scale);
 #endif
 duc_graph *duc_graph_new_svg(duc *duc, FILE *fout);
 duc_graph *duc_graph_new_html(duc *duc, FILE *fout, int write_body);
+duc_graph *duc_graph_new_json(duc *duc, FILE *fout);
 
 void duc_graph_free(duc_graph *g);
 
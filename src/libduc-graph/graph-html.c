@@ -149,6 +149,7 @@ void br_html_done(duc_graph *g)
 
 static void br_html_free(duc_graph *g)
 {
+	free(g->backend_data);
 }
 
 
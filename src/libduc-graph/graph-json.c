@@ -0,0 +1,146 @@
+
+/*
+ * Graph backend exporting the computed layout as JSON instead of drawing it,
+ * so the graph can be rendered on the client side. The output is a single
+ * object:
+ *
+ *   version, width, height, cx, cy, r_start, max_level, ring_gap, gradient,
+ *   path, size_type, size: { actual, apparent, count },
+ *   fields: names of the section array members,
+ *   sections: [ [ parent, level, a1, a2, r1, r2, color, line, type, name,
+ *                 actual, apparent, count ], ... ],
+ *   labels: [ [ x, y, font size, text ], ... ]
+ *
+ * Sections are listed depth first, parent is the index of the section of the
+ * parent directory or -1 for the entries of the graph root. Angles are in
+ * the range 0..1 clockwise from the top, radii in pixels.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "duc.h"
+#include "duc-graph.h"
+#include "graph-private.h"
+
+#define JSON_VERSION 1
+
+struct json_backend_data {
+	FILE *fout;
+	size_t label_count;
+};
+
+
+static void br_json_start(duc_graph *g)
+{
+	struct json_backend_data *bd = g->backend_data;
+	FILE *f = bd->fout;
+
+	bd->label_count = 0;
+
+	fprintf(f, "{\"version\":%d,", JSON_VERSION);
+	fprintf(f, "\"width\":%.0f,\"height\":%.0f,", g->width, g->height);
+	fprintf(f, "\"cx\":%.0f,\"cy\":%.0f,", g->cx, g->cy);
+	fprintf(f, "\"r_start\":%.1f,\"max_level\":%d,", g->r_start, g->max_level);
+	fprintf(f, "\"ring_gap\":%d,\"gradient\":%s,\n", g->ring_gap, g->gradient ? "true" : "false");
+	fprintf(f, "\"labels\":[");
+}
+
+
+static void br_json_draw_text(duc_graph *g, double x, double y, double size, char *text)
+{
+	struct json_backend_data *bd = g->backend_data;
+	FILE *f = bd->fout;
+
+	fprintf(f, "%s\n[%.0f,%.0f,%.0f,", bd->label_count++ ? "," : "", x, y, size);
+	duc_fquote(f, text, DUC_QUOTE_JSON);
+	fprintf(f, "]");
+}
+
+
+static void br_json_draw_tooltip(duc_graph *g, double x, double y, char *text)
+{
+}
+
+
+static void br_json_draw_section(duc_graph *g, double a1, double a2, double r1, double r2, double R, double G, double B, double L)
+{
+}
+
+
+/*
+ * The layout is complete when the backend is done, write out all sections
+ */
+
+static void br_json_done(duc_graph *g)
+{
+	struct json_backend_data *bd = g->backend_data;
+	FILE *f = bd->fout;
+	struct duc_size *size = &g->layout_dir_size;
+	size_t i;
+
+	fprintf(f, "],\n\"path\":");
+	duc_fquote(f, g->layout_path ? g->layout_path : "", DUC_QUOTE_JSON);
+	fprintf(f, ",\"size_type\":\"%s\",",
+			g->layout_size_type == DUC_SIZE_TYPE_COUNT ? "count" :
+			g->layout_size_type == DUC_SIZE_TYPE_APPARENT ? "apparent" : "actual");
+	fprintf(f, "\"size\":{\"actual\":%jd,\"apparent\":%jd,\"count\":%jd},\n",
+			(intmax_t)size->actual, (intmax_t)size->apparent, (intmax_t)size->count);
+	fprintf(f, "\"fields\":[\"parent\",\"level\",\"a1\",\"a2\",\"r1\",\"r2\",\"color\",\"line\","
+			"\"type\",\"name\",\"actual\",\"apparent\",\"count\"],\n");
+	fprintf(f, "\"sections\":[");
+
+	for(i=0; i<g->section_count; i++) {
+		struct section *s = &g->section_list[i];
+		fprintf(f, "%s\n[%zd,%d,%.6f,%.6f,%.1f,%.1f,\"#%02x%02x%02x\",%d,\"%s\",",
+				i ? "," : "",
+				s->parent, s->level, s->a1, s->a2, s->r1, s->r2,
+				(int)(s->R*255), (int)(s->G*255), (int)(s->B*255), (int)(s->L*255),
+				duc_file_type_name(s->ent.type));
+		duc_fquote(f, s->ent.name, DUC_QUOTE_JSON);
+		fprintf(f, ",%jd,%jd,%jd]",
+				(intmax_t)s->ent.size.actual, (intmax_t)s->ent.size.apparent, (intmax_t)s->ent.size.count);
+	}
+
+	fprintf(f, "]}\n");
+}
+
+
+static void br_json_free(duc_graph *g)
+{
+	free(g->backend_data);
+}
+
+
+struct duc_graph_backend duc_graph_backend_json = {
+	.start = br_json_start,
+	.draw_text = br_json_draw_text,
+	.draw_tooltip = br_json_draw_tooltip,
+	.draw_section = br_json_draw_section,
+	.done = br_json_done,
+	.free = br_json_free,
+};
+
+
+duc_graph *duc_graph_new_json(duc *duc, FILE *fout)
+{
+	duc_graph *g = duc_graph_new(duc);
+	g->backend = &duc_graph_backend_json;
+
+	struct json_backend_data *bd;
+	bd = duc_malloc0(sizeof *bd);
+	g->backend_data = bd;
+
+	bd->fout = fout;
+
+	return g;
+}
+
+/*
+ * End
+ */
@@ -14,6 +14,20 @@ struct label {
 	struct label *next;
 };
 
+/*
+ * Section of the graph as computed by the last layout, kept for hit testing
+ * and for exporting the layout with the json backend
+ */
+
+struct section {
+	double a1, a2;
+	double r1, r2;
+	double R, G, B, L;
+	int level;
+	ssize_t parent;
+	struct duc_dirent ent;
+};
+
 
 struct duc_graph_backend {
 	void (*free)(duc_graph *g);
@@ -54,10 +68,21 @@ struct duc_graph {
 	/* Reusable runtime info. Cleared after each graph_draw_* call */
 
 	struct label *label_list;
-	double spot_a;
-	double spot_r;
-	duc_dir *spot_dir;
-	struct duc_dirent *spot_ent;
+
+	/* Layout of the last drawn graph. Sections are stored in drawing order,
+	 * ring_list holds the section indices per ring, sorted by angle */
+
+	struct section *section_list;
+	size_t section_count;
+	size_t section_max;
+	size_t *ring_list;
+	size_t *ring_start;
+	char *layout_path;
+	struct duc_size layout_dir_size;
+	double layout_size;
+	double layout_fuzz;
+	int layout_max_level;
+	duc_size_type layout_size_type;
 
 	struct duc_graph_backend *backend;
 	void *backend_data;
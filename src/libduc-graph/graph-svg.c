@@ -159,6 +159,7 @@ void br_svg_done(duc_graph *g)
 
 static void br_svg_free(duc_graph *g)
 {
+	free(g->backend_data);
 }
 
 
@@ -39,10 +39,15 @@ duc_graph *duc_graph_new(duc *duc)
 }
 
 
+static void layout_clear(duc_graph *g);
+
+
 void duc_graph_free(duc_graph *g)
 {
 	if(g->backend)
 		g->backend->free(g);
+	layout_clear(g);
+	free(g->section_list);
 	free(g);
 }
 
@@ -219,15 +224,153 @@ static void gen_tooltip(duc_graph *g, struct duc_size *size, const char *name, d
 }
 
 
+static void layout_clear(duc_graph *g)
+{
+	size_t i;
+	for(i=0; i<g->section_count; i++) {
+		free(g->section_list[i].ent.name);
+	}
+	g->section_count = 0;
+	free(g->ring_list);
+	free(g->ring_start);
+	free(g->layout_path);
+	g->ring_list = NULL;
+	g->ring_start = NULL;
+	g->layout_path = NULL;
+}
+
+
+static ssize_t layout_add(duc_graph *g, int level, ssize_t parent, 
+		double a1, double a2, double r1, double r2, 
+		double R, double G, double B, double L, struct duc_dirent *e)
+{
+	if(g->section_count == g->section_max) {
+		g->section_max = g->section_max ? g->section_max * 2 : 256;
+		g->section_list = duc_realloc(g->section_list, g->section_max * sizeof(*g->section_list));
+	}
+
+	struct section *s = &g->section_list[g->section_count];
+	s->a1 = a1;
+	s->a2 = a2;
+	s->r1 = r1;
+	s->r2 = r2;
+	s->R = R;
+	s->G = G;
+	s->B = B;
+	s->L = L;
+	s->level = level;
+	s->parent = parent;
+	s->ent = *e;
+	s->ent.name = duc_strdup(e->name);
+
+	return g->section_count++;
+}
+
+
 /*
- * This function has two purposes:
- *
- * - If a backend is provided, a graph will be drawn on that context
- * - if spot_a and spot_r are defined, it will find the path on the graph
- *   that is below that spot
+ * Index the sections per ring. Sections are added in depth first order, so
+ * the sections of every ring are already sorted by angle
  */
 
-static int do_dir(duc_graph *g, duc_dir *dir, int level, double r1, double a1_dir, double a2_dir, struct duc_size *total)
+static void layout_finish(duc_graph *g, duc_dir *dir)
+{
+	size_t nrings = g->max_level + 1;
+	size_t i;
+
+	g->ring_start = duc_malloc0((nrings + 1) * sizeof(*g->ring_start));
+	g->ring_list = duc_malloc((g->section_count + 1) * sizeof(*g->ring_list));
+
+	for(i=0; i<g->section_count; i++) {
+		g->ring_start[g->section_list[i].level + 1] ++;
+	}
+	for(i=1; i<=nrings; i++) {
+		g->ring_start[i] += g->ring_start[i-1];
+	}
+
+	size_t *pos = duc_malloc(nrings * sizeof(*pos));
+	memcpy(pos, g->ring_start, nrings * sizeof(*pos));
+	for(i=0; i<g->section_count; i++) {
+		g->ring_list[pos[g->section_list[i].level]++] = i;
+	}
+	free(pos);
+
+	g->layout_path = duc_dir_get_path(dir);
+	duc_dir_get_size(dir, &g->layout_dir_size);
+	g->layout_size = g->size;
+	g->layout_fuzz = g->fuzz;
+	g->layout_max_level = g->max_level;
+	g->layout_size_type = g->size_type;
+}
+
+
+/*
+ * Check if the layout of the last drawn graph is still valid for the given
+ * directory and the current settings
+ */
+
+static int layout_valid(duc_graph *g, duc_dir *dir)
+{
+	if(g->layout_path == NULL) return 0;
+	if(g->layout_size != g->size) return 0;
+	if(g->layout_fuzz != g->fuzz) return 0;
+	if(g->layout_max_level != g->max_level) return 0;
+	if(g->layout_size_type != g->size_type) return 0;
+
+	struct duc_size size;
+	duc_dir_get_size(dir, &size);
+	if(memcmp(&size, &g->layout_dir_size, sizeof(size)) != 0) return 0;
+
+	char *path = duc_dir_get_path(dir);
+	int same = strcmp(path, g->layout_path) == 0;
+	free(path);
+
+	return same;
+}
+
+
+/*
+ * Find the section at the given polar coordinates. On every ring the section
+ * covering the angle is found with a binary search, the search ends on the
+ * first ring where no section covers the angle.
+ */
+
+static ssize_t layout_find(duc_graph *g, double a, double r)
+{
+	int level;
+
+	for(level=0; level<g->layout_max_level; level++) {
+
+		size_t lo = g->ring_start[level];
+		size_t hi = g->ring_start[level+1];
+		struct section *s = NULL;
+
+		while(lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			struct section *m = &g->section_list[g->ring_list[mid]];
+			if(a < m->a1) {
+				hi = mid;
+			} else if(a >= m->a2) {
+				lo = mid + 1;
+			} else {
+				s = m;
+				break;
+			}
+		}
+
+		if(s == NULL) return -1;
+		if(r >= s->r1 && r < s->r2) return s - g->section_list;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Draw the graph on the backend, if any, and record the layout of all
+ * sections for duc_graph_find_spot()
+ */
+
+static int do_dir(duc_graph *g, duc_dir *dir, int level, ssize_t parent, double r1, double a1_dir, double a2_dir, struct duc_size *total)
 {
 	double a_range = a2_dir - a1_dir;
 	double a1 = a1_dir;
@@ -341,21 +484,7 @@ static int do_dir(duc_graph *g, duc_dir *dir, int level, double r1, double a1_di
 		}
 
 
-		/* Check if the requested spot lies in this section */
-
-		if(g->spot_r > 0) {
-			double a = g->spot_a;
-			double r = g->spot_r;
-
-			if(a >= a1 && a < a2 && r >= r1 && r < r2) {
-				g->spot_ent = duc_malloc(sizeof *g->spot_ent);
-				*g->spot_ent = *e;
-				g->spot_ent->name = duc_strdup(e->name);
-				if(e->type == DUC_FILE_TYPE_DIR)
-					g->spot_dir = duc_dir_openent(dir, e);
-			}
-		}
-
+		ssize_t idx = layout_add(g, level, parent, a1, a2, r1, r2, R, G, B, L, e);
 
 		if(e->type == DUC_FILE_TYPE_DIR) {
 
@@ -364,7 +493,7 @@ static int do_dir(duc_graph *g, duc_dir *dir, int level, double r1, double a1_di
 			if(level+1 < g->max_level) {
 				duc_dir *dir_child = duc_dir_openent(dir, e);
 				if(!dir_child) continue;
-				do_dir(g, dir_child, level + 1, r2, a1, a2, &e->size);
+				do_dir(g, dir_child, level + 1, idx, r2, a1, a2, &e->size);
 				duc_dir_close(dir_child);
 			} else {
 				if(g->backend) 
@@ -430,7 +559,9 @@ int duc_graph_draw(duc_graph *g, duc_dir *dir)
 
 	if(g->backend)
 		g->backend->start(g);
-	do_dir(g, dir, 0, g->r_start, 0, 1, NULL);
+	layout_clear(g);
+	do_dir(g, dir, 0, -1, g->r_start, 0, 1, NULL);
+	layout_finish(g, dir);
 
 	/* Draw collected labels */
 
@@ -486,9 +617,10 @@ duc_dir *duc_graph_find_spot(duc_graph *g, duc_dir *dir, double x, double y, str
 	x -= (int)g->pos_x;
 	y -= (int)g->pos_y;
 
-	car2pol(g, x, y, &g->spot_a, &g->spot_r);
+	double a, r;
+	car2pol(g, x, y, &a, &r);
 
-	if(g->spot_r < g->r_start) {
+	if(r < g->r_start) {
 	
 		/* If clicked in the center, go up one directory */
 
@@ -496,20 +628,47 @@ duc_dir *duc_graph_find_spot(duc_graph *g, duc_dir *dir, double x, double y, str
 
 	} else {
 
-		/* Find directory at position x,y */
+		/* Reuse the layout of the last drawn graph if possible, only
+		 * compute the layout without drawing otherwise */
+
+		if(!layout_valid(g, dir)) {
+			duc_dir_rewind(dir);
+			struct duc_graph_backend *be = g->backend;
+			g->backend = NULL;
+			layout_clear(g);
+			do_dir(g, dir, 0, -1, g->r_start, 0, 1, NULL);
+			layout_finish(g, dir);
+			g->backend = be;
+		}
+
+		/* Find section at position x,y */
+
+		ssize_t idx = layout_find(g, a, r);
+		if(idx == -1) return NULL;
+
+		struct section *s = &g->section_list[idx];
 
-		g->spot_dir = NULL;
+		if(ent) {
+			*ent = duc_malloc(sizeof **ent);
+			**ent = s->ent;
+			(*ent)->name = duc_strdup(s->ent.name);
+		}
 
-		duc_dir_rewind(dir);
-		struct duc_graph_backend *be = g->backend;
-		g->backend = NULL;
-		do_dir(g, dir, 0, g->r_start, 0, 1, NULL);
-		g->backend = be;
+		/* Open the directory through its parents to get the full path */
 
-		g->spot_a = 0;
-		g->spot_r = 0;
-		if(ent) *ent = g->spot_ent;
-		dir2 = g->spot_dir;
+		if(s->ent.type == DUC_FILE_TYPE_DIR) {
+			ssize_t chain[g->layout_max_level];
+			int n = 0;
+			for(; idx != -1; idx = g->section_list[idx].parent) {
+				chain[n++] = idx;
+			}
+			dir2 = dir;
+			while(n > 0 && dir2) {
+				duc_dir *dir_next = duc_dir_openent(dir2, &g->section_list[chain[--n]].ent);
+				if(dir2 != dir) duc_dir_close(dir2);
+				dir2 = dir_next;
+			}
+		}
 	}
 
 	return dir2;
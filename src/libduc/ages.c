@@ -0,0 +1,147 @@
+
+/*
+ * File age histograms. When indexing with DUC_INDEX_AGES every directory gets
+ * a side record with the size of the files below it, bucketed by the age of
+ * their modification and access times at the time of the index run.
+ *
+ * Buckets are on a log scale: bucket 0 holds files younger than a day, bucket
+ * n holds files with an age between 2^((n-1)/4) and 2^(n/4) days, so every
+ * bucket is about 19% wider than the previous one and 64 buckets cover well
+ * over a century.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "ages.h"
+
+#define DAY (24 * 3600)
+
+/* 2^(i/4) for the steps within one doubling of the age */
+
+static const double step[4] = { 1.0, 1.189207115, 1.414213562, 1.681792831 };
+
+
+/*
+ * Lower bound of the age of the files in the given bucket, in seconds
+ */
+
+static double bucket_age(int bucket)
+{
+	if(bucket == 0) return 0;
+	bucket --;
+	return (double)DAY * (UINT64_C(1) << (bucket / 4)) * step[bucket % 4];
+}
+
+
+static int bucket_of(time_t age)
+{
+	if(age < DAY) return 0;
+
+	/* Find the doubling by the highest bit of the age in days, then the
+	 * step within it */
+
+	uint64_t days = age / DAY;
+	int octave = 0;
+	while(days >>= 1) octave ++;
+
+	int bucket = 1 + octave * 4 + 3;
+	while(bucket > 1 + octave * 4 && age < bucket_age(bucket)) bucket --;
+
+	return bucket < DUC_AGE_BUCKETS ? bucket : DUC_AGE_BUCKETS - 1;
+}
+
+
+static void add(struct tally *t, duc_age_type type, time_t age, const struct duc_size *size)
+{
+	uint8_t key[2] = { type, bucket_of(age) };
+	tally_add(t, key, sizeof key, size);
+}
+
+
+void ages_add(struct tally *t, const struct stat *st, time_t now, const struct duc_size *size)
+{
+	add(t, DUC_AGE_MTIME, now - st->st_mtime, size);
+	add(t, DUC_AGE_ATIME, now - st->st_atime, size);
+}
+
+
+struct age_list {
+	struct duc_age *list;
+	duc_age_type type;
+	time_t time;
+	size_t count;
+};
+
+
+static void add_age(const void *key, size_t keylen, const struct duc_size *size, void *ptr)
+{
+	struct age_list *al = ptr;
+	const uint8_t *k = key;
+
+	if(keylen != 2 || k[0] != al->type) return;
+
+	struct duc_age *a = &al->list[al->count++];
+	a->time_max = al->time - (time_t)bucket_age(k[1]);
+	a->time_min = k[1] < DUC_AGE_BUCKETS - 1 ? al->time - (time_t)bucket_age(k[1] + 1) : 0;
+	a->size = *size;
+}
+
+
+static int cmp_age(const void *a, const void *b)
+{
+	const struct duc_age *a1 = a;
+	const struct duc_age *a2 = b;
+	return a1->time_max < a2->time_max ? 1 : a1->time_max > a2->time_max ? -1 : 0;
+}
+
+
+/*
+ * Return the age histogram of the files below the given directory, by
+ * modification or access time, youngest bucket first. Returns NULL if the
+ * directory was not indexed with DUC_INDEX_AGES
+ */
+
+struct duc_age *duc_dir_get_ages(duc_dir *dir, duc_age_type type, size_t *count)
+{
+	struct duc_devino devino;
+	uint8_t check[DUC_DIGEST_SIZE];
+	time_t time = 0;
+
+	duc_dir_get_devino(dir, &devino);
+	duc_dir_get_check(dir, DIGEST_META_TIME, check);
+
+	*count = 0;
+
+	struct tally *t = tally_read(duc_dir_get_duc(dir), AGES_PREFIX, &devino, check, &time);
+	if(t == NULL) return NULL;
+
+	struct age_list al;
+	al.list = duc_malloc(tally_count(t) * sizeof(*al.list) + 1);
+	al.type = type;
+	al.time = time;
+	al.count = 0;
+	tally_foreach(t, add_age, &al);
+	tally_free(t);
+
+	qsort(al.list, al.count, sizeof(*al.list), cmp_age);
+
+	*count = al.count;
+	return al.list;
+}
+
+
+void duc_ages_free(struct duc_age *list)
+{
+	duc_free(list);
+}
+
+
+/*
+ * End
+ */
+
@@ -0,0 +1,13 @@
+#ifndef ages_h
+#define ages_h
+
+#include <sys/stat.h>
+
+#include "duc.h"
+#include "tally.h"
+
+#define AGES_PREFIX "duc_ages"
+
+void ages_add(struct tally *t, const struct stat *st, time_t now, const struct duc_size *size);
+
+#endif
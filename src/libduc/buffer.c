@@ -63,7 +63,7 @@ static int buffer_put(struct buffer *b, const void *data, size_t len)
 
 static int buffer_get(struct buffer *b, void *data, size_t len)
 {
-	if(b->ptr <= b->len - len) {
+	if(len <= b->len - b->ptr) {
 		memcpy(data, b->data + b->ptr, len);
 		b->ptr += len;
 		return len;
@@ -73,7 +73,7 @@ static int buffer_get(struct buffer *b, void *data, size_t len)
 }
 
 
-static int buffer_put_varint(struct buffer *b, uint64_t v)
+int buffer_put_varint(struct buffer *b, uint64_t v)
 {
 	uint8_t buf[9];
 	int l = PutVarint64(buf, v);
@@ -82,7 +82,7 @@ static int buffer_put_varint(struct buffer *b, uint64_t v)
 } 
 
 
-static int buffer_get_varint(struct buffer *b, uint64_t *v)
+int buffer_get_varint(struct buffer *b, uint64_t *v)
 {
 	uint8_t buf[9];
 	int r = buffer_get(b, buf, 1);
@@ -100,7 +100,7 @@ static int buffer_get_varint(struct buffer *b, uint64_t *v)
 }
 
 
-static void buffer_put_string(struct buffer *b, const char *s)
+void buffer_put_string(struct buffer *b, const char *s)
 {
 	size_t len = strlen(s);
 	if(len < 256) {
@@ -111,9 +111,9 @@ static void buffer_put_string(struct buffer *b, const char *s)
 }
 
 
-static void buffer_get_string(struct buffer *b, char **sout)
+void buffer_get_string(struct buffer *b, char **sout)
 {
-	uint8_t len;
+	uint8_t len = 0;
 	buffer_get(b, &len, sizeof len);
 	char *s = duc_malloc(len + 1);
 	if(s) {
@@ -124,14 +124,40 @@ static void buffer_get_string(struct buffer *b, char **sout)
 }
 
 
-static void buffer_put_devino(struct buffer *b, const struct duc_devino *devino)
+/*
+ * Variable length binary data, prefixed with its length
+ */
+
+void buffer_put_blob(struct buffer *b, const void *data, size_t len)
+{
+	buffer_put_varint(b, len);
+	buffer_put(b, data, len);
+}
+
+
+void *buffer_get_blob(struct buffer *b, size_t *len)
+{
+	uint64_t v = 0;
+	buffer_get_varint(b, &v);
+	if(v > b->len - b->ptr) {
+		*len = 0;
+		return NULL;
+	}
+	void *data = duc_malloc(v ? v : 1);
+	buffer_get(b, data, v);
+	*len = v;
+	return data;
+}
+
+
+void buffer_put_devino(struct buffer *b, const struct duc_devino *devino)
 {
 	buffer_put_varint(b, devino->dev);
 	buffer_put_varint(b, devino->ino);
 }
 
 
-static void buffer_get_devino(struct buffer *b, struct duc_devino *devino)
+void buffer_get_devino(struct buffer *b, struct duc_devino *devino)
 {
 	uint64_t v;
 	buffer_get_varint(b, &v); devino->dev = v;
@@ -139,7 +165,7 @@ static void buffer_get_devino(struct buffer *b, struct duc_devino *devino)
 }
 
 
-static void buffer_put_size(struct buffer *b, const struct duc_size *size)
+void buffer_put_size(struct buffer *b, const struct duc_size *size)
 {
 	buffer_put_varint(b, size->apparent);
 	buffer_put_varint(b, size->actual);
@@ -147,7 +173,7 @@ static void buffer_put_size(struct buffer *b, const struct duc_size *size)
 }
 
 
-static void buffer_get_size(struct buffer *b, struct duc_size *size)
+void buffer_get_size(struct buffer *b, struct duc_size *size)
 {
 	uint64_t v;
 	buffer_get_varint(b, &v); size->apparent = v;
@@ -160,18 +186,47 @@ static void buffer_get_size(struct buffer *b, struct duc_size *size)
  * Serialize data from structs into buffer
  */
 
-void buffer_put_dir(struct buffer *b, const struct duc_devino *devino, time_t mtime)
+void buffer_put_dir(struct buffer *b, const struct duc_devino *devino, time_t mtime, const uint8_t *digest, const uint8_t *meta)
 {
+	static const uint8_t digest_none[DUC_DIGEST_SIZE];
+	static const uint8_t meta_none[DIGEST_META_SIZE];
 	buffer_put_devino(b, devino);
 	buffer_put_varint(b, mtime);
+	buffer_put(b, digest ? digest : digest_none, DUC_DIGEST_SIZE);
+	buffer_put(b, meta ? meta : meta_none, DIGEST_META_SIZE);
 }
 
 
-void buffer_get_dir(struct buffer *b, struct duc_devino *devino, time_t *mtime)
+void buffer_get_dir(struct buffer *b, struct duc_devino *devino, time_t *mtime, uint8_t *digest, uint8_t *meta)
 {
 	uint64_t v;
+	uint8_t digest_tmp[DUC_DIGEST_SIZE];
+	uint8_t meta_tmp[DIGEST_META_SIZE];
 	buffer_get_devino(b, devino);
 	buffer_get_varint(b, &v); *mtime = v;
+	buffer_get(b, digest ? digest : digest_tmp, DUC_DIGEST_SIZE);
+	buffer_get(b, meta ? meta : meta_tmp, DIGEST_META_SIZE);
+}
+
+
+/*
+ * The digest and meta field are only known when the directory is complete,
+ * overwrite them in the header written by buffer_put_dir(). A NULL meta
+ * leaves the meta field as it is
+ */
+
+void buffer_set_dir_digest(struct buffer *b, const uint8_t *digest, const uint8_t *meta)
+{
+	struct duc_devino devino;
+	time_t mtime;
+	size_t ptr = b->ptr;
+
+	b->ptr = 0;
+	buffer_get_dir(b, &devino, &mtime, NULL, NULL);
+	b->ptr -= DUC_DIGEST_SIZE + DIGEST_META_SIZE;
+	buffer_put(b, digest, DUC_DIGEST_SIZE);
+	if(meta) buffer_put(b, meta, DIGEST_META_SIZE);
+	b->ptr = ptr;
 }
 
 void buffer_put_dirent(struct buffer *b, const struct duc_dirent *ent)
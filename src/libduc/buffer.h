@@ -11,8 +11,20 @@ struct buffer {
 struct buffer *buffer_new(void *data, size_t len);
 void buffer_free(struct buffer *b);
 
-void buffer_put_dir(struct buffer *b, const struct duc_devino *devino, time_t mtime);
-void buffer_get_dir(struct buffer *b, struct duc_devino *devino, time_t *mtime);
+int buffer_put_varint(struct buffer *b, uint64_t v);
+int buffer_get_varint(struct buffer *b, uint64_t *v);
+void buffer_put_string(struct buffer *b, const char *s);
+void buffer_get_string(struct buffer *b, char **sout);
+void buffer_put_blob(struct buffer *b, const void *data, size_t len);
+void *buffer_get_blob(struct buffer *b, size_t *len);
+void buffer_put_devino(struct buffer *b, const struct duc_devino *devino);
+void buffer_get_devino(struct buffer *b, struct duc_devino *devino);
+void buffer_put_size(struct buffer *b, const struct duc_size *size);
+void buffer_get_size(struct buffer *b, struct duc_size *size);
+
+void buffer_put_dir(struct buffer *b, const struct duc_devino *devino, time_t mtime, const uint8_t *digest, const uint8_t *meta);
+void buffer_get_dir(struct buffer *b, struct duc_devino *devino, time_t *mtime, uint8_t *digest, uint8_t *meta);
+void buffer_set_dir_digest(struct buffer *b, const uint8_t *digest, const uint8_t *meta);
 
 void buffer_put_dirent(struct buffer *b, const struct duc_dirent *ent);
 void buffer_get_dirent(struct buffer *b, struct duc_dirent *ent);
@@ -0,0 +1,389 @@
+
+/*
+ * Compaction. Directory records are keyed by device and inode number and are
+ * never deleted, so directories which disappeared between index runs leave
+ * their records behind. duc_compact() copies only the records reachable from
+ * the index reports of one or more databases into a fresh database:
+ *
+ *  - the directory records of all indexed trees, in key order
+ *  - side records which still match the digest of their directory, see
+ *    digest_check(), from every database holding the directory
+ *  - the history of every index root and the snapshot records it refers to
+ *  - the name index, rebuilt from the copied directories
+ *  - the index reports
+ *
+ * When several databases hold the same index root, the most recent run is
+ * kept. Checkpoints of interrupted index runs are not copied.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "duc.h"
+#include "private.h"
+#include "db.h"
+#include "buffer.h"
+#include "names.h"
+#include "history.h"
+#include "tally.h"
+#include "users.h"
+#include "exts.h"
+#include "ages.h"
+#include "inoset.h"
+#include "uthash.h"
+
+static const struct side {
+	const char *prefix;
+	enum digest_meta_part part;
+} side_list[] = {
+	{ USERS_PREFIX, DIGEST_META_UID },
+	{ EXTS_PREFIX,  DIGEST_META_NONE },
+	{ AGES_PREFIX,  DIGEST_META_TIME },
+	{ LINKS_PREFIX, DIGEST_META_NONE },
+};
+
+struct seen {
+	struct duc_devino devino;
+	uint8_t digest[DUC_DIGEST_SIZE];
+	uint8_t meta[DIGEST_META_SIZE];
+	size_t src;
+	size_t root;
+	size_t merged;            /* Last database queued for merging + 1 */
+	unsigned sides;           /* Side records copied, bit per side_list entry */
+	UT_hash_handle hh;
+};
+
+struct dirkey {
+	char key[48];
+	struct duc_devino devino;
+	int sides_only;
+};
+
+struct walk {
+	struct duc_devino devino;
+	int shared;
+};
+
+struct root {
+	size_t src;
+	struct duc_index_report report;
+};
+
+struct compact {
+	duc *duc;
+	duc **src;
+	struct seen *seen;
+	struct dirkey *keys;
+	size_t key_count;
+	size_t key_max;
+	size_t dir_count;
+	size_t conflicts;
+	size_t bytes;
+};
+
+
+static size_t dir_key(const struct duc_devino *devino, char *key, size_t keylen)
+{
+	return snprintf(key, keylen, "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
+}
+
+
+/*
+ * Collect the index reports of all databases, keeping the most recent run
+ * of every path
+ */
+
+static size_t collect_roots(duc **src, size_t src_count, struct root **out)
+{
+	struct root *roots = NULL;
+	size_t count = 0;
+	size_t i, j;
+
+	for(i=0; i<src_count; i++) {
+		struct duc_index_report *r;
+		size_t id = 0;
+		while((r = duc_get_report(src[i], id++)) != NULL) {
+			for(j=0; j<count; j++) {
+				if(strcmp(roots[j].report.path, r->path) == 0) break;
+			}
+			if(j == count) {
+				roots = duc_realloc(roots, (count + 1) * sizeof(*roots));
+				count ++;
+			} else if(timercmp(&r->time_stop, &roots[j].report.time_stop, <)) {
+				duc_log(src[i], DUC_LOG_WRN, "Skipping %s from %s, %s holds a more recent index run",
+						r->path, src[i]->path_db, src[roots[j].src]->path_db);
+				duc_index_report_free(r);
+				continue;
+			} else {
+				duc_log(src[i], DUC_LOG_WRN, "Skipping %s from %s, %s holds a more recent index run",
+						r->path, src[roots[j].src]->path_db, src[i]->path_db);
+			}
+			roots[j].src = i;
+			roots[j].report = *r;
+			roots[j].report.path_current = NULL;
+			duc_index_report_free(r);
+		}
+	}
+
+	*out = roots;
+	return count;
+}
+
+
+static void add_key(struct compact *c, const char *key, size_t keyl, const struct duc_devino *devino, int sides_only)
+{
+	if(c->key_count == c->key_max) {
+		c->key_max = c->key_max ? c->key_max * 2 : 1024;
+		c->keys = duc_realloc(c->keys, c->key_max * sizeof(*c->keys));
+	}
+	struct dirkey *k = &c->keys[c->key_count++];
+	memcpy(k->key, key, keyl + 1);
+	k->devino = *devino;
+	k->sides_only = sides_only;
+}
+
+
+/*
+ * Find all directories below an index root. New directories are added to
+ * the list of keys to copy. Directories shared with another root of the same
+ * database are only walked again for its name index. Directories already
+ * copied from another database with the same contents are walked for their
+ * side records, which are merged with the ones copied before
+ */
+
+static void walk_root(struct compact *c, size_t root_id, const struct root *root)
+{
+	duc *src = c->src[root->src];
+	struct names *names = NULL;
+
+	if(names_has_index(src, &root->report.devino)) {
+		names = names_new(c->duc, &root->report.devino, 0);
+	}
+
+	size_t depth = 0, max = 64;
+	struct walk *stack = duc_malloc(max * sizeof(*stack));
+	stack[depth].devino = root->report.devino;
+	stack[depth++].shared = 0;
+
+	while(depth > 0) {
+
+		struct walk w = stack[--depth];
+		struct duc_devino devino = w.devino;
+		int shared = w.shared;
+		char key[48];
+		size_t keyl = dir_key(&devino, key, sizeof(key));
+		size_t vall;
+
+		char *val = db_get(src->db, key, keyl, &vall);
+		if(val == NULL) continue;
+
+		struct buffer *b = buffer_new(val, vall);
+		struct duc_devino devino_parent;
+		time_t mtime;
+		uint8_t digest[DUC_DIGEST_SIZE];
+		uint8_t meta[DIGEST_META_SIZE];
+		buffer_get_dir(b, &devino_parent, &mtime, digest, meta);
+
+		struct seen *s;
+		HASH_FIND(hh, c->seen, &devino, sizeof(devino), s);
+
+		if(s == NULL && shared) {
+			buffer_free(b);
+			continue;
+
+		} else if(s == NULL) {
+			s = duc_malloc0(sizeof *s);
+			s->devino = devino;
+			memcpy(s->digest, digest, DUC_DIGEST_SIZE);
+			memcpy(s->meta, meta, DIGEST_META_SIZE);
+			s->src = root->src;
+			s->root = root_id;
+			HASH_ADD(hh, c->seen, devino, sizeof(s->devino), s);
+
+			add_key(c, key, keyl, &devino, 0);
+
+		} else if(s->root == root_id || (s->src == root->src && names == NULL)) {
+			buffer_free(b);
+			continue;
+
+		} else if(s->src != root->src) {
+			if(memcmp(s->digest, digest, DUC_DIGEST_SIZE) != 0) {
+				duc_log(c->duc, DUC_LOG_WRN, "Directory %s below %s in %s conflicts with %s, keeping the latter",
+						key, root->report.path, src->path_db, c->src[s->src]->path_db);
+				c->conflicts ++;
+				buffer_free(b);
+				continue;
+			}
+			if(s->merged == root->src + 1) {
+				buffer_free(b);
+				continue;
+			}
+			s->merged = root->src + 1;
+			shared = 1;
+
+			add_key(c, key, keyl, &devino, 1);
+
+		} else {
+			s->root = root_id;
+		}
+
+		if(names) names_add_dir(names, &devino, b, 0);
+
+		while(b->ptr < b->len) {
+			struct duc_dirent ent;
+			buffer_get_dirent(b, &ent);
+			if(ent.type == DUC_FILE_TYPE_DIR) {
+				if(depth == max) {
+					max *= 2;
+					stack = duc_realloc(stack, max * sizeof(*stack));
+				}
+				stack[depth].devino = ent.devino;
+				stack[depth++].shared = shared;
+			}
+			duc_free(ent.name);
+		}
+
+		buffer_free(b);
+	}
+
+	if(names) names_free(names);
+	duc_free(stack);
+}
+
+
+static int cmp_dirkey(const void *a, const void *b)
+{
+	const struct dirkey *k1 = a;
+	const struct dirkey *k2 = b;
+	return strcmp(k1->key, k2->key);
+}
+
+
+/*
+ * Copy the collected directory records and their side records
+ */
+
+static void copy_dirs(struct compact *c, duc *src)
+{
+	size_t i, j;
+
+	qsort(c->keys, c->key_count, sizeof(*c->keys), cmp_dirkey);
+
+	for(i=0; i<c->key_count; i++) {
+		struct dirkey *k = &c->keys[i];
+		if(k->sides_only) continue;
+		size_t vall;
+		char *val = db_get(src->db, k->key, strlen(k->key), &vall);
+		if(val == NULL) continue;
+		db_put(c->duc->db, k->key, strlen(k->key), val, vall);
+		free(val);
+		c->bytes += vall;
+		c->dir_count ++;
+	}
+
+	for(j=0; j<sizeof(side_list) / sizeof(side_list[0]); j++) {
+		for(i=0; i<c->key_count; i++) {
+			struct seen *s;
+			HASH_FIND(hh, c->seen, &c->keys[i].devino, sizeof(c->keys[i].devino), s);
+			if(s->sides & (1u << j)) continue;
+			uint8_t check[DUC_DIGEST_SIZE];
+			digest_check(s->digest, s->meta, side_list[j].part, check);
+			size_t n = tally_copy(c->duc, src, side_list[j].prefix, &s->devino, check);
+			if(n) s->sides |= 1u << j;
+			c->bytes += n;
+		}
+	}
+
+	c->key_count = 0;
+}
+
+
+static void check_checkpoint(duc *src, const char *path)
+{
+	char key[DUC_PATH_MAX + 32];
+	size_t keyl = snprintf(key, sizeof(key), "duc_checkpoint:%s", path);
+	if(keyl >= sizeof(key)) keyl = sizeof(key) - 1;
+
+	size_t vall;
+	char *val = db_get(src->db, key, keyl, &vall);
+	if(val) {
+		if(vall > 0) {
+			duc_log(src, DUC_LOG_WRN, "Not copying the checkpoint of the interrupted index run of %s", path);
+		}
+		free(val);
+	}
+}
+
+
+/*
+ * Copy everything reachable from the index reports of the given databases
+ * into the database of this handle, which should be freshly created
+ */
+
+int duc_compact(duc *duc, struct duc **src, size_t src_count)
+{
+	size_t i, j;
+
+	if(duc->db == NULL) {
+		duc->err = DUC_E_DB_NOT_FOUND;
+		return -1;
+	}
+	for(i=0; i<src_count; i++) {
+		if(src[i]->db == NULL) {
+			duc->err = DUC_E_DB_NOT_FOUND;
+			return -1;
+		}
+	}
+
+	struct compact c;
+	memset(&c, 0, sizeof c);
+	c.duc = duc;
+	c.src = src;
+
+	struct root *roots;
+	size_t root_count = collect_roots(src, src_count, &roots);
+
+	for(i=0; i<src_count; i++) {
+
+		for(j=0; j<root_count; j++) {
+			if(roots[j].src == i) walk_root(&c, j, &roots[j]);
+		}
+
+		copy_dirs(&c, src[i]);
+
+		for(j=0; j<root_count; j++) {
+			if(roots[j].src != i) continue;
+			c.bytes += history_copy(duc, src[i], roots[j].report.path);
+			check_checkpoint(src[i], roots[j].report.path);
+			db_write_report(duc, &roots[j].report);
+		}
+	}
+
+	db_sync(duc->db);
+
+	duc_log(duc, DUC_LOG_INF, "Copied %zu index roots with %zu directories, %zu bytes of records",
+			root_count, c.dir_count, c.bytes);
+	if(c.conflicts) {
+		duc_log(duc, DUC_LOG_WRN, "%zu directories were found in more than one database with different contents", c.conflicts);
+	}
+
+	struct seen *s, *sn;
+	HASH_ITER(hh, c.seen, s, sn) {
+		HASH_DEL(c.seen, s);
+		duc_free(s);
+	}
+	duc_free(c.keys);
+	duc_free(roots);
+
+	return 0;
+}
+
+
+/*
+ * End
+ */
+
@@ -94,6 +94,13 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+duc_errno db_sync(struct db *db)
+{
+	int r = kcdbsync(db->kdb, 0, NULL, NULL);
+	return (r==1) ? DUC_OK : DUC_E_UNKNOWN;
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	size_t vall;
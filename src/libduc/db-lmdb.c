@@ -33,7 +33,8 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 	if(flags & DUC_OPEN_RW) {
 		open_flags |= MDB_CREATE;
 	} else {
-		env_flags |= MDB_RDONLY;
+		/* Read handles may be passed between threads, see duc_share() */
+		env_flags |= MDB_RDONLY | MDB_NOTLS;
 		txn_flags |= MDB_RDONLY;
 	}
 
@@ -99,6 +100,28 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+/*
+ * Commit the running transaction and start a new one
+ */
+
+duc_errno db_sync(struct db *db)
+{
+	int rc = mdb_txn_commit(db->txn);
+	if(rc != MDB_SUCCESS) {
+		fprintf(stderr, "%s\n", mdb_strerror(rc));
+		return DUC_E_DB_BACKEND;
+	}
+
+	rc = mdb_txn_begin(db->env, NULL, 0, &db->txn);
+	if(rc != MDB_SUCCESS) {
+		fprintf(stderr, "%s\n", mdb_strerror(rc));
+		exit(1);
+	}
+
+	return DUC_OK;
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	MDB_val k, d;
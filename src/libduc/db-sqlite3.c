@@ -78,6 +78,18 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+/*
+ * Commit the running transaction and start a new one
+ */
+
+duc_errno db_sync(struct db *db)
+{
+	int r = sqlite3_exec(db->s, "commit", 0, 0, 0);
+	sqlite3_exec(db->s, "begin", 0, 0, 0);
+	return (r == SQLITE_OK) ? DUC_OK : DUC_E_DB_BACKEND;
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	sqlite3_stmt *pStmt;
@@ -108,6 +108,13 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+duc_errno db_sync(struct db *db)
+{
+	int r = tcbdbsync(db->hdb);
+	return (r==1) ? DUC_OK : tcdb_to_errno(db->hdb);
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	int vall;
@@ -12,6 +12,18 @@
 
 
 
+/*
+ * Read a record through a handle. Handles sharing their database between
+ * threads take turns, see duc_share()
+ */
+
+void *duc_db_get(duc *duc, const void *key, size_t key_len, size_t *val_len)
+{
+	duc_db_lock(duc);
+	void *val = db_get(duc->db, key, key_len, val_len);
+	duc_db_unlock(duc);
+	return val;
+}
 
 
 /* 
@@ -30,6 +42,7 @@ duc_errno db_write_report(duc *duc, const struct duc_index_report *report)
 			tmp = duc_realloc(tmp, tmpl + sizeof(report->path));
 			memcpy(tmp + tmpl, report->path, sizeof(report->path));
 			db_put(duc->db, "duc_index_reports", 17, tmp, tmpl + sizeof(report->path));
+			free(tmp);
 		} else {
 			db_put(duc->db, "duc_index_reports", 17, report->path, sizeof(report->path));
 		}
@@ -52,7 +65,7 @@ struct duc_index_report *db_read_report(duc *duc, const char *path)
 	struct duc_index_report *report;
 	size_t vall;
 
-	char *val = db_get(duc->db, path, strlen(path), &vall);
+	char *val = duc_db_get(duc, path, strlen(path), &vall);
 	if(val == NULL) {
 		duc->err = DUC_E_PATH_NOT_FOUND;
 		return NULL;
@@ -60,7 +73,7 @@ struct duc_index_report *db_read_report(duc *duc, const char *path)
 
 	struct buffer *b = buffer_new(val, vall);
 
-	report = duc_malloc(sizeof *report);
+	report = duc_malloc0(sizeof *report);
 	buffer_get_index_report(b, report);
 	buffer_free(b);
 
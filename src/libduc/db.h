@@ -10,6 +10,9 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e);
 void db_close(struct db *db);
 duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val, size_t val_len);
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len);
+duc_errno db_sync(struct db *db);
+
+void *duc_db_get(duc *duc, const void *key, size_t key_len, size_t *val_len);
 
 
 duc_errno db_write_report(duc *duc, const struct duc_index_report *rep);
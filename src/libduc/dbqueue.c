@@ -0,0 +1,342 @@
+
+/*
+ * Database access of parallel index runs. The database backends do not allow
+ * more than one writer, and some bind their write transaction to the thread
+ * which opened the database, so only one thread may touch the database.
+ *
+ * Index threads get a handle of their own which points to a bounded queue
+ * instead of a database. Records to store are copied into the queue and
+ * written in order by the writer thread, so the checkpoint of a thread is
+ * never written before the records it refers to. Reads and calls wait until
+ * the writer has handled them. Handles without a queue access the database
+ * directly, so the same code serves sequential index runs.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "duc.h"
+#include "private.h"
+#include "db.h"
+#include "dbqueue.h"
+
+#ifdef HAVE_LIBPTHREAD
+
+enum op_type {
+	OP_PUT,
+	OP_GET,
+	OP_SYNC,
+	OP_CALL,
+};
+
+struct op {
+	enum op_type type;
+	struct op *next;
+	const void *key;
+	size_t key_len;
+	void *val;
+	size_t val_len;
+	dbqueue_fn fn;
+	void *ptr;
+	int r;
+	int done;
+};
+
+struct dbqueue {
+	duc *duc;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_writer;
+	pthread_cond_t cond_client;
+	struct op *head;
+	struct op *tail;
+	size_t len;
+	size_t len_max;
+	size_t running;
+	int clients;
+	int waiting;
+	duc_errno err;
+};
+
+
+/*
+ * Create a queue writing to the database of the given handle. The writer
+ * runs until the given number of clients have left the queue
+ */
+
+struct dbqueue *dbqueue_new(duc *duc, size_t len_max, int clients)
+{
+	struct dbqueue *q = duc_malloc0(sizeof *q);
+	q->duc = duc;
+	q->len_max = len_max;
+	q->clients = clients;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond_writer, NULL);
+	pthread_cond_init(&q->cond_client, NULL);
+	return q;
+}
+
+
+/*
+ * Returns the first error of the records written asynchronously
+ */
+
+duc_errno dbqueue_free(struct dbqueue *q)
+{
+	duc_errno err = q->err;
+	pthread_cond_destroy(&q->cond_client);
+	pthread_cond_destroy(&q->cond_writer);
+	pthread_mutex_destroy(&q->mutex);
+	duc_free(q);
+	return err;
+}
+
+
+static void op_run(struct dbqueue *q, struct op *op)
+{
+	struct db *db = q->duc->db;
+
+	switch(op->type) {
+		case OP_PUT:
+			op->r = db_put(db, op->key, op->key_len, op->val, op->val_len);
+			if(op->r != 0 && q->err == 0) q->err = op->r;
+			break;
+		case OP_GET:
+			op->val = db_get(db, op->key, op->key_len, &op->val_len);
+			break;
+		case OP_SYNC:
+			op->r = db_sync(db);
+			break;
+		case OP_CALL:
+			op->r = op->fn(q->duc, op->ptr);
+			break;
+	}
+}
+
+
+/*
+ * Handle queued operations in the calling thread until all clients are done.
+ * The writer takes all queued operations at once, so clients only need to be
+ * woken up when they wait for room or for the result of an operation
+ */
+
+void dbqueue_run(struct dbqueue *q)
+{
+	pthread_mutex_lock(&q->mutex);
+
+	for(;;) {
+		while(q->head == NULL && q->clients > 0) {
+			pthread_cond_wait(&q->cond_writer, &q->mutex);
+		}
+		if(q->head == NULL) break;
+
+		struct op *list = q->head;
+		q->head = q->tail = NULL;
+		q->running = q->len;
+		q->len = 0;
+		if(q->waiting) pthread_cond_broadcast(&q->cond_client);
+		pthread_mutex_unlock(&q->mutex);
+
+		struct op *op, *next;
+		int wake = 0;
+		for(op=list; op; op=op->next) {
+			op_run(q, op);
+			if(op->type != OP_PUT) wake = 1;
+		}
+
+		pthread_mutex_lock(&q->mutex);
+		q->running = 0;
+		for(op=list; op; op=next) {
+			next = op->next;
+			if(op->type == OP_PUT) {
+				duc_free(op);
+			} else {
+				op->done = 1;
+			}
+		}
+		if(wake) pthread_cond_broadcast(&q->cond_client);
+	}
+
+	pthread_mutex_unlock(&q->mutex);
+}
+
+
+/*
+ * Queue an operation, waiting for room in the queue. Operations other than
+ * puts live on the stack of the caller, which waits until they are done
+ */
+
+static void op_push(struct dbqueue *q, struct op *op)
+{
+	pthread_mutex_lock(&q->mutex);
+
+	while(q->len >= q->len_max) {
+		q->waiting ++;
+		pthread_cond_wait(&q->cond_client, &q->mutex);
+		q->waiting --;
+	}
+
+	op->next = NULL;
+	if(q->tail) {
+		q->tail->next = op;
+	} else {
+		q->head = op;
+		pthread_cond_signal(&q->cond_writer);
+	}
+	q->tail = op;
+	q->len ++;
+
+	if(op->type != OP_PUT) {
+		while(!op->done) {
+			pthread_cond_wait(&q->cond_client, &q->mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&q->mutex);
+}
+
+
+static void client_leave(struct dbqueue *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	q->clients --;
+	pthread_cond_signal(&q->cond_writer);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+
+/*
+ * A handle for an index thread. It shares the settings of the writer handle
+ * but has no database of its own
+ */
+
+duc *dbqueue_handle_new(struct dbqueue *q)
+{
+	duc *duc = duc_malloc(sizeof *duc);
+	*duc = *q->duc;
+	duc->db = NULL;
+	duc->err = 0;
+	duc->queue = q;
+	return duc;
+}
+
+
+void dbqueue_handle_free(duc *duc)
+{
+	client_leave(duc->queue);
+	duc_free(duc);
+}
+
+
+duc_errno dbqueue_put(duc *duc, const void *key, size_t key_len, const void *val, size_t val_len)
+{
+	if(duc->queue == NULL) return db_put(duc->db, key, key_len, val, val_len);
+
+	struct op *op = duc_malloc0(sizeof *op + key_len + val_len);
+	char *p = (char *)(op + 1);
+	memcpy(p, key, key_len);
+	memcpy(p + key_len, val, val_len);
+	op->type = OP_PUT;
+	op->key = p;
+	op->key_len = key_len;
+	op->val = p + key_len;
+	op->val_len = val_len;
+
+	op_push(duc->queue, op);
+	return 0;
+}
+
+
+void *dbqueue_get(duc *duc, const void *key, size_t key_len, size_t *val_len)
+{
+	if(duc->queue == NULL) return duc_db_get(duc, key, key_len, val_len);
+
+	struct op op = { .type = OP_GET, .key = key, .key_len = key_len };
+	op_push(duc->queue, &op);
+	*val_len = op.val_len;
+	return op.val;
+}
+
+
+duc_errno dbqueue_sync(duc *duc)
+{
+	if(duc->queue == NULL) return db_sync(duc->db);
+
+	struct op op = { .type = OP_SYNC };
+	op_push(duc->queue, &op);
+	return op.r;
+}
+
+
+/*
+ * Run a function in the writer thread, with the writer handle. Used for
+ * read-modify-write updates and for calling back the application
+ */
+
+int dbqueue_call(duc *duc, dbqueue_fn fn, void *ptr)
+{
+	if(duc->queue == NULL) return fn(duc, ptr);
+
+	struct op op = { .type = OP_CALL, .fn = fn, .ptr = ptr };
+	op_push(duc->queue, &op);
+	return op.r;
+}
+
+
+/*
+ * Number of operations queued or being handled by the writer
+ */
+
+size_t dbqueue_pending(duc *duc)
+{
+	struct dbqueue *q = duc->queue;
+	if(q == NULL) return 0;
+
+	pthread_mutex_lock(&q->mutex);
+	size_t n = q->len + q->running;
+	pthread_mutex_unlock(&q->mutex);
+	return n;
+}
+
+#else
+
+duc_errno dbqueue_put(duc *duc, const void *key, size_t key_len, const void *val, size_t val_len)
+{
+	return db_put(duc->db, key, key_len, val, val_len);
+}
+
+
+void *dbqueue_get(duc *duc, const void *key, size_t key_len, size_t *val_len)
+{
+	return db_get(duc->db, key, key_len, val_len);
+}
+
+
+duc_errno dbqueue_sync(duc *duc)
+{
+	return db_sync(duc->db);
+}
+
+
+int dbqueue_call(duc *duc, dbqueue_fn fn, void *ptr)
+{
+	return fn(duc, ptr);
+}
+
+
+size_t dbqueue_pending(duc *duc)
+{
+	return 0;
+}
+
+#endif
+
+
+/*
+ * End
+ */
+
@@ -0,0 +1,23 @@
+#ifndef dbqueue_h
+#define dbqueue_h
+
+#include "duc.h"
+
+struct dbqueue;
+
+typedef int (*dbqueue_fn)(duc *duc, void *ptr);
+
+struct dbqueue *dbqueue_new(duc *duc, size_t len_max, int clients);
+void dbqueue_run(struct dbqueue *q);
+duc_errno dbqueue_free(struct dbqueue *q);
+
+duc *dbqueue_handle_new(struct dbqueue *q);
+void dbqueue_handle_free(duc *duc);
+
+duc_errno dbqueue_put(duc *duc, const void *key, size_t key_len, const void *val, size_t val_len);
+void *dbqueue_get(duc *duc, const void *key, size_t key_len, size_t *val_len);
+duc_errno dbqueue_sync(duc *duc);
+int dbqueue_call(duc *duc, dbqueue_fn fn, void *ptr);
+size_t dbqueue_pending(duc *duc);
+
+#endif
@@ -0,0 +1,165 @@
+
+/*
+ * Directory digests. Every directory record holds a 128 bit digest covering
+ * the name, size and type of all its entries, and for subdirectories their
+ * own digest. Two directories with equal digests hold the same tree, which
+ * allows comparing trees without reading the records below them.
+ *
+ * The entry hashes are summed, so the digest does not depend on the order in
+ * which the entries were read from the file system. Device and inode numbers
+ * and modification times are not covered, so the same tree indexed on
+ * another machine has the same digest.
+ *
+ * Owners and times are hashed the same way into a separate 128 bit meta
+ * field, one half each. Breakdowns depending on these are checked against
+ * the digest combined with the half they depend on, see digest_check().
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "digest.h"
+
+
+struct hash {
+	uint64_t h1;
+	uint64_t h2;
+};
+
+
+static void hash_data(struct hash *h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	for(i=0; i<len; i++) {
+		h->h1 = (h->h1 ^ p[i]) * 0x100000001b3ULL;
+		h->h2 = (h->h2 + p[i]) * 0x9e3779b97f4a7c15ULL;
+		h->h2 ^= h->h2 >> 29;
+	}
+}
+
+
+static void hash_u64(struct hash *h, uint64_t v)
+{
+	uint8_t buf[8];
+	int i;
+	for(i=0; i<8; i++) buf[i] = v >> (i * 8);
+	hash_data(h, buf, sizeof(buf));
+}
+
+
+/*
+ * 64 bit finalizer from splitmix64, spreads the hashes over all bits before
+ * summing
+ */
+
+static uint64_t mix(uint64_t v)
+{
+	v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+	return v ^ (v >> 31);
+}
+
+
+static const struct hash hash_init = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+
+
+static void digest_add(struct digest *d, const struct hash *h)
+{
+	d->sum1 += mix(h->h1);
+	d->sum2 += mix(h->h2);
+	d->count ++;
+}
+
+
+void digest_add_ent(struct digest *d, const struct duc_dirent *ent, const uint8_t *digest_child)
+{
+	struct hash h = hash_init;
+
+	hash_data(&h, ent->name, strlen(ent->name) + 1);
+	hash_u64(&h, ent->size.apparent);
+	hash_u64(&h, ent->size.actual);
+	hash_u64(&h, ent->size.count);
+	hash_u64(&h, ent->type);
+	if(digest_child) hash_data(&h, digest_child, DUC_DIGEST_SIZE);
+
+	digest_add(d, &h);
+}
+
+
+/*
+ * Add the owner and times of an entry. Subdirectories are added with the
+ * meta field of their own record, which covers their own owner
+ */
+
+void digest_meta_add(struct digest_meta *m, const char *name, uint64_t uid, uint64_t mtime, uint64_t atime, const uint8_t *meta_child)
+{
+	struct hash h = hash_init;
+	hash_data(&h, name, strlen(name) + 1);
+	hash_u64(&h, uid);
+	if(meta_child) hash_data(&h, meta_child, DIGEST_META_SIZE / 2);
+	digest_add(&m->uid, &h);
+
+	h = hash_init;
+	hash_data(&h, name, strlen(name) + 1);
+	hash_u64(&h, mtime);
+	hash_u64(&h, atime);
+	if(meta_child) hash_data(&h, meta_child + DIGEST_META_SIZE / 2, DIGEST_META_SIZE / 2);
+	digest_add(&m->time, &h);
+}
+
+
+void digest_final(const struct digest *d, uint8_t *digest)
+{
+	uint64_t h1 = mix(d->sum1 ^ mix(d->count));
+	uint64_t h2 = mix(d->sum2 + d->count);
+	int i;
+
+	for(i=0; i<8; i++) {
+		digest[i] = h1 >> (i * 8);
+		digest[i+8] = h2 >> (i * 8);
+	}
+}
+
+
+void digest_meta_final(const struct digest_meta *m, uint8_t *meta)
+{
+	uint64_t h1 = mix(mix(m->uid.sum1 ^ mix(m->uid.count)) + m->uid.sum2);
+	uint64_t h2 = mix(mix(m->time.sum1 ^ mix(m->time.count)) + m->time.sum2);
+	int i;
+
+	for(i=0; i<8; i++) {
+		meta[i] = h1 >> (i * 8);
+		meta[i+8] = h2 >> (i * 8);
+	}
+}
+
+
+/*
+ * Combine the digest with the part of the meta field a breakdown depends on,
+ * giving the value its side record is checked against
+ */
+
+void digest_check(const uint8_t *digest, const uint8_t *meta, enum digest_meta_part part, uint8_t *check)
+{
+	const uint8_t *m = meta + (part == DIGEST_META_TIME ? DIGEST_META_SIZE / 2 : 0);
+	int i;
+
+	memcpy(check, digest, DUC_DIGEST_SIZE);
+	if(part == DIGEST_META_NONE) return;
+
+	for(i=0; i<DIGEST_META_SIZE / 2; i++) {
+		check[i] ^= m[i];
+		check[i + DUC_DIGEST_SIZE / 2] ^= m[i];
+	}
+}
+
+
+/*
+ * End
+ */
+
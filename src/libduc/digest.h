@@ -0,0 +1,34 @@
+#ifndef digest_h
+#define digest_h
+
+#include "duc.h"
+
+struct digest {
+	uint64_t sum1;
+	uint64_t sum2;
+	uint64_t count;
+};
+
+/* Owners and times of the entries, which the digest leaves out. Breakdowns
+ * by owner or time are only valid while these are unchanged */
+
+#define DIGEST_META_SIZE 16
+
+enum digest_meta_part {
+	DIGEST_META_NONE,
+	DIGEST_META_UID,
+	DIGEST_META_TIME,
+};
+
+struct digest_meta {
+	struct digest uid;
+	struct digest time;
+};
+
+void digest_add_ent(struct digest *d, const struct duc_dirent *ent, const uint8_t *digest_child);
+void digest_final(const struct digest *d, uint8_t *digest);
+void digest_meta_add(struct digest_meta *m, const char *name, uint64_t uid, uint64_t mtime, uint64_t atime, const uint8_t *meta_child);
+void digest_meta_final(const struct digest_meta *m, uint8_t *meta);
+void digest_check(const uint8_t *digest, const uint8_t *meta, enum digest_meta_part part, uint8_t *check);
+
+#endif
@@ -12,10 +12,13 @@
 #include "db.h"
 #include "buffer.h"
 #include "private.h"
+#include "dircache.h"
+#include "federate.h"
 
 
 struct duc_dir {
 	struct duc *duc;
+	struct dir_data *data;
 	struct duc_devino devino;
 	struct duc_devino devino_parent;
 	time_t mtime;
@@ -24,57 +27,103 @@ struct duc_dir {
 	struct duc_size size;
 	size_t ent_cur;
 	size_t ent_count;
-	size_t ent_pool;
 	duc_size_type size_type;
 	duc_sort sort;
 };
 
 
-struct duc_dir *duc_dir_new(struct duc *duc, const struct duc_devino *devino)
+/*
+ * Read and decode a directory record from the database. Only the read itself
+ * holds the database lock, so threads sharing a handle decode in parallel
+ */
+
+struct dir_data *dir_data_read(duc *duc, const struct duc_devino *devino)
 {
 	size_t vall;
 	char key[32];
 	size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
-	char *val = db_get(duc->db, key, keyl, &vall);
+	char *val = duc_db_get(duc, key, keyl, &vall);
 	if(val == NULL) {
-		duc->err = DUC_E_PATH_NOT_FOUND;
 		return NULL;
 	}
 
-	struct duc_dir *dir = duc_malloc0(sizeof(struct duc_dir));
+	struct dir_data *d = dir_data_new();
 
-	dir->duc = duc;
-	dir->devino.dev = devino->dev;
-	dir->devino.ino = devino->ino;
-	dir->path = NULL;
-	dir->ent_pool = 32768;
-	dir->ent_list = duc_malloc(dir->ent_pool);
-	dir->size_type = -1;
+	d->devino.dev = devino->dev;
+	d->devino.ino = devino->ino;
+
+	size_t ent_pool = 32768;
+	d->ent_list = duc_malloc(ent_pool);
 
 	struct buffer *b = buffer_new(val, vall);
 
 	/* Read dir header */
 
-	buffer_get_dir(b, &dir->devino_parent, &dir->mtime);
+	buffer_get_dir(b, &d->devino_parent, &d->mtime, d->digest, d->meta);
 
 	/* Read all dirents */
 
 	while(b->ptr < b->len) {
 
-		if((dir->ent_count+1) * sizeof(struct duc_dirent) > dir->ent_pool) {
-			dir->ent_pool *= 2;
-			dir->ent_list = duc_realloc(dir->ent_list, dir->ent_pool);
+		if((d->ent_count+1) * sizeof(struct duc_dirent) > ent_pool) {
+			ent_pool *= 2;
+			d->ent_list = duc_realloc(d->ent_list, ent_pool);
 		}
 
-		struct duc_dirent *ent = &dir->ent_list[dir->ent_count];
+		struct duc_dirent *ent = &d->ent_list[d->ent_count];
 		buffer_get_dirent(b, ent);
 
-		duc_size_accum(&dir->size, &ent->size);
-		dir->ent_count ++;
+		duc_size_accum(&d->size, &ent->size);
+		d->ent_count ++;
+		d->mem += sizeof(struct duc_dirent) + strlen(ent->name) + 1;
 	}
 
 	buffer_free(b);
 
+	d->ent_list = duc_realloc(d->ent_list, d->ent_count * sizeof(struct duc_dirent) + 1);
+	d->mem += sizeof(*d);
+
+	return d;
+}
+
+
+struct duc_dir *duc_dir_new(struct duc *duc, const struct duc_devino *devino)
+{
+	struct dir_data *d = NULL;
+
+	if(duc->dircache) {
+		d = dircache_get(duc->dircache, duc->dircache_db, devino);
+	}
+
+	if(d == NULL) {
+		d = dir_data_read(duc, devino);
+		if(d == NULL) {
+			duc->err = DUC_E_PATH_NOT_FOUND;
+			return NULL;
+		}
+		if(duc->dircache) {
+			dircache_put(duc->dircache, duc->dircache_db, d);
+		}
+	}
+
+	struct duc_dir *dir = duc_malloc0(sizeof(struct duc_dir));
+
+	dir->duc = duc;
+	dir->data = d;
+	dir->devino = d->devino;
+	dir->devino_parent = d->devino_parent;
+	dir->mtime = d->mtime;
+	dir->size = d->size;
+	dir->path = NULL;
+	dir->size_type = -1;
+
+	/* The dirent array is sorted in place by duc_dir_read(), so every dir
+	 * gets its own copy. The names are shared with the decoded record */
+
+	dir->ent_count = d->ent_count;
+	dir->ent_list = duc_malloc(d->ent_count * sizeof(struct duc_dirent) + 1);
+	memcpy(dir->ent_list, d->ent_list, d->ent_count * sizeof(struct duc_dirent));
+
 	return dir;
 }
 
@@ -91,12 +140,52 @@ size_t duc_dir_get_count(duc_dir *dir)
 }
 
 
+/*
+ * Get the digest of the tree below this directory. Directories with equal
+ * digests hold the same names, sizes and subdirectories
+ */
+
+void duc_dir_get_digest(duc_dir *dir, uint8_t *digest)
+{
+	memcpy(digest, dir->data->digest, DUC_DIGEST_SIZE);
+}
+
+
+/*
+ * Get the value the side records of a breakdown depending on the given part
+ * of the meta field are checked against
+ */
+
+void duc_dir_get_check(duc_dir *dir, enum digest_meta_part part, uint8_t *check)
+{
+	digest_check(dir->data->digest, dir->data->meta, part, check);
+}
+
+
 char *duc_dir_get_path(duc_dir *dir)
 {
 	return strdup(dir->path);
 }
 
 
+struct duc *duc_dir_get_duc(duc_dir *dir)
+{
+	return dir->duc;
+}
+
+
+void duc_dir_get_parent(duc_dir *dir, struct duc_devino *devino)
+{
+	*devino = dir->devino_parent;
+}
+
+
+void duc_dir_get_devino(duc_dir *dir, struct duc_devino *devino)
+{
+	*devino = dir->devino;
+}
+
+
 duc_dir *duc_dir_openent(duc_dir *dir, const struct duc_dirent *e)
 {
 	duc_dir *dir2 = duc_dir_new(dir->duc, &e->devino);
@@ -158,6 +247,17 @@ struct duc_dirent *duc_dir_find_child(duc_dir *dir, const char *name)
 
 duc_dir *duc_dir_open(struct duc *duc, const char *path)
 {
+	/* On federated handles the directory is opened from the database
+	 * holding it */
+
+	if(duc->shards) {
+		struct duc *shard = federate_route(duc, path);
+		if(shard == NULL) return NULL;
+		duc_dir *dir = duc_dir_open(shard, path);
+		if(dir == NULL) duc->err = shard->err;
+		return dir;
+	}
+
 	/* Canonicalized path */
 
 	char *path_canon = duc_canonicalize_path(path);
@@ -204,7 +304,8 @@ duc_dir *duc_dir_open(struct duc *duc, const char *path)
 	char rest[DUC_PATH_MAX];
 	strncpy(rest, path_canon+l, sizeof rest);
 
-	char *name = strtok(rest, "/");
+	char *saveptr = NULL;
+	char *name = strtok_r(rest, "/", &saveptr);
 
 	while(dir && name) {
 
@@ -218,10 +319,11 @@ duc_dir *duc_dir_open(struct duc *duc, const char *path)
 
 		duc_dir_close(dir);
 		dir = dir_next;
-		name = strtok(NULL, "/");
+		name = strtok_r(NULL, "/", &saveptr);
 	}
 
 	if(dir) {
+		free(dir->path);
 		dir->path = strdup(path_canon);
 	}
 
@@ -339,10 +441,7 @@ int duc_dir_rewind(duc_dir *dir)
 int duc_dir_close(duc_dir *dir)
 {
 	if(dir->path) free(dir->path);
-	size_t i;
-	for(i=0; i<dir->ent_count; i++) {
-		free(dir->ent_list[i].name);
-	}
+	dir_data_unref(dir->data);
 	free(dir->ent_list);
 	free(dir);
 	return 0;
@@ -353,11 +452,16 @@ struct duc_index_report *duc_get_report(duc *duc, size_t id)
 {
 	size_t indexl;
 
-	char *index = db_get(duc->db, "duc_index_reports", 17, &indexl);
+	if(duc->shards) return federate_get_report(duc, id);
+
+	char *index = duc_db_get(duc, "duc_index_reports", 17, &indexl);
 	if(index == NULL) return NULL;
 
 	size_t report_count = indexl / DUC_PATH_MAX;
-	if(id >= report_count) return NULL;
+	if(id >= report_count) {
+		free(index);
+		return NULL;
+	}
 
 	char *path = index + id * DUC_PATH_MAX;
 
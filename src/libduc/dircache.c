@@ -0,0 +1,274 @@
+
+/*
+ * Cache of decoded directory records, keyed by database and device/inode. Opening a
+ * directory which is in the cache only copies the dirent array, the names
+ * are shared with the cached record. The cache is bounded by the memory used
+ * by its records, the least recently used records are dropped first. Records
+ * dropped from the cache stay alive until the last duc_dir using them is
+ * closed.
+ *
+ * A cache can be shared between duc handles, for example by the worker
+ * threads of a server, so all accesses are locked. The handles may read
+ * different databases, and a database may be indexed again while the cache
+ * lives, so the key holds an id of the database and of its last index run,
+ * see dircache_db_id(). Records of other ids are never found and are dropped
+ * as the least recently used.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "private.h"
+#include "utlist.h"
+#include "dircache.h"
+
+struct duc_dircache {
+	size_t mem;
+	size_t mem_max;
+	size_t hits;
+	size_t misses;
+	int refs;
+	struct dir_data *map;
+	struct dir_data *lru;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t mutex;
+#endif
+};
+
+
+#ifdef HAVE_LIBPTHREAD
+#define LOCK(c) pthread_mutex_lock(&(c)->mutex)
+#define UNLOCK(c) pthread_mutex_unlock(&(c)->mutex)
+#else
+#define LOCK(c)
+#define UNLOCK(c)
+#endif
+
+
+struct dir_data *dir_data_new(void)
+{
+	struct dir_data *d = duc_malloc0(sizeof *d);
+	d->refs = 1;
+	return d;
+}
+
+
+void dir_data_ref(struct dir_data *d)
+{
+	__sync_add_and_fetch(&d->refs, 1);
+}
+
+
+void dir_data_unref(struct dir_data *d)
+{
+	if(__sync_sub_and_fetch(&d->refs, 1) > 0) return;
+
+	size_t i;
+	for(i=0; i<d->ent_count; i++) {
+		duc_free(d->ent_list[i].name);
+	}
+	duc_free(d->ent_list);
+	duc_free(d);
+}
+
+
+duc_dircache *duc_dircache_new(size_t mem_max)
+{
+	duc_dircache *c = duc_malloc0(sizeof *c);
+	c->mem_max = mem_max;
+	c->refs = 1;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&c->mutex, NULL);
+#endif
+	return c;
+}
+
+
+void dircache_ref(duc_dircache *c)
+{
+	__sync_add_and_fetch(&c->refs, 1);
+}
+
+
+/*
+ * Drop a reference to the cache, the cache is freed when the last handle
+ * using it is deleted
+ */
+
+void duc_dircache_free(duc_dircache *c)
+{
+	if(__sync_sub_and_fetch(&c->refs, 1) > 0) return;
+
+	duc_dircache_purge(c);
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_destroy(&c->mutex);
+#endif
+	duc_free(c);
+}
+
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t i;
+	for(i=0; i<len; i++) {
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+
+/*
+ * Id of the database opened by the handle, made of the resolved path of the
+ * database and the end times of its index runs. Indexing the database again
+ * gives a new id, so records read before are not used any more
+ */
+
+uint64_t dircache_db_id(duc *duc)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const char *path = duc->path_db ? duc->path_db : "";
+	char real[PATH_MAX];
+
+	if(realpath(path, real)) path = real;
+	h = fnv(h, path, strlen(path));
+
+	struct duc_index_report *report;
+	size_t i = 0;
+
+	while((report = duc_get_report(duc, i)) != NULL) {
+		int64_t t[2] = { report->time_stop.tv_sec, report->time_stop.tv_usec };
+		h = fnv(h, t, sizeof(t));
+		duc_index_report_free(report);
+		i++;
+	}
+
+	return h;
+}
+
+
+static void set_key(struct dircache_key *k, uint64_t db, const struct duc_devino *devino)
+{
+	memset(k, 0, sizeof *k);
+	k->db = db;
+	k->devino = *devino;
+}
+
+
+static void evict(duc_dircache *c, struct dir_data *d)
+{
+	HASH_DEL(c->map, d);
+	DL_DELETE(c->lru, d);
+	c->mem -= d->mem;
+	dir_data_unref(d);
+}
+
+
+/*
+ * Drop all records from the cache, used when the database has changed
+ */
+
+void duc_dircache_purge(duc_dircache *c)
+{
+	LOCK(c);
+	while(c->lru) {
+		evict(c, c->lru);
+	}
+	UNLOCK(c);
+}
+
+
+void duc_dircache_get_stats(duc_dircache *c, size_t *hits, size_t *misses, size_t *mem)
+{
+	LOCK(c);
+	if(hits) *hits = c->hits;
+	if(misses) *misses = c->misses;
+	if(mem) *mem = c->mem;
+	UNLOCK(c);
+}
+
+
+/*
+ * Lookup a record in the cache. Returns a new reference to the record, or
+ * NULL if not found.
+ */
+
+struct dir_data *dircache_get(duc_dircache *c, uint64_t db, const struct duc_devino *devino)
+{
+	struct dircache_key k;
+	struct dir_data *d;
+
+	set_key(&k, db, devino);
+
+	LOCK(c);
+	HASH_FIND(hh, c->map, &k, sizeof(k), d);
+	if(d) {
+		DL_DELETE(c->lru, d);
+		DL_APPEND(c->lru, d);
+		dir_data_ref(d);
+		c->hits ++;
+	} else {
+		c->misses ++;
+	}
+	UNLOCK(c);
+
+	return d;
+}
+
+
+/*
+ * Check if a record is in the cache, without touching the LRU order or the
+ * hit statistics
+ */
+
+int dircache_has(duc_dircache *c, uint64_t db, const struct duc_devino *devino)
+{
+	struct dircache_key k;
+	struct dir_data *d;
+
+	set_key(&k, db, devino);
+
+	LOCK(c);
+	HASH_FIND(hh, c->map, &k, sizeof(k), d);
+	UNLOCK(c);
+
+	return d != NULL;
+}
+
+
+/*
+ * Add a freshly decoded record to the cache. If another handle added the same
+ * record in the meantime, the existing one is kept.
+ */
+
+void dircache_put(duc_dircache *c, uint64_t db, struct dir_data *d)
+{
+	if(d->mem > c->mem_max) return;
+
+	struct dir_data *d2;
+
+	LOCK(c);
+	set_key(&d->key, db, &d->devino);
+	HASH_FIND(hh, c->map, &d->key, sizeof(d->key), d2);
+	if(d2 == NULL) {
+		dir_data_ref(d);
+		HASH_ADD(hh, c->map, key, sizeof(d->key), d);
+		DL_APPEND(c->lru, d);
+		c->mem += d->mem;
+		while(c->mem > c->mem_max && c->lru != d) {
+			evict(c, c->lru);
+		}
+	}
+	UNLOCK(c);
+}
+
+
+/*
+ * End
+ */
@@ -0,0 +1,51 @@
+#ifndef dircache_h
+#define dircache_h
+
+#include "duc.h"
+#include "digest.h"
+#include "uthash.h"
+
+/*
+ * Records are cached per database, a cache shared between handles may hold
+ * records of several databases, and of earlier index runs on them
+ */
+
+struct dircache_key {
+	uint64_t db;
+	struct duc_devino devino;
+};
+
+/*
+ * Decoded directory record. These are immutable after decoding and shared
+ * between the cache and all duc_dir objects opened on the same directory.
+ */
+
+struct dir_data {
+	struct duc_devino devino;
+	struct duc_devino devino_parent;
+	time_t mtime;
+	uint8_t digest[DUC_DIGEST_SIZE];
+	uint8_t meta[DIGEST_META_SIZE];
+	struct duc_dirent *ent_list;
+	size_t ent_count;
+	struct duc_size size;
+	struct dircache_key key;
+	size_t mem;
+	int refs;
+	UT_hash_handle hh;
+	struct dir_data *prev;
+	struct dir_data *next;
+};
+
+struct dir_data *dir_data_new(void);
+struct dir_data *dir_data_read(duc *duc, const struct duc_devino *devino);
+void dir_data_ref(struct dir_data *d);
+void dir_data_unref(struct dir_data *d);
+
+uint64_t dircache_db_id(duc *duc);
+struct dir_data *dircache_get(duc_dircache *c, uint64_t db, const struct duc_devino *devino);
+int dircache_has(duc_dircache *c, uint64_t db, const struct duc_devino *devino);
+void dircache_put(duc_dircache *c, uint64_t db, struct dir_data *d);
+void dircache_ref(duc_dircache *c);
+
+#endif
@@ -12,10 +12,15 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #include "private.h"
 #include "duc.h"
 #include "db.h"
+#include "dircache.h"
+#include "federate.h"
 
 
 static void default_log_callback(duc_log_level level, const char *fmt, va_list va)
@@ -25,6 +30,121 @@ static void default_log_callback(duc_log_level level, const char *fmt, va_list v
 }
 
 
+#ifdef HAVE_LIBPTHREAD
+
+/*
+ * Few backends allow a process to open the same database twice, and not all
+ * of them allow one database handle to be used by several threads at once.
+ * Threads reading the same database therefore share one handle and take
+ * turns through this lock.
+ */
+
+struct dblock {
+	pthread_mutex_t mutex;
+	int refs;
+};
+
+static pthread_mutex_t dblock_refs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static struct dblock *dblock_ref(struct dblock *l)
+{
+	pthread_mutex_lock(&dblock_refs_mutex);
+	l->refs ++;
+	pthread_mutex_unlock(&dblock_refs_mutex);
+	return l;
+}
+
+
+static void dblock_unref(struct dblock *l)
+{
+	pthread_mutex_lock(&dblock_refs_mutex);
+	int refs = --l->refs;
+	pthread_mutex_unlock(&dblock_refs_mutex);
+
+	if(refs == 0) {
+		pthread_mutex_destroy(&l->mutex);
+		duc_free(l);
+	}
+}
+
+
+/*
+ * Make the database of the handle safe for reading from several threads.
+ * The shards of a federated handle each get a lock of their own.
+ */
+
+void duc_db_lock_init(duc *duc)
+{
+	if(duc->lock == NULL) {
+		duc->lock = duc_malloc0(sizeof *duc->lock);
+		pthread_mutex_init(&duc->lock->mutex, NULL);
+		duc->lock->refs = 1;
+	}
+
+	if(duc->shards) {
+		federate_lock_init(duc);
+	}
+}
+
+
+void duc_db_lock(duc *duc)
+{
+	if(duc->lock) pthread_mutex_lock(&duc->lock->mutex);
+}
+
+
+void duc_db_unlock(duc *duc)
+{
+	if(duc->lock) pthread_mutex_unlock(&duc->lock->mutex);
+}
+
+#else
+
+#define dblock_ref(l) (l)
+#define dblock_unref(l)
+
+void duc_db_lock_init(duc *duc)
+{
+}
+
+
+void duc_db_lock(duc *duc)
+{
+}
+
+
+void duc_db_unlock(duc *duc)
+{
+}
+
+#endif
+
+
+/*
+ * Return a new handle reading the database of the given one, for use by
+ * another thread. The handles share the database, the directory cache and
+ * the shards of a federated database, but have their own error state. Close
+ * all shared handles before closing the handle they were made from.
+ */
+
+duc *duc_share(duc *duc)
+{
+	duc_db_lock_init(duc);
+
+	struct duc *d = duc_malloc(sizeof *d);
+	*d = *duc;
+	d->err = 0;
+	d->shared = 1;
+	d->dircache_private = 0;
+	d->shard_shares = NULL;
+	if(d->dircache) dircache_ref(d->dircache);
+	if(d->lock) d->lock = dblock_ref(d->lock);
+
+	return d;
+}
+
+
 
 duc *duc_new(void)
 {
@@ -39,11 +159,29 @@ duc *duc_new(void)
 
 void duc_del(duc *duc)
 {
-	if(duc->db) duc_close(duc);
+	if(duc->db || duc->shards) duc_close(duc);
+	if(duc->dircache) duc_dircache_free(duc->dircache);
 	free(duc);
 }
 
 
+/*
+ * Use the given directory cache for this handle, which allows sharing one
+ * cache between handles. Records are kept per database and index run, so the
+ * handles may read different databases. Without this every handle gets its
+ * own cache, which is emptied when the database is closed.
+ */
+
+int duc_set_dircache(duc *duc, duc_dircache *cache)
+{
+	if(duc->dircache) duc_dircache_free(duc->dircache);
+	duc->dircache = cache;
+	duc->dircache_private = 0;
+	if(cache) dircache_ref(cache);
+	return 0;
+}
+
+
 void duc_set_log_level(duc *duc, duc_log_level level)
 {
 	duc->log_level = level;
@@ -120,6 +258,12 @@ int duc_open(duc *duc, const char *path_db, duc_open_flags flags)
 		return -1;
 	}
 
+	/* A list of databases or a wildcard pattern opens them all together */
+
+	if(!(flags & DUC_OPEN_RW) && federate_is_spec(path_db)) {
+		return federate_open(duc, path_db, flags);
+	}
+
 	duc_log(duc, DUC_LOG_INF, "%s database \"%s\"", 
 			(flags & DUC_OPEN_RO) ? "Reading from" : "Writing to",
 			path_db);
@@ -130,15 +274,69 @@ int duc_open(duc *duc, const char *path_db, duc_open_flags flags)
 		return -1;
 	}
 
+	/* Not all backends check the database version. Databases without a
+	 * version but with index reports were written by an older version */
+
+	size_t vall;
+	char *version = db_get(duc->db, "duc_db_version", 14, &vall);
+	int version_ok = 1;
+	if(version) {
+		version_ok = vall == strlen(DUC_DB_VERSION) && memcmp(version, DUC_DB_VERSION, vall) == 0;
+		free(version);
+	} else {
+		char *reports = db_get(duc->db, "duc_index_reports", 17, &vall);
+		if(reports) {
+			version_ok = 0;
+			free(reports);
+		} else if(flags & DUC_OPEN_RW) {
+			db_put(duc->db, "duc_db_version", 14, DUC_DB_VERSION, strlen(DUC_DB_VERSION));
+		}
+	}
+
+	if(!version_ok) {
+		db_close(duc->db);
+		duc->db = NULL;
+		duc->err = DUC_E_DB_VERSION_MISMATCH;
+		duc_log(duc, DUC_LOG_FTL, "Error opening: %s - %s", path_db, duc_strerror(duc));
+		return -1;
+	}
+
+	duc->path_db = duc_strdup(path_db);
+	duc->dircache_db = dircache_db_id(duc);
+
+	if(duc->dircache == NULL) {
+		duc->dircache = duc_dircache_new(DUC_DIRCACHE_DEFAULT_SIZE);
+		duc->dircache_private = 1;
+	}
+
 	return 0;
 }
 
 
 int duc_close(struct duc *duc)
 {
+	if(duc->shared) {
+		if(duc->shards) federate_close(duc);
+		duc->db = NULL;
+		duc->shards = NULL;
+		duc->shard_count = 0;
+		duc->path_db = NULL;
+	}
+	if(duc->shards) {
+		federate_close(duc);
+	}
 	if(duc->db) {
 		db_close(duc->db);
 		duc->db = NULL;
+		duc_free(duc->path_db);
+		duc->path_db = NULL;
+		if(duc->dircache_private) {
+			duc_dircache_purge(duc->dircache);
+		}
+	}
+	if(duc->lock) {
+		dblock_unref(duc->lock);
+		duc->lock = NULL;
 	}
 	return 0;
 }
@@ -261,6 +459,55 @@ int duc_human_duration(struct timeval start, struct timeval stop, char *buf, siz
 }
 
 
+/*
+ * Write a string in double quotes, escaped for the given format. Runs of
+ * characters which need no escaping are passed to put() in one go. The
+ * Prometheus text format only escapes backslash, double quote and newline
+ */
+
+void duc_quote(const char *s, duc_quote_style style, duc_put_cb put, void *ptr)
+{
+	int json = style == DUC_QUOTE_JSON;
+
+	put("\"", 1, ptr);
+
+	for(;;) {
+		const char *run = s;
+		while(*s != '\0' && *s != '"' && *s != '\\' && *s != '\n' && (!json || (uint8_t)*s >= 0x20)) s++;
+		if(s > run) put(run, s - run, ptr);
+		if(*s == '\0') break;
+
+		char esc[8];
+		switch(*s) {
+			case '"': put("\\\"", 2, ptr); break;
+			case '\\': put("\\\\", 2, ptr); break;
+			case '\n': put("\\n", 2, ptr); break;
+			case '\r': put("\\r", 2, ptr); break;
+			case '\t': put("\\t", 2, ptr); break;
+			default:
+				snprintf(esc, sizeof(esc), "\\u%04x", *(uint8_t *)s);
+				put(esc, 6, ptr);
+				break;
+		}
+		s++;
+	}
+
+	put("\"", 1, ptr);
+}
+
+
+static void put_file(const char *s, size_t len, void *ptr)
+{
+	fwrite(s, 1, len, ptr);
+}
+
+
+void duc_fquote(FILE *f, const char *s, duc_quote_style style)
+{
+	duc_quote(s, style, put_file, f);
+}
+
+
 off_t duc_get_size(struct duc_size *size, duc_size_type st)
 {
 	switch(st) {
@@ -325,6 +572,34 @@ void duc_free(void *p)
 }
 
 
+/*
+ * Join a directory path and a name, allocated with duc_malloc()
+ */
+
+char *duc_path_join(const char *parent, const char *name)
+{
+	size_t l1 = strlen(parent);
+	size_t l2 = strlen(name);
+	char *path = duc_malloc(l1 + l2 + 2);
+	memcpy(path, parent, l1);
+	if(l1 == 0 || parent[l1-1] != '/') path[l1++] = '/';
+	memcpy(path + l1, name, l2 + 1);
+	return path;
+}
+
+
+/*
+ * Check if path is the directory prefix or below it
+ */
+
+int duc_path_is_below(const char *path, const char *prefix)
+{
+	size_t l = strlen(prefix);
+	if(strncmp(path, prefix, l) != 0) return 0;
+	return path[l] == '\0' || path[l] == '/' || (l > 0 && prefix[l-1] == '/');
+}
+
+
 static struct {
 	char c;
 	char *s;
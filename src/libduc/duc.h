@@ -12,6 +12,9 @@
 #include <sys/time.h>
 
 #define DUC_PATH_MAX 16384
+#define DUC_DIGEST_SIZE 16
+#define DUC_EXT_MAX 16
+#define DUC_AGE_BUCKETS 64
 
 #ifdef WIN32
 typedef int64_t duc_dev_t;
@@ -23,7 +26,9 @@ typedef ino_t duc_ino_t;
 
 typedef struct duc duc;
 typedef struct duc_dir duc_dir;
+typedef struct duc_dircache duc_dircache;
 typedef struct duc_index_req duc_index_req;
+typedef struct duc_walk_req duc_walk_req;
 
 typedef enum {
 	DUC_OPEN_RO = 1<<0,        /* Open read-only (for querying)*/
@@ -38,6 +43,12 @@ typedef enum {
 	DUC_INDEX_HIDE_FILE_NAMES  = 1<<1, /* Hide file names */
 	DUC_INDEX_CHECK_HARD_LINKS = 1<<2, /* Count hard links only once during indexing */
 	DUC_INDEX_DRY_RUN          = 1<<3, /* Do not touch the database */
+	DUC_INDEX_RESUME           = 1<<4, /* Resume from the last checkpoint */
+	DUC_INDEX_NAMES            = 1<<5, /* Build name index for duc_find() */
+	DUC_INDEX_HISTORY          = 1<<6, /* Keep a generation of the tree for duc_diff() */
+	DUC_INDEX_USERS            = 1<<7, /* Keep the usage per user for duc_dir_get_users() */
+	DUC_INDEX_EXTS             = 1<<8, /* Keep the usage per extension for duc_dir_get_exts() */
+	DUC_INDEX_AGES             = 1<<9, /* Keep file age histograms for duc_dir_get_ages() */
 } duc_index_flags;
 
 typedef enum {
@@ -51,6 +62,11 @@ typedef enum {
 	DUC_SORT_NAME = 2,
 } duc_sort;
 
+typedef enum {
+	DUC_AGE_MTIME = 'm',        /* Age by modification time */
+	DUC_AGE_ATIME = 'a',        /* Age by access time */
+} duc_age_type;
+
 typedef enum {
 	DUC_OK,                     /* No error, success */
 	DUC_E_DB_NOT_FOUND,         /* Database not found */
@@ -102,6 +118,10 @@ struct duc_index_report {
 	size_t file_count;          /* Total number of files indexed */
 	size_t dir_count;           /* Total number of directories indexed */
 	struct duc_size size;       /* Total size */
+	size_t error_count;         /* Number of entries which could not be read */
+	const char *path_current;   /* Directory being scanned, only valid in progress callback */
+	int depth_current;          /* Depth of the directory being scanned */
+	size_t queue_current;       /* Records waiting for the database writer, only valid in progress callback */
 };
 
 struct duc_dirent {
@@ -111,6 +131,22 @@ struct duc_dirent {
 	struct duc_devino devino;   /* Device id and inode number */
 };
 
+struct duc_user {
+	uid_t uid;                  /* User id */
+	struct duc_size size;       /* Size of all files owned by this user */
+};
+
+struct duc_ext {
+	char name[DUC_EXT_MAX + 1]; /* Extension, "" for files without one, "*" for all others */
+	struct duc_size size;       /* Size of all regular files with this extension */
+};
+
+struct duc_age {
+	time_t time_min;            /* Oldest time in this bucket */
+	time_t time_max;            /* Newest time in this bucket, or later for the youngest bucket */
+	struct duc_size size;       /* Size of all files with a time in this bucket */
+};
+
 /*
  * Duc context, logging and error reporting
  */
@@ -133,6 +169,7 @@ const char *duc_strerror(duc *duc);
 
 int duc_open(duc *duc, const char *path_db, duc_open_flags flags);
 int duc_close(duc *duc);
+int duc_compact(duc *duc, struct duc **src, size_t count);
 
 
 /*
@@ -140,6 +177,7 @@ int duc_close(duc *duc);
  */
 
 typedef void (*duc_index_progress_cb)(struct duc_index_report *report, void *ptr);
+typedef void (*duc_index_done_cb)(const char *path, struct duc_index_report *report, void *ptr);
 
 duc_index_req *duc_index_req_new(duc *duc);
 int duc_index_req_set_username(duc_index_req *req, const char *username);
@@ -148,8 +186,15 @@ int duc_index_req_add_exclude(duc_index_req *req, const char *pattern);
 int duc_index_req_add_fstype_include(duc_index_req *req, const char *types);
 int duc_index_req_add_fstype_exclude(duc_index_req *req, const char *types);
 int duc_index_req_set_maxdepth(duc_index_req *req, int maxdepth);
+int duc_index_req_set_hard_link_spill(duc_index_req *req, const char *dir);
+int duc_index_req_set_checkpoint(duc_index_req *req, int interval);
 int duc_index_req_set_progress_cb(duc_index_req *req, duc_index_progress_cb fn, void *ptr);
+int duc_index_req_set_threads(duc_index_req *req, int threads);
+int duc_index_req_add_graft(duc_index_req *req, const char *path_db);
 struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_index_flags flags);
+int duc_index_paths(duc_index_req *req, char **paths, size_t count, duc_index_flags flags,
+		duc_index_done_cb fn, void *ptr);
+struct duc_index_report *duc_import(duc *duc, FILE *f, char sep, duc_index_flags flags);
 int duc_index_req_free(duc_index_req *req);
 int duc_index_report_free(struct duc_index_report *rep);
 
@@ -167,11 +212,101 @@ struct duc_dirent *duc_dir_read(duc_dir *dir, duc_size_type st, duc_sort sort);
 char *duc_dir_get_path(duc_dir *dir);
 void duc_dir_get_size(duc_dir *dir, struct duc_size *size);
 size_t duc_dir_get_count(duc_dir *dir);
+void duc_dir_get_digest(duc_dir *dir, uint8_t *digest);
+struct duc_user *duc_dir_get_users(duc_dir *dir, size_t *count);
+void duc_users_free(struct duc_user *list);
+struct duc_ext *duc_dir_get_exts(duc_dir *dir, size_t *count);
+void duc_exts_free(struct duc_ext *list);
+struct duc_age *duc_dir_get_ages(duc_dir *dir, duc_age_type type, size_t *count);
+void duc_ages_free(struct duc_age *list);
 struct duc_dirent *duc_dir_find_child(duc_dir *dir, const char *name);
 int duc_dir_seek(duc_dir *dir, size_t offset);
 int duc_dir_rewind(duc_dir *dir);
 int duc_dir_close(duc_dir *dir);
 
+duc_dircache *duc_dircache_new(size_t mem_max);
+void duc_dircache_free(duc_dircache *cache);
+void duc_dircache_purge(duc_dircache *cache);
+void duc_dircache_get_stats(duc_dircache *cache, size_t *hits, size_t *misses, size_t *mem);
+int duc_set_dircache(duc *duc, duc_dircache *cache);
+
+/*
+ * Walk a subtree of the database
+ */
+
+typedef enum {
+	DUC_WALK_DIR_ENTER,         /* Entering a directory, its entries follow */
+	DUC_WALK_DIR_LEAVE,         /* Leaving a directory */
+	DUC_WALK_ENTRY,             /* File, or directory not descended into */
+} duc_walk_event;
+
+struct duc_walk_ent {
+	duc_walk_event event;
+	int depth;                  /* Depth below the starting directory */
+	const struct duc_dirent *ent;
+	size_t skipped_count;       /* DIR_LEAVE: number of entries not visited */
+	struct duc_size skipped_size; /* DIR_LEAVE: total size of entries not visited */
+};
+
+typedef int (*duc_walk_cb)(struct duc_walk_ent *we, void *ptr);
+
+duc_walk_req *duc_walk_req_new(duc *duc);
+int duc_walk_req_set_size_type(duc_walk_req *req, duc_size_type st);
+int duc_walk_req_set_maxdepth(duc_walk_req *req, int maxdepth);
+int duc_walk_req_set_min_size(duc_walk_req *req, off_t min_size);
+int duc_walk_req_set_top(duc_walk_req *req, size_t top);
+int duc_walk_req_set_exclude_files(duc_walk_req *req, int exclude_files);
+int duc_walk_req_set_threads(duc_walk_req *req, int threads);
+int duc_walk(duc_walk_req *req, duc_dir *dir, duc_walk_cb cb, void *ptr);
+int duc_walk_req_free(duc_walk_req *req);
+
+/*
+ * Find the largest entries anywhere below a directory
+ */
+
+typedef enum {
+	DUC_TOP_FILES = 1<<0,       /* Include files and other non-directories */
+	DUC_TOP_DIRS = 1<<1,        /* Include directories */
+} duc_top_flags;
+
+struct duc_dirent *duc_top(duc_dir *dir, duc_size_type st, size_t n, duc_top_flags flags, size_t *count);
+void duc_top_free(struct duc_dirent *list, size_t count);
+
+/*
+ * Find entries by name below a directory
+ */
+
+typedef enum {
+	DUC_FIND_ICASE = 1<<0,      /* Case insensitive matching */
+} duc_find_flags;
+
+typedef int (*duc_find_cb)(const char *path, const struct duc_dirent *e, void *ptr);
+
+int duc_find(duc_dir *dir, const char *pattern, duc_find_flags flags, duc_find_cb cb, void *ptr);
+
+/*
+ * Index history, kept when indexing with DUC_INDEX_HISTORY
+ */
+
+struct duc_generation {
+	struct timeval time;        /* Time the index run finished */
+	struct duc_size size;       /* Total size of the indexed tree */
+};
+
+typedef enum {
+	DUC_QUOTE_JSON,             /* JSON string */
+	DUC_QUOTE_PROMETHEUS,       /* Label value of the Prometheus text format */
+} duc_quote_style;
+
+typedef void (*duc_put_cb)(const char *s, size_t len, void *ptr);
+
+typedef int (*duc_diff_cb)(const char *path, int depth,
+		const struct duc_dirent *e_old, const struct duc_dirent *e_new, void *ptr);
+
+struct duc_generation *duc_get_generations(duc *duc, const char *path, size_t *count);
+void duc_generations_free(struct duc_generation *list);
+int duc_diff(duc *duc, const char *path, size_t gen_old, size_t gen_new, int maxdepth, duc_diff_cb cb, void *ptr);
+
 /* 
  * Helper functions
  */
@@ -180,6 +315,8 @@ off_t duc_get_size(struct duc_size *size, duc_size_type st);
 int duc_human_number(double v, int exact, char *buf, size_t maxlen);
 int duc_human_size(const struct duc_size *size, duc_size_type st, int exact, char *buf, size_t maxlen);
 int duc_human_duration(struct timeval start, struct timeval end, char *buf, size_t maxlen);
+void duc_quote(const char *s, duc_quote_style style, duc_put_cb put, void *ptr);
+void duc_fquote(FILE *f, const char *s, duc_quote_style style);
 void duc_log(struct duc *duc, duc_log_level lvl, const char *fmt, ...);
 char duc_file_type_char(duc_file_type t);
 char *duc_file_type_name(duc_file_type t);
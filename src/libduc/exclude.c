@@ -0,0 +1,268 @@
+
+/*
+ * Exclude pattern matching. Instead of running fnmatch() for every pattern on
+ * every directory entry, patterns are sorted into classes when they are added:
+ *
+ * - literal names without any wildcards go into a hash table
+ * - 'prefix*' patterns go into a trie
+ * - '*suffix' patterns go into a trie of reversed strings
+ * - all other patterns fall back to fnmatch()
+ *
+ * Matching a name against the first three classes takes time proportional to
+ * the length of the name, regardless of the number of patterns. Patterns
+ * containing a '/' are matched against the full path of the entry instead of
+ * its name.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_FNMATCH_H
+#include <fnmatch.h>
+#endif
+
+#include "private.h"
+#include "uthash.h"
+#include "utlist.h"
+#include "exclude.h"
+
+struct literal {
+	char *s;
+	UT_hash_handle hh;
+};
+
+struct trie {
+	char c;
+	int terminal;
+	struct trie *child;
+	struct trie *next;
+};
+
+struct glob {
+	char *pattern;
+	struct glob *next;
+};
+
+struct matcher {
+	size_t count;
+	struct literal *literal_map;
+	struct trie *prefix;
+	struct trie *suffix;
+	struct glob *glob_list;
+};
+
+struct exclude {
+	struct matcher name;
+	struct matcher path;
+};
+
+
+struct exclude *exclude_new(void)
+{
+	struct exclude *ex = duc_malloc0(sizeof *ex);
+	return ex;
+}
+
+
+static void trie_free(struct trie *t)
+{
+	while(t) {
+		struct trie *next = t->next;
+		trie_free(t->child);
+		duc_free(t);
+		t = next;
+	}
+}
+
+
+static void matcher_free(struct matcher *m)
+{
+	struct literal *l, *ln;
+	struct glob *g, *gn;
+
+	HASH_ITER(hh, m->literal_map, l, ln) {
+		HASH_DEL(m->literal_map, l);
+		duc_free(l->s);
+		duc_free(l);
+	}
+
+	trie_free(m->prefix);
+	trie_free(m->suffix);
+
+	LL_FOREACH_SAFE(m->glob_list, g, gn) {
+		duc_free(g->pattern);
+		duc_free(g);
+	}
+}
+
+
+void exclude_free(struct exclude *ex)
+{
+	matcher_free(&ex->name);
+	matcher_free(&ex->path);
+	duc_free(ex);
+}
+
+
+static struct trie *trie_child(struct trie *t, char c, int create)
+{
+	struct trie *n;
+	for(n=t->child; n; n=n->next) {
+		if(n->c == c) return n;
+	}
+	if(create) {
+		n = duc_malloc0(sizeof *n);
+		n->c = c;
+		n->next = t->child;
+		t->child = n;
+	}
+	return n;
+}
+
+
+/*
+ * Add string s of length len to the trie. If reverse is set the string is
+ * added back to front for suffix matching.
+ */
+
+static void trie_add(struct trie **root, const char *s, size_t len, int reverse)
+{
+	if(*root == NULL) *root = duc_malloc0(sizeof **root);
+
+	struct trie *t = *root;
+	size_t i;
+	for(i=0; i<len; i++) {
+		char c = reverse ? s[len-i-1] : s[i];
+		t = trie_child(t, c, 1);
+	}
+	t->terminal = 1;
+}
+
+
+static int trie_match(struct trie *t, const char *s, size_t len, int reverse)
+{
+	size_t i = 0;
+
+	while(t) {
+		if(t->terminal) return 1;
+		if(i == len) return 0;
+		char c = reverse ? s[len-i-1] : s[i];
+		t = trie_child(t, c, 0);
+		i++;
+	}
+
+	return 0;
+}
+
+
+static int is_wild(char c)
+{
+	return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+
+static size_t count_wild(const char *s, size_t len)
+{
+	size_t i, n = 0;
+	for(i=0; i<len; i++) {
+		if(is_wild(s[i])) n++;
+	}
+	return n;
+}
+
+
+static void matcher_add(struct matcher *m, const char *pattern)
+{
+	size_t len = strlen(pattern);
+	size_t nwild = count_wild(pattern, len);
+
+	if(nwild == 0) {
+
+		struct literal *l;
+		HASH_FIND_STR(m->literal_map, pattern, l);
+		if(l == NULL) {
+			l = duc_malloc(sizeof *l);
+			l->s = duc_strdup(pattern);
+			HASH_ADD_KEYPTR(hh, m->literal_map, l->s, len, l);
+		}
+
+	} else if(nwild == 1 && pattern[0] == '*') {
+
+		trie_add(&m->suffix, pattern + 1, len - 1, 1);
+
+	} else if(nwild == 1 && pattern[len-1] == '*') {
+
+		trie_add(&m->prefix, pattern, len - 1, 0);
+
+	} else {
+
+		struct glob *g = duc_malloc(sizeof *g);
+		g->pattern = duc_strdup(pattern);
+		LL_APPEND(m->glob_list, g);
+	}
+
+	m->count ++;
+}
+
+
+static int matcher_match(struct matcher *m, const char *s)
+{
+	if(m->count == 0) return 0;
+
+	size_t len = strlen(s);
+
+	if(m->literal_map) {
+		struct literal *l;
+		HASH_FIND(hh, m->literal_map, s, len, l);
+		if(l) return 1;
+	}
+
+	if(m->prefix && trie_match(m->prefix, s, len, 0)) return 1;
+	if(m->suffix && trie_match(m->suffix, s, len, 1)) return 1;
+
+	struct glob *g;
+	LL_FOREACH(m->glob_list, g) {
+#ifdef HAVE_FNMATCH_H
+		if(fnmatch(g->pattern, s, 0) == 0) return 1;
+#else
+		if(strstr(s, g->pattern) != NULL) return 1;
+#endif
+	}
+
+	return 0;
+}
+
+
+void exclude_add(struct exclude *ex, const char *pattern)
+{
+	if(strchr(pattern, '/')) {
+		matcher_add(&ex->path, pattern);
+	} else {
+		matcher_add(&ex->name, pattern);
+	}
+}
+
+
+int exclude_has_paths(struct exclude *ex)
+{
+	return ex->path.count > 0;
+}
+
+
+/*
+ * Returns 1 if the given entry matches any of the exclude patterns. The path
+ * is only needed when exclude_has_paths() is true and may be NULL otherwise.
+ */
+
+int exclude_match(struct exclude *ex, const char *name, const char *path)
+{
+	if(matcher_match(&ex->name, name)) return 1;
+	if(path && matcher_match(&ex->path, path)) return 1;
+	return 0;
+}
+
+
+/*
+ * End
+ */
@@ -0,0 +1,13 @@
+#ifndef exclude_h
+#define exclude_h
+
+struct exclude;
+
+struct exclude *exclude_new(void);
+void exclude_free(struct exclude *ex);
+
+void exclude_add(struct exclude *ex, const char *pattern);
+int exclude_match(struct exclude *ex, const char *name, const char *path);
+int exclude_has_paths(struct exclude *ex);
+
+#endif
@@ -0,0 +1,156 @@
+
+/*
+ * Usage per file name extension. When indexing with DUC_INDEX_EXTS every
+ * directory gets a side record with the total size of the regular files below
+ * it for its largest extensions, all other extensions are added up under
+ * EXTS_OTHER.
+ *
+ * Extensions are case folded, and the extension of compressed tar archives
+ * includes the 'tar' part, so 'a.tar.gz' and 'b.TGZ' count as 'tar.gz' and
+ * 'tgz'. Files without an extension are counted under the empty extension.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "private.h"
+#include "exts.h"
+
+
+static const char *compressors[] = {
+	"gz", "bz2", "xz", "zst", "lz4", "lz", "lzma", "z", NULL
+};
+
+
+static int is_compressor(const char *ext)
+{
+	const char **c;
+	for(c=compressors; *c; c++) {
+		if(strcmp(ext, *c) == 0) return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Copy the case folded extension of p, up to the end of the name or the next
+ * dot. Returns its length, or -1 if it is not a plausible extension
+ */
+
+static int fold_ext(const char *p, char *ext, size_t max)
+{
+	size_t l = 0;
+
+	while(p[l] && p[l] != '.') {
+		unsigned char c = p[l];
+		if(!isalnum(c) && c != '_' && c != '-') return -1;
+		if(l == max) return -1;
+		ext[l] = tolower(c);
+		l++;
+	}
+
+	ext[l] = '\0';
+	return l > 0 ? (int)l : -1;
+}
+
+
+static size_t get_ext(const char *name, char *ext)
+{
+	const char *dot = strrchr(name, '.');
+	if(dot == NULL || dot == name) return 0;
+
+	int l = fold_ext(dot + 1, ext, DUC_EXT_MAX);
+	if(l < 0) return 0;
+
+	/* Include the 'tar' of compressed tar archives */
+
+	if(is_compressor(ext) && dot - name > 4 && strncasecmp(dot - 4, ".tar", 4) == 0 && l + 4 <= DUC_EXT_MAX) {
+		memmove(ext + 4, ext, l + 1);
+		memcpy(ext, "tar.", 4);
+		l += 4;
+	}
+
+	return l;
+}
+
+
+void exts_add(struct tally *t, const char *name, const struct duc_size *size)
+{
+	char ext[DUC_EXT_MAX + 1];
+	size_t l = get_ext(name, ext);
+	tally_add(t, ext, l, size);
+}
+
+
+struct ext_list {
+	struct duc_ext *list;
+	size_t count;
+};
+
+
+static void add_ext(const void *key, size_t keylen, const struct duc_size *size, void *ptr)
+{
+	struct ext_list *el = ptr;
+	struct duc_ext *e = &el->list[el->count++];
+
+	if(keylen > DUC_EXT_MAX) keylen = DUC_EXT_MAX;
+	memcpy(e->name, key, keylen);
+	e->name[keylen] = '\0';
+	e->size = *size;
+}
+
+
+static int cmp_ext(const void *a, const void *b)
+{
+	const struct duc_ext *e1 = a;
+	const struct duc_ext *e2 = b;
+	if(e1->size.actual != e2->size.actual) return e1->size.actual > e2->size.actual ? -1 : 1;
+	return strcmp(e1->name, e2->name);
+}
+
+
+/*
+ * Return the usage per extension below the given directory, largest first.
+ * Returns NULL if the directory was not indexed with DUC_INDEX_EXTS
+ */
+
+struct duc_ext *duc_dir_get_exts(duc_dir *dir, size_t *count)
+{
+	struct duc_devino devino;
+	uint8_t digest[DUC_DIGEST_SIZE];
+
+	duc_dir_get_devino(dir, &devino);
+	duc_dir_get_digest(dir, digest);
+
+	*count = 0;
+
+	struct tally *t = tally_read(duc_dir_get_duc(dir), EXTS_PREFIX, &devino, digest, NULL);
+	if(t == NULL) return NULL;
+
+	struct ext_list el;
+	el.list = duc_malloc(tally_count(t) * sizeof(*el.list) + 1);
+	el.count = 0;
+	tally_foreach(t, add_ext, &el);
+	tally_free(t);
+
+	qsort(el.list, el.count, sizeof(*el.list), cmp_ext);
+
+	*count = el.count;
+	return el.list;
+}
+
+
+void duc_exts_free(struct duc_ext *list)
+{
+	duc_free(list);
+}
+
+
+/*
+ * End
+ */
+
@@ -0,0 +1,15 @@
+#ifndef exts_h
+#define exts_h
+
+#include "duc.h"
+#include "tally.h"
+
+#define EXTS_PREFIX "duc_exts"
+#define EXTS_OTHER "*"
+
+#define EXTS_TOP 20       /* Extensions kept in the side record of a directory */
+#define EXTS_TRACK 4096   /* Extensions tracked per directory during indexing */
+
+void exts_add(struct tally *t, const char *name, const struct duc_size *size);
+
+#endif
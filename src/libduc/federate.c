@@ -0,0 +1,344 @@
+
+/*
+ * Federated databases. A handle opened read-only on a ':' separated list of
+ * databases, or on a wildcard pattern matching several, gets one shard per
+ * database instead of a database of its own. A path which exists is always
+ * opened as a single database, whatever characters it holds.
+ *
+ * Shards are loaded lazily: the first query only reads the index reports of
+ * every shard, and a shard is opened for good when a path below one of its
+ * roots is requested. Directories opened from a shard use the handle of that
+ * shard, so everything reached from them reads the right database. The
+ * reports of a shard are read again when its database file has changed, so
+ * long running servers see new index runs.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <glob.h>
+#endif
+
+#include "duc.h"
+#include "private.h"
+#include "federate.h"
+
+/* Windows paths hold a ':' after the drive letter */
+
+#ifdef WIN32
+#define SPEC_SEP ";"
+#else
+#define SPEC_SEP ":"
+#endif
+
+struct shard {
+	char *path_db;
+	duc *duc;                           /* Handle, NULL until first used */
+	struct duc_index_report *reports;
+	size_t report_count;
+	int loaded;
+	time_t mtime;                       /* Of the database when the reports were read */
+	off_t size;
+};
+
+
+/*
+ * A database spec holding a list or a wildcard pattern asks for federation,
+ * unless a database exists at that path
+ */
+
+int federate_is_spec(const char *spec)
+{
+	if(access(spec, F_OK) == 0) return 0;
+	return strpbrk(spec, SPEC_SEP "*?[") != NULL;
+}
+
+
+static void add_shard(duc *duc, const char *path_db)
+{
+	size_t i;
+	for(i=0; i<duc->shard_count; i++) {
+		if(strcmp(duc->shards[i].path_db, path_db) == 0) return;
+	}
+
+	duc->shards = duc_realloc(duc->shards, (duc->shard_count + 1) * sizeof(*duc->shards));
+	struct shard *s = &duc->shards[duc->shard_count++];
+	memset(s, 0, sizeof *s);
+	s->path_db = duc_strdup(path_db);
+}
+
+
+int federate_open(duc *duc, const char *spec, duc_open_flags flags)
+{
+	char *tmp = duc_strdup(spec);
+	char *saveptr = NULL;
+	char *part;
+
+	for(part = strtok_r(tmp, SPEC_SEP, &saveptr); part; part = strtok_r(NULL, SPEC_SEP, &saveptr)) {
+#ifndef WIN32
+		glob_t g;
+		if(glob(part, 0, NULL, &g) == 0) {
+			size_t i;
+			for(i=0; i<g.gl_pathc; i++) add_shard(duc, g.gl_pathv[i]);
+			globfree(&g);
+		} else if(strpbrk(part, "*?[") == NULL) {
+			add_shard(duc, part);
+		}
+#else
+		add_shard(duc, part);
+#endif
+	}
+
+	duc_free(tmp);
+
+	if(duc->shard_count == 0) {
+		duc->err = DUC_E_DB_NOT_FOUND;
+		duc_log(duc, DUC_LOG_FTL, "Error opening: %s - %s", spec, duc_strerror(duc));
+		return -1;
+	}
+
+	duc_log(duc, DUC_LOG_INF, "Reading from %zu databases \"%s\"", duc->shard_count, spec);
+
+	duc->path_db = duc_strdup(spec);
+	return 0;
+}
+
+
+static struct duc *shard_open(duc *duc, struct shard *s)
+{
+	struct duc *d = duc_new();
+	duc_set_log_level(d, duc->log_level);
+	duc_set_log_callback(d, duc->log_callback);
+
+	/* All shards together get the memory of a single directory cache */
+
+	duc_dircache *cache = duc_dircache_new(DUC_DIRCACHE_DEFAULT_SIZE / duc->shard_count);
+	duc_set_dircache(d, cache);
+	duc_dircache_free(cache);
+
+	if(duc_open(d, s->path_db, DUC_OPEN_RO) != 0) {
+		duc->err = d->err;
+		duc_del(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+
+/*
+ * Read the index reports of a shard, through its handle if it is open since
+ * not all backends allow a database to be opened twice. Shards which can not
+ * be opened are skipped with a warning, so one broken database does not hide
+ * the others
+ */
+
+static void shard_load_reports(duc *duc, struct shard *s)
+{
+	duc_free(s->reports);
+	s->reports = NULL;
+	s->report_count = 0;
+
+	struct duc *d = s->duc ? s->duc : shard_open(duc, s);
+	if(d == NULL) {
+		duc_log(duc, DUC_LOG_WRN, "Skipping database %s", s->path_db);
+		return;
+	}
+
+	struct duc_index_report *r;
+	while((r = duc_get_report(d, s->report_count)) != NULL) {
+		s->reports = duc_realloc(s->reports, (s->report_count + 1) * sizeof(*s->reports));
+		s->reports[s->report_count] = *r;
+		s->reports[s->report_count].path_current = NULL;
+		s->report_count ++;
+		duc_index_report_free(r);
+	}
+
+	duc_log(duc, DUC_LOG_DBG, "Database %s holds %zu index roots", s->path_db, s->report_count);
+
+	if(d != s->duc) {
+		duc_close(d);
+		duc_del(d);
+	}
+}
+
+
+/*
+ * Read the index reports of all shards whose database changed since they
+ * were last read. The files are checked at most once a second
+ */
+
+static void load_reports(duc *duc)
+{
+	time_t now = time(NULL);
+	if(duc->shards_checked == now) return;
+	duc->shards_checked = now;
+
+	size_t i;
+	for(i=0; i<duc->shard_count; i++) {
+		struct shard *s = &duc->shards[i];
+		struct stat st;
+		memset(&st, 0, sizeof st);
+		stat(s->path_db, &st);
+		if(!s->loaded || st.st_mtime != s->mtime || st.st_size != s->size) {
+			shard_load_reports(duc, s);
+			s->loaded = 1;
+			s->mtime = st.st_mtime;
+			s->size = st.st_size;
+		}
+	}
+}
+
+
+struct duc_index_report *federate_get_report(duc *duc, size_t id)
+{
+	struct duc_index_report *r = NULL;
+
+	duc_db_lock(duc);
+	load_reports(duc);
+
+	size_t i;
+	for(i=0; i<duc->shard_count; i++) {
+		struct shard *s = &duc->shards[i];
+		if(id < s->report_count) {
+			r = duc_malloc(sizeof *r);
+			*r = s->reports[id];
+			break;
+		}
+		id -= s->report_count;
+	}
+
+	duc_db_unlock(duc);
+	return r;
+}
+
+
+/*
+ * Return the handle of the shard with the deepest index root holding the
+ * given path, opening it if needed
+ */
+
+struct duc *federate_route(duc *duc, const char *path)
+{
+	char *path_canon = duc_canonicalize_path(path);
+	if(path_canon == NULL) {
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		return NULL;
+	}
+
+	duc_db_lock(duc);
+	load_reports(duc);
+
+	struct shard *best = NULL;
+	size_t best_len = 0;
+	size_t i, j;
+
+	for(i=0; i<duc->shard_count; i++) {
+		struct shard *s = &duc->shards[i];
+		for(j=0; j<s->report_count; j++) {
+			size_t l = strlen(s->reports[j].path);
+			if(l >= best_len && duc_path_is_below(path_canon, s->reports[j].path)) {
+				best = s;
+				best_len = l;
+			}
+		}
+	}
+
+	duc_free(path_canon);
+
+	if(best == NULL) {
+		duc_db_unlock(duc);
+		duc_log(duc, DUC_LOG_FTL, "Path %s not found in any database", path);
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		return NULL;
+	}
+
+	if(best->duc == NULL) {
+		duc_log(duc, DUC_LOG_DBG, "Opening database %s for %s", best->path_db, path);
+		best->duc = shard_open(duc, best);
+		if(best->duc && duc->lock) duc_db_lock_init(best->duc);
+	}
+
+	/* Shared handles get handles of their own on the shard as well, so the
+	 * threads do not share error state */
+
+	struct duc *d = best->duc;
+	if(d && duc->shared) {
+		size_t n = best - duc->shards;
+		if(duc->shard_shares == NULL) {
+			duc->shard_shares = duc_malloc0(duc->shard_count * sizeof(*duc->shard_shares));
+		}
+		if(duc->shard_shares[n] == NULL) {
+			duc->shard_shares[n] = duc_share(d);
+		}
+		d = duc->shard_shares[n];
+	}
+
+	duc_db_unlock(duc);
+	return d;
+}
+
+
+/*
+ * Prepare the shards for reading from several threads: all index reports
+ * are loaded up front, and every shard gets a lock of its own
+ */
+
+void federate_lock_init(duc *duc)
+{
+	duc_db_lock(duc);
+	load_reports(duc);
+
+	size_t i;
+	for(i=0; i<duc->shard_count; i++) {
+		struct shard *s = &duc->shards[i];
+		if(s->duc) duc_db_lock_init(s->duc);
+	}
+
+	duc_db_unlock(duc);
+}
+
+
+void federate_close(duc *duc)
+{
+	size_t i;
+
+	if(duc->shared) {
+		if(duc->shard_shares) {
+			for(i=0; i<duc->shard_count; i++) {
+				if(duc->shard_shares[i]) duc_del(duc->shard_shares[i]);
+			}
+			duc_free(duc->shard_shares);
+			duc->shard_shares = NULL;
+		}
+		return;
+	}
+
+	for(i=0; i<duc->shard_count; i++) {
+		struct shard *s = &duc->shards[i];
+		if(s->duc) {
+			duc_close(s->duc);
+			duc_del(s->duc);
+		}
+		duc_free(s->reports);
+		duc_free(s->path_db);
+	}
+
+	duc_free(duc->shards);
+	duc->shards = NULL;
+	duc->shard_count = 0;
+	duc->shards_checked = 0;
+	duc_free(duc->path_db);
+	duc->path_db = NULL;
+}
+
+
+/*
+ * End
+ */
+
@@ -0,0 +1,13 @@
+#ifndef federate_h
+#define federate_h
+
+#include "duc.h"
+
+int federate_is_spec(const char *spec);
+int federate_open(duc *duc, const char *spec, duc_open_flags flags);
+struct duc_index_report *federate_get_report(duc *duc, size_t id);
+struct duc *federate_route(duc *duc, const char *path);
+void federate_lock_init(duc *duc);
+void federate_close(duc *duc);
+
+#endif
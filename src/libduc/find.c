@@ -0,0 +1,369 @@
+
+/*
+ * Find entries by name. The pattern is a shell wildcard pattern matched
+ * against the entry names, a pattern without any wildcards matches all names
+ * containing it.
+ *
+ * When the tree was indexed with a name index, only the directories listed
+ * for all trigrams in the literal parts of the pattern are read, and their
+ * paths are found by following the parent links up to the index root. Without
+ * a name index, or for patterns without any three consecutive literal
+ * characters, the whole tree below the directory is walked.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_FNMATCH_H
+#include <fnmatch.h>
+#endif
+
+#include "duc.h"
+#include "private.h"
+#include "names.h"
+#include "uthash.h"
+
+struct pathmap {
+	struct duc_devino devino;
+	char *path;
+	UT_hash_handle hh;
+};
+
+struct find {
+	duc *duc;
+	char *pattern;
+	int fnm_flags;
+	duc_find_cb cb;
+	void *ptr;
+	struct duc_devino root;
+	char *root_path;
+	struct pathmap *map;
+	char **stack;
+	size_t stack_len;
+	size_t stack_max;
+};
+
+
+static int match(struct find *f, const struct duc_dirent *e)
+{
+#ifdef HAVE_FNMATCH_H
+	return fnmatch(f->pattern, e->name, f->fnm_flags) == 0;
+#else
+	return strstr(e->name, f->pattern) != NULL;
+#endif
+}
+
+
+/*
+ * Collect the trigrams of the literal parts of a wildcard pattern
+ */
+
+static size_t pattern_trigrams(const char *patt, uint32_t **out)
+{
+	size_t l = strlen(patt);
+	char *run = duc_malloc(l + 1);
+	uint32_t *tri = duc_malloc((l + 1) * sizeof(*tri));
+	size_t n = 0, rl = 0;
+	const char *p;
+
+	for(p=patt; ; p++) {
+
+		if(*p == '\\' && p[1]) {
+			run[rl++] = *++p;
+			continue;
+		}
+
+		if(*p == '[') {
+			const char *q = p + 1;
+			if(*q == '!' || *q == '^') q++;
+			if(*q == ']') q++;
+			while(*q && *q != ']') q++;
+			if(*q == ']') {
+				n += names_get_trigrams(run, rl, tri + n);
+				rl = 0;
+				p = q;
+				continue;
+			}
+		}
+
+		if(*p == '*' || *p == '?' || *p == '\0') {
+			n += names_get_trigrams(run, rl, tri + n);
+			rl = 0;
+			if(*p == '\0') break;
+			continue;
+		}
+
+		run[rl++] = *p;
+	}
+
+	duc_free(run);
+	*out = tri;
+	return n;
+}
+
+
+/*
+ * Walk the whole tree when there is no usable name index
+ */
+
+static int walk_cb(struct duc_walk_ent *we, void *ptr)
+{
+	struct find *f = ptr;
+	size_t depth = we->depth;
+	int r = 0;
+
+	if(we->event == DUC_WALK_DIR_LEAVE) {
+		duc_free(f->stack[depth]);
+		f->stack_len = depth;
+		return 0;
+	}
+
+	if(depth == 0) {
+		f->stack[0] = duc_strdup(we->ent->name);
+		f->stack_len = 1;
+		return 0;
+	}
+
+	if(we->event == DUC_WALK_ENTRY && !match(f, we->ent)) {
+		return 0;
+	}
+
+	char *path = duc_path_join(f->stack[depth-1], we->ent->name);
+	if(match(f, we->ent)) {
+		r = f->cb(path, we->ent, f->ptr);
+	}
+
+	if(we->event == DUC_WALK_DIR_ENTER) {
+		if(depth == f->stack_max) {
+			f->stack_max *= 2;
+			f->stack = duc_realloc(f->stack, f->stack_max * sizeof(*f->stack));
+		}
+		f->stack[depth] = path;
+		f->stack_len = depth + 1;
+	} else {
+		duc_free(path);
+	}
+
+	return r;
+}
+
+
+static int find_walk(struct find *f, duc_dir *dir)
+{
+	f->stack_max = 64;
+	f->stack = duc_malloc(f->stack_max * sizeof(*f->stack));
+
+	duc_walk_req *req = duc_walk_req_new(f->duc);
+	int r = duc_walk(req, dir, walk_cb, f);
+	duc_walk_req_free(req);
+
+	/* The walk stops without leaving the directories when the callback
+	 * returns non-zero */
+
+	while(f->stack_len > 0) {
+		duc_free(f->stack[--f->stack_len]);
+	}
+	duc_free(f->stack);
+	return r;
+}
+
+
+/*
+ * Find the path of a directory by following the parent links up to the
+ * index root. Returns NULL for directories no longer in the tree
+ */
+
+static const char *resolve(struct find *f, const struct duc_devino *devino)
+{
+	if(devino->dev == f->root.dev && devino->ino == f->root.ino) {
+		return f->root_path;
+	}
+
+	struct pathmap *m;
+	HASH_FIND(hh, f->map, devino, sizeof(*devino), m);
+	if(m) return m->path;
+
+	/* Add the entry before recursing, which also stops loops */
+
+	m = duc_malloc0(sizeof *m);
+	m->devino = *devino;
+	HASH_ADD(hh, f->map, devino, sizeof(m->devino), m);
+
+	duc_dir *d = duc_dir_new(f->duc, devino);
+	if(d == NULL) return NULL;
+	struct duc_devino devino_parent;
+	duc_dir_get_parent(d, &devino_parent);
+	duc_dir_close(d);
+
+	const char *path_parent = resolve(f, &devino_parent);
+	if(path_parent == NULL) return NULL;
+
+	d = duc_dir_new(f->duc, &devino_parent);
+	if(d == NULL) return NULL;
+
+	struct duc_dirent *e;
+	while((e = duc_dir_read(d, DUC_SIZE_TYPE_ACTUAL, DUC_SORT_NAME)) != NULL) {
+		if(e->type == DUC_FILE_TYPE_DIR &&
+		   e->devino.dev == devino->dev && e->devino.ino == devino->ino) {
+			m->path = duc_path_join(path_parent, e->name);
+			break;
+		}
+	}
+	duc_dir_close(d);
+
+	return m->path;
+}
+
+
+/*
+ * Intersect two sorted lists, the result is stored in the first
+ */
+
+static size_t intersect(struct duc_devino *l1, size_t n1, struct duc_devino *l2, size_t n2)
+{
+	size_t i = 0, j = 0, n = 0;
+
+	while(i < n1 && j < n2) {
+		struct duc_devino *a = &l1[i], *b = &l2[j];
+		if(a->dev < b->dev || (a->dev == b->dev && a->ino < b->ino)) {
+			i++;
+		} else if(a->dev > b->dev || (a->dev == b->dev && a->ino > b->ino)) {
+			j++;
+		} else {
+			l1[n++] = l1[i];
+			i++; j++;
+		}
+	}
+
+	return n;
+}
+
+
+static int find_indexed(struct find *f, const char *path, uint32_t *tri, size_t tri_count)
+{
+	struct duc_devino *cand = NULL;
+	size_t cand_count = 0;
+	size_t i;
+	int r = 0;
+
+	/* Candidate directories hold names with all trigrams of the pattern */
+
+	for(i=0; i<tri_count; i++) {
+		size_t count;
+		struct duc_devino *list = names_lookup(f->duc, &f->root, tri[i], &count);
+		if(i == 0) {
+			cand = list;
+			cand_count = count;
+		} else {
+			cand_count = intersect(cand, cand_count, list, count);
+			duc_free(list);
+		}
+		if(cand_count == 0) break;
+	}
+
+	duc_log(f->duc, DUC_LOG_DBG, "find: %zu candidate directories", cand_count);
+
+	for(i=0; i<cand_count && r == 0; i++) {
+
+		const char *path_dir = resolve(f, &cand[i]);
+		if(path_dir == NULL || !duc_path_is_below(path_dir, path)) continue;
+
+		duc_dir *d = duc_dir_new(f->duc, &cand[i]);
+		if(d == NULL) continue;
+
+		struct duc_dirent *e;
+		while(r == 0 && (e = duc_dir_read(d, DUC_SIZE_TYPE_ACTUAL, DUC_SORT_NAME)) != NULL) {
+			if(!match(f, e)) continue;
+			char *path_ent = duc_path_join(path_dir, e->name);
+			r = f->cb(path_ent, e, f->ptr);
+			duc_free(path_ent);
+		}
+		duc_dir_close(d);
+	}
+
+	duc_free(cand);
+	return r;
+}
+
+
+/*
+ * Call back for every entry below the directory matching the pattern.
+ * Returns 0 when done, or the non-zero value returned by the callback to stop
+ * the search
+ */
+
+int duc_find(duc_dir *dir, const char *pattern, duc_find_flags flags, duc_find_cb cb, void *ptr)
+{
+	struct find f;
+	memset(&f, 0, sizeof f);
+
+	f.duc = duc_dir_get_duc(dir);
+	f.cb = cb;
+	f.ptr = ptr;
+
+#ifdef HAVE_FNMATCH_H
+	if(strpbrk(pattern, "*?[")) {
+		f.pattern = duc_strdup(pattern);
+	} else {
+		f.pattern = duc_malloc(strlen(pattern) + 3);
+		sprintf(f.pattern, "*%s*", pattern);
+	}
+#else
+	f.pattern = duc_strdup(pattern);
+#endif
+
+#ifdef FNM_CASEFOLD
+	if(flags & DUC_FIND_ICASE) f.fnm_flags |= FNM_CASEFOLD;
+#endif
+
+	/* Find the index root holding this directory */
+
+	char *path = duc_dir_get_path(dir);
+	struct duc_index_report *report;
+	size_t i = 0;
+	size_t best = 0;
+
+	while((report = duc_get_report(f.duc, i++)) != NULL) {
+		size_t l = strlen(report->path);
+		if(l >= best && duc_path_is_below(path, report->path) && names_has_index(f.duc, &report->devino)) {
+			duc_free(f.root_path);
+			f.root_path = duc_strdup(report->path);
+			f.root = report->devino;
+			best = l;
+		}
+		duc_index_report_free(report);
+	}
+
+	uint32_t *tri;
+	size_t tri_count = pattern_trigrams(f.pattern, &tri);
+	int r;
+
+	if(f.root_path && tri_count > 0) {
+		r = find_indexed(&f, path, tri, tri_count);
+	} else {
+		duc_log(f.duc, DUC_LOG_DBG, "find: %s, walking the tree",
+				f.root_path ? "pattern too short for name index" : "no name index");
+		r = find_walk(&f, dir);
+	}
+
+	struct pathmap *m, *mn;
+	HASH_ITER(hh, f.map, m, mn) {
+		HASH_DEL(f.map, m);
+		duc_free(m->path);
+		duc_free(m);
+	}
+
+	duc_free(tri);
+	duc_free(path);
+	duc_free(f.root_path);
+	duc_free(f.pattern);
+
+	return r;
+}
+
+
+/*
+ * End
+ */
+
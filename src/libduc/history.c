@@ -0,0 +1,598 @@
+
+/*
+ * Index history. When indexing with DUC_INDEX_HISTORY, every directory is
+ * also stored as a snapshot record, addressed by the digest of the directory
+ * (see digest.c), which covers exactly what the snapshot holds:
+ *
+ *   duc_snap:<hash>       entries of the directory, subdirectories are
+ *                         referred to by their digest
+ *   duc_history:<path>    list of generations of the index root: time,
+ *                         total size and digest of the root directory
+ *
+ * Since the digest of a directory covers the digests of all directories below
+ * it, unchanged subtrees map to the same records in every generation and are
+ * stored only once. The same property allows comparing two generations
+ * without descending into subtrees with equal hashes.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "db.h"
+#include "dbqueue.h"
+#include "buffer.h"
+#include "history.h"
+#include "federate.h"
+#include "uthash.h"
+
+#define HISTORY_VERSION 1
+
+struct snap_ent {
+	struct duc_dirent ent;
+	uint8_t hash[HISTORY_HASH_SIZE];
+};
+
+struct generation {
+	struct duc_generation gen;
+	uint8_t hash[HISTORY_HASH_SIZE];
+};
+
+
+static size_t snap_key(const uint8_t *hash, char *key, size_t keylen)
+{
+	size_t l = snprintf(key, keylen, "duc_snap:");
+	size_t i;
+	for(i=0; i<HISTORY_HASH_SIZE; i++) {
+		l += snprintf(key + l, keylen - l, "%02x", hash[i]);
+	}
+	return l;
+}
+
+
+static size_t history_key(const char *path, char *key, size_t keylen)
+{
+	size_t l = snprintf(key, keylen, "duc_history:%s", path);
+	if(l >= keylen) l = keylen - 1;
+	return l;
+}
+
+
+/*
+ * Add an entry to the snapshot record of a directory. Directories are added
+ * with their digest
+ */
+
+void history_put_ent(struct buffer *snap, const struct duc_dirent *ent, const uint8_t *digest)
+{
+	buffer_put_string(snap, ent->name);
+	buffer_put_size(snap, &ent->size);
+	buffer_put_varint(snap, ent->type);
+	if(ent->type == DUC_FILE_TYPE_DIR) {
+		buffer_put_blob(snap, digest, HISTORY_HASH_SIZE);
+	}
+}
+
+
+/*
+ * Store the snapshot record of a completed directory under its digest, unless
+ * a record of an equal directory is already present
+ */
+
+void history_put_dir(duc *duc, struct buffer *snap, const uint8_t *digest)
+{
+	char key[64];
+
+	size_t keyl = snap_key(digest, key, sizeof(key));
+
+	size_t vall;
+	char *val = dbqueue_get(duc, key, keyl, &vall);
+	if(val) {
+		free(val);
+		return;
+	}
+
+	dbqueue_put(duc, key, keyl, snap->data, snap->len);
+}
+
+
+/*
+ * Append a generation to the history of the indexed path
+ */
+
+void history_add_generation(duc *duc, const struct duc_index_report *report, const uint8_t *hash)
+{
+	char key[DUC_PATH_MAX + 16];
+	size_t keyl = history_key(report->path, key, sizeof(key));
+	size_t vall;
+
+	char *val = db_get(duc->db, key, keyl, &vall);
+	struct buffer *b;
+	if(val) {
+		b = buffer_new(val, vall);
+		b->ptr = b->len;
+	} else {
+		b = buffer_new(NULL, 0);
+		buffer_put_varint(b, HISTORY_VERSION);
+	}
+
+	buffer_put_varint(b, report->time_stop.tv_sec);
+	buffer_put_varint(b, report->time_stop.tv_usec);
+	buffer_put_size(b, &report->size);
+	buffer_put_blob(b, hash, HISTORY_HASH_SIZE);
+
+	db_put(duc->db, key, keyl, b->data, b->len);
+	buffer_free(b);
+}
+
+
+static void get_hash(struct buffer *b, uint8_t *hash)
+{
+	size_t len;
+	void *data = buffer_get_blob(b, &len);
+	memset(hash, 0, HISTORY_HASH_SIZE);
+	if(data) {
+		memcpy(hash, data, len < HISTORY_HASH_SIZE ? len : HISTORY_HASH_SIZE);
+		duc_free(data);
+	}
+}
+
+
+/*
+ * Read the generations of the index root holding the given path. The root
+ * path is returned in root, if not NULL
+ */
+
+static struct generation *read_generations(duc *duc, const char *path, size_t *count, char **root)
+{
+	char *path_try = duc_strdup(path);
+	char *val = NULL;
+	size_t vall = 0;
+
+	*count = 0;
+
+	/* Try the path itself and all its parents */
+
+	for(;;) {
+		char key[DUC_PATH_MAX + 16];
+		size_t keyl = history_key(path_try, key, sizeof(key));
+		val = duc_db_get(duc, key, keyl, &vall);
+		if(val) break;
+		char *p = strrchr(path_try, '/');
+		if(p == NULL || (p == path_try && p[1] == '\0')) break;
+		if(p == path_try) p++;
+		*p = '\0';
+	}
+
+	if(val == NULL) {
+		duc_free(path_try);
+		return NULL;
+	}
+
+	if(root) {
+		*root = path_try;
+	} else {
+		duc_free(path_try);
+	}
+
+	struct buffer *b = buffer_new(val, vall);
+	struct generation *list = NULL;
+	size_t n = 0;
+	uint64_t v;
+
+	buffer_get_varint(b, &v);
+	if(v == HISTORY_VERSION) {
+		while(b->ptr < b->len) {
+			list = duc_realloc(list, (n + 1) * sizeof(*list));
+			struct generation *g = &list[n++];
+			buffer_get_varint(b, &v); g->gen.time.tv_sec = v;
+			buffer_get_varint(b, &v); g->gen.time.tv_usec = v;
+			buffer_get_size(b, &g->gen.size);
+			get_hash(b, g->hash);
+		}
+	}
+	buffer_free(b);
+
+	*count = n;
+	return list;
+}
+
+
+/*
+ * Get the snapshot hash of the latest generation of an index root. Returns -1
+ * if the path has no history of its own
+ */
+
+int history_get_latest(duc *duc, const char *path, uint8_t *hash)
+{
+	size_t count;
+	char *root = NULL;
+	int r = -1;
+
+	struct generation *list = read_generations(duc, path, &count, &root);
+	if(list && count > 0 && strcmp(root, path) == 0) {
+		memcpy(hash, list[count-1].hash, HISTORY_HASH_SIZE);
+		r = 0;
+	}
+
+	duc_free(list);
+	duc_free(root);
+	return r;
+}
+
+
+/*
+ * Return the list of generations of the index root holding the given path,
+ * oldest first
+ */
+
+struct duc_generation *duc_get_generations(duc *duc, const char *path, size_t *count)
+{
+	if(duc->shards) {
+		struct duc *shard = federate_route(duc, path);
+		*count = 0;
+		return shard ? duc_get_generations(shard, path, count) : NULL;
+	}
+
+	char *path_canon = duc_canonicalize_path(path);
+	if(path_canon == NULL) {
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		return NULL;
+	}
+
+	struct generation *list = read_generations(duc, path_canon, count, NULL);
+	duc_free(path_canon);
+
+	if(list == NULL) {
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		return NULL;
+	}
+
+	struct duc_generation *gens = duc_malloc(*count * sizeof(*gens) + 1);
+	size_t i;
+	for(i=0; i<*count; i++) {
+		gens[i] = list[i].gen;
+	}
+	duc_free(list);
+
+	return gens;
+}
+
+
+void duc_generations_free(struct duc_generation *list)
+{
+	duc_free(list);
+}
+
+
+static int cmp_snap_ent(const void *a, const void *b)
+{
+	const struct snap_ent *e1 = a;
+	const struct snap_ent *e2 = b;
+	return strcmp(e1->ent.name, e2->ent.name);
+}
+
+
+/*
+ * Read a snapshot record, entries are sorted by name. A missing record reads
+ * as an empty directory
+ */
+
+static struct snap_ent *snap_read(duc *duc, const uint8_t *hash, size_t *count)
+{
+	char key[64];
+	size_t keyl = snap_key(hash, key, sizeof(key));
+	size_t vall;
+	struct snap_ent *list = NULL;
+	size_t n = 0, max = 0;
+
+	char *val = duc_db_get(duc, key, keyl, &vall);
+	if(val) {
+		struct buffer *b = buffer_new(val, vall);
+		while(b->ptr < b->len) {
+			if(n == max) {
+				max = max ? max * 2 : 32;
+				list = duc_realloc(list, max * sizeof(*list));
+			}
+			struct snap_ent *e = &list[n++];
+			uint64_t v;
+			memset(e, 0, sizeof(*e));
+			buffer_get_string(b, &e->ent.name);
+			buffer_get_size(b, &e->ent.size);
+			buffer_get_varint(b, &v); e->ent.type = v;
+			if(e->ent.type == DUC_FILE_TYPE_DIR) get_hash(b, e->hash);
+		}
+		buffer_free(b);
+	}
+
+	qsort(list, n, sizeof(*list), cmp_snap_ent);
+	*count = n;
+	return list;
+}
+
+
+static void snap_free(struct snap_ent *list, size_t count)
+{
+	size_t i;
+	for(i=0; i<count; i++) {
+		duc_free(list[i].ent.name);
+	}
+	duc_free(list);
+}
+
+
+/*
+ * Find the hash of the directory at the given path below the root of a
+ * generation. Returns 0 on success
+ */
+
+static int snap_find(duc *duc, const uint8_t *root, const char *rel, uint8_t *hash)
+{
+	char *p = duc_strdup(rel);
+	char *save = NULL;
+	char *name;
+	int r = 0;
+
+	memcpy(hash, root, HISTORY_HASH_SIZE);
+
+	for(name = strtok_r(p, "/", &save); name; name = strtok_r(NULL, "/", &save)) {
+		size_t count, i;
+		struct snap_ent *list = snap_read(duc, hash, &count);
+		r = -1;
+		for(i=0; i<count; i++) {
+			if(list[i].ent.type == DUC_FILE_TYPE_DIR && strcmp(list[i].ent.name, name) == 0) {
+				memcpy(hash, list[i].hash, HISTORY_HASH_SIZE);
+				r = 0;
+				break;
+			}
+		}
+		snap_free(list, count);
+		if(r != 0) break;
+	}
+
+	duc_free(p);
+	return r;
+}
+
+
+struct diff {
+	duc *duc;
+	int maxdepth;
+	duc_diff_cb cb;
+	void *ptr;
+};
+
+
+/*
+ * Compare two snapshots of a directory. Subdirectories present in both with
+ * equal hashes are unchanged and skipped
+ */
+
+static int diff_dir(struct diff *d, const char *path, int depth, const uint8_t *h_old, const uint8_t *h_new)
+{
+	size_t n_old = 0, n_new = 0;
+	struct snap_ent *l_old = h_old ? snap_read(d->duc, h_old, &n_old) : NULL;
+	struct snap_ent *l_new = h_new ? snap_read(d->duc, h_new, &n_new) : NULL;
+	size_t i = 0, j = 0;
+	int r = 0;
+
+	while(r == 0 && (i < n_old || j < n_new)) {
+
+		struct snap_ent *e_old = i < n_old ? &l_old[i] : NULL;
+		struct snap_ent *e_new = j < n_new ? &l_new[j] : NULL;
+
+		if(e_old && e_new) {
+			int c = strcmp(e_old->ent.name, e_new->ent.name);
+			if(c < 0) e_new = NULL;
+			if(c > 0) e_old = NULL;
+		}
+		if(e_old) i++;
+		if(e_new) j++;
+
+		int is_dir_old = e_old && e_old->ent.type == DUC_FILE_TYPE_DIR;
+		int is_dir_new = e_new && e_new->ent.type == DUC_FILE_TYPE_DIR;
+
+		if(e_old && e_new && is_dir_old == is_dir_new) {
+			if(is_dir_old && memcmp(e_old->hash, e_new->hash, HISTORY_HASH_SIZE) == 0) continue;
+			if(!is_dir_old && memcmp(&e_old->ent.size, &e_new->ent.size, sizeof(struct duc_size)) == 0) continue;
+		}
+
+		char *path_ent = duc_path_join(path, e_new ? e_new->ent.name : e_old->ent.name);
+
+		r = d->cb(path_ent, depth,
+				e_old ? &e_old->ent : NULL,
+				e_new ? &e_new->ent : NULL, d->ptr);
+
+		if(r == 0 && (is_dir_old || is_dir_new) && (d->maxdepth == 0 || depth + 1 < d->maxdepth)) {
+			r = diff_dir(d, path_ent, depth + 1,
+					is_dir_old ? e_old->hash : NULL,
+					is_dir_new ? e_new->hash : NULL);
+		}
+
+		duc_free(path_ent);
+	}
+
+	snap_free(l_old, n_old);
+	snap_free(l_new, n_new);
+	return r;
+}
+
+
+/*
+ * Compare two generations of the tree below the given path, calling back for
+ * every entry which was added, removed or changed in size, up to maxdepth
+ * levels deep (0 for no limit). Returns 0 when done, -1 on error, or the
+ * non-zero value returned by the callback to stop
+ */
+
+int duc_diff(duc *duc, const char *path, size_t gen_old, size_t gen_new, int maxdepth, duc_diff_cb cb, void *ptr)
+{
+	if(duc->shards) {
+		struct duc *shard = federate_route(duc, path);
+		return shard ? duc_diff(shard, path, gen_old, gen_new, maxdepth, cb, ptr) : -1;
+	}
+
+	char *path_canon = duc_canonicalize_path(path);
+	if(path_canon == NULL) {
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		return -1;
+	}
+
+	size_t count;
+	char *root = NULL;
+	struct generation *list = read_generations(duc, path_canon, &count, &root);
+	int r = -1;
+
+	if(list == NULL || gen_old >= count || gen_new >= count) {
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		goto out;
+	}
+
+	/* Find the directory in both generations, it may be missing in one */
+
+	const char *rel = path_canon + strlen(root);
+	uint8_t h_old[HISTORY_HASH_SIZE], h_new[HISTORY_HASH_SIZE];
+	int found_old = snap_find(duc, list[gen_old].hash, rel, h_old) == 0;
+	int found_new = snap_find(duc, list[gen_new].hash, rel, h_new) == 0;
+
+	if(!found_old && !found_new) {
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		goto out;
+	}
+
+	struct diff d = {
+		.duc = duc,
+		.maxdepth = maxdepth,
+		.cb = cb,
+		.ptr = ptr,
+	};
+
+	r = 0;
+	if(!found_old || !found_new || memcmp(h_old, h_new, HISTORY_HASH_SIZE) != 0) {
+		r = diff_dir(&d, path_canon, 0, found_old ? h_old : NULL, found_new ? h_new : NULL);
+	}
+
+out:
+	duc_free(list);
+	duc_free(root);
+	duc_free(path_canon);
+	return r;
+}
+
+
+struct snap_seen {
+	uint8_t hash[HISTORY_HASH_SIZE];
+	UT_hash_handle hh;
+};
+
+
+static int cmp_hash(const void *a, const void *b)
+{
+	return memcmp(a, b, HISTORY_HASH_SIZE);
+}
+
+
+/*
+ * Copy the history of an index root and all snapshot records it refers to
+ * into another database. Snapshot records already present there are skipped
+ * with everything below them. Returns the number of bytes copied
+ */
+
+size_t history_copy(duc *dst, duc *src, const char *path)
+{
+	char key[DUC_PATH_MAX + 16];
+	size_t keyl = history_key(path, key, sizeof(key));
+	size_t vall;
+
+	char *val = db_get(src->db, key, keyl, &vall);
+	if(val == NULL) return 0;
+	db_put(dst->db, key, keyl, val, vall);
+	free(val);
+	size_t copied = vall;
+
+	size_t count, i;
+	char *root = NULL;
+	struct generation *list = read_generations(src, path, &count, &root);
+
+	/* Collect the snapshot records reachable from all generations */
+
+	struct snap_seen *seen = NULL, *s, *sn;
+	uint8_t (*stack)[HISTORY_HASH_SIZE] = duc_malloc((count + 1) * HISTORY_HASH_SIZE);
+	size_t depth = 0, max = count + 1;
+	size_t n = 0;
+
+	for(i=0; i<count; i++) {
+		memcpy(stack[depth++], list[i].hash, HISTORY_HASH_SIZE);
+	}
+
+	while(depth > 0) {
+		uint8_t hash[HISTORY_HASH_SIZE];
+		memcpy(hash, stack[--depth], HISTORY_HASH_SIZE);
+
+		HASH_FIND(hh, seen, hash, HISTORY_HASH_SIZE, s);
+		if(s) continue;
+
+		keyl = snap_key(hash, key, sizeof(key));
+		val = db_get(dst->db, key, keyl, &vall);
+		if(val) {
+			free(val);
+			continue;
+		}
+
+		s = duc_malloc(sizeof *s);
+		memcpy(s->hash, hash, HISTORY_HASH_SIZE);
+		HASH_ADD(hh, seen, hash, HISTORY_HASH_SIZE, s);
+		n ++;
+
+		size_t ent_count, j;
+		struct snap_ent *ents = snap_read(src, hash, &ent_count);
+		for(j=0; j<ent_count; j++) {
+			if(ents[j].ent.type != DUC_FILE_TYPE_DIR) continue;
+			if(depth == max) {
+				max *= 2;
+				stack = duc_realloc(stack, max * HISTORY_HASH_SIZE);
+			}
+			memcpy(stack[depth++], ents[j].hash, HISTORY_HASH_SIZE);
+		}
+		snap_free(ents, ent_count);
+	}
+
+	/* Write them in key order */
+
+	uint8_t (*hashes)[HISTORY_HASH_SIZE] = duc_malloc(n * HISTORY_HASH_SIZE + 1);
+	i = 0;
+	HASH_ITER(hh, seen, s, sn) {
+		memcpy(hashes[i++], s->hash, HISTORY_HASH_SIZE);
+		HASH_DEL(seen, s);
+		duc_free(s);
+	}
+	qsort(hashes, n, HISTORY_HASH_SIZE, cmp_hash);
+
+	for(i=0; i<n; i++) {
+		keyl = snap_key(hashes[i], key, sizeof(key));
+		val = db_get(src->db, key, keyl, &vall);
+		if(val == NULL) continue;
+		db_put(dst->db, key, keyl, val, vall);
+		free(val);
+		copied += vall;
+	}
+
+	duc_free(hashes);
+	duc_free(stack);
+	duc_free(list);
+	duc_free(root);
+
+	duc_log(src, DUC_LOG_DBG, "Copied %zu history generations and %zu snapshot records of %s", count, n, path);
+
+	return copied;
+}
+
+
+/*
+ * End
+ */
+
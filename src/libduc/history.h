@@ -0,0 +1,15 @@
+#ifndef history_h
+#define history_h
+
+#include "duc.h"
+#include "buffer.h"
+
+#define HISTORY_HASH_SIZE DUC_DIGEST_SIZE
+
+void history_put_ent(struct buffer *snap, const struct duc_dirent *ent, const uint8_t *digest);
+void history_put_dir(duc *duc, struct buffer *snap, const uint8_t *digest);
+void history_add_generation(duc *duc, const struct duc_index_report *report, const uint8_t *hash);
+int history_get_latest(duc *duc, const char *path, uint8_t *hash);
+size_t history_copy(duc *dst, duc *src, const char *path);
+
+#endif
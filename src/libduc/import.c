@@ -0,0 +1,394 @@
+
+/*
+ * Import of file listings. Storage systems can often list their metadata much
+ * faster than a walk of the file system, for example with
+ *
+ *   find PATH -printf '%i %D %s %b %y %p\0'
+ *
+ * Every record of the listing holds the inode and device number, the apparent
+ * size, the number of 512 byte blocks, the type and the path of one entry, the
+ * first record being the indexed directory itself. duc_import() builds the
+ * same directory records as duc_index() from such a listing.
+ *
+ * The listing is expected in depth-first order with every directory before
+ * its contents, as written by find without -depth. Only the directories from
+ * the root down to the current entry are kept in memory; a directory is
+ * written as soon as the listing leaves it. Entries of directories which were
+ * already written, or not listed at all, can not be placed and are skipped.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "duc.h"
+#include "private.h"
+#include "db.h"
+#include "buffer.h"
+#include "digest.h"
+#include "names.h"
+#include "tally.h"
+#include "exts.h"
+
+struct level {
+	char *path;
+	size_t path_len;
+	struct duc_dirent ent;
+	struct buffer *buffer;
+	struct digest digest;
+	struct tally *exts;
+};
+
+struct import {
+	duc *duc;
+	duc_index_flags flags;
+	struct duc_index_report *report;
+	struct names *names;
+	struct level *levels;
+	size_t depth;
+	size_t depth_max;
+};
+
+
+static duc_file_type char_to_type(char c)
+{
+	switch(c) {
+		case 'f': return DUC_FILE_TYPE_REG;
+		case 'd': return DUC_FILE_TYPE_DIR;
+		case 'l': return DUC_FILE_TYPE_LNK;
+		case 'b': return DUC_FILE_TYPE_BLK;
+		case 'c': return DUC_FILE_TYPE_CHR;
+		case 'p': return DUC_FILE_TYPE_FIFO;
+		case 's': return DUC_FILE_TYPE_SOCK;
+		default:  return DUC_FILE_TYPE_UNKNOWN;
+	}
+}
+
+
+/*
+ * Parse one record, returns the path or NULL if the record is malformed
+ */
+
+static char *parse_record(char *rec, struct duc_dirent *ent)
+{
+	uintmax_t v[4];
+	char *p = rec;
+	char *end;
+	int i;
+
+	for(i=0; i<4; i++) {
+		if(*p < '0' || *p > '9') return NULL;
+		errno = 0;
+		v[i] = strtoumax(p, &end, 10);
+		if(errno != 0 || *end != ' ') return NULL;
+		p = end + 1;
+	}
+
+	if(p[0] == '\0' || p[1] != ' ' || p[2] == '\0') return NULL;
+
+	ent->devino.ino = v[0];
+	ent->devino.dev = v[1];
+	ent->type = char_to_type(p[0]);
+	ent->size.apparent = ent->type == DUC_FILE_TYPE_DIR ? 0 : v[2];
+	ent->size.actual = v[3] * 512;
+	ent->size.count = 1;
+
+	return p + 2;
+}
+
+
+/*
+ * Return the name of path relative to the directory at the given level, or
+ * NULL if it does not lie below it
+ */
+
+static const char *name_below(const struct level *l, const char *path)
+{
+	if(strncmp(path, l->path, l->path_len) != 0) return NULL;
+	if(l->path_len > 0 && l->path[l->path_len-1] == '/') {
+		return path[l->path_len] ? path + l->path_len : NULL;
+	}
+	if(path[l->path_len] != '/' || path[l->path_len+1] == '\0') return NULL;
+	return path + l->path_len + 1;
+}
+
+
+static void level_push(struct import *imp, const char *path, const char *name, struct duc_dirent *ent)
+{
+	if(imp->depth == imp->depth_max) {
+		imp->depth_max = imp->depth_max ? imp->depth_max * 2 : 32;
+		imp->levels = duc_realloc(imp->levels, imp->depth_max * sizeof(*imp->levels));
+	}
+
+	struct level *parent = imp->depth ? &imp->levels[imp->depth-1] : NULL;
+	struct level *l = &imp->levels[imp->depth++];
+	struct duc_devino devino_parent = { 0, 0 };
+	if(parent) devino_parent = parent->ent.devino;
+
+	l->path = duc_strdup(path);
+	l->path_len = strlen(path);
+	l->ent = *ent;
+	l->ent.name = duc_strdup(name);
+	l->buffer = buffer_new(NULL, 32768);
+	memset(&l->digest, 0, sizeof l->digest);
+	l->exts = (imp->flags & DUC_INDEX_EXTS) ? tally_new() : NULL;
+
+	buffer_put_dir(l->buffer, &devino_parent, 0, NULL, NULL);
+
+	imp->report->dir_count ++;
+	duc_size_accum(&imp->report->size, &l->ent.size);
+}
+
+
+/*
+ * Write the completed directory at the top of the stack and add it to its
+ * parent, see scanner_free() in index.c
+ */
+
+static void level_pop(struct import *imp)
+{
+	struct level *l = &imp->levels[--imp->depth];
+	struct level *parent = imp->depth ? &imp->levels[imp->depth-1] : NULL;
+	duc *duc = imp->duc;
+	int dry_run = imp->flags & DUC_INDEX_DRY_RUN;
+
+	uint8_t digest[DUC_DIGEST_SIZE];
+	digest_final(&l->digest, digest);
+	buffer_set_dir_digest(l->buffer, digest, NULL);
+
+	if(l->exts) {
+		if(!dry_run) {
+			if(tally_count(l->exts) > EXTS_TOP) {
+				struct tally *t = tally_new();
+				tally_merge(t, l->exts);
+				tally_trim(t, EXTS_TOP, EXTS_OTHER, strlen(EXTS_OTHER));
+				tally_write(duc, EXTS_PREFIX, &l->ent.devino, digest, imp->report->time_start.tv_sec, t);
+				tally_free(t);
+			} else {
+				tally_write(duc, EXTS_PREFIX, &l->ent.devino, digest, imp->report->time_start.tv_sec, l->exts);
+			}
+		}
+		if(parent) {
+			tally_merge(parent->exts, l->exts);
+			if(tally_count(parent->exts) > EXTS_TRACK) {
+				tally_trim(parent->exts, EXTS_TRACK / 2, EXTS_OTHER, strlen(EXTS_OTHER));
+			}
+		}
+		tally_free(l->exts);
+	}
+
+	if(parent) {
+		duc_size_accum(&parent->ent.size, &l->ent.size);
+		buffer_put_dirent(parent->buffer, &l->ent);
+		digest_add_ent(&parent->digest, &l->ent, digest);
+	}
+
+	if(imp->names) {
+		names_add_dir(imp->names, &l->ent.devino, l->buffer, imp->flags & DUC_INDEX_HIDE_FILE_NAMES);
+	}
+
+	if(!dry_run) {
+		char key[32];
+		struct duc_devino *devino = &l->ent.devino;
+		size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
+		int r = db_put(duc->db, key, keyl, l->buffer->data, l->buffer->len);
+		if(r != 0) duc->err = r;
+	}
+
+	buffer_free(l->buffer);
+	duc_free(l->ent.name);
+	duc_free(l->path);
+}
+
+
+/*
+ * The first record is the indexed directory. The report holds its canonical
+ * path when the listing was made on this host with a relative path
+ */
+
+static int import_root(struct import *imp, const char *path, struct duc_dirent *ent)
+{
+	duc *duc = imp->duc;
+	struct duc_index_report *report = imp->report;
+
+	if(ent->type != DUC_FILE_TYPE_DIR) {
+		duc_log(duc, DUC_LOG_FTL, "The listing does not start with a directory: %s", path);
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		return -1;
+	}
+
+	if(path[0] == '/') {
+		size_t l = strlen(path);
+		while(l > 1 && path[l-1] == '/') l--;
+		snprintf(report->path, sizeof(report->path), "%.*s", (int)l, path);
+	} else {
+		char *path_canon = duc_canonicalize_path(path);
+		if(path_canon == NULL) {
+			duc_log(duc, DUC_LOG_FTL, "Error converting path %s: %s", path, strerror(errno));
+			duc->err = DUC_E_PATH_NOT_FOUND;
+			return -1;
+		}
+		snprintf(report->path, sizeof(report->path), "%s", path_canon);
+		duc_free(path_canon);
+	}
+
+	report->devino = ent->devino;
+	level_push(imp, path, report->path, ent);
+
+	if(!(imp->flags & DUC_INDEX_DRY_RUN)) {
+		if(imp->flags & DUC_INDEX_NAMES) {
+			imp->names = names_new(duc, &report->devino, 0);
+		} else {
+			names_clear(duc, &report->devino);
+		}
+	}
+
+	return 0;
+}
+
+
+static void import_record(struct import *imp, const char *path, struct duc_dirent *ent)
+{
+	struct duc_index_report *report = imp->report;
+	const char *name;
+
+	/* Leave the directories this entry does not belong to */
+
+	while(imp->depth > 1 && name_below(&imp->levels[imp->depth-1], path) == NULL) {
+		level_pop(imp);
+	}
+
+	struct level *l = &imp->levels[imp->depth-1];
+	name = name_below(l, path);
+
+	if(name == NULL) {
+		duc_log(imp->duc, DUC_LOG_WRN, "Skipping %s: not below %s", path, report->path);
+		report->error_count ++;
+		return;
+	}
+
+	if(strchr(name, '/')) {
+		duc_log(imp->duc, DUC_LOG_WRN, "Skipping %s: directory not listed before its contents", path);
+		report->error_count ++;
+		return;
+	}
+
+	if(ent->type == DUC_FILE_TYPE_DIR) {
+		level_push(imp, path, name, ent);
+		return;
+	}
+
+	ent->name = (char *)name;
+
+	duc_size_accum(&l->ent.size, &ent->size);
+	if(l->exts && ent->type == DUC_FILE_TYPE_REG) {
+		exts_add(l->exts, name, &ent->size);
+	}
+	duc_size_accum(&report->size, &ent->size);
+	report->file_count ++;
+
+	if(imp->flags & DUC_INDEX_HIDE_FILE_NAMES) ent->name = "<FILE>";
+
+	buffer_put_dirent(l->buffer, ent);
+	digest_add_ent(&l->digest, ent, NULL);
+}
+
+
+struct duc_index_report *duc_import(duc *duc, FILE *f, char sep, duc_index_flags flags)
+{
+	if(duc->db == NULL && !(flags & DUC_INDEX_DRY_RUN)) {
+		duc->err = DUC_E_DB_NOT_FOUND;
+		return NULL;
+	}
+
+	if(flags & (DUC_INDEX_USERS | DUC_INDEX_AGES | DUC_INDEX_HISTORY)) {
+		duc_log(duc, DUC_LOG_WRN, "Listings hold no owners and times, not recording users, ages or history");
+	}
+
+	struct import imp;
+	memset(&imp, 0, sizeof imp);
+	imp.duc = duc;
+	imp.flags = flags;
+	imp.report = duc_malloc0(sizeof(struct duc_index_report));
+	gettimeofday(&imp.report->time_start, NULL);
+
+	char *rec = NULL;
+	size_t rec_max = 0;
+	ssize_t len;
+	size_t n = 0;
+	int r = 0;
+
+	while((len = getdelim(&rec, &rec_max, sep, f)) != -1) {
+
+		n ++;
+		if(len > 0 && rec[len-1] == sep) rec[--len] = '\0';
+		if(len > 0 && sep == '\n' && rec[len-1] == '\r') rec[--len] = '\0';
+		if(len == 0) continue;
+
+		struct duc_dirent ent;
+		char *path = parse_record(rec, &ent);
+		if(path == NULL) {
+			duc_log(duc, DUC_LOG_WRN, "Skipping malformed record %zu", n);
+			imp.report->error_count ++;
+			continue;
+		}
+
+		duc_log(duc, DUC_LOG_DMP, "  %c %jd %jd %s",
+				duc_file_type_char(ent.type), ent.size.apparent, ent.size.actual, path);
+
+		if(imp.depth == 0) {
+			r = import_root(&imp, path, &ent);
+			if(r != 0) break;
+		} else {
+			import_record(&imp, path, &ent);
+		}
+	}
+
+	free(rec);
+
+	if(r == 0 && ferror(f)) {
+		duc_log(duc, DUC_LOG_FTL, "Error reading listing: %s", strerror(errno));
+		duc->err = DUC_E_UNKNOWN;
+		r = -1;
+	}
+
+	if(r == 0 && imp.depth == 0) {
+		duc_log(duc, DUC_LOG_FTL, "The listing holds no entries");
+		duc->err = DUC_E_PATH_NOT_FOUND;
+		r = -1;
+	}
+
+	/* An incomplete listing is not stored, the directories written so far
+	 * are not referred to by any report */
+
+	while(imp.depth > 0) {
+		if(r != 0) imp.flags |= DUC_INDEX_DRY_RUN;
+		level_pop(&imp);
+	}
+	if(imp.names) names_free(imp.names);
+	duc_free(imp.levels);
+
+	if(r != 0) {
+		duc_free(imp.report);
+		return NULL;
+	}
+
+	gettimeofday(&imp.report->time_stop, NULL);
+	if(!(flags & DUC_INDEX_DRY_RUN)) {
+		db_write_report(duc, imp.report);
+	}
+
+	return imp.report;
+}
+
+
+/*
+ * End
+ */
+
@@ -17,21 +17,40 @@
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
-#ifdef HAVE_FNMATCH_H
-#include <fnmatch.h>
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
 #endif
 
 #include "db.h"
+#include "dbqueue.h"
 #include "duc.h"
 #include "private.h"
 #include "uthash.h"
 #include "utlist.h"
 #include "buffer.h"
+#include "exclude.h"
+#include "inoset.h"
+#include "names.h"
+#include "history.h"
+#include "digest.h"
+#include "users.h"
+#include "exts.h"
+#include "ages.h"
+
+/* With the *at() functions entries are opened relative to the directory
+ * being scanned. Otherwise the scanner changes the working directory of the
+ * process, and paths can not be indexed in parallel */
+
+#if defined(HAVE_OPENAT) && defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+#define HAVE_AT_FUNCS
+#endif
 
-struct hard_link {
-	struct duc_devino devino;
-	UT_hash_handle hh;
-};
+#if defined(HAVE_LIBPTHREAD) && defined(HAVE_AT_FUNCS)
+#define INDEX_PARALLEL
+#endif
 
 struct fstype {
 	char *path;
@@ -39,14 +58,84 @@ struct fstype {
 	UT_hash_handle hh;
 };
 
-struct exclude {
+/* File system type and scan decision per device, -1 means not yet decided */
+
+struct fsdev {
+	duc_dev_t dev;
+	char *type;
+	int allowed;
+	UT_hash_handle hh;
+};
+
+/* Set of entry names, used for skipping completed entries when resuming */
+
+struct name {
+	char *name;
+	UT_hash_handle hh;
+};
+
+/*
+ * Breakdowns of the directory sizes, kept as side records next to the
+ * directory records. Every directory gets a tally, which is merged into the
+ * tally of its parent when the directory is complete
+ */
+
+enum side_kind {
+	SIDE_USERS,
+	SIDE_EXTS,
+	SIDE_AGES,
+	SIDE_COUNT
+};
+
+static const struct side_info {
+	duc_index_flags flag;
+	const char *prefix;
+	const char *descr;
+	size_t keys_max;          /* Keys stored in the side record, 0 for all */
+	size_t keys_track;        /* Keys tracked while indexing, 0 for all */
+	const char *key_other;    /* Key for the sum of all dropped keys */
+	enum digest_meta_part part; /* Owners or times the breakdown depends on */
+} side_info[SIDE_COUNT] = {
+	[SIDE_USERS] = { DUC_INDEX_USERS, USERS_PREFIX, "usage per user", 0, 0, NULL, DIGEST_META_UID },
+	[SIDE_EXTS]  = { DUC_INDEX_EXTS,  EXTS_PREFIX,  "usage per extension", EXTS_TOP, EXTS_TRACK, EXTS_OTHER, DIGEST_META_NONE },
+	[SIDE_AGES]  = { DUC_INDEX_AGES,  AGES_PREFIX,  "file ages", 0, 0, NULL, DIGEST_META_TIME },
+};
+
+
+/* Saved state of one directory on the path being scanned at checkpoint time */
+
+struct checkpoint_level {
 	char *name;
-	struct exclude *next;
+	struct duc_devino devino;
+	struct duc_size size;
+	struct buffer *buffer;
+	struct buffer *done;
+	struct digest digest;
+	struct digest_meta meta;
+	int has_side[SIDE_COUNT];
+	struct buffer *side[SIDE_COUNT];
+};
+
+struct checkpoint {
+	struct duc_index_report report;
+	int has_links;
+	size_t links_chunks;
+	size_t level_count;
+	struct checkpoint_level *levels;
+};
+
+/* Index run of a partial database, grafted in place of the directory at its
+ * path instead of scanning it. All runs of one database share its handle */
+
+struct graft {
+	duc *duc;
+	struct duc_index_report report;
+	int used;
 };
 
 struct duc_index_req {
 	duc *duc;
-	struct exclude *exclude_list;
+	struct exclude *exclude;
 	duc_dev_t dev;
 	duc_index_flags flags;
 	int maxdepth;
@@ -57,10 +146,25 @@ struct duc_index_req {
 	int progress_n;
 	struct timeval progress_interval;
 	struct timeval progress_time;
-	struct hard_link *hard_link_map;
+	struct inoset *hard_link_set;
+	char *hard_link_spill_dir;
+	struct buffer *links_new;   /* Hard links added since the last checkpoint */
+	size_t links_chunks;        /* Hard link records written with the checkpoints */
+	size_t links_stale;         /* Hard link records of a checkpoint not resumed */
 	struct fstype *fstypes_mounted;
+	struct fsdev *fsdev_map;
+	int mounts_read;
 	struct fstype *fstypes_include;
 	struct fstype *fstypes_exclude;
+	struct timeval checkpoint_interval;
+	struct timeval checkpoint_time;
+	struct checkpoint *checkpoint;
+	struct names *names;
+	uint8_t history_hash[HISTORY_HASH_SIZE];
+	int history_incomplete;
+	int threads;
+	struct graft *grafts;
+	size_t graft_count;
 };
 
 struct scanner {
@@ -72,10 +176,22 @@ struct scanner {
 	struct duc_index_req *req;
 	struct duc_index_report *rep;
 	struct duc_dirent ent;
+	char *path;
+	struct buffer *done;
+	struct name *done_map;
+	struct checkpoint_level *resume;
+	int resumed;
+	struct buffer *snap;
+	struct digest digest;
+	struct digest_meta meta;
+	struct tally *side[SIDE_COUNT];
+	struct tally *links;
+	uid_t uid;
 };
 
 
 static void scanner_free(struct scanner *scanner);
+static void checkpoint_free(struct checkpoint *cp);
 
 
 duc_index_req *duc_index_req_new(duc *duc)
@@ -85,23 +201,19 @@ duc_index_req *duc_index_req_new(duc *duc)
 	req->duc = duc;
 	req->progress_interval.tv_sec = 0;
 	req->progress_interval.tv_usec = 100 * 1000;
-	req->hard_link_map = NULL;
+	req->exclude = exclude_new();
 
 	return req;
 }
 
 
-int duc_index_req_free(duc_index_req *req)
+/*
+ * Free the mount tables, which are filled lazily by every request
+ */
+
+static void free_mounts(duc_index_req *req)
 {
-	struct hard_link *h, *hn;
 	struct fstype *f, *fn;
-	struct exclude *e, *en;
-
-	HASH_ITER(hh, req->hard_link_map, h, hn) {
-		HASH_DEL(req->hard_link_map, h);
-		free(h);
-	}
-	
 	HASH_ITER(hh, req->fstypes_mounted, f, fn) {
 		duc_free(f->type);
 		duc_free(f->path);
@@ -109,6 +221,25 @@ int duc_index_req_free(duc_index_req *req)
 		free(f);
 	}
 	
+	struct fsdev *d, *dn;
+	HASH_ITER(hh, req->fsdev_map, d, dn) {
+		duc_free(d->type);
+		HASH_DEL(req->fsdev_map, d);
+		free(d);
+	}
+}
+
+
+int duc_index_req_free(duc_index_req *req)
+{
+	struct fstype *f, *fn;
+
+	if(req->hard_link_set) inoset_free(req->hard_link_set);
+	if(req->links_new) buffer_free(req->links_new);
+	duc_free(req->hard_link_spill_dir);
+	
+	free_mounts(req);
+	
 	HASH_ITER(hh, req->fstypes_include, f, fn) {
 		duc_free(f->type);
 		HASH_DEL(req->fstypes_include, f);
@@ -121,10 +252,16 @@ int duc_index_req_free(duc_index_req *req)
 		free(f);
 	}
 
-	LL_FOREACH_SAFE(req->exclude_list, e, en) {
-		free(e->name);
-		free(e);
+	size_t i;
+	for(i=0; i<req->graft_count; i++) {
+		if(i == 0 || req->grafts[i].duc != req->grafts[i-1].duc) {
+			duc_close(req->grafts[i].duc);
+			duc_del(req->grafts[i].duc);
+		}
 	}
+	duc_free(req->grafts);
+
+	exclude_free(req->exclude);
 
 	free(req);
 
@@ -134,9 +271,7 @@ int duc_index_req_free(duc_index_req *req)
 
 int duc_index_req_add_exclude(duc_index_req *req, const char *patt)
 {
-	struct exclude *e = duc_malloc(sizeof(struct exclude));
-	e->name = duc_strdup(patt);
-	LL_APPEND(req->exclude_list, e);
+	exclude_add(req->exclude, patt);
 	return 0;
 }
 
@@ -199,6 +334,22 @@ int duc_index_req_set_uid(duc_index_req *req, int uid)
 }
 
 
+int duc_index_req_set_hard_link_spill(duc_index_req *req, const char *dir)
+{
+	duc_free(req->hard_link_spill_dir);
+	req->hard_link_spill_dir = dir ? duc_strdup(dir) : NULL;
+	return 0;
+}
+
+
+int duc_index_req_set_checkpoint(duc_index_req *req, int interval)
+{
+	req->checkpoint_interval.tv_sec = interval;
+	req->checkpoint_interval.tv_usec = 0;
+	return 0;
+}
+
+
 int duc_index_req_set_progress_cb(duc_index_req *req, duc_index_progress_cb fn, void *ptr)
 {
 	req->progress_fn = fn;
@@ -207,16 +358,50 @@ int duc_index_req_set_progress_cb(duc_index_req *req, duc_index_progress_cb fn,
 }
 
 
-static int match_exclude(const char *name, struct exclude *list)
+int duc_index_req_set_threads(duc_index_req *req, int threads)
 {
-	struct exclude *e;
-	LL_FOREACH(list, e) {
-#ifdef HAVE_FNMATCH_H
-		if(fnmatch(e->name, name, 0) == 0) return 1;
-#else
-		if(strstr(name, e->name) == 0) return 1;
-#endif
+	req->threads = threads;
+	return 0;
+}
+
+
+/*
+ * Graft the index runs of a partial database into this index. A directory
+ * found at the path of one of these runs is not scanned, its records are
+ * copied from the partial database instead
+ */
+
+int duc_index_req_add_graft(duc_index_req *req, const char *path_db)
+{
+	duc *src = duc_new();
+	duc_set_log_level(src, req->duc->log_level);
+	duc_set_log_callback(src, req->duc->log_callback);
+
+	if(duc_open(src, path_db, DUC_OPEN_RO) != DUC_OK) {
+		req->duc->err = src->err;
+		duc_del(src);
+		return -1;
+	}
+
+	struct duc_index_report *r;
+	size_t id = 0;
+
+	while((r = duc_get_report(src, id++)) != NULL) {
+		req->grafts = duc_realloc(req->grafts, (req->graft_count + 1) * sizeof(*req->grafts));
+		struct graft *g = &req->grafts[req->graft_count++];
+		g->duc = src;
+		g->report = *r;
+		g->report.path_current = NULL;
+		g->used = 0;
+		duc_index_report_free(r);
 	}
+
+	if(id == 1) {
+		duc_log(req->duc, DUC_LOG_WRN, "Database %s holds no index runs to graft", path_db);
+		duc_close(src);
+		duc_del(src);
+	}
+
 	return 0;
 }
 
@@ -279,37 +464,77 @@ static void st_to_devino(struct stat *st, struct duc_devino *devino)
 
 static int is_duplicate(struct duc_index_req *req, struct duc_devino *devino)
 {
-	struct hard_link *h;
-	HASH_FIND(hh, req->hard_link_map, devino, sizeof(*devino), h);
-	if(h) return 1;
-
-	h = duc_malloc(sizeof *h);
-	h->devino = *devino;
-	HASH_ADD(hh, req->hard_link_map, devino, sizeof(h->devino), h);
-	return 0;
+	if(req->hard_link_set == NULL) {
+		req->hard_link_set = inoset_new(req->hard_link_spill_dir);
+	}
+	int dup = inoset_add(req->hard_link_set, devino);
+	if(!dup && req->links_new) buffer_put_devino(req->links_new, devino);
+	return dup;
 }
 
 
-static void report_skip(struct duc *duc, const char *name, const char *fmt, ...)
+/*
+ * Log a warning for a skipped entry. The full path is composed of the path of
+ * the directory being scanned and the entry name, either of which may be NULL
+ */
+
+static void report_skip(struct duc *duc, const char *dir, const char *name, const char *fmt, ...)
 {
-	char path_full[DUC_PATH_MAX];
 	char msg[DUC_PATH_MAX + 128];
-	realpath(name, path_full);
 	va_list va;
 	va_start(va, fmt);
 	vsnprintf(msg, sizeof(msg), fmt, va);
-	duc_log(duc, DUC_LOG_WRN, "skipping %s: %s", path_full, msg);
 	va_end(va);
+
+	if(dir && name) {
+		const char *sep = strcmp(dir, "/") == 0 ? "" : "/";
+		duc_log(duc, DUC_LOG_WRN, "skipping %s%s%s: %s", dir, sep, name, msg);
+	} else {
+		duc_log(duc, DUC_LOG_WRN, "skipping %s: %s", dir ? dir : name, msg);
+	}
+}
+
+
+/*
+ * Find the file system type of the given device. The device numbers of all
+ * mounts are known from /proc/self/mountinfo, for devices not listed there
+ * (nested btrfs subvolumes, systems without mountinfo) fall back to looking
+ * up the mount point path of the entry. The scanner does not change into the
+ * directories it reads, so the path is made from the scanned directory.
+ */
+
+static struct fsdev *find_fsdev(struct duc_index_req *req, const char *dir, const char *name, duc_dev_t dev)
+{
+	struct fsdev *fsdev;
+	HASH_FIND(hh, req->fsdev_map, &dev, sizeof(dev), fsdev);
+	if(fsdev) return fsdev;
+
+	fsdev = duc_malloc0(sizeof *fsdev);
+	fsdev->dev = dev;
+	fsdev->allowed = -1;
+
+	char path_full[DUC_PATH_MAX];
+	char *path = duc_path_join(dir, name);
+	if(realpath(path, path_full)) {
+		struct fstype *fstype = NULL;
+		HASH_FIND_STR(req->fstypes_mounted, path_full, fstype);
+		if(fstype) fsdev->type = duc_strdup(fstype->type);
+	}
+	duc_free(path);
+
+	HASH_ADD(hh, req->fsdev_map, dev, sizeof(fsdev->dev), fsdev);
+	return fsdev;
 }
 
 
 /*
  * Check if this file system type should be scanned, depending on the
  * fstypes_include and fstypes_exclude lists. If neither has any entries, all
- * fs types are allowed. return 0 to skip, or 1 to scan
+ * fs types are allowed. The decision is made once per device and cached.
+ * return 0 to skip, or 1 to scan
  */
 
-static int is_fstype_allowed(struct duc_index_req *req, const char *name)
+static int is_fstype_allowed(struct duc_index_req *req, const char *dir, const char *name, duc_dev_t dev)
 {
 	struct duc *duc = req->duc;
 
@@ -317,39 +542,134 @@ static int is_fstype_allowed(struct duc_index_req *req, const char *name)
 		return 1;
 	}
 
-	/* Find file system type */
+	struct fsdev *fsdev = find_fsdev(req, dir, name, dev);
 
-	char path_full[DUC_PATH_MAX];
-	realpath(name, path_full);
-	struct fstype *fstype = NULL;
-	HASH_FIND_STR(req->fstypes_mounted, path_full, fstype);
-	if(fstype == NULL) {
-		report_skip(duc, name, "Unable to determine fs type");
-		return 0;
-	}
-	const char *type = fstype->type;
+	if(fsdev->allowed == -1) {
+
+		struct fstype *fstype = NULL;
+		fsdev->allowed = 1;
 
-	/* Check if excluded */
+		if(fsdev->type == NULL) {
+			fsdev->allowed = 0;
+		}
+
+		if(fsdev->allowed && req->fstypes_exclude) {
+			HASH_FIND_STR(req->fstypes_exclude, fsdev->type, fstype);
+			if(fstype) fsdev->allowed = 0;
+		}
+
+		if(fsdev->allowed && req->fstypes_include) {
+			HASH_FIND_STR(req->fstypes_include, fsdev->type, fstype);
+			if(!fstype) fsdev->allowed = 0;
+		}
+	}
 
-	if(req->fstypes_exclude) {
-		HASH_FIND_STR(req->fstypes_exclude, type, fstype);
-		if(fstype) {
-			report_skip(duc, name, "File system type '%s' is excluded", type);
-			return 0;
+	if(!fsdev->allowed) {
+		struct fstype *fstype = NULL;
+		if(fsdev->type && req->fstypes_exclude) {
+			HASH_FIND_STR(req->fstypes_exclude, fsdev->type, fstype);
+		}
+		if(fsdev->type == NULL) {
+			report_skip(duc, dir, name, "Unable to determine fs type");
+		} else if(fstype) {
+			report_skip(duc, dir, name, "File system type '%s' is excluded", fsdev->type);
+		} else {
+			report_skip(duc, dir, name, "File system type '%s' is not included", fsdev->type);
 		}
 	}
 
-	/* Check if included */
+	return fsdev->allowed;
+}
+
+
+/*
+ * Add the directory itself to its breakdowns
+ */
+
+static void side_add_self(struct scanner *scanner)
+{
+	if(scanner->side[SIDE_USERS]) {
+		users_add(scanner->side[SIDE_USERS], scanner->uid, &scanner->ent.size);
+	}
+}
+
+
+/*
+ * Store the breakdowns of a completed directory, and add them to those of
+ * its parent
+ */
+
+static void side_write(struct scanner *scanner, const uint8_t *digest, const uint8_t *meta)
+{
+	struct duc_index_req *req = scanner->req;
+	time_t time = scanner->rep->time_start.tv_sec;
+	int i;
+
+	for(i=0; i<SIDE_COUNT; i++) {
+
+		struct tally *t = scanner->side[i];
+		const struct side_info *si = &side_info[i];
+		if(t == NULL) continue;
+
+		if(!(req->flags & DUC_INDEX_DRY_RUN)) {
+			uint8_t check[DUC_DIGEST_SIZE];
+			digest_check(digest, meta, si->part, check);
+			if(si->keys_max && tally_count(t) > si->keys_max) {
+				struct tally *t2 = tally_new();
+				tally_merge(t2, t);
+				tally_trim(t2, si->keys_max, si->key_other, strlen(si->key_other));
+				tally_write(scanner->duc, si->prefix, &scanner->ent.devino, check, time, t2);
+				tally_free(t2);
+			} else {
+				tally_write(scanner->duc, si->prefix, &scanner->ent.devino, check, time, t);
+			}
+		}
 
-	if(req->fstypes_include) {
-		HASH_FIND_STR(req->fstypes_include, type, fstype);
-		if(!fstype) {
-			report_skip(duc, name, "File system type '%s' is not included", type);
-			return 0;
+		struct scanner *parent = scanner->parent;
+		if(parent && parent->side[i]) {
+			tally_merge(parent->side[i], t);
+			if(si->keys_track && tally_count(parent->side[i]) > si->keys_track) {
+				tally_trim(parent->side[i], si->keys_track / 2, si->key_other, strlen(si->key_other));
+			}
 		}
+
+		tally_free(t);
+		scanner->side[i] = NULL;
+	}
+}
+
+
+/*
+ * Hard links counted in a directory are stored in a side record, so a later
+ * index run grafting this one can skip other links to the same files. The
+ * top directory always gets one, telling that hard links were checked
+ */
+
+static void links_add(struct scanner *scanner, const struct duc_devino *devino, const struct duc_size *size)
+{
+	if(scanner->links == NULL) scanner->links = tally_new();
+	struct buffer *b = buffer_new(NULL, 16);
+	buffer_put_devino(b, devino);
+	tally_add(scanner->links, b->data, b->len, size);
+	buffer_free(b);
+}
+
+
+static void links_write(struct scanner *scanner, const uint8_t *digest)
+{
+	struct duc_index_req *req = scanner->req;
+
+	if(!(req->flags & DUC_INDEX_CHECK_HARD_LINKS)) return;
+	if(scanner->links == NULL && scanner->parent) return;
+
+	if(!(req->flags & DUC_INDEX_DRY_RUN)) {
+		struct tally *t = scanner->links ? scanner->links : tally_new();
+		tally_write(scanner->duc, LINKS_PREFIX, &scanner->ent.devino, digest, scanner->rep->time_start.tv_sec, t);
+		if(t != scanner->links) tally_free(t);
 	}
 
-	return 1;
+	if(scanner->links) tally_free(scanner->links);
+	scanner->links = NULL;
 }
 
 
@@ -380,9 +700,25 @@ static struct scanner *scanner_new(struct duc *duc, struct scanner *scanner_pare
 		st = &st2;
 	}
 	
+#ifdef HAVE_AT_FUNCS
+	if(scanner_parent) {
+		int fd = openat(dirfd(scanner_parent->d), path, O_RDONLY | O_DIRECTORY);
+		if(fd != -1) {
+			scanner->d = fdopendir(fd);
+			if(scanner->d == NULL) {
+				int e = errno;
+				close(fd);
+				errno = e;
+			}
+		}
+	} else {
+		scanner->d = opendir(path);
+	}
+#else
 	scanner->d = opendir(path);
+#endif
 	if(scanner->d == NULL) {
-		report_skip(duc, path, strerror(errno));
+		report_skip(duc, scanner_parent ? scanner_parent->path : NULL, path, strerror(errno));
 		goto err;
 	}
 	
@@ -390,13 +726,38 @@ static struct scanner *scanner_new(struct duc *duc, struct scanner *scanner_pare
 	scanner->parent = scanner_parent;
 	scanner->buffer = buffer_new(NULL, 32768);
 
+	if(scanner_parent && scanner_parent->done) {
+		scanner->done = buffer_new(NULL, 1024);
+	}
+
+	if(scanner_parent && scanner_parent->snap) {
+		scanner->snap = buffer_new(NULL, 1024);
+	}
+
 	scanner->ent.name = duc_strdup(path);
+	if(scanner_parent) {
+		const char *sep = strcmp(scanner_parent->path, "/") == 0 ? "" : "/";
+		size_t len = strlen(scanner_parent->path) + strlen(sep) + strlen(path) + 1;
+		scanner->path = duc_malloc(len);
+		snprintf(scanner->path, len, "%s%s%s", scanner_parent->path, sep, path);
+	} else {
+		scanner->path = duc_strdup(path);
+	}
 	scanner->ent.type = DUC_FILE_TYPE_DIR,
 	st_to_devino(st, &scanner->ent.devino);
 	st_to_size(st, &scanner->ent.size);
 	scanner->ent.size.apparent = 0;
+	scanner->uid = st->st_uid;
+
+	int i;
+	for(i=0; i<SIDE_COUNT; i++) {
+		if(scanner_parent && scanner_parent->side[i]) {
+			scanner->side[i] = tally_new();
+		}
+	}
+	side_add_self(scanner);
 		
-	buffer_put_dir(scanner->buffer, &devino_parent, st->st_mtime);
+	buffer_put_dir(scanner->buffer, &devino_parent, st->st_mtime, NULL, NULL);
 
 	duc_log(duc, DUC_LOG_DMP, ">> %s", scanner->ent.name);
 
@@ -409,109 +770,788 @@ err:
 }
 
 
-static void scanner_scan(struct scanner *scanner_dir)
+/*
+ * Checkpoints allow resuming an interrupted index run. A checkpoint holds the
+ * report counters and the state of all directories on the path currently
+ * being scanned: their accumulated size, their partial database record and
+ * the names of the entries already handled. The records of all completed
+ * subdirectories are already in the database, and are committed together
+ * with the checkpoint.
+ *
+ * With --check-hard-links the hard links counted so far are saved as well,
+ * so a resumed run does not count them again. The set can be large, so every
+ * checkpoint only adds a record with the links counted since the one before:
+ *
+ *   duc_checkpoint:<path>            checkpoint, number of link records
+ *   duc_checkpoint_links:<n>:<path>  devino of the links added before checkpoint n
+ */
+
+#define CHECKPOINT_VERSION 6
+
+static void checkpoint_key(const char *path, char *key, size_t keylen, size_t *l)
 {
-	struct duc *duc = scanner_dir->duc;
-	struct duc_index_req *req = scanner_dir->req;
-	struct duc_index_report *report = scanner_dir->rep; 	
+	*l = snprintf(key, keylen, "duc_checkpoint:%s", path);
+	if(*l >= keylen) *l = keylen - 1;
+}
 
-	report->dir_count ++;
-	duc_size_accum(&report->size, &scanner_dir->ent.size);
 
-	int r = chdir(scanner_dir->ent.name);
-	if(r != 0) {
-		report_skip(duc, scanner_dir->ent.name, strerror(errno));
-		return;
-	}
+static void checkpoint_links_key(const char *path, size_t chunk, char *key, size_t keylen, size_t *l)
+{
+	*l = snprintf(key, keylen, "duc_checkpoint_links:%zx:%s", chunk, path);
+	if(*l >= keylen) *l = keylen - 1;
+}
 
-	/* Iterate directory entries */
 
-	struct dirent *e;
-	while( (e = readdir(scanner_dir->d)) != NULL) {
+/*
+ * Add the hard links saved with a checkpoint to the set of the run resuming
+ * from it
+ */
 
-		/* Skip . and .. */
+static void checkpoint_links_read(struct duc_index_req *req, const char *path, size_t chunks)
+{
+	struct duc *duc = req->duc;
+	size_t i;
 
-		char *name = e->d_name;
+	if(req->hard_link_set == NULL) {
+		req->hard_link_set = inoset_new(req->hard_link_spill_dir);
+	}
 
-		if(name[0] == '.') {
-			if(name[1] == '\0') continue;
-			if((name[1] == '.') && (name[2] == '\0')) continue;
-		}
+	for(i=0; i<chunks; i++) {
+		char key[DUC_PATH_MAX + 48];
+		size_t keyl;
+		checkpoint_links_key(path, i, key, sizeof(key), &keyl);
 
-		if(match_exclude(name, req->exclude_list)) {
-			report_skip(duc, name, "Excluded by user");
-			continue;
+		size_t vall;
+		char *val = dbqueue_get(duc, key, keyl, &vall);
+		if(val == NULL) continue;
+
+		struct buffer *b = buffer_new(val, vall);
+		while(b->ptr < b->len) {
+			struct duc_devino devino;
+			buffer_get_devino(b, &devino);
+			inoset_add(req->hard_link_set, &devino);
 		}
+		buffer_free(b);
+	}
+}
 
-		/* Get file info. Derive the file type from st.st_mode. It
-		 * seems that we cannot trust e->d_type because it is not
-		 * guaranteed to contain a sane value on all file system types.
-		 * See the readdir() man page for more details */
 
-		struct stat st_ent;
-		int r = lstat(name, &st_ent);
-		if(r == -1) {
-			duc_log(duc, DUC_LOG_WRN, "Error statting %s: %s", name, strerror(errno));
-			continue;
-		}
+static void checkpoint_put_digest(struct buffer *b, const struct digest *d)
+{
+	buffer_put_varint(b, d->sum1);
+	buffer_put_varint(b, d->sum2);
+	buffer_put_varint(b, d->count);
+}
 
-		/* If this dirent lies on a different device, check the file system type of the new
-		 * device and skip if it is not on the list of approved types */
 
-		if(st_ent.st_dev != scanner_dir->ent.devino.dev) {
-			if(!is_fstype_allowed(req, name)) {
-				continue;
-			}
-		}
+static void checkpoint_get_digest(struct buffer *b, struct digest *d)
+{
+	buffer_get_varint(b, &d->sum1);
+	buffer_get_varint(b, &d->sum2);
+	buffer_get_varint(b, &d->count);
+}
 
-		/* Are we looking for data for only a specific user? */
-		if(req->username) {
-		    if(st_ent.st_uid != req->uid) {
-			continue;
-		    }
-		}
-		
-		/* Create duc_dirent from readdir() and fstatat() results */
-		
-		struct duc_dirent ent;
-		ent.name = name;
-		ent.type = st_to_type(st_ent.st_mode);
-		st_to_devino(&st_ent, &ent.devino);
-		st_to_size(&st_ent, &ent.size);
 
-		/* Skip hard link duplicates for any files with more then one hard link */
+static void checkpoint_write(struct scanner *scanner)
+{
+	struct duc *duc = scanner->duc;
+	struct duc_index_report *report = scanner->rep;
+	struct scanner *s;
 
-		if((ent.type != DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_CHECK_HARD_LINKS) &&
-		   (st_ent.st_nlink > 1) && is_duplicate(req, &ent.devino)) {
-			continue;
-		}
+	size_t n = 0;
+	for(s=scanner; s; s=s->parent) n++;
 
+	struct scanner **chain = duc_malloc(n * sizeof(*chain));
+	size_t i = n;
+	for(s=scanner; s; s=s->parent) chain[--i] = s;
 
-		/* Check if we can cross file system boundaries */
+	struct buffer *b = buffer_new(NULL, 0);
 
-		if((ent.type == DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_XDEV) &&
-		   (st_ent.st_dev != req->dev)) {
-			report_skip(duc, name, "Not crossing file system boundaries");
-			continue;
+	buffer_put_varint(b, CHECKPOINT_VERSION);
+	buffer_put_varint(b, report->time_start.tv_sec);
+	buffer_put_varint(b, report->time_start.tv_usec);
+	buffer_put_varint(b, report->file_count);
+	buffer_put_varint(b, report->dir_count);
+	buffer_put_varint(b, report->error_count);
+	buffer_put_size(b, &report->size);
+
+	struct duc_index_req *req = scanner->req;
+	char key[DUC_PATH_MAX + 48];
+	size_t keyl;
+
+	if(req->links_new && req->links_new->len > 0) {
+		checkpoint_links_key(report->path, req->links_chunks++, key, sizeof(key), &keyl);
+		dbqueue_put(duc, key, keyl, req->links_new->data, req->links_new->len);
+		req->links_new->len = 0;
+		req->links_new->ptr = 0;
+	}
+	buffer_put_varint(b, req->links_new != NULL);
+	buffer_put_varint(b, req->links_chunks);
+	buffer_put_varint(b, n);
+
+	for(i=0; i<n; i++) {
+		s = chain[i];
+		buffer_put_string(b, i ? s->ent.name : "");
+		buffer_put_devino(b, &s->ent.devino);
+		buffer_put_size(b, &s->ent.size);
+		buffer_put_blob(b, s->buffer->data, s->buffer->len);
+		buffer_put_blob(b, s->done->data, s->done->len);
+		checkpoint_put_digest(b, &s->digest);
+		checkpoint_put_digest(b, &s->meta.uid);
+		checkpoint_put_digest(b, &s->meta.time);
+		size_t j;
+		for(j=0; j<SIDE_COUNT; j++) {
+			struct buffer *bs = buffer_new(NULL, 0);
+			if(s->side[j]) tally_put(bs, s->side[j]);
+			buffer_put_varint(b, s->side[j] != NULL);
+			buffer_put_blob(b, bs->data, bs->len);
+			buffer_free(bs);
 		}
+	}
 
+	checkpoint_key(report->path, key, sizeof(key), &keyl);
+	if(req->names) names_flush(req->names);
+	dbqueue_put(duc, key, keyl, b->data, b->len);
+	dbqueue_sync(duc);
 
-		/* Calculate size of this dirent */
-		
-		if(ent.type == DUC_FILE_TYPE_DIR) {
+	duc_log(duc, DUC_LOG_INF, "Checkpoint at %s", scanner->path);
 
-			/* Open and scan child directory */
+	buffer_free(b);
+	duc_free(chain);
+}
 
-			struct scanner *scanner_ent = scanner_new(duc, scanner_dir, name, &st_ent);
-			if(scanner_ent == NULL)
-				continue;
 
-			scanner_scan(scanner_ent);
-			scanner_free(scanner_ent);
+static void checkpoint_clear(struct duc *duc, const char *path, size_t links_chunks)
+{
+	char key[DUC_PATH_MAX + 48];
+	size_t keyl;
+	checkpoint_key(path, key, sizeof(key), &keyl);
+	dbqueue_put(duc, key, keyl, "", 0);
+
+	size_t i;
+	for(i=0; i<links_chunks; i++) {
+		checkpoint_links_key(path, i, key, sizeof(key), &keyl);
+		dbqueue_put(duc, key, keyl, "", 0);
+	}
+}
 
-		} else {
+
+static struct buffer *buffer_from_blob(struct buffer *b)
+{
+	size_t len;
+	void *data = buffer_get_blob(b, &len);
+	struct buffer *b2 = buffer_new(data, len);
+	if(b2->max == 0) b2->max = 1;
+	b2->ptr = b2->len;
+	return b2;
+}
+
+
+static struct checkpoint *checkpoint_read(struct duc *duc, const char *path)
+{
+	char key[DUC_PATH_MAX + 32];
+	size_t keyl;
+	checkpoint_key(path, key, sizeof(key), &keyl);
+
+	size_t vall;
+	char *val = dbqueue_get(duc, key, keyl, &vall);
+	if(val == NULL) return NULL;
+	if(vall == 0) {
+		free(val);
+		return NULL;
+	}
+
+	struct buffer *b = buffer_new(val, vall);
+	struct checkpoint *cp = duc_malloc0(sizeof *cp);
+	uint64_t v = 0;
+
+	buffer_get_varint(b, &v);
+	if(v != CHECKPOINT_VERSION) {
+		duc_log(duc, DUC_LOG_WRN, "Ignoring checkpoint with unknown version %ju", (uintmax_t)v);
+		buffer_free(b);
+		duc_free(cp);
+		return NULL;
+	}
+
+	buffer_get_varint(b, &v); cp->report.time_start.tv_sec = v;
+	buffer_get_varint(b, &v); cp->report.time_start.tv_usec = v;
+	buffer_get_varint(b, &v); cp->report.file_count = v;
+	buffer_get_varint(b, &v); cp->report.dir_count = v;
+	buffer_get_varint(b, &v); cp->report.error_count = v;
+	buffer_get_size(b, &cp->report.size);
+	buffer_get_varint(b, &v); cp->has_links = v;
+	buffer_get_varint(b, &v); cp->links_chunks = v;
+	buffer_get_varint(b, &v); cp->level_count = v;
+
+	cp->levels = duc_malloc0(cp->level_count * sizeof(*cp->levels));
+
+	size_t i;
+	for(i=0; i<cp->level_count; i++) {
+		struct checkpoint_level *l = &cp->levels[i];
+		buffer_get_string(b, &l->name);
+		buffer_get_devino(b, &l->devino);
+		buffer_get_size(b, &l->size);
+		l->buffer = buffer_from_blob(b);
+		l->done = buffer_from_blob(b);
+		checkpoint_get_digest(b, &l->digest);
+		checkpoint_get_digest(b, &l->meta.uid);
+		checkpoint_get_digest(b, &l->meta.time);
+		size_t j;
+		for(j=0; j<SIDE_COUNT; j++) {
+			buffer_get_varint(b, &v); l->has_side[j] = v;
+			l->side[j] = buffer_from_blob(b);
+		}
+	}
+
+	buffer_free(b);
+	return cp;
+}
+
+
+static void checkpoint_free(struct checkpoint *cp)
+{
+	size_t i;
+	for(i=0; i<cp->level_count; i++) {
+		struct checkpoint_level *l = &cp->levels[i];
+		duc_free(l->name);
+		if(l->buffer) buffer_free(l->buffer);
+		if(l->done) buffer_free(l->done);
+		size_t j;
+		for(j=0; j<SIDE_COUNT; j++) {
+			if(l->side[j]) buffer_free(l->side[j]);
+		}
+	}
+	duc_free(cp->levels);
+	duc_free(cp);
+}
+
+
+/*
+ * Restore the state of a directory from a checkpoint level, and prepare to
+ * resume into the subdirectory which was being scanned at checkpoint time
+ */
+
+static void scanner_resume(struct scanner *scanner, struct checkpoint_level *l)
+{
+	struct checkpoint *cp = scanner->req->checkpoint;
+
+	if(l->devino.dev != scanner->ent.devino.dev || l->devino.ino != scanner->ent.devino.ino) {
+		duc_log(scanner->duc, DUC_LOG_WRN, "%s changed since checkpoint, rescanning", scanner->path);
+		return;
+	}
+
+	buffer_free(scanner->buffer);
+	scanner->buffer = l->buffer;
+	l->buffer = NULL;
+
+	if(scanner->done) buffer_free(scanner->done);
+	scanner->done = l->done;
+	l->done = NULL;
+
+	scanner->ent.size = l->size;
+	scanner->digest = l->digest;
+	scanner->meta = l->meta;
+	scanner->resumed = 1;
+
+	/* The breakdowns of the entries handled before the checkpoint are only
+	 * known if the interrupted run recorded them as well */
+
+	size_t j;
+	for(j=0; j<SIDE_COUNT; j++) {
+		if(scanner->side[j] == NULL) continue;
+		tally_free(scanner->side[j]);
+		scanner->side[j] = NULL;
+		if(l->has_side[j]) {
+			scanner->side[j] = tally_new();
+			struct buffer *bs = buffer_new(l->side[j]->data, l->side[j]->len);
+			tally_get(bs, scanner->side[j]);
+			duc_free(bs);
+		} else {
+			duc_log(scanner->duc, DUC_LOG_WRN, "Interrupted run did not record %s, not recording it now",
+					side_info[j].descr);
+		}
+	}
+
+	struct buffer *b = buffer_new(scanner->done->data, scanner->done->len);
+	while(b->ptr < b->len) {
+		struct name *n = duc_malloc(sizeof *n);
+		buffer_get_string(b, &n->name);
+		HASH_ADD_KEYPTR(hh, scanner->done_map, n->name, strlen(n->name), n);
+	}
+	duc_free(b);
+
+	size_t i = l - cp->levels;
+	if(i + 1 < cp->level_count) {
+		scanner->resume = &cp->levels[i+1];
+	}
+}
+
+
+/*
+ * Find the partial index run to graft at the given directory entry. The
+ * directory must still be the one which was indexed
+ */
+
+static struct graft *graft_find(struct scanner *scanner_dir, const char *name, const struct duc_devino *devino)
+{
+	struct duc_index_req *req = scanner_dir->req;
+	char path[DUC_PATH_MAX];
+	const char *sep = strcmp(scanner_dir->path, "/") == 0 ? "" : "/";
+	snprintf(path, sizeof(path), "%s%s%s", scanner_dir->path, sep, name);
+
+	size_t i;
+	for(i=0; i<req->graft_count; i++) {
+		struct graft *g = &req->grafts[i];
+		if(strcmp(g->report.path, path) != 0) continue;
+		if(g->report.devino.dev != devino->dev || g->report.devino.ino != devino->ino) {
+			duc_log(scanner_dir->duc, DUC_LOG_WRN, "Not grafting %s from %s, the directory was replaced since",
+					path, g->duc->path_db);
+			return NULL;
+		}
+		return g;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Read the digest and meta field of a directory in a partial database.
+ * Returns -1 if its record is missing
+ */
+
+static int graft_read_top(struct duc *src, const struct duc_devino *devino, uint8_t *digest, uint8_t *meta)
+{
+	char key[32];
+	size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
+	size_t vall;
+
+	char *val = db_get(src->db, key, keyl, &vall);
+	if(val == NULL) return -1;
+
+	struct buffer *b = buffer_new(val, vall);
+	struct duc_devino devino_parent;
+	time_t mtime;
+	buffer_get_dir(b, &devino_parent, &mtime, digest, meta);
+	buffer_free(b);
+	return 0;
+}
+
+
+/*
+ * Register a hard link of a grafted subtree, so the scan skips other links to
+ * the same file. When only checking, count the links to files which were
+ * indexed before instead
+ */
+
+struct graft_links {
+	struct duc_index_req *req;
+	int check;
+	size_t dup_count;
+};
+
+static void graft_link(const void *key, size_t keylen, const struct duc_size *size, void *ptr)
+{
+	struct graft_links *gl = ptr;
+	struct buffer *b = buffer_new((void *)key, keylen);
+	struct duc_devino devino;
+	buffer_get_devino(b, &devino);
+	duc_free(b);
+	if(gl->check) {
+		if(inoset_has(gl->req->hard_link_set, &devino)) gl->dup_count ++;
+	} else {
+		is_duplicate(gl->req, &devino);
+	}
+}
+
+
+/*
+ * Copy the directory records of a grafted subtree, with their side records
+ * and name index entries, and register its hard links. The parent of the top
+ * directory is set to the directory it is grafted into. With check set
+ * nothing is copied, only the hard links to files which were indexed before
+ * are counted and returned
+ */
+
+static size_t graft_copy(struct scanner *scanner_dir, struct graft *g, int check)
+{
+	struct duc_index_req *req = scanner_dir->req;
+	duc *duc = scanner_dir->duc;
+	struct duc *src = g->duc;
+	int dry_run = (req->flags & DUC_INDEX_DRY_RUN) || check;
+	int first = 1;
+	struct graft_links gl = { req, check, 0 };
+
+	size_t depth = 0, max = 64;
+	struct duc_devino *stack = duc_malloc(max * sizeof(*stack));
+	stack[depth++] = g->report.devino;
+
+	while(depth > 0) {
+
+		struct duc_devino devino = stack[--depth];
+		char key[32];
+		size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino.dev, (uintmax_t)devino.ino);
+		size_t vall;
+
+		char *val = db_get(src->db, key, keyl, &vall);
+		if(val == NULL) continue;
+
+		struct buffer *b = buffer_new(val, vall);
+		struct buffer *top = NULL;
+		struct duc_devino devino_parent;
+		time_t mtime;
+		uint8_t dig[DUC_DIGEST_SIZE];
+		uint8_t met[DIGEST_META_SIZE];
+		buffer_get_dir(b, &devino_parent, &mtime, dig, met);
+
+		if(req->flags & DUC_INDEX_CHECK_HARD_LINKS) {
+			struct tally *t = tally_read(src, LINKS_PREFIX, &devino, dig, NULL);
+			if(t) {
+				tally_foreach(t, graft_link, &gl);
+				tally_free(t);
+				if(!dry_run) tally_copy(duc, src, LINKS_PREFIX, &devino, dig);
+			}
+		}
+
+		if(first) {
+			top = buffer_new(NULL, vall + 16);
+			buffer_put_dir(top, &scanner_dir->ent.devino, mtime, dig, met);
+			first = 0;
+		}
+
+		while(b->ptr < b->len) {
+			struct duc_dirent ent;
+			buffer_get_dirent(b, &ent);
+			if(top) buffer_put_dirent(top, &ent);
+			if(ent.type == DUC_FILE_TYPE_DIR) {
+				if(depth == max) {
+					max *= 2;
+					stack = duc_realloc(stack, max * sizeof(*stack));
+				}
+				stack[depth++] = ent.devino;
+			}
+			duc_free(ent.name);
+		}
+
+		if(!dry_run) {
+			struct buffer *rec = top ? top : b;
+			dbqueue_put(duc, key, keyl, rec->data, rec->len);
+			if(req->names) {
+				names_add_dir(req->names, &devino, rec, req->flags & DUC_INDEX_HIDE_FILE_NAMES);
+			}
+
+			int i;
+			for(i=0; i<SIDE_COUNT; i++) {
+				if(req->flags & side_info[i].flag) {
+					uint8_t check[DUC_DIGEST_SIZE];
+					digest_check(dig, met, side_info[i].part, check);
+					tally_copy(duc, src, side_info[i].prefix, &devino, check);
+				}
+			}
+		}
+
+		if(top) buffer_free(top);
+		buffer_free(b);
+	}
+
+	duc_free(stack);
+	return gl.dup_count;
+}
+
+
+/*
+ * Take a subtree from a partial database instead of scanning it, and add it
+ * to the directory being scanned as if it was. Returns -1 if the subtree can
+ * not be grafted, it is scanned instead
+ */
+
+static int graft_subtree(struct scanner *scanner_dir, struct graft *g, struct duc_dirent *ent)
+{
+	struct duc_index_req *req = scanner_dir->req;
+	struct duc_index_report *report = scanner_dir->rep;
+	duc *duc = scanner_dir->duc;
+	struct duc *src = g->duc;
+	const char *path = g->report.path;
+
+	uint8_t digest[DUC_DIGEST_SIZE];
+	uint8_t meta[DIGEST_META_SIZE];
+	if(graft_read_top(src, &ent->devino, digest, meta) != 0) {
+		duc_log(duc, DUC_LOG_WRN, "Not grafting %s, its record is missing from %s", path, src->path_db);
+		return -1;
+	}
+
+	/* The partial index run must have recorded everything this run records,
+	 * otherwise the subtree is missing from the breakdowns or its hard links
+	 * are counted again */
+
+	struct tally *side[SIDE_COUNT] = { NULL };
+	const char *missing = NULL;
+	int i;
+
+	for(i=0; i<SIDE_COUNT && missing == NULL; i++) {
+		if(scanner_dir->side[i] == NULL) continue;
+		uint8_t check[DUC_DIGEST_SIZE];
+		digest_check(digest, meta, side_info[i].part, check);
+		side[i] = tally_read(src, side_info[i].prefix, &ent->devino, check, NULL);
+		if(side[i] == NULL) missing = side_info[i].descr;
+	}
+
+	if(missing == NULL && (req->flags & DUC_INDEX_CHECK_HARD_LINKS)) {
+		struct tally *t = tally_read(src, LINKS_PREFIX, &ent->devino, digest, NULL);
+		if(t == NULL) missing = "hard links";
+		else tally_free(t);
+	}
+
+	if(missing) {
+		duc_log(duc, DUC_LOG_WRN, "Not grafting %s, %s did not record %s", path, src->path_db, missing);
+		goto refuse;
+	}
+
+	/* Files linked from outside the subtree and indexed before would be
+	 * counted twice, only the scan can skip them */
+
+	if(req->hard_link_set && inoset_count(req->hard_link_set) > 0) {
+		size_t dup_count = graft_copy(scanner_dir, g, 1);
+		if(dup_count) {
+			duc_log(duc, DUC_LOG_WRN, "Not grafting %s, %zu of its files are hard links to files indexed before",
+					path, dup_count);
+			goto refuse;
+		}
+	}
+
+	graft_copy(scanner_dir, g, 0);
+
+	duc_log(duc, DUC_LOG_INF, "Grafted %s from %s", path, src->path_db);
+	g->used = 1;
+
+	/* The snapshot of the top directory is the latest one of the partial
+	 * index run, without one no generation can be added */
+
+	if(scanner_dir->snap) {
+		uint8_t hash[HISTORY_HASH_SIZE];
+		if(history_get_latest(src, path, hash) == 0 && memcmp(hash, digest, sizeof(hash)) == 0) {
+			history_copy(duc, src, path);
+		} else {
+			duc_log(duc, DUC_LOG_WRN, "No history found for %s in %s", path, src->path_db);
+			req->history_incomplete = 1;
+		}
+	}
+
+	for(i=0; i<SIDE_COUNT; i++) {
+		const struct side_info *si = &side_info[i];
+		if(side[i] == NULL) continue;
+		tally_merge(scanner_dir->side[i], side[i]);
+		if(si->keys_track && tally_count(scanner_dir->side[i]) > si->keys_track) {
+			tally_trim(scanner_dir->side[i], si->keys_track / 2, si->key_other, strlen(si->key_other));
+		}
+		tally_free(side[i]);
+	}
+
+	ent->size = g->report.size;
+	report->file_count += g->report.file_count;
+	report->dir_count += g->report.dir_count;
+	report->error_count += g->report.error_count;
+	duc_size_accum(&report->size, &g->report.size);
+	duc_size_accum(&scanner_dir->ent.size, &ent->size);
+
+	if((req->maxdepth == 0) || (scanner_dir->depth + 1 < req->maxdepth)) {
+		buffer_put_dirent(scanner_dir->buffer, ent);
+		digest_add_ent(&scanner_dir->digest, ent, digest);
+		if(scanner_dir->snap) history_put_ent(scanner_dir->snap, ent, digest);
+	}
+	digest_meta_add(&scanner_dir->meta, ent->name, 0, 0, 0, meta);
+
+	return 0;
+
+refuse:
+	for(i=0; i<SIDE_COUNT; i++) {
+		if(side[i]) tally_free(side[i]);
+	}
+	return -1;
+}
+
+
+static void scanner_scan(struct scanner *scanner_dir)
+{
+	struct duc *duc = scanner_dir->duc;
+	struct duc_index_req *req = scanner_dir->req;
+	struct duc_index_report *report = scanner_dir->rep; 	
+
+	/* The size of a resumed directory was already accounted for before the checkpoint */
+
+	if(!scanner_dir->resumed) {
+		report->dir_count ++;
+		duc_size_accum(&report->size, &scanner_dir->ent.size);
+	}
+
+#ifndef HAVE_AT_FUNCS
+	int r = chdir(scanner_dir->ent.name);
+	if(r != 0) {
+		report_skip(duc, scanner_dir->path, NULL, strerror(errno));
+		report->error_count ++;
+		return;
+	}
+#endif
+
+	/* Iterate directory entries */
+
+	struct dirent *e;
+	while( (e = readdir(scanner_dir->d)) != NULL) {
+
+		/* Skip . and .. */
+
+		char *name = e->d_name;
+
+		if(name[0] == '.') {
+			if(name[1] == '\0') continue;
+			if((name[1] == '.') && (name[2] == '\0')) continue;
+		}
+
+		/* When resuming, skip entries which were handled before the
+		 * checkpoint, except for the directory which was being scanned */
+
+		struct checkpoint_level *resume = NULL;
+		if(scanner_dir->resume && strcmp(scanner_dir->resume->name, name) == 0) {
+			resume = scanner_dir->resume;
+			scanner_dir->resume = NULL;
+		}
+
+		if(scanner_dir->done_map && !resume) {
+			struct name *n;
+			HASH_FIND_STR(scanner_dir->done_map, name, n);
+			if(n) continue;
+		}
+
+		if(scanner_dir->done && !resume) {
+			buffer_put_string(scanner_dir->done, name);
+		}
+
+		char *path_ent = NULL;
+		char path_ent_buf[DUC_PATH_MAX];
+		if(exclude_has_paths(req->exclude)) {
+			const char *sep = strcmp(scanner_dir->path, "/") == 0 ? "" : "/";
+			snprintf(path_ent_buf, sizeof(path_ent_buf), "%s%s%s", scanner_dir->path, sep, name);
+			path_ent = path_ent_buf;
+		}
+
+		if(exclude_match(req->exclude, name, path_ent)) {
+			report_skip(duc, scanner_dir->path, name, "Excluded by user");
+			continue;
+		}
+
+		/* Get file info. Derive the file type from st.st_mode. It
+		 * seems that we cannot trust e->d_type because it is not
+		 * guaranteed to contain a sane value on all file system types.
+		 * See the readdir() man page for more details */
+
+		struct stat st_ent;
+#ifdef HAVE_AT_FUNCS
+		int r = fstatat(dirfd(scanner_dir->d), name, &st_ent, AT_SYMLINK_NOFOLLOW);
+#else
+		int r = lstat(name, &st_ent);
+#endif
+		if(r == -1) {
+			duc_log(duc, DUC_LOG_WRN, "Error statting %s: %s", name, strerror(errno));
+			report->error_count ++;
+			continue;
+		}
+
+		/* If this dirent lies on a different device, check the file system type of the new
+		 * device and skip if it is not on the list of approved types */
+
+		if(st_ent.st_dev != scanner_dir->ent.devino.dev) {
+			if(!is_fstype_allowed(req, scanner_dir->path, name, st_ent.st_dev)) {
+				continue;
+			}
+		}
+
+		/* Are we looking for data for only a specific user? */
+		if(req->username) {
+		    if(st_ent.st_uid != req->uid) {
+			continue;
+		    }
+		}
+		
+		/* Create duc_dirent from readdir() and fstatat() results */
+		
+		struct duc_dirent ent;
+		ent.name = name;
+		ent.type = st_to_type(st_ent.st_mode);
+		st_to_devino(&st_ent, &ent.devino);
+		st_to_size(&st_ent, &ent.size);
+
+		/* Skip hard link duplicates for any files with more then one hard link */
+
+		if((ent.type != DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_CHECK_HARD_LINKS) &&
+		   (st_ent.st_nlink > 1) && is_duplicate(req, &ent.devino)) {
+			continue;
+		}
+
+
+		/* Check if we can cross file system boundaries */
+
+		if((ent.type == DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_XDEV) &&
+		   (st_ent.st_dev != req->dev)) {
+			report_skip(duc, scanner_dir->path, name, "Not crossing file system boundaries");
+			continue;
+		}
+
+
+		/* Calculate size of this dirent */
+		
+		if(ent.type == DUC_FILE_TYPE_DIR) {
+
+			/* Graft subtrees indexed into a partial database, or open
+			 * and scan child directory */
+
+			struct graft *g = NULL;
+			if(req->graft_count && !resume) {
+				g = graft_find(scanner_dir, name, &ent.devino);
+			}
+
+			if(g == NULL || graft_subtree(scanner_dir, g, &ent) != 0) {
+
+				struct scanner *scanner_ent = scanner_new(duc, scanner_dir, name, &st_ent);
+				if(scanner_ent == NULL) {
+					report->error_count ++;
+					continue;
+				}
+
+				if(resume) {
+					scanner_resume(scanner_ent, resume);
+				}
+
+				scanner_scan(scanner_ent);
+				scanner_free(scanner_ent);
+			}
+
+			/* Completed subdirectories are a consistent point for checkpointing */
+
+			if(req->checkpoint_interval.tv_sec) {
+				struct timeval t_now;
+				gettimeofday(&t_now, NULL);
+				if(timercmp(&t_now, &req->checkpoint_time, > )) {
+					checkpoint_write(scanner_dir);
+					timeradd(&t_now, &req->checkpoint_interval, &req->checkpoint_time);
+				}
+			}
+
+		} else {
 
 			duc_size_accum(&scanner_dir->ent.size, &ent.size);
+			if((req->flags & DUC_INDEX_CHECK_HARD_LINKS) && st_ent.st_nlink > 1) {
+				links_add(scanner_dir, &ent.devino, &ent.size);
+			}
+			digest_meta_add(&scanner_dir->meta, name, st_ent.st_uid, st_ent.st_mtime, st_ent.st_atime, NULL);
+			if(scanner_dir->side[SIDE_USERS]) {
+				users_add(scanner_dir->side[SIDE_USERS], st_ent.st_uid, &ent.size);
+			}
+			if(scanner_dir->side[SIDE_EXTS] && ent.type == DUC_FILE_TYPE_REG) {
+				exts_add(scanner_dir->side[SIDE_EXTS], name, &ent.size);
+			}
+			if(scanner_dir->side[SIDE_AGES]) {
+				ages_add(scanner_dir->side[SIDE_AGES], &st_ent, report->time_start.tv_sec, &ent.size);
+			}
 			duc_size_accum(&report->size, &ent.size);
 
 			report->file_count ++;
@@ -529,11 +1569,15 @@ static void scanner_scan(struct scanner *scanner_dir)
 
 			if((req->maxdepth == 0) || (scanner_dir->depth < req->maxdepth)) {
 				buffer_put_dirent(scanner_dir->buffer, &ent);
+				digest_add_ent(&scanner_dir->digest, &ent, NULL);
+				if(scanner_dir->snap) history_put_ent(scanner_dir->snap, &ent, NULL);
 			}
 		}
 	}
 
+#ifndef HAVE_AT_FUNCS
 	chdir("..");
+#endif
 }
 
 
@@ -546,12 +1590,36 @@ static void scanner_free(struct scanner *scanner)
 	duc_log(duc, DUC_LOG_DMP, "<< %s actual:%jd apparent:%jd", 
 			scanner->ent.name, scanner->ent.size.apparent, scanner->ent.size.actual);
 
+	/* The digest covers all entries and the digests of all subdirectories,
+	 * which are complete by now. The meta field also covers the owner of
+	 * the directory itself, which is in its own usage per user */
+
+	uint8_t digest[DUC_DIGEST_SIZE];
+	uint8_t meta[DIGEST_META_SIZE];
+	digest_meta_add(&scanner->meta, ".", scanner->uid, 0, 0, NULL);
+	digest_final(&scanner->digest, digest);
+	digest_meta_final(&scanner->meta, meta);
+	buffer_set_dir_digest(scanner->buffer, digest, meta);
+
+	/* Store the snapshot record, the parent refers to it by the digest */
+
+	if(scanner->snap) {
+		history_put_dir(duc, scanner->snap, digest);
+		if(!scanner->parent) memcpy(req->history_hash, digest, sizeof(req->history_hash));
+	}
+
+	side_write(scanner, digest, meta);
+	links_write(scanner, digest);
+
 	if(scanner->parent) {
 		duc_size_accum(&scanner->parent->ent.size, &scanner->ent.size);
 
 		if((req->maxdepth == 0) || (scanner->depth < req->maxdepth)) {
 			buffer_put_dirent(scanner->parent->buffer, &scanner->ent);
+			digest_add_ent(&scanner->parent->digest, &scanner->ent, digest);
+			if(scanner->parent->snap) history_put_ent(scanner->parent->snap, &scanner->ent, digest);
 		}
+		digest_meta_add(&scanner->parent->meta, scanner->ent.name, 0, 0, 0, meta);
 
 	}
 	
@@ -565,7 +1633,11 @@ static void scanner_free(struct scanner *scanner)
 			gettimeofday(&t_now, NULL);
 
 			if(!scanner->parent || timercmp(&t_now, &req->progress_time, > )) {
+				struct scanner *scanner_cur = scanner->parent ? scanner->parent : scanner;
+				report->path_current = scanner_cur->path;
+				report->depth_current = scanner_cur->depth;
 				req->progress_fn(report, req->progress_fndata);
+				report->path_current = NULL;
 				timeradd(&t_now, &req->progress_interval, &req->progress_time);
 			}
 			req->progress_n = 0;
@@ -573,21 +1645,41 @@ static void scanner_free(struct scanner *scanner)
 
 	}
 	
+	if(req->names) {
+		names_add_dir(req->names, &scanner->ent.devino, scanner->buffer,
+				req->flags & DUC_INDEX_HIDE_FILE_NAMES);
+	}
+
 	if(!(req->flags & DUC_INDEX_DRY_RUN)) {
 		char key[32];
 		struct duc_devino *devino = &scanner->ent.devino;
 		size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
-		int r = db_put(duc->db, key, keyl, scanner->buffer->data, scanner->buffer->len);
+		int r = dbqueue_put(duc, key, keyl, scanner->buffer->data, scanner->buffer->len);
 		if(r != 0) duc->err = r;
 	}
 
+	struct name *n, *nn;
+	HASH_ITER(hh, scanner->done_map, n, nn) {
+		HASH_DEL(scanner->done_map, n);
+		duc_free(n->name);
+		duc_free(n);
+	}
+	if(scanner->done) buffer_free(scanner->done);
+	if(scanner->snap) buffer_free(scanner->snap);
+
 	buffer_free(scanner->buffer);
 	closedir(scanner->d);
 	duc_free(scanner->ent.name);
+	duc_free(scanner->path);
 	duc_free(scanner);
 }
 
 
+/*
+ * Read the mount table. The path to type map is used as a fallback for devices
+ * not found in /proc/self/mountinfo
+ */
+
 static void read_mounts(duc_index_req *req)
 {
 	FILE *f;
@@ -600,16 +1692,20 @@ static void read_mounts(duc_index_req *req)
 
 	if(f == NULL) {
 		duc_log(req->duc, DUC_LOG_FTL, "Unable to get list of mounted file systems");
+		return;
 	}
 
 	char buf[DUC_PATH_MAX];
+	char *saveptr;
 
 	while(fgets(buf, sizeof(buf)-1, f) != NULL) {
-		(void)strtok(buf, " ");
-		char *path = strtok(NULL, " ");
-		char *type = strtok(NULL, " ");
+		(void)strtok_r(buf, " ", &saveptr);
+		char *path = strtok_r(NULL, " ", &saveptr);
+		char *type = strtok_r(NULL, " ", &saveptr);
 		if(path && type) {
 			struct fstype *fstype;
+			HASH_FIND_STR(req->fstypes_mounted, path, fstype);
+			if(fstype) continue;
 			fstype = duc_malloc(sizeof *fstype);
 			fstype->type = duc_strdup(type);
 			fstype->path = duc_strdup(path);
@@ -620,6 +1716,80 @@ static void read_mounts(duc_index_req *req)
 }
 
 
+/*
+ * Read the device numbers and file system types of all mounts from
+ * /proc/self/mountinfo. Each line looks like:
+ *
+ * 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw
+ *
+ * The number of optional fields before the '-' separator varies.
+ */
+
+static void read_mountinfo(duc_index_req *req)
+{
+	FILE *f = fopen("/proc/self/mountinfo", "r");
+	if(f == NULL) return;
+
+	char buf[DUC_PATH_MAX];
+	char *saveptr;
+
+	while(fgets(buf, sizeof(buf)-1, f) != NULL) {
+		unsigned int major, minor;
+		if(sscanf(buf, "%*s %*s %u:%u", &major, &minor) != 2) continue;
+
+		char *sep = strstr(buf, " - ");
+		if(sep == NULL) continue;
+		char *type = strtok_r(sep + 3, " ", &saveptr);
+		if(type == NULL) continue;
+
+		duc_dev_t dev = makedev(major, minor);
+		struct fsdev *fsdev;
+		HASH_FIND(hh, req->fsdev_map, &dev, sizeof(dev), fsdev);
+		if(fsdev) continue;
+
+		fsdev = duc_malloc0(sizeof *fsdev);
+		fsdev->dev = dev;
+		fsdev->type = duc_strdup(type);
+		fsdev->allowed = -1;
+		HASH_ADD(hh, req->fsdev_map, dev, sizeof(fsdev->dev), fsdev);
+	}
+	fclose(f);
+}
+
+
+/*
+ * Add the finished run to the history and the list of index reports. These
+ * are read-modify-write updates, so parallel runs do this in the writer
+ * thread
+ */
+
+struct index_result {
+	duc_index_req *req;
+	struct duc_index_report *report;
+	int history;
+};
+
+static int index_store(duc *duc, void *ptr)
+{
+	struct index_result *res = ptr;
+	duc_index_req *req = res->req;
+	struct duc_index_report *report = res->report;
+
+	if(res->history) {
+		history_add_generation(duc, report, req->history_hash);
+	}
+
+	gettimeofday(&report->time_stop, NULL);
+	db_write_report(duc, report);
+	if(req->checkpoint_interval.tv_sec || (req->flags & DUC_INDEX_RESUME)) {
+		size_t chunks = req->links_chunks > req->links_stale ? req->links_chunks : req->links_stale;
+		checkpoint_clear(duc, report->path, chunks);
+	}
+
+	return 0;
+}
+
+
 struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_index_flags flags)
 {
 	duc *duc = req->duc;
@@ -645,13 +1815,16 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 
 	/* Read mounted file systems to find fs types */
 
-	if(req->fstypes_include || req->fstypes_exclude) {
+	if((req->fstypes_include || req->fstypes_exclude) && !req->mounts_read) {
+		read_mountinfo(req);
 		read_mounts(req);
+		req->mounts_read = 1;
 	}
 
 	/* Recursively index subdirectories */
 
 	struct scanner *scanner = scanner_new(duc, NULL, path_canon, NULL);
+	int history = 0;
 
 	if(scanner) {
 		scanner->req = req;
@@ -660,16 +1833,138 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 		req->dev = scanner->ent.devino.dev;
 		report->devino = scanner->ent.devino;
 
+		int i;
+		for(i=0; i<SIDE_COUNT; i++) {
+			if(req->flags & side_info[i].flag) scanner->side[i] = tally_new();
+		}
+		side_add_self(scanner);
+
+		if(req->checkpoint_interval.tv_sec && !(req->flags & DUC_INDEX_DRY_RUN)) {
+			scanner->done = buffer_new(NULL, 1024);
+			gettimeofday(&req->checkpoint_time, NULL);
+			timeradd(&req->checkpoint_time, &req->checkpoint_interval, &req->checkpoint_time);
+		}
+
+		/* Restore state from the last checkpoint. The hard links counted
+		 * before it are needed to resume a run checking them */
+
+		req->links_chunks = 0;
+		req->links_stale = 0;
+
+		if((req->flags & DUC_INDEX_RESUME) && !(req->flags & DUC_INDEX_DRY_RUN)) {
+			req->checkpoint = checkpoint_read(duc, path_canon);
+			if(req->checkpoint) {
+				req->links_stale = req->checkpoint->links_chunks;
+			}
+			if(req->checkpoint && req->checkpoint->level_count > 0 &&
+					(req->flags & DUC_INDEX_CHECK_HARD_LINKS) && !req->checkpoint->has_links) {
+				duc_log(duc, DUC_LOG_WRN, "Interrupted run did not check hard links, rescanning %s", path_canon);
+				checkpoint_free(req->checkpoint);
+				req->checkpoint = NULL;
+			}
+			if(req->checkpoint && req->checkpoint->level_count > 0) {
+				duc_log(duc, DUC_LOG_INF, "Resuming index of %s from checkpoint", path_canon);
+				if(scanner->done == NULL) scanner->done = buffer_new(NULL, 1024);
+				scanner_resume(scanner, &req->checkpoint->levels[0]);
+				if(scanner->resumed && (req->flags & DUC_INDEX_CHECK_HARD_LINKS)) {
+					checkpoint_links_read(req, path_canon, req->checkpoint->links_chunks);
+					req->links_chunks = req->checkpoint->links_chunks;
+				}
+				if(scanner->resumed) {
+					report->time_start = req->checkpoint->report.time_start;
+					report->file_count = req->checkpoint->report.file_count;
+					report->dir_count = req->checkpoint->report.dir_count;
+					report->error_count = req->checkpoint->report.error_count;
+					report->size = req->checkpoint->report.size;
+				}
+			} else {
+				duc_log(duc, DUC_LOG_INF, "No checkpoint found for %s", path_canon);
+			}
+		} else if(req->checkpoint_interval.tv_sec && !(req->flags & DUC_INDEX_DRY_RUN)) {
+			struct checkpoint *cp = checkpoint_read(duc, path_canon);
+			if(cp) {
+				req->links_stale = cp->links_chunks;
+				checkpoint_free(cp);
+			}
+		}
+
+		if(req->checkpoint_interval.tv_sec && (req->flags & DUC_INDEX_CHECK_HARD_LINKS) &&
+				!(req->flags & DUC_INDEX_DRY_RUN)) {
+			req->links_new = buffer_new(NULL, 1024);
+		}
+
+		/* The name index of a completed run is rebuilt from scratch, a
+		 * resumed run continues after the chunks already written */
+
+		if(!(req->flags & DUC_INDEX_DRY_RUN)) {
+			if(req->flags & DUC_INDEX_NAMES) {
+				int resume = req->checkpoint && scanner->resumed;
+				req->names = names_new(duc, &scanner->ent.devino, resume);
+			} else {
+				names_clear(duc, &scanner->ent.devino);
+			}
+		}
+
+		/* Snapshot records of the directories completed before the
+		 * checkpoint are not known, so resumed runs add no generation */
+
+		history = (req->flags & DUC_INDEX_HISTORY) && !(req->flags & DUC_INDEX_DRY_RUN);
+		if(history && scanner->resumed) {
+			duc_log(duc, DUC_LOG_WRN, "Resumed index run, not adding a generation to the history");
+			history = 0;
+		}
+		if(history) {
+			scanner->snap = buffer_new(NULL, 1024);
+		}
+
+		/* Report the start of the run, the next report only comes when
+		 * directories complete */
+
+		if(req->progress_fn) {
+			report->path_current = scanner->path;
+			req->progress_fn(report, req->progress_fndata);
+			report->path_current = NULL;
+		}
+
+		req->history_incomplete = 0;
 		scanner_scan(scanner);
 		gettimeofday(&report->time_stop, NULL);
 		scanner_free(scanner);
+
+		if(history && req->history_incomplete) {
+			duc_log(duc, DUC_LOG_WRN, "Grafted index run without history, not adding a generation to the history");
+			history = 0;
+		}
+
+		size_t j;
+		for(j=0; j<req->graft_count; j++) {
+			struct graft *g = &req->grafts[j];
+			size_t l = strlen(report->path);
+			if(!g->used && strncmp(g->report.path, report->path, l) == 0 && g->report.path[l] == '/') {
+				duc_log(duc, DUC_LOG_WRN, "Index run of %s in %s was not grafted", g->report.path, g->duc->path_db);
+			}
+		}
+
+		if(req->names) {
+			names_free(req->names);
+			req->names = NULL;
+		}
 	}
 	
 	/* Store report */
 
 	if(!(req->flags & DUC_INDEX_DRY_RUN)) {
-		gettimeofday(&report->time_stop, NULL);
-		db_write_report(duc, report);
+		struct index_result res = { req, report, history };
+		dbqueue_call(duc, index_store, &res);
+	}
+
+	if(req->checkpoint) {
+		checkpoint_free(req->checkpoint);
+		req->checkpoint = NULL;
+	}
+	if(req->links_new) {
+		buffer_free(req->links_new);
+		req->links_new = NULL;
 	}
 
 	free(path_canon);
@@ -679,6 +1974,234 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 
 
 
+#ifdef INDEX_PARALLEL
+
+/*
+ * Parallel index runs. Every thread takes the next path from the list and
+ * indexes it with a request and database handle of its own, while the
+ * calling thread writes the records of all threads to the database, see
+ * dbqueue.c. Progress and completion callbacks are also run in the calling
+ * thread, one at a time.
+ *
+ * The threads read the mount table for themselves, so the result does not
+ * depend on which thread happened to index which path. When checking hard
+ * links all threads share one set, see inoset_share(). A link shared by
+ * several paths is counted once, in the path whose thread found it first.
+ */
+
+#define INDEX_QUEUE_LEN 1024
+
+struct index_job {
+	duc_index_req *req;
+	char **paths;
+	size_t count;
+	size_t next;
+	duc_index_flags flags;
+	duc_index_done_cb fn;
+	void *ptr;
+	pthread_mutex_t mutex;
+};
+
+struct index_thread {
+	struct index_job *job;
+	duc_index_req *req;
+	pthread_t thread;
+	const char *path;
+	struct duc_index_report *report;
+	duc_errno err;
+};
+
+struct index_progress {
+	duc_index_req *req;
+	struct duc_index_report *report;
+};
+
+
+/*
+ * Copy the settings of a request for an index thread. The exclude patterns
+ * and file system type lists are only read while indexing, and are shared
+ */
+
+static duc_index_req *req_clone(duc_index_req *req, duc *duc)
+{
+	duc_index_req *r = duc_malloc0(sizeof *r);
+
+	r->duc = duc;
+	r->exclude = req->exclude;
+	r->maxdepth = req->maxdepth;
+	r->uid = req->uid;
+	r->username = req->username;
+	r->progress_interval = req->progress_interval;
+	r->hard_link_spill_dir = req->hard_link_spill_dir;
+	r->fstypes_include = req->fstypes_include;
+	r->fstypes_exclude = req->fstypes_exclude;
+	r->checkpoint_interval = req->checkpoint_interval;
+	r->hard_link_set = req->hard_link_set;
+
+	return r;
+}
+
+
+static void req_clone_free(duc_index_req *req)
+{
+	free_mounts(req);
+	duc_free(req);
+}
+
+
+static int progress_call(duc *duc, void *ptr)
+{
+	struct index_progress *p = ptr;
+	p->req->progress_fn(p->report, p->req->progress_fndata);
+	return 0;
+}
+
+
+static void progress_thread(struct duc_index_report *report, void *ptr)
+{
+	struct index_thread *t = ptr;
+	struct index_progress p = { t->job->req, report };
+	report->queue_current = dbqueue_pending(t->req->duc);
+	dbqueue_call(t->req->duc, progress_call, &p);
+}
+
+
+static int done_call(duc *duc, void *ptr)
+{
+	struct index_thread *t = ptr;
+	duc->err = t->err;
+	t->job->fn(t->path, t->report, t->job->ptr);
+	return 0;
+}
+
+
+static void *index_thread(void *ptr)
+{
+	struct index_thread *t = ptr;
+	struct index_job *job = t->job;
+	duc *duc = t->req->duc;
+
+	for(;;) {
+		pthread_mutex_lock(&job->mutex);
+		size_t i = job->next++;
+		pthread_mutex_unlock(&job->mutex);
+		if(i >= job->count) break;
+
+		duc->err = 0;
+		t->path = job->paths[i];
+		t->report = duc_index(t->req, t->path, job->flags);
+		t->err = duc->err;
+		dbqueue_call(duc, done_call, t);
+	}
+
+	dbqueue_handle_free(duc);
+	return NULL;
+}
+
+
+static void index_parallel(duc_index_req *req, char **paths, size_t count,
+		duc_index_flags flags, duc_index_done_cb fn, void *ptr)
+{
+	duc *duc = req->duc;
+	int nthreads = (size_t)req->threads < count ? req->threads : (int)count;
+
+	struct index_job job = {
+		.req = req,
+		.paths = paths,
+		.count = count,
+		.flags = flags,
+		.fn = fn,
+		.ptr = ptr,
+	};
+	pthread_mutex_init(&job.mutex, NULL);
+
+	if(flags & DUC_INDEX_CHECK_HARD_LINKS) {
+		if(req->hard_link_set == NULL) {
+			req->hard_link_set = inoset_new(req->hard_link_spill_dir);
+		}
+		inoset_share(req->hard_link_set);
+	}
+
+	struct dbqueue *q = dbqueue_new(duc, INDEX_QUEUE_LEN, nthreads);
+	struct index_thread *threads = duc_malloc0(nthreads * sizeof(*threads));
+	int i;
+
+	for(i=0; i<nthreads; i++) {
+		struct index_thread *t = &threads[i];
+		t->job = &job;
+		t->req = req_clone(req, dbqueue_handle_new(q));
+		if(req->progress_fn) {
+			t->req->progress_fn = progress_thread;
+			t->req->progress_fndata = t;
+		}
+		if(pthread_create(&t->thread, NULL, index_thread, t) != 0) {
+			duc_log(duc, DUC_LOG_WRN, "Unable to start index thread");
+			dbqueue_handle_free(t->req->duc);
+			req_clone_free(t->req);
+			t->req = NULL;
+		}
+	}
+
+	duc_log(duc, DUC_LOG_DBG, "Indexing %zu paths with %d threads", count, nthreads);
+
+	dbqueue_run(q);
+
+	for(i=0; i<nthreads; i++) {
+		struct index_thread *t = &threads[i];
+		if(t->req) {
+			pthread_join(t->thread, NULL);
+			req_clone_free(t->req);
+		}
+	}
+
+	duc->err = dbqueue_free(q);
+	if(duc->err) {
+		duc_log(duc, DUC_LOG_WRN, "Error writing index records: %s", duc_strerror(duc));
+	}
+
+	/* Paths left over when no thread could be started */
+
+	for(; job.next<count; job.next++) {
+		struct duc_index_report *report = duc_index(req, paths[job.next], flags);
+		fn(paths[job.next], report, ptr);
+	}
+
+	pthread_mutex_destroy(&job.mutex);
+	duc_free(threads);
+}
+
+#endif
+
+
+/*
+ * Index a list of paths, in parallel when the request allows more than one
+ * thread. The callback is called with the report of every path as soon as it
+ * is done, or with NULL if the path could not be indexed, and is responsible
+ * for freeing the report
+ */
+
+int duc_index_paths(duc_index_req *req, char **paths, size_t count, duc_index_flags flags,
+		duc_index_done_cb fn, void *ptr)
+{
+#ifdef INDEX_PARALLEL
+	if(req->threads > 1 && count > 1 && req->graft_count) {
+		duc_log(req->duc, DUC_LOG_WRN, "Not indexing in parallel when grafting partial databases");
+	} else if(req->threads > 1 && count > 1) {
+		index_parallel(req, paths, count, flags, fn, ptr);
+		return req->duc->err ? -1 : 0;
+	}
+#endif
+
+	size_t i;
+	for(i=0; i<count; i++) {
+		struct duc_index_report *report = duc_index(req, paths[i], flags);
+		fn(paths[i], report, ptr);
+	}
+
+	return 0;
+}
+
+
 int duc_index_report_free(struct duc_index_report *rep)
 {
 	free(rep);
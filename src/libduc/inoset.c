@@ -0,0 +1,431 @@
+
+/*
+ * Set of device/inode pairs, used for detecting hard link duplicates during
+ * indexing. This can hold hundreds of millions of entries on hard link farm
+ * style backup stores, so the table is an open addressing hash with compact
+ * slots instead of a malloc()ed node per entry:
+ *
+ * - Device numbers are mapped to a small device index, there are usually only
+ *   a handful of devices in one index run
+ * - Each slot is 12 bytes: the 64 bit inode number and the 32 bit device
+ *   index, where device index 0 marks an empty slot
+ *
+ * Optionally the table is kept in a deleted temporary file in the given spill
+ * directory, so the kernel can page it out to disk instead of growing the
+ * process memory.
+ *
+ * A set can be shared by the threads of a parallel index run, see
+ * inoset_share(). The table is then split in stripes by the top bits of the
+ * hash, every stripe has a lock of its own and grows by itself. Device
+ * numbers are mapped without locking: the device list has a fixed capacity
+ * once shared, and new devices are published after they are written.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "private.h"
+#include "inoset.h"
+
+#define SLOT_WORDS 3
+#define INITIAL_SIZE 4096
+#define STRIPE_BITS 6
+#define STRIPE_COUNT (1 << STRIPE_BITS)
+#define STRIPE_INITIAL_SIZE 1024
+#define SHARED_DEV_MAX 4096
+
+struct stripe {
+	uint32_t *slots;
+	size_t size;
+	size_t count;
+	int mapped;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t mutex;
+#endif
+};
+
+struct inoset {
+	struct stripe *stripes;
+	int stripe_bits;
+	int shared;
+	duc_dev_t *dev_list;
+	size_t dev_count;
+	uint32_t dev_last;
+	int dev_full;
+	char *spill_dir;
+	int spill;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t dev_mutex;
+#endif
+};
+
+
+#ifdef HAVE_LIBPTHREAD
+#define LOCK(set, m) if((set)->shared) pthread_mutex_lock(m)
+#define UNLOCK(set, m) if((set)->shared) pthread_mutex_unlock(m)
+#else
+#define LOCK(set, m)
+#define UNLOCK(set, m)
+#endif
+
+
+static uint64_t mix(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53ULL;
+	v ^= v >> 33;
+	return v;
+}
+
+
+static uint64_t hash(uint64_t ino, uint32_t dev)
+{
+	return mix(ino ^ ((uint64_t)dev << 56));
+}
+
+
+/*
+ * Allocate zeroed slot memory, either from the heap or backed by a temporary
+ * file in the spill directory
+ */
+
+static uint32_t *slots_alloc(struct inoset *set, size_t size, int *mapped)
+{
+	size_t len = size * SLOT_WORDS * sizeof(uint32_t);
+
+	if(set->spill) {
+		char path[DUC_PATH_MAX];
+		snprintf(path, sizeof(path), "%s/duc-inoset-XXXXXX", set->spill_dir);
+		int fd = mkstemp(path);
+		if(fd != -1) {
+			unlink(path);
+			if(ftruncate(fd, len) == 0) {
+				void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				close(fd);
+				if(p != MAP_FAILED) {
+					*mapped = 1;
+					return p;
+				}
+			} else {
+				close(fd);
+			}
+		}
+		duc_log(NULL, DUC_LOG_WRN, "Unable to create hard link table in %s: %s, using memory",
+				set->spill_dir, strerror(errno));
+		set->spill = 0;
+	}
+
+	*mapped = 0;
+	return duc_malloc0(len);
+}
+
+
+static void slots_free(uint32_t *slots, size_t size, int mapped)
+{
+	if(mapped) {
+		munmap(slots, size * SLOT_WORDS * sizeof(uint32_t));
+	} else {
+		duc_free(slots);
+	}
+}
+
+
+static void stripe_init(struct inoset *set, struct stripe *st, size_t size)
+{
+	st->size = size;
+	st->count = 0;
+	st->slots = slots_alloc(set, size, &st->mapped);
+}
+
+
+struct inoset *inoset_new(const char *spill_dir)
+{
+	struct inoset *set = duc_malloc0(sizeof *set);
+
+	if(spill_dir) {
+		set->spill_dir = duc_strdup(spill_dir);
+		set->spill = 1;
+	}
+
+	set->stripes = duc_malloc0(sizeof(*set->stripes));
+	stripe_init(set, &set->stripes[0], INITIAL_SIZE);
+
+	return set;
+}
+
+
+void inoset_free(struct inoset *set)
+{
+	size_t i;
+	size_t n = (size_t)1 << set->stripe_bits;
+
+	for(i=0; i<n; i++) {
+		struct stripe *st = &set->stripes[i];
+		slots_free(st->slots, st->size, st->mapped);
+#ifdef HAVE_LIBPTHREAD
+		if(set->shared) pthread_mutex_destroy(&st->mutex);
+#endif
+	}
+#ifdef HAVE_LIBPTHREAD
+	if(set->shared) pthread_mutex_destroy(&set->dev_mutex);
+#endif
+	duc_free(set->stripes);
+	duc_free(set->dev_list);
+	duc_free(set->spill_dir);
+	duc_free(set);
+}
+
+
+size_t inoset_count(struct inoset *set)
+{
+	size_t i, count = 0;
+	size_t n = (size_t)1 << set->stripe_bits;
+
+	for(i=0; i<n; i++) {
+		struct stripe *st = &set->stripes[i];
+		LOCK(set, &st->mutex);
+		count += st->count;
+		UNLOCK(set, &st->mutex);
+	}
+	return count;
+}
+
+
+/*
+ * Find the device index of a device number, starting at 1. Returns 0 if the
+ * device was not seen before
+ */
+
+static uint32_t dev_find(struct inoset *set, duc_dev_t dev)
+{
+	size_t n = __atomic_load_n(&set->dev_count, __ATOMIC_ACQUIRE);
+	size_t i;
+
+	for(i=0; i<n; i++) {
+		if(set->dev_list[i] == dev) return i + 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Map a device number to a device index, adding the device if it is new.
+ * Returns 0 if a shared set can not take more devices
+ */
+
+static uint32_t dev_index(struct inoset *set, duc_dev_t dev)
+{
+	if(!set->shared && set->dev_last && set->dev_list[set->dev_last-1] == dev) {
+		return set->dev_last;
+	}
+
+	uint32_t idx = dev_find(set, dev);
+
+	if(idx == 0) {
+		LOCK(set, &set->dev_mutex);
+		idx = dev_find(set, dev);
+		if(idx == 0) {
+			if(set->shared) {
+				if(set->dev_count < SHARED_DEV_MAX) {
+					set->dev_list[set->dev_count] = dev;
+					idx = set->dev_count + 1;
+					__atomic_store_n(&set->dev_count, idx, __ATOMIC_RELEASE);
+				} else if(!set->dev_full) {
+					duc_log(NULL, DUC_LOG_WRN, "Too many devices, not checking hard links on all of them");
+					set->dev_full = 1;
+				}
+			} else {
+				set->dev_list = duc_realloc(set->dev_list, (set->dev_count + 1) * sizeof(*set->dev_list));
+				set->dev_list[set->dev_count++] = dev;
+				idx = set->dev_count;
+			}
+		}
+		UNLOCK(set, &set->dev_mutex);
+	}
+
+	if(!set->shared) set->dev_last = idx;
+	return idx;
+}
+
+
+static struct stripe *find_stripe(struct inoset *set, uint64_t h)
+{
+	if(set->stripe_bits == 0) return &set->stripes[0];
+	return &set->stripes[h >> (64 - set->stripe_bits)];
+}
+
+
+/*
+ * Find the slot for the given key. Returns the existing slot holding the key,
+ * or the empty slot where it should be inserted
+ */
+
+static uint32_t *find_slot(uint32_t *slots, size_t size, uint64_t h, uint64_t ino, uint32_t dev)
+{
+	size_t mask = size - 1;
+	size_t i = h & mask;
+
+	for(;;) {
+		uint32_t *slot = slots + i * SLOT_WORDS;
+		if(slot[2] == 0) return slot;
+		if(slot[2] == dev && slot[0] == (uint32_t)ino && slot[1] == (uint32_t)(ino >> 32)) return slot;
+		i = (i + 1) & mask;
+	}
+}
+
+
+/*
+ * Copy all entries of a table to the given stripes
+ */
+
+static void rehash(struct inoset *set, uint32_t *slots, size_t size)
+{
+	size_t i;
+
+	for(i=0; i<size; i++) {
+		uint32_t *slot = slots + i * SLOT_WORDS;
+		if(slot[2]) {
+			uint64_t ino = slot[0] | ((uint64_t)slot[1] << 32);
+			uint64_t h = hash(ino, slot[2]);
+			struct stripe *st = find_stripe(set, h);
+			uint32_t *slot_new = find_slot(st->slots, st->size, h, ino, slot[2]);
+			memcpy(slot_new, slot, SLOT_WORDS * sizeof(uint32_t));
+			st->count ++;
+		}
+	}
+}
+
+
+static void grow(struct inoset *set, struct stripe *st)
+{
+	struct stripe old = *st;
+
+	stripe_init(set, st, old.size * 2);
+
+	size_t i;
+	for(i=0; i<old.size; i++) {
+		uint32_t *slot = old.slots + i * SLOT_WORDS;
+		if(slot[2]) {
+			uint64_t ino = slot[0] | ((uint64_t)slot[1] << 32);
+			uint32_t *slot_new = find_slot(st->slots, st->size, hash(ino, slot[2]), ino, slot[2]);
+			memcpy(slot_new, slot, SLOT_WORDS * sizeof(uint32_t));
+		}
+	}
+	st->count = old.count;
+
+	slots_free(old.slots, old.size, old.mapped);
+}
+
+
+/*
+ * Make the set safe for use by several threads at once. The entries are
+ * moved to the stripes of the shared layout, the set can not be made private
+ * again
+ */
+
+void inoset_share(struct inoset *set)
+{
+	if(set->shared) return;
+
+	struct stripe old = set->stripes[0];
+	duc_free(set->stripes);
+
+	set->stripe_bits = STRIPE_BITS;
+	set->stripes = duc_malloc0(STRIPE_COUNT * sizeof(*set->stripes));
+
+	size_t i;
+	size_t size = STRIPE_INITIAL_SIZE;
+	while(size * STRIPE_COUNT < old.count * 2) size *= 2;
+
+	for(i=0; i<STRIPE_COUNT; i++) {
+		stripe_init(set, &set->stripes[i], size);
+#ifdef HAVE_LIBPTHREAD
+		pthread_mutex_init(&set->stripes[i].mutex, NULL);
+#endif
+	}
+
+	rehash(set, old.slots, old.size);
+	slots_free(old.slots, old.size, old.mapped);
+
+	set->dev_list = duc_realloc(set->dev_list, SHARED_DEV_MAX * sizeof(*set->dev_list));
+	set->dev_last = 0;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&set->dev_mutex, NULL);
+#endif
+	set->shared = 1;
+}
+
+
+/*
+ * Add device/inode pair to the set. Returns 1 if the pair was already present
+ */
+
+int inoset_add(struct inoset *set, const struct duc_devino *devino)
+{
+	uint64_t ino = devino->ino;
+	uint32_t dev = dev_index(set, devino->dev);
+	if(dev == 0) return 0;
+
+	uint64_t h = hash(ino, dev);
+	struct stripe *st = find_stripe(set, h);
+	int found = 1;
+
+	LOCK(set, &st->mutex);
+
+	uint32_t *slot = find_slot(st->slots, st->size, h, ino, dev);
+	if(slot[2] == 0) {
+		slot[0] = (uint32_t)ino;
+		slot[1] = (uint32_t)(ino >> 32);
+		slot[2] = dev;
+		st->count ++;
+		found = 0;
+
+		/* Keep the load factor below 0.75 */
+
+		if(st->count * 4 > st->size * 3) {
+			grow(set, st);
+		}
+	}
+
+	UNLOCK(set, &st->mutex);
+
+	return found;
+}
+
+
+/*
+ * Check if the device/inode pair is in the set
+ */
+
+int inoset_has(struct inoset *set, const struct duc_devino *devino)
+{
+	uint32_t dev = dev_find(set, devino->dev);
+	if(dev == 0) return 0;
+
+	uint64_t h = hash(devino->ino, dev);
+	struct stripe *st = find_stripe(set, h);
+
+	LOCK(set, &st->mutex);
+	uint32_t *slot = find_slot(st->slots, st->size, h, devino->ino, dev);
+	int found = slot[2] != 0;
+	UNLOCK(set, &st->mutex);
+
+	return found;
+}
+
+
+/*
+ * End
+ */
@@ -0,0 +1,20 @@
+#ifndef inoset_h
+#define inoset_h
+
+#include "duc.h"
+
+/* Side records of the hard links counted in a directory, see index.c */
+
+#define LINKS_PREFIX "duc_links"
+
+struct inoset;
+
+struct inoset *inoset_new(const char *spill_dir);
+void inoset_free(struct inoset *set);
+
+int inoset_add(struct inoset *set, const struct duc_devino *devino);
+int inoset_has(struct inoset *set, const struct duc_devino *devino);
+void inoset_share(struct inoset *set);
+size_t inoset_count(struct inoset *set);
+
+#endif
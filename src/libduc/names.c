@@ -0,0 +1,421 @@
+
+/*
+ * Name index, built during indexing when DUC_INDEX_NAMES is given. For every
+ * trigram (three consecutive bytes, ASCII case folded) found in the entry
+ * names of a directory, the index holds the list of directories containing
+ * such a name. A name search only needs to read the directories found in the
+ * lists of all trigrams of the search pattern.
+ *
+ * The lists are collected in memory and written out in chunks, every flush
+ * writes one record per trigram, and the list of trigrams in the chunk:
+ *
+ *   duc_names:<root dev>/<root ino>             number of chunks, number of
+ *                                               chunks of an earlier run
+ *   duc_names:<root dev>/<root ino>:<n>         trigrams of chunk n
+ *   duc_names:<root dev>/<root ino>:<tri>:<n>   dev/ino varint pairs
+ *
+ * Lists are kept per index root, so indexing another path into the same
+ * database does not overwrite them. When a root is indexed again, every
+ * flush removes the lists of the earlier run in the chunk it overwrites, and
+ * the chunks beyond the last one are removed at the end. Lists may still
+ * hold directories which were removed since, readers have to check every
+ * candidate.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "dbqueue.h"
+#include "names.h"
+#include "varint.h"
+#include "uthash.h"
+
+#define NAMES_FLUSH_SIZE (64 * 1024 * 1024)
+
+struct posting {
+	uint32_t tri;
+	uint8_t *data;
+	size_t len;
+	size_t max;
+	UT_hash_handle hh;
+};
+
+struct names {
+	duc *duc;
+	struct duc_devino root;
+	struct posting *map;
+	size_t mem;
+	size_t chunk;
+	size_t chunk_old;         /* Chunks of an earlier run */
+	uint32_t *tri;
+	size_t tri_max;
+};
+
+
+static uint32_t fold(uint8_t c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+
+/*
+ * Write the trigrams of the given string to out, which must have room for
+ * len - 2 entries. Returns the number of trigrams
+ */
+
+size_t names_get_trigrams(const char *s, size_t len, uint32_t *out)
+{
+	const uint8_t *p = (const uint8_t *)s;
+	size_t i, n = 0;
+
+	for(i=0; i+2<len; i++) {
+		out[n++] = fold(p[i]) << 16 | fold(p[i+1]) << 8 | fold(p[i+2]);
+	}
+
+	return n;
+}
+
+
+static size_t meta_key(const struct duc_devino *root, char *key, size_t keylen)
+{
+	return snprintf(key, keylen, "duc_names:%jx/%jx",
+			(uintmax_t)root->dev, (uintmax_t)root->ino);
+}
+
+
+static size_t posting_key(const struct duc_devino *root, uint32_t tri, size_t chunk, char *key, size_t keylen)
+{
+	return snprintf(key, keylen, "duc_names:%jx/%jx:%06x:%zx",
+			(uintmax_t)root->dev, (uintmax_t)root->ino, tri, chunk);
+}
+
+
+static size_t chunk_key(const struct duc_devino *root, size_t chunk, char *key, size_t keylen)
+{
+	return snprintf(key, keylen, "duc_names:%jx/%jx:%zx",
+			(uintmax_t)root->dev, (uintmax_t)root->ino, chunk);
+}
+
+
+static size_t read_chunk_count(duc *duc, const struct duc_devino *root, int *found, size_t *chunk_old)
+{
+	char key[64];
+	size_t keyl = meta_key(root, key, sizeof(key));
+	size_t vall;
+	uint64_t v = 0, v_old = 0;
+
+	char *val = dbqueue_get(duc, key, keyl, &vall);
+	if(found) *found = val != NULL && vall > 0;
+	if(val) {
+		struct buffer *b = buffer_new(val, vall);
+		buffer_get_varint(b, &v);
+		if(b->ptr < b->len) buffer_get_varint(b, &v_old);
+		buffer_free(b);
+	}
+
+	if(chunk_old) *chunk_old = v_old;
+	return v;
+}
+
+
+static void write_chunk_count(struct names *n)
+{
+	char key[64];
+	size_t keyl = meta_key(&n->root, key, sizeof(key));
+	struct buffer *b = buffer_new(NULL, 0);
+	buffer_put_varint(b, n->chunk);
+	buffer_put_varint(b, n->chunk_old);
+	dbqueue_put(n->duc, key, keyl, b->data, b->len);
+	buffer_free(b);
+}
+
+
+/*
+ * Remove the lists of an earlier run in the given chunk, except the ones in
+ * keep, which are overwritten by the current run
+ */
+
+static void remove_chunk(duc *duc, const struct duc_devino *root, size_t chunk, struct posting *keep)
+{
+	char key[64];
+	size_t keyl = chunk_key(root, chunk, key, sizeof(key));
+	size_t vall;
+
+	char *val = dbqueue_get(duc, key, keyl, &vall);
+	if(val == NULL) return;
+
+	struct buffer *b = buffer_new(val, vall);
+	while(b->ptr < b->len) {
+		uint64_t tri;
+		buffer_get_varint(b, &tri);
+		struct posting *p = NULL;
+		uint32_t t = tri;
+		if(keep) HASH_FIND(hh, keep, &t, sizeof(t), p);
+		if(p == NULL) {
+			keyl = posting_key(root, t, chunk, key, sizeof(key));
+			dbqueue_put(duc, key, keyl, "", 0);
+		}
+	}
+	buffer_free(b);
+
+	if(keep == NULL) {
+		keyl = chunk_key(root, chunk, key, sizeof(key));
+		dbqueue_put(duc, key, keyl, "", 0);
+	}
+}
+
+
+/*
+ * Start collecting the name index for the given index root. When resuming an
+ * interrupted run, the chunks written before the interruption are kept
+ */
+
+struct names *names_new(duc *duc, const struct duc_devino *root, int resume)
+{
+	struct names *n = duc_malloc0(sizeof *n);
+	n->duc = duc;
+	n->root = *root;
+
+	size_t chunk_old;
+	size_t chunk = read_chunk_count(duc, root, NULL, &chunk_old);
+	if(resume) {
+		n->chunk = chunk;
+		n->chunk_old = chunk_old;
+	} else {
+		n->chunk_old = chunk > chunk_old ? chunk : chunk_old;
+	}
+	return n;
+}
+
+
+static int cmp_tri(const void *a, const void *b)
+{
+	uint32_t t1 = *(const uint32_t *)a;
+	uint32_t t2 = *(const uint32_t *)b;
+	return t1 < t2 ? -1 : t1 > t2;
+}
+
+
+static void posting_add(struct names *n, uint32_t tri, const struct duc_devino *devino)
+{
+	struct posting *p;
+
+	HASH_FIND(hh, n->map, &tri, sizeof(tri), p);
+	if(p == NULL) {
+		p = duc_malloc0(sizeof *p);
+		p->tri = tri;
+		HASH_ADD(hh, n->map, tri, sizeof(p->tri), p);
+		n->mem += sizeof(*p);
+	}
+
+	if(p->len + 18 > p->max) {
+		size_t max = p->max ? p->max * 2 : 32;
+		p->data = duc_realloc(p->data, max);
+		n->mem += max - p->max;
+		p->max = max;
+	}
+
+	p->len += PutVarint64(p->data + p->len, devino->dev);
+	p->len += PutVarint64(p->data + p->len, devino->ino);
+}
+
+
+/*
+ * Add the names of a directory, taken from its database record
+ */
+
+void names_add_dir(struct names *n, const struct duc_devino *devino, struct buffer *record, int hide_file_names)
+{
+	struct buffer *b = buffer_new(record->data, record->len);
+	struct duc_devino devino_parent;
+	time_t mtime;
+	size_t count = 0;
+
+	buffer_get_dir(b, &devino_parent, &mtime, NULL, NULL);
+
+	while(b->ptr < b->len) {
+		struct duc_dirent ent;
+		buffer_get_dirent(b, &ent);
+
+		size_t l = strlen(ent.name);
+		if(l > 2 && !(hide_file_names && ent.type != DUC_FILE_TYPE_DIR)) {
+			if(count + l > n->tri_max) {
+				n->tri_max = (count + l) * 2;
+				n->tri = duc_realloc(n->tri, n->tri_max * sizeof(*n->tri));
+			}
+			count += names_get_trigrams(ent.name, l, n->tri + count);
+		}
+		duc_free(ent.name);
+	}
+	duc_free(b);
+
+	qsort(n->tri, count, sizeof(*n->tri), cmp_tri);
+
+	size_t i;
+	for(i=0; i<count; i++) {
+		if(i == 0 || n->tri[i] != n->tri[i-1]) {
+			posting_add(n, n->tri[i], devino);
+		}
+	}
+
+	if(n->mem > NAMES_FLUSH_SIZE) {
+		names_flush(n);
+	}
+}
+
+
+/*
+ * Write all collected lists as a new chunk
+ */
+
+void names_flush(struct names *n)
+{
+	struct posting *p, *pn;
+	char key[64];
+	size_t keyl;
+
+	if(n->map == NULL) return;
+
+	if(n->chunk < n->chunk_old) {
+		remove_chunk(n->duc, &n->root, n->chunk, n->map);
+	}
+
+	struct buffer *b = buffer_new(NULL, 0);
+
+	HASH_ITER(hh, n->map, p, pn) {
+		keyl = posting_key(&n->root, p->tri, n->chunk, key, sizeof(key));
+		dbqueue_put(n->duc, key, keyl, p->data, p->len);
+		buffer_put_varint(b, p->tri);
+		HASH_DEL(n->map, p);
+		duc_free(p->data);
+		duc_free(p);
+	}
+
+	keyl = chunk_key(&n->root, n->chunk, key, sizeof(key));
+	dbqueue_put(n->duc, key, keyl, b->data, b->len);
+	buffer_free(b);
+
+	n->chunk ++;
+	n->mem = 0;
+	write_chunk_count(n);
+
+	duc_log(n->duc, DUC_LOG_DBG, "Wrote name index chunk %zu", n->chunk);
+}
+
+
+void names_free(struct names *n)
+{
+	names_flush(n);
+
+	if(n->chunk_old > n->chunk) {
+		size_t i;
+		for(i=n->chunk; i<n->chunk_old; i++) {
+			remove_chunk(n->duc, &n->root, i, NULL);
+		}
+	}
+	if(n->chunk_old) {
+		n->chunk_old = 0;
+		write_chunk_count(n);
+	}
+
+	duc_free(n->tri);
+	duc_free(n);
+}
+
+
+/*
+ * Drop the name index of the given root, used when it is indexed again
+ * without one
+ */
+
+void names_clear(duc *duc, const struct duc_devino *root)
+{
+	int found;
+	size_t chunk_old;
+	size_t chunk = read_chunk_count(duc, root, &found, &chunk_old);
+	if(!found) return;
+
+	size_t i;
+	for(i=0; i<chunk || i<chunk_old; i++) {
+		remove_chunk(duc, root, i, NULL);
+	}
+
+	char key[64];
+	size_t keyl = meta_key(root, key, sizeof(key));
+	dbqueue_put(duc, key, keyl, "", 0);
+}
+
+
+int names_has_index(duc *duc, const struct duc_devino *root)
+{
+	int found;
+	read_chunk_count(duc, root, &found, NULL);
+	return found;
+}
+
+
+static int cmp_devino(const void *a, const void *b)
+{
+	const struct duc_devino *d1 = a;
+	const struct duc_devino *d2 = b;
+	if(d1->dev != d2->dev) return d1->dev < d2->dev ? -1 : 1;
+	if(d1->ino != d2->ino) return d1->ino < d2->ino ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * Return the sorted list of directories holding names with the given
+ * trigram
+ */
+
+struct duc_devino *names_lookup(duc *duc, const struct duc_devino *root, uint32_t tri, size_t *count)
+{
+	size_t chunks = read_chunk_count(duc, root, NULL, NULL);
+	struct duc_devino *list = NULL;
+	size_t n = 0, max = 0;
+	size_t i;
+
+	for(i=0; i<chunks; i++) {
+		char key[64];
+		size_t keyl = posting_key(root, tri, i, key, sizeof(key));
+		size_t vall;
+		char *val = dbqueue_get(duc, key, keyl, &vall);
+		if(val == NULL) continue;
+
+		struct buffer *b = buffer_new(val, vall);
+		while(b->ptr < b->len) {
+			if(n == max) {
+				max = max ? max * 2 : 64;
+				list = duc_realloc(list, max * sizeof(*list));
+			}
+			buffer_get_devino(b, &list[n++]);
+		}
+		buffer_free(b);
+	}
+
+	qsort(list, n, sizeof(*list), cmp_devino);
+
+	/* Directories rescanned after resuming can be listed twice */
+
+	size_t j = 0;
+	for(i=0; i<n; i++) {
+		if(j == 0 || cmp_devino(&list[i], &list[j-1]) != 0) {
+			list[j++] = list[i];
+		}
+	}
+
+	*count = j;
+	return list;
+}
+
+
+/*
+ * End
+ */
+
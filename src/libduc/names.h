@@ -0,0 +1,19 @@
+#ifndef names_h
+#define names_h
+
+#include "duc.h"
+#include "buffer.h"
+
+struct names;
+
+struct names *names_new(duc *duc, const struct duc_devino *root, int resume);
+void names_add_dir(struct names *n, const struct duc_devino *devino, struct buffer *record, int hide_file_names);
+void names_flush(struct names *n);
+void names_free(struct names *n);
+void names_clear(duc *duc, const struct duc_devino *root);
+
+int names_has_index(duc *duc, const struct duc_devino *root);
+size_t names_get_trigrams(const char *s, size_t len, uint32_t *out);
+struct duc_devino *names_lookup(duc *duc, const struct duc_devino *root, uint32_t tri, size_t *count);
+
+#endif
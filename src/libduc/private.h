@@ -2,8 +2,9 @@
 #define duc_internal_h
 
 #include "duc.h"
+#include "digest.h"
 
-#define DUC_DB_VERSION "17"
+#define DUC_DB_VERSION "18"
 
 #ifndef S_ISLNK
 #define S_ISLNK(v) 0
@@ -35,8 +36,21 @@ struct duc {
 	duc_errno err;
 	duc_log_level log_level;
 	duc_log_callback log_callback;
+	char *path_db;
+	duc_dircache *dircache;
+	int dircache_private;
+	uint64_t dircache_db;       /* Database id in the directory cache, see dircache_db_id() */
+	struct shard *shards;       /* Federated databases, see federate.c */
+	size_t shard_count;
+	time_t shards_checked;      /* Time the shard reports were last checked */
+	struct duc **shard_shares;  /* Shard handles of a shared handle, see federate_route() */
+	struct dbqueue *queue;     /* Set on handles of index threads, see dbqueue.c */
+	struct dblock *lock;       /* Set on databases read by several threads, see duc_share() */
+	int shared;                /* Handle does not own its database, see duc_share() */
 };
 
+#define DUC_DIRCACHE_DEFAULT_SIZE (32 * 1024 * 1024)
+
 void *duc_malloc(size_t s);
 void *duc_malloc0(size_t s);
 void *duc_realloc(void *p, size_t s);
@@ -44,8 +58,20 @@ char *duc_strdup(const char *s);
 void duc_free(void *p);
 
 
+struct duc_dir *duc_dir_new(struct duc *duc, const struct duc_devino *devino);
+struct duc *duc_dir_get_duc(struct duc_dir *dir);
+void duc_dir_get_parent(struct duc_dir *dir, struct duc_devino *devino);
+void duc_dir_get_devino(struct duc_dir *dir, struct duc_devino *devino);
+void duc_dir_get_check(struct duc_dir *dir, enum digest_meta_part part, uint8_t *check);
 void duc_size_accum(struct duc_size *s1, const struct duc_size *s2);
 char *duc_canonicalize_path(const char *dir);
+char *duc_path_join(const char *parent, const char *name);
+int duc_path_is_below(const char *path, const char *prefix);
+
+void duc_db_lock_init(duc *duc);
+void duc_db_lock(duc *duc);
+void duc_db_unlock(duc *duc);
+duc *duc_share(duc *duc);
 
 #endif
 
@@ -0,0 +1,262 @@
+
+/*
+ * A tally maps arbitrary keys to sizes. The indexer keeps one per directory
+ * for breakdowns like the usage per user, adding every file to the tally of
+ * its directory and merging the tally of every completed subdirectory into
+ * the tally of its parent.
+ *
+ * Tallies are stored as side records next to the directory records, so
+ * reading a directory does not get any slower:
+ *
+ *   <prefix>:<dev>/<ino>   check value of the directory record, time of the
+ *                          index run, then key/size pairs
+ *
+ * The check value ties the side record to the contents of the directory at
+ * the time it was written. It is the digest of the directory, combined with
+ * the owners or times of its entries for breakdowns which depend on those,
+ * see digest_check(). When a later index run without the breakdown changed
+ * the directory, the values differ and the stale side record is ignored.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "db.h"
+#include "dbqueue.h"
+#include "tally.h"
+#include "uthash.h"
+
+struct tally_ent {
+	void *key;
+	size_t keylen;
+	struct duc_size size;
+	UT_hash_handle hh;
+};
+
+struct tally {
+	struct tally_ent *map;
+};
+
+
+struct tally *tally_new(void)
+{
+	return duc_malloc0(sizeof(struct tally));
+}
+
+
+void tally_free(struct tally *t)
+{
+	struct tally_ent *e, *en;
+	HASH_ITER(hh, t->map, e, en) {
+		HASH_DEL(t->map, e);
+		duc_free(e->key);
+		duc_free(e);
+	}
+	duc_free(t);
+}
+
+
+void tally_add(struct tally *t, const void *key, size_t keylen, const struct duc_size *size)
+{
+	struct tally_ent *e;
+
+	HASH_FIND(hh, t->map, key, keylen, e);
+	if(e == NULL) {
+		e = duc_malloc0(sizeof *e);
+		e->key = duc_malloc(keylen ? keylen : 1);
+		memcpy(e->key, key, keylen);
+		e->keylen = keylen;
+		HASH_ADD_KEYPTR(hh, t->map, e->key, e->keylen, e);
+	}
+
+	duc_size_accum(&e->size, size);
+}
+
+
+void tally_merge(struct tally *t, const struct tally *src)
+{
+	struct tally_ent *e, *en;
+	HASH_ITER(hh, src->map, e, en) {
+		tally_add(t, e->key, e->keylen, &e->size);
+	}
+}
+
+
+size_t tally_count(const struct tally *t)
+{
+	return HASH_COUNT(t->map);
+}
+
+
+static int cmp_ent(const void *a, const void *b)
+{
+	const struct tally_ent *e1 = *(const struct tally_ent **)a;
+	const struct tally_ent *e2 = *(const struct tally_ent **)b;
+	if(e1->size.actual != e2->size.actual) return e1->size.actual > e2->size.actual ? -1 : 1;
+	if(e1->size.apparent != e2->size.apparent) return e1->size.apparent > e2->size.apparent ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * Keep only the largest keys, the others are added up under key_other. The
+ * result holds at most max keys, including key_other
+ */
+
+void tally_trim(struct tally *t, size_t max, const void *key_other, size_t keylen_other)
+{
+	if(tally_count(t) <= max || max == 0) return;
+
+	struct tally_ent *other;
+	HASH_FIND(hh, t->map, key_other, keylen_other, other);
+
+	size_t n = 0;
+	struct tally_ent **list = duc_malloc(tally_count(t) * sizeof(*list));
+	struct tally_ent *e, *en;
+	HASH_ITER(hh, t->map, e, en) {
+		if(e != other) list[n++] = e;
+	}
+
+	qsort(list, n, sizeof(*list), cmp_ent);
+
+	struct duc_size size_other = { 0, 0, 0 };
+	size_t i;
+	for(i=max-1; i<n; i++) {
+		duc_size_accum(&size_other, &list[i]->size);
+		HASH_DEL(t->map, list[i]);
+		duc_free(list[i]->key);
+		duc_free(list[i]);
+	}
+	duc_free(list);
+
+	tally_add(t, key_other, keylen_other, &size_other);
+}
+
+
+void tally_foreach(const struct tally *t, tally_cb cb, void *ptr)
+{
+	struct tally_ent *e, *en;
+	HASH_ITER(hh, t->map, e, en) {
+		cb(e->key, e->keylen, &e->size, ptr);
+	}
+}
+
+
+void tally_put(struct buffer *b, const struct tally *t)
+{
+	struct tally_ent *e, *en;
+	HASH_ITER(hh, t->map, e, en) {
+		buffer_put_blob(b, e->key, e->keylen);
+		buffer_put_size(b, &e->size);
+	}
+}
+
+
+void tally_get(struct buffer *b, struct tally *t)
+{
+	while(b->ptr < b->len) {
+		size_t keylen;
+		void *key = buffer_get_blob(b, &keylen);
+		if(key == NULL) break;
+		struct duc_size size;
+		buffer_get_size(b, &size);
+		tally_add(t, key, keylen, &size);
+		duc_free(key);
+	}
+}
+
+
+static size_t tally_key(const char *prefix, const struct duc_devino *devino, char *key, size_t keylen)
+{
+	return snprintf(key, keylen, "%s:%jx/%jx", prefix,
+			(uintmax_t)devino->dev, (uintmax_t)devino->ino);
+}
+
+
+void tally_write(duc *duc, const char *prefix, const struct duc_devino *devino, const uint8_t *check, time_t time, const struct tally *t)
+{
+	char key[64];
+	size_t keyl = tally_key(prefix, devino, key, sizeof(key));
+
+	struct buffer *b = buffer_new(NULL, 0);
+	buffer_put_blob(b, check, DUC_DIGEST_SIZE);
+	buffer_put_varint(b, time);
+	tally_put(b, t);
+	dbqueue_put(duc, key, keyl, b->data, b->len);
+	buffer_free(b);
+}
+
+
+/*
+ * Read the side record of a directory. Returns NULL if there is none, or if
+ * it does not match the check value of the current directory record. The
+ * time of the index run which wrote it is returned in time, if not NULL
+ */
+
+struct tally *tally_read(duc *duc, const char *prefix, const struct duc_devino *devino, const uint8_t *check, time_t *time)
+{
+	char key[64];
+	size_t keyl = tally_key(prefix, devino, key, sizeof(key));
+	size_t vall;
+
+	char *val = duc_db_get(duc, key, keyl, &vall);
+	if(val == NULL) return NULL;
+
+	struct buffer *b = buffer_new(val, vall);
+	struct tally *t = NULL;
+
+	size_t len;
+	void *check_rec = buffer_get_blob(b, &len);
+	if(check_rec && len == DUC_DIGEST_SIZE && memcmp(check_rec, check, DUC_DIGEST_SIZE) == 0) {
+		uint64_t v = 0;
+		buffer_get_varint(b, &v);
+		if(time) *time = v;
+		t = tally_new();
+		tally_get(b, t);
+	}
+
+	duc_free(check_rec);
+	buffer_free(b);
+	return t;
+}
+
+
+/*
+ * Copy the side record of a directory to another database, if it matches the
+ * check value of the directory record. Returns the size of the copied record
+ */
+
+size_t tally_copy(duc *dst, duc *src, const char *prefix, const struct duc_devino *devino, const uint8_t *check)
+{
+	char key[64];
+	size_t keyl = tally_key(prefix, devino, key, sizeof(key));
+	size_t vall;
+
+	char *val = db_get(src->db, key, keyl, &vall);
+	if(val == NULL) return 0;
+
+	struct buffer *b = buffer_new(val, vall);
+	size_t len;
+	void *check_rec = buffer_get_blob(b, &len);
+	size_t copied = 0;
+
+	if(check_rec && len == DUC_DIGEST_SIZE && memcmp(check_rec, check, DUC_DIGEST_SIZE) == 0) {
+		db_put(dst->db, key, keyl, b->data, b->len);
+		copied = b->len;
+	}
+
+	duc_free(check_rec);
+	buffer_free(b);
+	return copied;
+}
+
+
+/*
+ * End
+ */
+
@@ -0,0 +1,26 @@
+#ifndef tally_h
+#define tally_h
+
+#include "duc.h"
+#include "buffer.h"
+
+struct tally;
+
+typedef void (*tally_cb)(const void *key, size_t keylen, const struct duc_size *size, void *ptr);
+
+struct tally *tally_new(void);
+void tally_free(struct tally *t);
+void tally_add(struct tally *t, const void *key, size_t keylen, const struct duc_size *size);
+void tally_merge(struct tally *t, const struct tally *src);
+size_t tally_count(const struct tally *t);
+void tally_trim(struct tally *t, size_t max, const void *key_other, size_t keylen_other);
+void tally_foreach(const struct tally *t, tally_cb cb, void *ptr);
+
+void tally_put(struct buffer *b, const struct tally *t);
+void tally_get(struct buffer *b, struct tally *t);
+
+void tally_write(duc *duc, const char *prefix, const struct duc_devino *devino, const uint8_t *check, time_t time, const struct tally *t);
+struct tally *tally_read(duc *duc, const char *prefix, const struct duc_devino *devino, const uint8_t *check, time_t *time);
+size_t tally_copy(duc *dst, duc *src, const char *prefix, const struct duc_devino *devino, const uint8_t *check);
+
+#endif
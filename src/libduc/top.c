@@ -0,0 +1,225 @@
+
+/*
+ * Find the largest files or directories anywhere below a directory.
+ *
+ * Directories are visited best first, largest total size first, while the N
+ * largest entries found so far are kept in a min-heap. No entry below a
+ * directory can be larger than the directory itself, so once the heap is full
+ * every directory not larger than the smallest entry in the heap is skipped,
+ * and the search ends as soon as the largest unvisited directory is too small.
+ * Usually only a small part of the directories is ever read.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "duc.h"
+#include "private.h"
+
+struct item {
+	off_t key;
+	struct duc_dirent ent;
+};
+
+/*
+ * Binary min-heap on the item key. The directory queue stores the negated
+ * size as key to get the largest directory on top
+ */
+
+struct heap {
+	struct item *list;
+	size_t len;
+	size_t max;
+};
+
+
+static void heap_down(struct heap *h, size_t i)
+{
+	struct item *l = h->list;
+
+	for(;;) {
+		size_t c = i * 2 + 1;
+		if(c >= h->len) break;
+		if(c + 1 < h->len && l[c+1].key < l[c].key) c++;
+		if(l[i].key <= l[c].key) break;
+		struct item t = l[i]; l[i] = l[c]; l[c] = t;
+		i = c;
+	}
+}
+
+
+static void heap_push(struct heap *h, struct item *it)
+{
+	if(h->len == h->max) {
+		h->max = h->max ? h->max * 2 : 64;
+		h->list = duc_realloc(h->list, h->max * sizeof(*h->list));
+	}
+
+	struct item *l = h->list;
+	size_t i = h->len++;
+	l[i] = *it;
+
+	while(i > 0) {
+		size_t p = (i - 1) / 2;
+		if(l[p].key <= l[i].key) break;
+		struct item t = l[i]; l[i] = l[p]; l[p] = t;
+		i = p;
+	}
+}
+
+
+static void heap_pop(struct heap *h, struct item *it)
+{
+	*it = h->list[0];
+	h->list[0] = h->list[--h->len];
+	heap_down(h, 0);
+}
+
+
+/*
+ * Add an entry to the result heap if it is larger than the smallest entry,
+ * takes ownership of the name
+ */
+
+static void offer(struct heap *top, size_t n, struct item *it)
+{
+	if(top->len < n) {
+		heap_push(top, it);
+	} else if(it->key > top->list[0].key) {
+		duc_free(top->list[0].ent.name);
+		top->list[0] = *it;
+		heap_down(top, 0);
+	} else {
+		duc_free(it->ent.name);
+	}
+}
+
+
+static int cmp_item(const void *p1, const void *p2)
+{
+	const struct item *i1 = p1;
+	const struct item *i2 = p2;
+	if(i1->key > i2->key) return -1;
+	if(i1->key < i2->key) return +1;
+	return strcmp(i1->ent.name, i2->ent.name);
+}
+
+
+/*
+ * Offer all entries of a directory to the result and queue its
+ * subdirectories
+ */
+
+static void visit(duc_dir *d, const char *path, duc_size_type st, size_t n, duc_top_flags flags,
+		struct heap *queue, struct heap *top)
+{
+	struct duc_dirent *e;
+
+	while((e = duc_dir_read(d, st, DUC_SORT_SIZE)) != NULL) {
+
+		off_t size = duc_get_size(&e->size, st);
+
+		/* Entries are sorted by size, nothing after this one can make it
+		 * into the result */
+
+		if(top->len == n && size <= top->list[0].key) break;
+
+		int is_dir = e->type == DUC_FILE_TYPE_DIR;
+
+		if(flags & (is_dir ? DUC_TOP_DIRS : DUC_TOP_FILES)) {
+			struct item r = { size, *e };
+			r.ent.name = duc_path_join(path, e->name);
+			offer(top, n, &r);
+		}
+
+		if(is_dir) {
+			struct item q = { -size, *e };
+			q.ent.name = duc_path_join(path, e->name);
+			heap_push(queue, &q);
+		}
+	}
+}
+
+
+/*
+ * Return the n largest entries below the given directory, largest first.
+ * The names of the returned entries are full paths. The list is to be freed
+ * with duc_top_free()
+ */
+
+struct duc_dirent *duc_top(duc_dir *dir, duc_size_type st, size_t n, duc_top_flags flags, size_t *count)
+{
+	struct heap queue = { NULL, 0, 0 };
+	struct heap top = { NULL, 0, 0 };
+	struct item it;
+	size_t visited = 1;
+	duc *duc = duc_dir_get_duc(dir);
+
+	*count = 0;
+	if(n == 0) return NULL;
+
+	char *path = duc_dir_get_path(dir);
+	duc_dir_rewind(dir);
+	visit(dir, path, st, n, flags, &queue, &top);
+	duc_dir_rewind(dir);
+	duc_free(path);
+
+	while(queue.len > 0) {
+
+		heap_pop(&queue, &it);
+		path = it.ent.name;
+
+		if(top.len == n && -it.key <= top.list[0].key) {
+			duc_free(path);
+			break;
+		}
+
+		duc_dir *d = duc_dir_new(duc, &it.ent.devino);
+		if(d) {
+			visit(d, path, st, n, flags, &queue, &top);
+			duc_dir_close(d);
+			visited ++;
+		}
+		duc_free(path);
+	}
+
+	while(queue.len > 0) {
+		heap_pop(&queue, &it);
+		duc_free(it.ent.name);
+	}
+	duc_free(queue.list);
+
+	duc_log(duc, DUC_LOG_DBG, "top: %zu directories visited", visited);
+
+	/* Sort the result largest first and return the bare entries */
+
+	qsort(top.list, top.len, sizeof(*top.list), cmp_item);
+
+	struct duc_dirent *list = duc_malloc(top.len * sizeof(*list) + 1);
+	size_t i;
+	for(i=0; i<top.len; i++) {
+		list[i] = top.list[i].ent;
+	}
+	*count = top.len;
+	duc_free(top.list);
+
+	return list;
+}
+
+
+void duc_top_free(struct duc_dirent *list, size_t count)
+{
+	size_t i;
+	for(i=0; i<count; i++) {
+		duc_free(list[i].name);
+	}
+	duc_free(list);
+}
+
+
+/*
+ * End
+ */
+
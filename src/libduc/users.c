@@ -0,0 +1,93 @@
+
+/*
+ * Usage per user. When indexing with DUC_INDEX_USERS every directory gets a
+ * side record with the size of the files and directories below it for every
+ * owner, so the usage of all users is known after a single index run.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "users.h"
+#include "varint.h"
+
+
+void users_add(struct tally *t, uid_t uid, const struct duc_size *size)
+{
+	uint8_t key[9];
+	int l = PutVarint64(key, uid);
+	tally_add(t, key, l, size);
+}
+
+
+struct user_list {
+	struct duc_user *list;
+	size_t count;
+};
+
+
+static void add_user(const void *key, size_t keylen, const struct duc_size *size, void *ptr)
+{
+	struct user_list *ul = ptr;
+	uint64_t uid;
+
+	GetVarint64(key, keylen, &uid);
+	ul->list[ul->count].uid = uid;
+	ul->list[ul->count].size = *size;
+	ul->count ++;
+}
+
+
+static int cmp_user(const void *a, const void *b)
+{
+	const struct duc_user *u1 = a;
+	const struct duc_user *u2 = b;
+	return u1->uid < u2->uid ? -1 : u1->uid > u2->uid;
+}
+
+
+/*
+ * Return the usage per user below the given directory, sorted by uid. Returns
+ * NULL if the directory was not indexed with DUC_INDEX_USERS
+ */
+
+struct duc_user *duc_dir_get_users(duc_dir *dir, size_t *count)
+{
+	struct duc_devino devino;
+	uint8_t check[DUC_DIGEST_SIZE];
+
+	duc_dir_get_devino(dir, &devino);
+	duc_dir_get_check(dir, DIGEST_META_UID, check);
+
+	*count = 0;
+
+	struct tally *t = tally_read(duc_dir_get_duc(dir), USERS_PREFIX, &devino, check, NULL);
+	if(t == NULL) return NULL;
+
+	struct user_list ul;
+	ul.list = duc_malloc(tally_count(t) * sizeof(*ul.list) + 1);
+	ul.count = 0;
+	tally_foreach(t, add_user, &ul);
+	tally_free(t);
+
+	qsort(ul.list, ul.count, sizeof(*ul.list), cmp_user);
+
+	*count = ul.count;
+	return ul.list;
+}
+
+
+void duc_users_free(struct duc_user *list)
+{
+	duc_free(list);
+}
+
+
+/*
+ * End
+ */
+
@@ -0,0 +1,11 @@
+#ifndef users_h
+#define users_h
+
+#include "duc.h"
+#include "tally.h"
+
+#define USERS_PREFIX "duc_users"
+
+void users_add(struct tally *t, uid_t uid, const struct duc_size *size);
+
+#endif
@@ -0,0 +1,431 @@
+
+/*
+ * Depth first walk over a subtree of the database, calling back for every
+ * directory entered and left and for every other entry visited.
+ *
+ * The walk is iterative and does not keep the directories of the current path
+ * open: when entering a directory, only the entries which are still to be
+ * visited are copied into a compact per-level list and the directory is closed
+ * again. Memory use is proportional to the path depth times the number of
+ * entries kept per level, which is further limited by the min size and top N
+ * pruning options.
+ *
+ * Optionally a number of prefetch threads read and decode the directories
+ * which are about to be visited into the directory cache. They read through
+ * the handle of the walk, taking turns on the database but decoding in
+ * parallel. The walk itself and all callbacks stay on
+ * the calling thread in the same order, so the output does not depend on the
+ * number of threads.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "duc.h"
+#include "private.h"
+#include "dircache.h"
+
+#define PREFETCH_QUEUE_SIZE 256
+
+struct duc_walk_req {
+	duc *duc;
+	duc_size_type size_type;
+	int max_depth;
+	off_t min_size;
+	size_t top;
+	int exclude_files;
+	int threads;
+};
+
+struct frame {
+	struct duc_dirent ent;
+	struct duc_dirent *ent_list;
+	size_t ent_count;
+	size_t ent_cur;
+	char *names;
+	size_t skipped_count;
+	struct duc_size skipped_size;
+};
+
+
+duc_walk_req *duc_walk_req_new(duc *duc)
+{
+	struct duc_walk_req *req = duc_malloc0(sizeof *req);
+	req->duc = duc;
+	req->size_type = DUC_SIZE_TYPE_ACTUAL;
+	return req;
+}
+
+
+int duc_walk_req_free(duc_walk_req *req)
+{
+	duc_free(req);
+	return 0;
+}
+
+
+int duc_walk_req_set_size_type(duc_walk_req *req, duc_size_type st)
+{
+	req->size_type = st;
+	return 0;
+}
+
+
+int duc_walk_req_set_maxdepth(duc_walk_req *req, int maxdepth)
+{
+	req->max_depth = maxdepth;
+	return 0;
+}
+
+
+int duc_walk_req_set_min_size(duc_walk_req *req, off_t min_size)
+{
+	req->min_size = min_size;
+	return 0;
+}
+
+
+int duc_walk_req_set_top(duc_walk_req *req, size_t top)
+{
+	req->top = top;
+	return 0;
+}
+
+
+int duc_walk_req_set_exclude_files(duc_walk_req *req, int exclude_files)
+{
+	req->exclude_files = exclude_files;
+	return 0;
+}
+
+
+int duc_walk_req_set_threads(duc_walk_req *req, int threads)
+{
+	req->threads = threads;
+	return 0;
+}
+
+
+#ifdef HAVE_LIBPTHREAD
+
+/*
+ * The prefetch queue is a bounded stack: the directories pushed last are
+ * the ones visited next. When the stack is full the oldest entries are
+ * dropped, these will simply be read by the walk itself.
+ */
+
+struct prefetch {
+	duc *duc;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct duc_devino queue[PREFETCH_QUEUE_SIZE];
+	size_t first;
+	size_t len;
+	int stop;
+	pthread_t *threads;
+	int nthreads;
+};
+
+
+static void *prefetch_worker(void *ptr)
+{
+	struct prefetch *p = ptr;
+	duc_dircache *c = p->duc->dircache;
+
+	pthread_mutex_lock(&p->mutex);
+
+	for(;;) {
+		while(p->len == 0 && !p->stop) {
+			pthread_cond_wait(&p->cond, &p->mutex);
+		}
+		if(p->stop) break;
+
+		p->len --;
+		struct duc_devino devino = p->queue[(p->first + p->len) % PREFETCH_QUEUE_SIZE];
+		pthread_mutex_unlock(&p->mutex);
+
+		if(!dircache_has(c, p->duc->dircache_db, &devino)) {
+			struct dir_data *d = dir_data_read(p->duc, &devino);
+			if(d) {
+				dircache_put(c, p->duc->dircache_db, d);
+				dir_data_unref(d);
+			}
+		}
+
+		pthread_mutex_lock(&p->mutex);
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+
+static struct prefetch *prefetch_start(duc_walk_req *req)
+{
+	duc *duc = req->duc;
+	if(req->threads < 2 || duc->db == NULL || duc->dircache == NULL) return NULL;
+
+	duc_db_lock_init(duc);
+
+	struct prefetch *p = duc_malloc0(sizeof *p);
+	p->duc = duc;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	/* The calling thread reads too, so start one thread less */
+
+	p->threads = duc_malloc((req->threads - 1) * sizeof(*p->threads));
+	int i;
+	for(i=0; i<req->threads-1; i++) {
+		if(pthread_create(&p->threads[p->nthreads], NULL, prefetch_worker, p) == 0) {
+			p->nthreads ++;
+		}
+	}
+
+	return p;
+}
+
+
+/*
+ * Queue the directories of a freshly loaded frame, in reverse order so the
+ * first one to be visited ends up on top of the stack
+ */
+
+static void prefetch_push(struct prefetch *p, struct frame *f)
+{
+	if(p == NULL) return;
+
+	pthread_mutex_lock(&p->mutex);
+	size_t i = f->ent_count;
+	while(i-- > 0) {
+		struct duc_dirent *e = &f->ent_list[i];
+		if(e->type != DUC_FILE_TYPE_DIR) continue;
+		if(p->len == PREFETCH_QUEUE_SIZE) {
+			p->first = (p->first + 1) % PREFETCH_QUEUE_SIZE;
+			p->len --;
+		}
+		p->queue[(p->first + p->len) % PREFETCH_QUEUE_SIZE] = e->devino;
+		p->len ++;
+	}
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void prefetch_stop(struct prefetch *p)
+{
+	if(p == NULL) return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	int i;
+	for(i=0; i<p->nthreads; i++) {
+		pthread_join(p->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mutex);
+	duc_free(p->threads);
+	duc_free(p);
+}
+
+#else
+
+struct prefetch;
+#define prefetch_start(req) NULL
+#define prefetch_push(p, f)
+#define prefetch_stop(p)
+
+#endif
+
+
+static void frame_skip(struct frame *f, const struct duc_dirent *e)
+{
+	f->skipped_count ++;
+	duc_size_accum(&f->skipped_size, &e->size);
+}
+
+
+/*
+ * Copy the entries of the directory which are to be visited into the frame,
+ * largest first. The names are packed into a single buffer
+ */
+
+static void frame_load(duc_walk_req *req, struct frame *f, duc_dir *dir)
+{
+	struct duc_dirent *e;
+	size_t count = 0;
+	size_t names_len = 0;
+
+	while((e = duc_dir_read(dir, req->size_type, DUC_SORT_SIZE)) != NULL) {
+		off_t size = duc_get_size(&e->size, req->size_type);
+		if(size < req->min_size) continue;
+		if(req->exclude_files && e->type != DUC_FILE_TYPE_DIR) continue;
+		if(req->top && count == req->top) continue;
+		count ++;
+		names_len += strlen(e->name) + 1;
+	}
+
+	f->ent_list = duc_malloc(count * sizeof(*f->ent_list) + 1);
+	f->names = duc_malloc(names_len + 1);
+	f->ent_count = 0;
+	f->ent_cur = 0;
+
+	char *p = f->names;
+
+	duc_dir_rewind(dir);
+	while((e = duc_dir_read(dir, req->size_type, DUC_SORT_SIZE)) != NULL) {
+		off_t size = duc_get_size(&e->size, req->size_type);
+		if(size < req->min_size ||
+		   (req->exclude_files && e->type != DUC_FILE_TYPE_DIR) ||
+		   f->ent_count == count) {
+			frame_skip(f, e);
+			continue;
+		}
+		struct duc_dirent *e2 = &f->ent_list[f->ent_count++];
+		*e2 = *e;
+		size_t l = strlen(e->name) + 1;
+		memcpy(p, e->name, l);
+		e2->name = p;
+		p += l;
+	}
+}
+
+
+static void frame_free(struct frame *f)
+{
+	duc_free(f->ent_list);
+	duc_free(f->names);
+}
+
+
+static int call(duc_walk_cb cb, void *ptr, duc_walk_event ev, int depth, const struct duc_dirent *e, struct frame *f)
+{
+	struct duc_walk_ent we = {
+		.event = ev,
+		.depth = depth,
+		.ent = e,
+	};
+
+	if(f) {
+		we.skipped_count = f->skipped_count;
+		we.skipped_size = f->skipped_size;
+	}
+
+	return cb(&we, ptr);
+}
+
+
+/*
+ * Walk the subtree below the given directory. Returns 0 when done, or the
+ * non-zero value returned by the callback to stop the walk
+ */
+
+int duc_walk(duc_walk_req *req, duc_dir *dir, duc_walk_cb cb, void *ptr)
+{
+	struct frame *stack = NULL;
+	size_t depth = 0;
+	size_t stack_max = 0;
+	int r = 0;
+	struct prefetch *prefetch = NULL;
+
+	/* Read from the database holding the directory, which is not the one of
+	 * the request on federated handles */
+
+	req->duc = duc_dir_get_duc(dir);
+
+	/* The directory to start from is reported with its path as name */
+
+	char *path = duc_dir_get_path(dir);
+	struct duc_dirent root = {
+		.name = path,
+		.type = DUC_FILE_TYPE_DIR,
+	};
+	duc_dir_get_size(dir, &root.size);
+
+	r = call(cb, ptr, DUC_WALK_DIR_ENTER, 0, &root, NULL);
+	if(r != 0) goto out;
+
+	stack_max = 16;
+	stack = duc_malloc(stack_max * sizeof(*stack));
+	memset(&stack[0], 0, sizeof(*stack));
+	stack[0].ent = root;
+	duc_dir_rewind(dir);
+	frame_load(req, &stack[0], dir);
+	duc_dir_rewind(dir);
+	depth = 1;
+
+	prefetch = prefetch_start(req);
+	if(req->max_depth != 1) prefetch_push(prefetch, &stack[0]);
+
+	while(depth > 0) {
+
+		struct frame *f = &stack[depth-1];
+
+		if(f->ent_cur == f->ent_count) {
+			r = call(cb, ptr, DUC_WALK_DIR_LEAVE, depth - 1, &f->ent, f);
+			frame_free(f);
+			depth --;
+			if(r != 0) goto out;
+			continue;
+		}
+
+		struct duc_dirent *e = &f->ent_list[f->ent_cur++];
+
+		if(e->type == DUC_FILE_TYPE_DIR && (req->max_depth == 0 || (int)depth < req->max_depth)) {
+
+			duc_dir *child = duc_dir_new(req->duc, &e->devino);
+			if(child == NULL) {
+				frame_skip(f, e);
+				continue;
+			}
+
+			r = call(cb, ptr, DUC_WALK_DIR_ENTER, depth, e, NULL);
+			if(r != 0) {
+				duc_dir_close(child);
+				goto out;
+			}
+
+			if(depth == stack_max) {
+				stack_max *= 2;
+				stack = duc_realloc(stack, stack_max * sizeof(*stack));
+			}
+
+			struct frame *fc = &stack[depth++];
+			memset(fc, 0, sizeof(*fc));
+			fc->ent = *e;
+			frame_load(req, fc, child);
+			duc_dir_close(child);
+			if(req->max_depth == 0 || (int)depth < req->max_depth) {
+				prefetch_push(prefetch, fc);
+			}
+
+		} else {
+
+			r = call(cb, ptr, DUC_WALK_ENTRY, depth, e, NULL);
+			if(r != 0) goto out;
+		}
+	}
+
+out:
+	prefetch_stop(prefetch);
+	while(depth > 0) {
+		frame_free(&stack[--depth]);
+	}
+	duc_free(stack);
+	duc_free(path);
+	return r;
+}
+
+
+/*
+ * End
+ */
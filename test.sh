@@ -121,5 +121,127 @@ else
 	exit 1
 fi
 
+# The checks below compare the output of two ways to get the same result, or
+# use apparent sizes only, so they do not depend on the file system
+
+same()
+{
+	if cmp -s "$2" "$3"; then
+		echo "$1 ok"
+	else
+		echo "$1 failed"
+		diff "$2" "$3"
+		exit 1
+	fi
+}
+
+rm -f test-*.db test-*.out
+
+mkfile test/more/a.txt 3000
+mkfile test/more/sub/b.txt 5000
+mkfile test/more/sub/c.png 7000
+mkfile test/more/old.log 9000
+touch -d 2000-01-01 test/more/old.log
+
+./duc index -q -d test-seq.db test/tree test/more
+./duc ls -abR -d test-seq.db test/tree test/more > test-seq.out
+
+# Parallel index
+
+./duc index -q --threads=2 -d test-par.db test/tree test/more
+./duc ls -abR -d test-par.db test/tree test/more > test-par.out
+same "threads" test-seq.out test-par.out
+
+# Import
+
+find test/tree -printf '%i %D %s %b %y %p\n' | ./duc import -q -d test-imp.db
+./duc ls -abR -d test-seq.db test/tree > test.out
+./duc ls -abR -d test-imp.db test/tree > test-imp.out
+same "import" test.out test-imp.out
+
+# Graft
+
+./duc index -q -d test-part.db test/tree/sub1 test/more/sub
+./duc index -q --graft=test-part.db -d test-graft.db test/tree test/more
+./duc ls -abR -d test-graft.db test/tree test/more > test-graft.out
+same "graft" test-seq.out test-graft.out
+
+# Breakdowns
+
+./duc index -q --users --extensions --ages -d test-bd.db test/more
+
+./duc ls -ab --by-user -d test-bd.db test/more > test-users.out
+printf "%12s %s\n" 24000 "`id -un`" > test.out
+same "users" test.out test-users.out
+
+./duc ls -ab --by-ext -d test-bd.db test/more > test-exts.out
+printf "%12s %s\n" 9000 .log 8000 .txt 7000 .png > test.out
+same "extensions" test.out test-exts.out
+
+./duc ls -ab --older-than=1y -d test-bd.db test/more > test-ages.out
+printf "%12s %s\n" 9000 "(files)" > test.out
+same "ages" test.out test-ages.out
+
+# Compact keeps the tree and the breakdowns
+
+./duc compact -q test-cmp.db test-bd.db test-seq.db > /dev/null
+./duc ls -abR -d test-cmp.db test/tree test/more > test-cmp.out
+same "compact" test-seq.out test-cmp.out
+./duc ls -ab --by-ext -d test-cmp.db test/more > test-cmp.out
+same "compact extensions" test-exts.out test-cmp.out
+
+# Find, with and without name index
+
+./duc index -q --name-index -d test-names.db test/tree
+./duc find -ab -d test-seq.db "*o*" test/tree | sort > test-find.out
+./duc find -ab -d test-names.db "*o*" test/tree | sort > test-names.out
+same "find" test-find.out test-names.out
+grep -q "test/tree/sub2/foxtrot$" test-find.out || { echo "find failed"; exit 1; }
+
+# Top
+
+./duc top -ab -n 3 -d test-seq.db test/tree | sed 's|.*/||' | sort > test-top.out
+printf "%s\n" delta hotel november > test.out
+same "top" test.out test-top.out
+
+# JSON and XML, sequential and threaded
+
+./duc json -d test-seq.db test/tree > test-json.out
+./duc json --threads=4 -d test-seq.db test/tree > test.out
+same "json threads" test-json.out test.out
+./duc xml -d test-seq.db test/tree > test-xml.out
+./duc xml --threads=4 -d test-seq.db test/tree > test.out
+same "xml threads" test-xml.out test.out
+
+if command -v python3 > /dev/null; then
+	python3 -m json.tool test-json.out > /dev/null || { echo "json failed"; exit 1; }
+	echo "json ok"
+fi
+
+# Diff
+
+./duc index -q --history -d test-hist.db test/tree
+mkfile test/tree/sub3/oscar 6000
+./duc index -q --history -d test-hist.db test/tree
+./duc diff -ab -l 0 -d test-hist.db test/tree > test-diff.out
+grep -q "^+6000 .*/sub3/oscar (new)$" test-diff.out || { echo "diff failed"; cat test-diff.out; exit 1; }
+echo "diff ok"
+rm test/tree/sub3/oscar
+
+# Serve gives the same page as the CGI interface
+
+if command -v curl > /dev/null; then
+	export DUC_DATABASE=test-seq.db
+	./duc serve -q --port=18080 &
+	pid=$!
+	sleep 1
+	curl -s "http://127.0.0.1:18080/?cmd=index&path=$PWD/test/tree" > test-serve.out
+	kill -INT $pid
+	wait $pid
+	GATEWAY_INTERFACE=CGI/1.1 QUERY_STRING="cmd=index&path=$PWD/test/tree" SCRIPT_NAME=/ \
+		./duc cgi | awk 'body { print } /^\r?$/ { body = 1 }' > test-cgi.out
+	same "serve" test-cgi.out test-serve.out
+fi
+
 # end
 